@@ -24,9 +24,13 @@ typedef union ut_begin_packed ui_edit_range_s {
     ui_edit_pg_t a[2];
 } ut_end_packed ui_edit_range_t; // "from"[0] "to"[1]
 
+typedef struct ui_edit_node_s ui_edit_node_t; // paragraphs tree node
+
 typedef struct ui_edit_text_s {
     int32_t np;   // number of paragraphs
-    ui_edit_str_t* ps; // ps[np] paragraphs
+    ui_edit_node_t* root; // paragraphs tree, use ui_edit_text.ps(t, pn)
+    ut_heap_t* heap; // of nodes and paragraphs, null: process heap
+    int32_t gap; // 1 + pn of long paragraph edited in place, 0: none
 } ui_edit_text_t;
 
 typedef struct ui_edit_notify_info_s {
@@ -34,15 +38,15 @@ typedef struct ui_edit_notify_info_s {
     const ui_edit_doc_t*   const d;
     const ui_edit_range_t* const r; // range to be replaced
     const ui_edit_range_t* const x; // extended range (replacement)
-    const ui_edit_text_t*  const t; // replacement text
+    const ui_edit_text_t*  const t; // replacement text (null for batch)
     // d->text.np number of paragraphs may change after replace
     // before/after: [pnf..pnt] is inside [0..d->text.np-1]
     int32_t const pnf; // paragraph number from
     int32_t const pnt; // paragraph number to. (inclusive)
     // one can safely assume that ps[pnf] was modified
     // except empty range replace with empty text (which shouldn't be)
-    // d->text.ps[pnf..pnf + deleted] were deleted
-    // d->text.ps[pnf..pnf + inserted] were inserted
+    // paragraphs [pnf..pnf + deleted] were deleted
+    // paragraphs [pnf..pnf + inserted] were inserted
     int32_t const deleted;  // number of deleted  paragraphs (before: 0)
     int32_t const inserted; // paragraph inserted paragraphs (before: 0)
 } ui_edit_notify_info_t;
@@ -67,22 +71,101 @@ typedef struct ui_edit_to_do_s { // undo/redo action
     ui_edit_to_do_t* next; // inside undo or redo list
 } ui_edit_to_do_t;
 
+typedef struct ui_edit_record_s ui_edit_record_t; // undo/redo history record
+
+typedef struct ui_edit_history_s {
+    ui_edit_record_t* undo; // undo stack
+    ui_edit_record_t* redo; // redo stack
+    ut_heap_t* heap;  // private heap of the records
+    int64_t budget;   // bytes: 0 unlimited, oldest undo records are trimmed
+    // counters:
+    int64_t bytes;    // memory used by undo and redo records
+    int32_t records;  // number of undo and redo records
+    int32_t merged;   // edits coalesced into existing records
+    int32_t trimmed;  // records trimmed because of budget
+} ui_edit_history_t;
+
+typedef struct ui_edit_mapping_s ui_edit_mapping_t; // file mapping
+
+typedef struct ui_edit_arena_s ui_edit_arena_t; // private heap of the text
+
+typedef struct ui_edit_cold_s { // compressed leaves, see ui_edit_doc.cool()
+    int64_t ceiling; // bytes: 0 (default) paragraphs are never compressed
+    // counters updated by cool():
+    int64_t hot;     // bytes of paragraphs in uncompressed leaves
+    int64_t bytes;   // bytes of compressed leaves
+    int32_t leaves;  // number of compressed leaves
+    int64_t epoch;   // after the previous cool(): newer leaves stay hot
+} ui_edit_cold_t;
+
+typedef struct ui_edit_dedup_s { // shared paragraphs, see ui_edit_doc.dedup()
+    // counters updated by dedup():
+    int32_t paragraphs; // number of paragraphs that share bytes
+    int32_t blocks;     // number of distinct shared byte sequences
+    int64_t bytes;      // utf8 and .g2b[] bytes of the shared paragraphs
+    int64_t shared;     // bytes of the blocks: dedup ratio bytes / shared
+} ui_edit_dedup_t;
+
+typedef struct ui_edit_tail_s { // append only mode, see ui_edit_doc.append()
+    int32_t lines;   // 0 (default) unlimited or number of paragraphs to keep
+    int64_t bytes;   // 0 (default) unlimited or utf8 bytes to keep
+    // utf8 appended since the previous flush():
+    uint8_t* pending;
+    int32_t  count;    // bytes in pending[]
+    int32_t  capacity; // of pending[]
+    ut_file_t* file;   // ui_edit_doc.follow() file or null
+    int64_t  position; // in the file of the next byte to read
+    bool     skip;     // partial first line of the followed file
+    int64_t  dropped;  // counter: paragraphs dropped from the head
+} ui_edit_tail_t;
+
 typedef struct ui_edit_doc_s {
     ui_edit_text_t   text;
-    ui_edit_to_do_t* undo; // undo stack
-    ui_edit_to_do_t* redo; // redo stack
+    ui_edit_history_t history;
+    ui_edit_cold_t   cold;
+    ui_edit_dedup_t  dedup;
+    ui_edit_tail_t   tail;
     ui_edit_listener_t* listeners;
+    ui_edit_mapping_t* mapping; // read only file of ui_edit_doc.open()
+    ui_edit_arena_t* arena; // null: text uses the process heap
 } ui_edit_doc_t;
 
+typedef struct ui_edit_snapshot_s { // see ui_edit_doc.snapshot()
+    ui_edit_text_t text; // read only
+    ui_edit_mapping_t* mapping;
+    ui_edit_arena_t* arena;
+} ui_edit_snapshot_t;
+
+typedef struct ui_edit_replacement_s { // see ui_edit_doc.replace_batch()
+    ui_edit_range_t range;
+    const uint8_t*  utf8;  // null or zero terminated when bytes < 0
+    int32_t         bytes;
+} ui_edit_replacement_t;
+
+typedef struct ui_edit_find_s { // see ui_edit_doc.find()
+    const uint8_t* utf8;  // pattern w/o "\n", zero terminated if bytes < 0
+    int32_t bytes;
+    bool    ignore_case;  // ASCII letters only
+    bool    whole_word;   // not adjacent to [0-9A-Za-z_] or non ASCII glyphs
+} ui_edit_find_t;
+
 typedef struct ui_edit_doc_if {
     // init(utf8, bytes, heap:false) must have longer lifetime
     // than document, otherwise use heap: true to copy
     bool    (*init)(ui_edit_doc_t* d, const uint8_t* utf8_or_null,
                     int32_t bytes, bool heap);
+    // open() maps file read only, paragraphs are materialized lazily
+    errno_t (*open)(ui_edit_doc_t* d, const char* filename);
     bool    (*replace_text)(ui_edit_doc_t* d, const ui_edit_range_t* r,
                 const ui_edit_text_t* t, ui_edit_to_do_t* undo_or_null);
     bool    (*replace)(ui_edit_doc_t* d, const ui_edit_range_t* r,
                 const uint8_t* utf8, int32_t bytes);
+    // replace_batch() ranges must be ordered and must not overlap
+    bool    (*replace_batch)(ui_edit_doc_t* d,
+                const ui_edit_replacement_t* replacements, int32_t n);
+    // snapshot() of the text for a background thread, null on no memory
+    ui_edit_snapshot_t* (*snapshot)(ui_edit_doc_t* d);
+    void (*dispose_snapshot)(ui_edit_snapshot_t* s); // on any thread
     int32_t (*bytes)(const ui_edit_doc_t* d, const ui_edit_range_t* range);
     bool    (*copy_text)(ui_edit_doc_t* d, const ui_edit_range_t* range,
                 ui_edit_text_t* text); // retrieves range into string
@@ -90,19 +173,117 @@ typedef struct ui_edit_doc_if {
     // utf8 must be at least ui_edit_doc.utf8bytes()
     void    (*copy)(ui_edit_doc_t* d, const ui_edit_range_t* range,
                 char* utf8);
+    // write() range as copy() does (w/o 0x00) "\r\n" separators on crlf
+    errno_t (*write)(ui_edit_doc_t* d, const ui_edit_range_t* range,
+                ut_stream_if* out, bool crlf);
+    // save() whole document to "<filename>.tmp" and renames it to filename
+    errno_t (*save)(ui_edit_doc_t* d, const char* filename, bool crlf);
+    // find() first match at or after pg, false if there are no more
+    bool    (*find)(ui_edit_doc_t* d, const ui_edit_find_t* f,
+                const ui_edit_pg_t pg, ui_edit_range_t* match);
+    // find_all() matches inside range (null: whole document) into heap
+    // allocated *matches (ut_heap.free() it), returns number of matches
+    // or -1 on out of memory
+    int32_t (*find_all)(ui_edit_doc_t* d, const ui_edit_find_t* f,
+                const ui_edit_range_t* range, ui_edit_range_t* *matches);
+    // replace_all() matches inside range as a single undo step, returns
+    // number of replacements or -1 on failure
+    int32_t (*replace_all)(ui_edit_doc_t* d, const ui_edit_find_t* f,
+                const ui_edit_range_t* range,
+                const uint8_t* utf8, int32_t bytes);
     // undo() and push reverse into redo stack
-    bool (*undo)(ui_edit_doc_t* d); // false if there is nothing to redo
+    bool (*undo)(ui_edit_doc_t* d); // false if there is nothing to undo
     // redo() and push reverse into undo stack
-    bool (*redo)(ui_edit_doc_t* d); // false if there is nothing to undo
+    bool (*redo)(ui_edit_doc_t* d); // false if there is nothing to redo
     bool (*subscribe)(ui_edit_doc_t* d, ui_edit_notify_t* notify);
     void (*unsubscribe)(ui_edit_doc_t* d, ui_edit_notify_t* notify);
     void (*dispose_to_do)(ui_edit_to_do_t* to_do);
+    // cool() compresses least recently used leaves down to d->cold.ceiling
+    void (*cool)(ui_edit_doc_t* d);
+    // dedup() makes paragraphs with identical bytes share one copy
+    void (*dedup)(ui_edit_doc_t* d);
+    // append() utf8 to the end of the text on the next flush() w/o undo
+    bool    (*append)(ui_edit_doc_t* d, const uint8_t* utf8, int32_t bytes);
+    // flush() appended and followed bytes as a single replace notification
+    // and drops the oldest paragraphs over the d->tail limits
+    errno_t (*flush)(ui_edit_doc_t* d);
+    // follow() appends bytes written to the end of the file on flush()
+    errno_t (*follow)(ui_edit_doc_t* d, const char* filename);
     void (*dispose)(ui_edit_doc_t* d);
     void (*test)(void);
+    // arena: true (default) documents allocate nodes and paragraphs
+    // of the text from a private heap, see ui_edit_doc.dispose()
+    bool arena;
 } ui_edit_doc_if;
 
 extern ui_edit_doc_if ui_edit_doc;
 
+typedef struct ui_edit_index_list_s ui_edit_index_list_t; // postings
+typedef struct ui_edit_index_slot_s ui_edit_index_slot_t; // paragraph
+
+typedef struct ui_edit_index_s { // trigram index, see ui_edit_index.init()
+    ui_edit_notify_t notify; // subscribed to the document changes
+    ui_edit_doc_t* d;
+    ui_edit_index_list_t* lists; // trigram -> paragraph slots hash table
+    int32_t  capacity; // of lists[] (power of 2)
+    int32_t  count;    // number of trigrams
+    int32_t* slots;    // slots[pn] slot of the paragraph pn
+    int32_t  np;       // number of paragraphs
+    int32_t  sc;       // capacity of slots[]
+    ui_edit_index_slot_t* slot; // slot[slots[pn]].pn == pn or -1 if stale
+    int32_t  ns;       // number of slots
+    int32_t  nc;       // capacity of slot[]
+    int64_t  entries;  // all slots in all lists
+    int64_t  stale;    // entries of stale slots
+    bool     dirty;    // slot[].pn must be recounted from slots[]
+    bool     valid;    // false: rebuilt by the next find_all()
+} ui_edit_index_t;
+
+typedef struct ui_edit_index_if {
+    // init() indexes all paragraphs and subscribes to the document
+    bool    (*init)(ui_edit_index_t* x, ui_edit_doc_t* d);
+    // find_all() same as ui_edit_doc.find_all() of the whole document
+    int32_t (*find_all)(ui_edit_index_t* x, const ui_edit_find_t* f,
+                        ui_edit_range_t* *matches);
+    void    (*dispose)(ui_edit_index_t* x); // unsubscribes
+} ui_edit_index_if;
+
+extern ui_edit_index_if ui_edit_index;
+
+typedef struct ui_edit_journal_s { // edits log, see ui_edit_journal.open()
+    ui_edit_notify_t notify; // subscribed to the document changes
+    ui_edit_doc_t* d;
+    ut_stream_file_if fs;  // buffered "<filename>.journal"
+    ut_file_name_t base;   // document file
+    ut_file_name_t name;   // journal file
+    uint8_t* record;  // reused buffer of a single record
+    int32_t  capacity; // of record[]
+    int64_t  bytes;    // of the journal file including buffered records
+    int64_t  limit;    // journal bytes that allow compaction (default 1MB)
+    fp64_t   period;   // seconds between fsync() (default 1.0)
+    fp64_t   synced;   // ut_clock.seconds() of the last fsync()
+    errno_t  error;    // first failure: journal stops recording
+    bool     crlf;     // "\r\n" line endings of the compacted file
+    // counters:
+    int32_t  records;  // since the last compaction
+    int32_t  replayed; // records recovered by open()
+    int32_t  compactions;
+} ui_edit_journal_t;
+
+typedef struct ui_edit_journal_if {
+    // open() replays the journal of filename left by the previous
+    // session (if any) onto d just opened from filename and starts
+    // recording changes of d
+    errno_t (*open)(ui_edit_journal_t* j, ui_edit_doc_t* d,
+                    const char* filename);
+    errno_t (*sync)(ui_edit_journal_t* j); // writes and fsync() records
+    // compact() saves the document to filename and empties the journal
+    errno_t (*compact)(ui_edit_journal_t* j);
+    errno_t (*dispose)(ui_edit_journal_t* j); // syncs and unsubscribes
+} ui_edit_journal_if;
+
+extern ui_edit_journal_if ui_edit_journal;
+
 typedef struct ui_edit_range_if {
     int (*compare)(const ui_edit_pg_t pg1, const ui_edit_pg_t pg2);
     ui_edit_range_t (*all_on_null)(const ui_edit_text_t* t,
@@ -128,28 +309,50 @@ extern ui_edit_range_if ui_edit_range;
 
 typedef struct ui_edit_text_if {
     bool    (*init)(ui_edit_text_t* t, const uint8_t* s, int32_t b, bool heap);
+    // ps() paragraph pn in [0..t->np - 1] O(log(np)), the pointer
+    // is valid until the next modification of the text
+    ui_edit_str_t* (*ps)(const ui_edit_text_t* t, int32_t pn);
+    // bytes() and glyphs() of the range w/o "\n" between paragraphs,
+    // offset() of pg in utf8 text with "\n" after each paragraph and
+    // pg() of the offset are O(log(np)), see ui_edit_text.offset()
     int32_t (*bytes)(const ui_edit_text_t* t, const ui_edit_range_t* r);
+    int64_t (*glyphs)(const ui_edit_text_t* t, const ui_edit_range_t* r);
+    int64_t (*offset)(const ui_edit_text_t* t, const ui_edit_pg_t pg);
+    ui_edit_pg_t (*pg)(const ui_edit_text_t* t, int64_t offset);
     void    (*dispose)(ui_edit_text_t* t);
+    // threads: init() of huge (megabytes) texts splits paragraphs
+    // in parallel: 0 (default) ut_thread.processors(), 1 single thread
+    int32_t threads;
 } ui_edit_text_if;
 
 extern ui_edit_text_if ui_edit_text;
 
+enum { ui_edit_str_inline = 20 }; // bytes of short strings kept in place
+
 typedef struct ut_begin_packed ui_edit_str_s {
     uint8_t* u;    // always correct utf8 bytes not zero terminated(!) sequence
     // s.g2b[s.g + 1] glyph to byte position inside s.u[]
     // s.g2b[0] == 0, s.g2b[s.glyphs] == s.bytes
+    // or sparse: s.g2b[0] == -n, s.g2b[k] byte position of glyph k * n
+    // use ui_edit_str.g2b(s, gp) to read it
+    // ASCII only strings (g == b) share identity index of any length
     int32_t* g2b;  // g2b_0 or heap allocated glyphs to bytes indices
     int32_t  b;    // number of bytes
     int32_t  c;    // when capacity is zero .u is not heap allocated
+                   // negative: .u == .i short string stored in place
     int32_t  g;    // number of glyphs
+    uint8_t  i[ui_edit_str_inline]; // in place bytes of short strings
+                                    // or shared block, see dedup()
 } ut_end_packed ui_edit_str_t;
 
 typedef struct ui_edit_str_if {
     bool (*init)(ui_edit_str_t* s, const uint8_t* utf8, int32_t bytes, bool heap);
     void (*swap)(ui_edit_str_t* s1, ui_edit_str_t* s2);
+    void (*moved)(ui_edit_str_t* s); // re-points .u after struct copy
     int32_t (*utf8bytes)(const uint8_t* utf8, int32_t bytes); // 0 on error
     int32_t (*glyphs)(const uint8_t* utf8, int32_t bytes); // -1 on error
     int32_t (*gp_to_bp)(const uint8_t* s, int32_t bytes, int32_t gp); // -1
+    int32_t (*g2b)(const ui_edit_str_t* s, int32_t gp); // byte position
     int32_t (*bytes)(ui_edit_str_t* s, int32_t from, int32_t to); // glyphs
     bool (*expand)(ui_edit_str_t* s, int32_t capacity); // reallocate
     void (*shrink)(ui_edit_str_t* s); // get rid of extra heap memory
@@ -158,6 +361,9 @@ typedef struct ui_edit_str_if {
     void (*test)(void);
     void (*free)(ui_edit_str_t* s);
     const ui_edit_str_t* const empty;
+    // sparse: 0 (default) full s.g2b[s.g + 1] index, n > 0 strings
+    // longer than n glyphs keep one checkpoint every n glyphs
+    int32_t sparse;
 } ui_edit_str_if;
 
 extern ui_edit_str_if ui_edit_str;
@@ -184,6 +390,198 @@ extern ui_edit_str_if ui_edit_str;
             element is number of bytes in the s.u memory.
             Called must zero out the string struct before calling init().
 
+    ui_edit_doc.open()
+            maps the file read only with ut_mem.map_ro() and only
+            splits it into paragraphs by scanning for '\n' and counts
+            (validates) utf8 glyphs of each paragraph. Both passes are
+            split between ui_edit_text.threads. Glyphs are indexed
+            (.g2b[]) when the paragraph is first accessed via
+            ui_edit_text.ps() (by view or edit). Paragraphs with invalid
+            utf8 bytes get them replaced with U+FFFD on open.
+            Empty file opens as an empty document. The mapping is
+            released by ui_edit_doc.dispose().
+
+    ui_edit_doc.replace()
+            records reverse edit in the undo history. Adjacent typing
+            (until the next word starts) and adjacent backspacing or
+            deleting within a paragraph are merged into a single record.
+            Records keep replaced text as utf8 bytes in one allocation
+            from the document private heap. When d->history.budget is
+            not zero the oldest undo records are trimmed to fit it.
+
+    ui_edit_doc.replace_batch()
+            applies n replacements (e.g. replace all, multi-cursor
+            typing) in a single pass over paragraphs with a single
+            before()/after() notification where r and x span all
+            replacements and t is null. Whole batch is one undo step.
+            All or nothing: returns false on invalid utf8, invalid
+            or overlapping ranges or out of memory.
+
+    ui_edit_text.offset()
+    ui_edit_text.pg()
+            convert between ui_edit_pg_t and byte offset in the utf8
+            representation of the text (paragraphs joined by "\n" as
+            ui_edit_doc.copy() produces). Tree nodes keep subtree sums
+            of paragraph bytes and glyphs thus offset(), pg(), bytes()
+            and glyphs() only touch O(log(np)) nodes and do not
+            materialize lazy paragraphs except the ones at the ends.
+            pg() of an offset in the middle of multibyte glyph returns
+            that glyph, offset at "\n" or past the end of text returns
+            the end of the paragraph. Number of paragraphs (lines) is
+            t->np, totals are glyphs() and bytes() of all_on_null().
+
+    ui_edit_doc.snapshot()
+            returns immutable view of the document text in O(1).
+            Paragraphs tree nodes are reference counted and shared
+            between the document and its snapshots. Edits copy only
+            the nodes on the path to the modified paragraphs (and the
+            paragraphs of the copied leaves) so the snapshot text
+            stays consistent while the user keeps typing. Snapshot
+            text can be read with ui_edit_text.ps(), bytes(), offset()
+            etc. on one thread while the document is edited on another.
+            Each background reader should take its own snapshot.
+            A snapshot keeps the file mapping of ui_edit_doc.open()
+            alive and may outlive the document.
+
+    ui_edit_doc.write()
+            streams the range to any ut_stream_if without copying the
+            whole text: paragraphs are written directly from the tree
+            and are not materialized (except at the ends of the range).
+            Unmodified paragraphs of ui_edit_doc.open() that are adjacent
+            in the mapped file go out together with the original line
+            separators in a single out.write() call. Returns the first
+            error of out.write() and stops writing after it.
+
+    ui_edit_doc.save()
+            writes the document through buffered ut_streams.file_write()
+            stream in constant memory into "<filename>.tmp" in the same
+            folder, flushes it to the disk and only then renames it over
+            the filename. On any failure the temporary file is removed
+            and the original file is left intact. Note that Windows does
+            not allow to replace the file that is still mapped by the
+            ui_edit_doc.open() of this (or any other) document.
+
+    ui_edit_doc.find()
+    ui_edit_doc.find_all()
+            search raw paragraph bytes (lazy paragraphs of open() are not
+            materialized). Vectorized filter compares the first and
+            the last bytes of the pattern at 16 or 32 positions at once
+            and only the candidates that pass are compared in full.
+            Matches do not overlap and never span paragraphs. find() is
+            incremental: next search starts at the previous match.to.
+            find_all() of a large range (megabytes) is split between
+            ui_edit_text.threads worker threads, matches are returned in
+            the document order. Empty, invalid utf8 or multi-line
+            patterns have no matches.
+
+    ui_edit_doc.replace_all()
+            replaces find_all() matches via ui_edit_doc.replace_batch()
+            with a single notification and a single undo record.
+
+    ui_edit_index.init()
+            optional trigram index of the document for repeated searches
+            (e.g. on each keystroke in the search box). Posting lists map
+            case folded 3 bytes sequences to paragraphs. After each
+            replace only paragraphs [pnf..pnt] of ui_edit_notify_info_t
+            are indexed again. Paragraphs get new slot on every change,
+            postings of the old slots become stale and are removed when
+            the index is rebuilt after stale entries outnumber the live
+            ones. Patterns of 3 and more bytes only verify paragraphs
+            that contain all of the pattern trigrams, shorter patterns
+            fall back to ui_edit_doc.find_all().
+
+    ui_edit_journal.open()
+            durable autosave: every replace (including undo, redo,
+            batches and appends) is recorded as the replaced range and
+            the utf8 text that replaced it in "<filename>.journal" with
+            a checksum per record. Cost of recording is proportional
+            to the edit (a batch records the span of its replacements)
+            and not to the document. Records are buffered and fsync()ed
+            at most every j->period seconds. When the journal grows over
+            j->limit and over a half of the document compact() saves the
+            whole document to filename and starts an empty journal, so
+            the full saves are amortized O(1) per recorded byte. After
+            a crash open() replays the records on top of the last full
+            save up to the first torn or corrupted one, drops the rest
+            and keeps appending to the same journal. The journal header
+            keeps the length and hash of the file it applies to.
+            A journal of a different file content (e.g. the file was
+            saved by other means) is discarded. Save through compact()
+            instead of ui_edit_doc.save() while journaling. Windows
+            does not allow to replace the file still mapped by
+            ui_edit_doc.open(): such documents are not compacted
+            automatically and compact() fails like save() leaving the
+            file and the journal intact. Other failures are sticky in
+            j->error and stop the recording.
+
+    ui_edit_doc.dispose()
+            with ui_edit_doc.arena the text of the document lives in
+            a private heap (ut_heap.create()): allocations of the text
+            do not contend with other threads and documents, and when
+            no snapshot is alive dispose() releases the whole heap at
+            once instead of freeing paragraphs one by one. Snapshots
+            keep the heap alive until the last one is disposed.
+
+    ui_edit_doc.cool()
+            opt-in low memory mode for huge (read only) documents: when
+            d->cold.ceiling is not zero the leaves of the paragraphs tree
+            (up to 64 paragraphs) that were not accessed since the previous
+            cool() of the same document (d->cold.epoch) are compressed
+            with a fast LZ codec until the rest fits into the ceiling. Compressed leaves drop ps[] and .g2b[] and
+            keep only utf8 bytes of the edited paragraphs and pointers
+            into the file mapping for untouched ones. A leaf is restored
+            on demand when ui_edit_text.ps(), copy, write or find touches
+            it (on any thread). Leaves shared with snapshots are not
+            compressed. The view calls cool() from every_100ms() after
+            paint so the visible paragraphs stay hot. Like any modification cool() invalidates
+            pointers returned by ui_edit_text.ps().
+
+    ui_edit_doc.dedup()
+            opt-in interning of repeated paragraphs (logs, generated
+            code): heap allocated paragraphs with identical utf8 bytes
+            (found by 64-bit hash) share one reference counted immutable
+            block of bytes and .g2b[]. A shared paragraph is copied back
+            to its own heap memory on the first edit, the block is freed
+            with its last paragraph. Only paragraphs of leaves that are
+            not shared with snapshots and not compressed are considered.
+            Short (in place) and lazy paragraphs do not use heap bytes
+            and are left alone. dedup() is O(n) in the number of bytes
+            of the considered paragraphs, call it after init(), open()
+            (once paragraphs were touched) or a series of flush().
+            d->dedup counters report the saving. Like cool() it does not
+            change the text but invalidates ui_edit_text.ps() pointers.
+
+    ui_edit_doc.append()
+            streaming ("tail -f") mode for logs and consoles: append()
+            only copies bytes into d->tail.pending (amortized O(1)) and
+            flush() (e.g. once per frame or timer tick) inserts all of
+            them at the end of the text with one before()/after()
+            notification and without undo records. Incomplete trailing
+            utf8 sequence and '\r' are kept pending until the rest of
+            them arrives, invalid utf8 is replaced by U+FFFD. When
+            d->tail.lines or d->tail.bytes is set flush() drops the
+            oldest paragraphs above the limits with a single delete
+            (O(log(np)) in the paragraphs tree) and discards undo/redo
+            history because its ranges are no longer valid.
+            follow() reads the growing file on each flush() starting
+            from the last d->tail.bytes of it (at the beginning of a
+            line) and starts over when the file is truncated.
+
+    ui_edit_str.init()
+            with heap == true strings up to ui_edit_str_inline bytes
+            keep utf8 bytes in place (.c < 0 and .u == .i) and short
+            ASCII strings share the ui_edit_str_g2b_ascii index: no
+            heap allocations for blank lines, braces and alike. Edits
+            use the in place bytes while the result fits and shrink()
+            moves short results back from the heap. Because .u points
+            inside the struct, in place strings are moved with
+            ui_edit_str.swap() or re-pointed after memcpy() of structs.
+
+    ui_edit_str.g2b()
+            returns byte position of the glyph gp in [0..s.g]. For
+            sparse strings it decodes forward from the nearest
+            checkpoint: at most n - 1 glyphs.
+
     ui_edit_str.bytes()
             returns number of bytes in utf8 string in the exclusive
             range [from..to[ between string glyphs.
@@ -196,6 +594,13 @@ extern ui_edit_str_if ui_edit_str;
             heap allocation fails. The called must ensure that the
             range [from..to[ is valid, failure to do so is a fatal
             error. ui_edit_str.replace() moves string content to the heap.
+            Long paragraphs (minified JSON, single line logs) of 64KB
+            and more keep spare capacity and ASCII only paragraphs have
+            no .g2b[] at all. ui_edit_doc.replace() edits such paragraphs
+            in place with a gap at the caret: typing, backspace, undo
+            and redo cost the distance from the previous edit and the
+            tail of the paragraph is not moved. ui_edit_text.ps() closes
+            the gap and always returns contiguous .u[0..b - 1].
 
     ui_edit_str.free()
             deallocates all heap allocated memory and zero out string
@@ -36,11 +36,91 @@ typedef struct ui_edit_run_s {
 // with .allocated == 0; as text is modified it is copied to
 // heap and reallocated there.
 
+typedef struct ui_edit_metrics_s ui_edit_metrics_t;
+
+typedef struct ui_edit_background_s ui_edit_background_t;
+
+typedef struct ui_edit_metrics_s { // glyph advance widths provider
+    // advance() width in pixels of a single glyph utf8[bytes] in font fm
+    int32_t (*advance)(ui_edit_metrics_t* m, const ui_fm_t* fm,
+                       const uint8_t* utf8, int32_t bytes);
+    bool concurrent; // advance() may be called on background threads
+} ui_edit_metrics_t;
+
+extern ui_edit_metrics_t ui_edit_metrics_gdi;   // ui_gdi.text() measurements
+extern ui_edit_metrics_t ui_edit_metrics_fixed; // deterministic, see notes
+
+typedef struct ui_edit_width_s {
+    uint32_t glyph; // utf8 bytes of non-ASCII glyph, 0: empty slot
+    int32_t  width;
+} ui_edit_width_t;
+
+typedef struct ui_edit_widths_s { // advance widths cache of a font
+    ui_edit_metrics_t* metrics; // provider the cache was filled by
+    const ui_fm_t* fm;          // font metrics, .font and .height
+    ui_font_t font;             // at the time the cache was filled
+    int32_t height;
+    int32_t ascii[128];         // -1: not measured yet
+    ui_edit_width_t* entry;     // open addressing hash of entry[capacity]
+    int32_t capacity;           // power of 2
+    int32_t count;
+    int32_t cell;               // fm->mono: printable ASCII advance or 0
+} ui_edit_widths_t;
+
+typedef struct ui_edit_token_s { // colored span of paragraph bytes
+    int32_t bp;   // position in bytes since start of the paragraph
+    int32_t kind; // index of ui_edit_lexer_t.color[] (token ends where
+                  // the next token starts or at the end of paragraph)
+} ui_edit_token_t;
+
+enum { // token kinds of ui_edit_lexer_c
+    ui_edit_token_text         = 0,
+    ui_edit_token_keyword      = 1,
+    ui_edit_token_number       = 2,
+    ui_edit_token_string       = 3,
+    ui_edit_token_comment      = 4,
+    ui_edit_token_preprocessor = 5,
+    ui_edit_token_punctuation  = 6,
+    ui_edit_token_kinds        = 8  // countof(ui_edit_lexer_t.color)
+};
+
+typedef struct ui_edit_lexer_s ui_edit_lexer_t;
+
+typedef struct ui_edit_lexer_s { // pluggable syntax tokenizer
+    // lex() paragraph u[b] that starts in lexer `state` (0 for the first
+    // paragraph) and returns the state at the end of the paragraph.
+    // If tokens != null fills tokens[*count] (at most b) of the paragraph.
+    uint32_t (*lex)(ui_edit_lexer_t* x, uint32_t state,
+                    const uint8_t* u, int32_t b,
+                    ui_edit_token_t* tokens, int32_t* count);
+    ui_color_t color[ui_edit_token_kinds]; // undefined: ui_view_t.color
+} ui_edit_lexer_t;
+
+extern ui_edit_lexer_t ui_edit_lexer_c; // C, C++ and JSON
+
 typedef struct ui_edit_paragraph_s { // "paragraph" view consists of wrapped runs
-    int32_t runs;       // number of runs in this paragraph
-    ui_edit_run_t* run; // heap allocated array[runs]
+    int32_t runs;       // number of runs in this paragraph, 0: not laid out
+    ui_edit_run_t* run; // heap allocated array[runs] or null if evicted
+    int32_t prev;       // paragraphs with .run != null in most recently
+    int32_t next;       // used order (see ui_edit_t.mru) or -1
+    // syntax coloring (see ui_edit_t.lexer):
+    int32_t tokens;         // number of tokens in this paragraph
+    ui_edit_token_t* token; // heap allocated array[tokens] or null
+    uint32_t start;         // lexer state at the start of the paragraph
+    uint32_t state;         // lexer state at the end of the paragraph
+    bool lexed;             // .state is lexed from .start and the text
 } ui_edit_paragraph_t;
 
+typedef struct ui_edit_run_sums_s { // Fenwick tree node
+    int32_t runs; // partial sum of para[].runs
+    int32_t laid; // partial sum of paragraphs that have runs
+} ui_edit_run_sums_t;
+
+typedef struct ui_edit_run_index_s { // binary indexed tree of para[].runs
+    ui_edit_run_sums_t* sum; // sum[np + 1], sum[0] is not used
+    int32_t np;          // 0: not built or stale, rebuilt on demand
+} ui_edit_run_index_t;
+
 typedef struct ui_edit_notify_view_s {
     ui_edit_notify_t notify;
     void*            that; // specific for listener
@@ -75,6 +155,25 @@ typedef struct ui_edit_s {
     uint32_t fuzz_seed;   // fuzzer random32 seed (must start with odd number)
     // paragraphs memory:
     ui_edit_paragraph_t* para; // para[e->doc->text.np]
+    ui_edit_run_index_t run_index; // run counts of laid out paragraphs
+    int32_t mru;    // most recently used paragraph with run[] or -1
+    int32_t lru;    // least recently used paragraph with run[] or -1
+    int32_t cached; // number of paragraphs with run[]
+    // glyph advance widths: null metrics is ui_edit_metrics_gdi
+    ui_edit_metrics_t* metrics;
+    ui_edit_widths_t widths;
+    // background layout of runs (see notes):
+    ui_edit_background_t* background; // running layout job or null
+    int32_t generation; // incremented by edits and by relayout of all runs
+    int32_t quiet;      // generation at the previous every_100ms()
+    bool relayout;      // runs of all paragraphs were invalidated
+    bool painted;       // since the previous ui_edit_doc.cool()
+    // syntax coloring: null paints plain text
+    ui_edit_lexer_t* lexer;
+    ui_edit_lexer_t* lexed_by; // lexer of para[].state
+    int32_t lexed;    // para[0..lexed - 1].state is up to date
+    ui_edit_token_t* tokens; // lex() scratch buffer
+    int32_t capacity; // of tokens[]
 } ui_edit_t;
 
 typedef struct ui_edit_if {
@@ -110,6 +209,7 @@ typedef struct ui_edit_if {
     void (*fuzz)(ui_edit_t* e);      // start/stop fuzzing test
     void (*next_fuzz)(ui_edit_t* e); // next fuzz input event(s)
     void (*dispose)(ui_edit_t* e);
+    void (*test)(void); // headless layout tests with ui_edit_metrics_fixed
 } ui_edit_if;
 
 extern ui_edit_if ui_edit;
@@ -123,6 +223,64 @@ extern ui_edit_if ui_edit;
                  to set font via this function instead which also requests
                  edit UI element re-layout.
 
+    .metrics   - text widths are sums of glyph advances cached per font in
+                 .widths (an array for ASCII and a hash for the rest of
+                 glyphs) so each distinct glyph is measured only once per
+                 font instead of measuring text again and again during the
+                 word break search. ui_edit_metrics_fixed is a deterministic
+                 provider that does not need GDI: every glyph is fm->em.w
+                 wide and glyphs from U+3000 and above (CJK, emoji) are
+                 twice as wide. It allows headless layout tests and
+                 benchmarks. The cache is dropped when the font, its height
+                 or the provider changes. For monospaced fonts (fm->mono)
+                 only "m" is measured for all printable ASCII glyphs and
+                 their spans are broken into runs, hit tested and measured
+                 arithmetically. Wide, zero width and all other non-ASCII
+                 glyphs keep their measured advances from the cache.
+
+    background - after runs of all paragraphs are invalidated (resize or
+                 font change) of a document with thousands of paragraphs
+                 the view lays out the visible paragraphs on demand as
+                 before and, once the view stays unchanged for 100ms,
+                 starts worker threads that lay out the rest of them
+                 (starting below the visible ones) from snapshots of the
+                 text. Run counts of paragraphs are published and
+                 installed by every_100ms(). Edits or another resize
+                 cancel the job without waiting for it. Glyphs missing
+                 from the widths cache of not .concurrent metrics (GDI)
+                 are never measured on workers, such paragraphs are laid
+                 out on demand. Scrolling and paging count runs only up
+                 to a page thus never lay out the whole document.
+
+    .run_index - prefix sums of run counts of the paragraphs that are laid
+                 out (Fenwick tree). Counting runs between two positions,
+                 pg_to_xy() and scrolling by a number of runs are O(log n)
+                 when every paragraph in between is laid out and fall back
+                 to per paragraph loops otherwise. Laying out or dropping
+                 runs of a paragraph updates the index in O(log n). Edits
+                 that insert or delete paragraphs renumber para[] (O(n)
+                 memmove anyway) and the index is rebuilt in O(n) on the
+                 next query.
+
+    .mru       - run[] arrays (and syntax tokens) are kept only for the
+                 4K most recently used paragraphs, the ones around the
+                 viewport. Evicted paragraphs keep their .runs count, so
+                 .run_index stays intact, and run[] is laid out again on
+                 demand. Layout memory does not grow with the number of
+                 paragraphs scrolled through. Pointers returned for
+                 run[] stay valid until thousands of other paragraphs
+                 are laid out.
+
+    .lexer     - syntax coloring. Lexer state at the end of each paragraph
+                 is kept in para[]. An edit only moves e->lexed watermark
+                 back to the first modified paragraph. Paint re-lexes from
+                 the watermark to the painted paragraphs but skips every
+                 paragraph that is unchanged and starts in the same state
+                 it was lexed from: as soon as states converge after the
+                 edited paragraphs no more lexing is done. Tokens are
+                 cached per paragraph like run[] only for the paragraphs
+                 that were painted recently. Changing .lexer discards all states.
+
     .ro        - readonly edit->ro is used to control readonly mode.
                  If edit control is readonly its appearance does not change but it
                  refuses to accept any changes to the rendered text.
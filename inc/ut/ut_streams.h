@@ -23,11 +23,32 @@ typedef struct {
     int64_t     pos_write;
 } ut_stream_memory_if;
 
+typedef struct { // buffered write only file stream
+    ut_stream_if stream;
+    ut_file_t*   file;
+    uint8_t*     data;   // heap allocated buffer
+    int64_t      bytes;  // buffer capacity
+    int64_t      pos;    // number of buffered bytes
+    errno_t      error;  // first write error (sticky)
+} ut_stream_file_if;
+
 typedef struct {
     void (*read_only)(ut_stream_memory_if* s,  const void* data, int64_t bytes);
     void (*write_only)(ut_stream_memory_if* s, void* data, int64_t bytes);
     void (*read_write)(ut_stream_memory_if* s, const void* read, int64_t read_bytes,
                                                void* write, int64_t write_bytes);
+    // file_write() creates or truncates the file, writes smaller than
+    // buffer bytes are coalesced, larger writes go straight to the file.
+    // file_append() opens existing file and writes after its end.
+    // file_flush() writes the buffer and flushes file to the disk.
+    // file_close() writes the buffer, closes the file and frees the buffer
+    // returns the first error of all writes. stream.close() == file_close()
+    errno_t (*file_write)(ut_stream_file_if* s, const char* filename,
+                          int64_t buffer_bytes);
+    errno_t (*file_append)(ut_stream_file_if* s, const char* filename,
+                           int64_t buffer_bytes);
+    errno_t (*file_flush)(ut_stream_file_if* s);
+    errno_t (*file_close)(ut_stream_file_if* s);
     void (*test)(void);
 } ut_streams_if;
 
@@ -44,6 +44,7 @@ typedef struct {
     void        (*realtime)(void); // bumps calling thread priority
     void        (*yield)(void);    // pthread_yield() / Win32: SwitchToThread()
     void        (*sleep_for)(fp64_t seconds);
+    int32_t     (*processors)(void); // number of logical processors
     uint64_t    (*id_of)(ut_thread_t t);
     uint64_t    (*id)(void); // gettid()
     ut_thread_t (*self)(void); // Pseudo Handle may differ in access to .open(.id())
@@ -1033,9 +1033,13 @@ typedef union ut_begin_packed ui_edit_range_s {
     ui_edit_pg_t a[2];
 } ut_end_packed ui_edit_range_t; // "from"[0] "to"[1]
 
+typedef struct ui_edit_node_s ui_edit_node_t; // paragraphs tree node
+
 typedef struct ui_edit_text_s {
     int32_t np;   // number of paragraphs
-    ui_edit_str_t* ps; // ps[np] paragraphs
+    ui_edit_node_t* root; // paragraphs tree, use ui_edit_text.ps(t, pn)
+    ut_heap_t* heap; // of nodes and paragraphs, null: process heap
+    int32_t gap; // 1 + pn of long paragraph edited in place, 0: none
 } ui_edit_text_t;
 
 typedef struct ui_edit_notify_info_s {
@@ -1043,15 +1047,15 @@ typedef struct ui_edit_notify_info_s {
     const ui_edit_doc_t*   const d;
     const ui_edit_range_t* const r; // range to be replaced
     const ui_edit_range_t* const x; // extended range (replacement)
-    const ui_edit_text_t*  const t; // replacement text
+    const ui_edit_text_t*  const t; // replacement text (null for batch)
     // d->text.np number of paragraphs may change after replace
     // before/after: [pnf..pnt] is inside [0..d->text.np-1]
     int32_t const pnf; // paragraph number from
     int32_t const pnt; // paragraph number to. (inclusive)
     // one can safely assume that ps[pnf] was modified
     // except empty range replace with empty text (which shouldn't be)
-    // d->text.ps[pnf..pnf + deleted] were deleted
-    // d->text.ps[pnf..pnf + inserted] were inserted
+    // paragraphs [pnf..pnf + deleted] were deleted
+    // paragraphs [pnf..pnf + inserted] were inserted
     int32_t const deleted;  // number of deleted  paragraphs (before: 0)
     int32_t const inserted; // paragraph inserted paragraphs (before: 0)
 } ui_edit_notify_info_t;
@@ -1076,22 +1080,101 @@ typedef struct ui_edit_to_do_s { // undo/redo action
     ui_edit_to_do_t* next; // inside undo or redo list
 } ui_edit_to_do_t;
 
+typedef struct ui_edit_record_s ui_edit_record_t; // undo/redo history record
+
+typedef struct ui_edit_history_s {
+    ui_edit_record_t* undo; // undo stack
+    ui_edit_record_t* redo; // redo stack
+    ut_heap_t* heap;  // private heap of the records
+    int64_t budget;   // bytes: 0 unlimited, oldest undo records are trimmed
+    // counters:
+    int64_t bytes;    // memory used by undo and redo records
+    int32_t records;  // number of undo and redo records
+    int32_t merged;   // edits coalesced into existing records
+    int32_t trimmed;  // records trimmed because of budget
+} ui_edit_history_t;
+
+typedef struct ui_edit_mapping_s ui_edit_mapping_t; // file mapping
+
+typedef struct ui_edit_arena_s ui_edit_arena_t; // private heap of the text
+
+typedef struct ui_edit_cold_s { // compressed leaves, see ui_edit_doc.cool()
+    int64_t ceiling; // bytes: 0 (default) paragraphs are never compressed
+    // counters updated by cool():
+    int64_t hot;     // bytes of paragraphs in uncompressed leaves
+    int64_t bytes;   // bytes of compressed leaves
+    int32_t leaves;  // number of compressed leaves
+    int64_t epoch;   // after the previous cool(): newer leaves stay hot
+} ui_edit_cold_t;
+
+typedef struct ui_edit_dedup_s { // shared paragraphs, see ui_edit_doc.dedup()
+    // counters updated by dedup():
+    int32_t paragraphs; // number of paragraphs that share bytes
+    int32_t blocks;     // number of distinct shared byte sequences
+    int64_t bytes;      // utf8 and .g2b[] bytes of the shared paragraphs
+    int64_t shared;     // bytes of the blocks: dedup ratio bytes / shared
+} ui_edit_dedup_t;
+
+typedef struct ui_edit_tail_s { // append only mode, see ui_edit_doc.append()
+    int32_t lines;   // 0 (default) unlimited or number of paragraphs to keep
+    int64_t bytes;   // 0 (default) unlimited or utf8 bytes to keep
+    // utf8 appended since the previous flush():
+    uint8_t* pending;
+    int32_t  count;    // bytes in pending[]
+    int32_t  capacity; // of pending[]
+    ut_file_t* file;   // ui_edit_doc.follow() file or null
+    int64_t  position; // in the file of the next byte to read
+    bool     skip;     // partial first line of the followed file
+    int64_t  dropped;  // counter: paragraphs dropped from the head
+} ui_edit_tail_t;
+
 typedef struct ui_edit_doc_s {
     ui_edit_text_t   text;
-    ui_edit_to_do_t* undo; // undo stack
-    ui_edit_to_do_t* redo; // redo stack
+    ui_edit_history_t history;
+    ui_edit_cold_t   cold;
+    ui_edit_dedup_t  dedup;
+    ui_edit_tail_t   tail;
     ui_edit_listener_t* listeners;
+    ui_edit_mapping_t* mapping; // read only file of ui_edit_doc.open()
+    ui_edit_arena_t* arena; // null: text uses the process heap
 } ui_edit_doc_t;
 
+typedef struct ui_edit_snapshot_s { // see ui_edit_doc.snapshot()
+    ui_edit_text_t text; // read only
+    ui_edit_mapping_t* mapping;
+    ui_edit_arena_t* arena;
+} ui_edit_snapshot_t;
+
+typedef struct ui_edit_replacement_s { // see ui_edit_doc.replace_batch()
+    ui_edit_range_t range;
+    const uint8_t*  utf8;  // null or zero terminated when bytes < 0
+    int32_t         bytes;
+} ui_edit_replacement_t;
+
+typedef struct ui_edit_find_s { // see ui_edit_doc.find()
+    const uint8_t* utf8;  // pattern w/o "\n", zero terminated if bytes < 0
+    int32_t bytes;
+    bool    ignore_case;  // ASCII letters only
+    bool    whole_word;   // not adjacent to [0-9A-Za-z_] or non ASCII glyphs
+} ui_edit_find_t;
+
 typedef struct ui_edit_doc_if {
     // init(utf8, bytes, heap:false) must have longer lifetime
     // than document, otherwise use heap: true to copy
     bool    (*init)(ui_edit_doc_t* d, const uint8_t* utf8_or_null,
                     int32_t bytes, bool heap);
+    // open() maps file read only, paragraphs are materialized lazily
+    errno_t (*open)(ui_edit_doc_t* d, const char* filename);
     bool    (*replace_text)(ui_edit_doc_t* d, const ui_edit_range_t* r,
                 const ui_edit_text_t* t, ui_edit_to_do_t* undo_or_null);
     bool    (*replace)(ui_edit_doc_t* d, const ui_edit_range_t* r,
                 const uint8_t* utf8, int32_t bytes);
+    // replace_batch() ranges must be ordered and must not overlap
+    bool    (*replace_batch)(ui_edit_doc_t* d,
+                const ui_edit_replacement_t* replacements, int32_t n);
+    // snapshot() of the text for a background thread, null on no memory
+    ui_edit_snapshot_t* (*snapshot)(ui_edit_doc_t* d);
+    void (*dispose_snapshot)(ui_edit_snapshot_t* s); // on any thread
     int32_t (*bytes)(const ui_edit_doc_t* d, const ui_edit_range_t* range);
     bool    (*copy_text)(ui_edit_doc_t* d, const ui_edit_range_t* range,
                 ui_edit_text_t* text); // retrieves range into string
@@ -1099,19 +1182,117 @@ typedef struct ui_edit_doc_if {
     // utf8 must be at least ui_edit_doc.utf8bytes()
     void    (*copy)(ui_edit_doc_t* d, const ui_edit_range_t* range,
                 char* utf8);
+    // write() range as copy() does (w/o 0x00) "\r\n" separators on crlf
+    errno_t (*write)(ui_edit_doc_t* d, const ui_edit_range_t* range,
+                ut_stream_if* out, bool crlf);
+    // save() whole document to "<filename>.tmp" and renames it to filename
+    errno_t (*save)(ui_edit_doc_t* d, const char* filename, bool crlf);
+    // find() first match at or after pg, false if there are no more
+    bool    (*find)(ui_edit_doc_t* d, const ui_edit_find_t* f,
+                const ui_edit_pg_t pg, ui_edit_range_t* match);
+    // find_all() matches inside range (null: whole document) into heap
+    // allocated *matches (ut_heap.free() it), returns number of matches
+    // or -1 on out of memory
+    int32_t (*find_all)(ui_edit_doc_t* d, const ui_edit_find_t* f,
+                const ui_edit_range_t* range, ui_edit_range_t* *matches);
+    // replace_all() matches inside range as a single undo step, returns
+    // number of replacements or -1 on failure
+    int32_t (*replace_all)(ui_edit_doc_t* d, const ui_edit_find_t* f,
+                const ui_edit_range_t* range,
+                const uint8_t* utf8, int32_t bytes);
     // undo() and push reverse into redo stack
-    bool (*undo)(ui_edit_doc_t* d); // false if there is nothing to redo
+    bool (*undo)(ui_edit_doc_t* d); // false if there is nothing to undo
     // redo() and push reverse into undo stack
-    bool (*redo)(ui_edit_doc_t* d); // false if there is nothing to undo
+    bool (*redo)(ui_edit_doc_t* d); // false if there is nothing to redo
     bool (*subscribe)(ui_edit_doc_t* d, ui_edit_notify_t* notify);
     void (*unsubscribe)(ui_edit_doc_t* d, ui_edit_notify_t* notify);
     void (*dispose_to_do)(ui_edit_to_do_t* to_do);
+    // cool() compresses least recently used leaves down to d->cold.ceiling
+    void (*cool)(ui_edit_doc_t* d);
+    // dedup() makes paragraphs with identical bytes share one copy
+    void (*dedup)(ui_edit_doc_t* d);
+    // append() utf8 to the end of the text on the next flush() w/o undo
+    bool    (*append)(ui_edit_doc_t* d, const uint8_t* utf8, int32_t bytes);
+    // flush() appended and followed bytes as a single replace notification
+    // and drops the oldest paragraphs over the d->tail limits
+    errno_t (*flush)(ui_edit_doc_t* d);
+    // follow() appends bytes written to the end of the file on flush()
+    errno_t (*follow)(ui_edit_doc_t* d, const char* filename);
     void (*dispose)(ui_edit_doc_t* d);
     void (*test)(void);
+    // arena: true (default) documents allocate nodes and paragraphs
+    // of the text from a private heap, see ui_edit_doc.dispose()
+    bool arena;
 } ui_edit_doc_if;
 
 extern ui_edit_doc_if ui_edit_doc;
 
+typedef struct ui_edit_index_list_s ui_edit_index_list_t; // postings
+typedef struct ui_edit_index_slot_s ui_edit_index_slot_t; // paragraph
+
+typedef struct ui_edit_index_s { // trigram index, see ui_edit_index.init()
+    ui_edit_notify_t notify; // subscribed to the document changes
+    ui_edit_doc_t* d;
+    ui_edit_index_list_t* lists; // trigram -> paragraph slots hash table
+    int32_t  capacity; // of lists[] (power of 2)
+    int32_t  count;    // number of trigrams
+    int32_t* slots;    // slots[pn] slot of the paragraph pn
+    int32_t  np;       // number of paragraphs
+    int32_t  sc;       // capacity of slots[]
+    ui_edit_index_slot_t* slot; // slot[slots[pn]].pn == pn or -1 if stale
+    int32_t  ns;       // number of slots
+    int32_t  nc;       // capacity of slot[]
+    int64_t  entries;  // all slots in all lists
+    int64_t  stale;    // entries of stale slots
+    bool     dirty;    // slot[].pn must be recounted from slots[]
+    bool     valid;    // false: rebuilt by the next find_all()
+} ui_edit_index_t;
+
+typedef struct ui_edit_index_if {
+    // init() indexes all paragraphs and subscribes to the document
+    bool    (*init)(ui_edit_index_t* x, ui_edit_doc_t* d);
+    // find_all() same as ui_edit_doc.find_all() of the whole document
+    int32_t (*find_all)(ui_edit_index_t* x, const ui_edit_find_t* f,
+                        ui_edit_range_t* *matches);
+    void    (*dispose)(ui_edit_index_t* x); // unsubscribes
+} ui_edit_index_if;
+
+extern ui_edit_index_if ui_edit_index;
+
+typedef struct ui_edit_journal_s { // edits log, see ui_edit_journal.open()
+    ui_edit_notify_t notify; // subscribed to the document changes
+    ui_edit_doc_t* d;
+    ut_stream_file_if fs;  // buffered "<filename>.journal"
+    ut_file_name_t base;   // document file
+    ut_file_name_t name;   // journal file
+    uint8_t* record;  // reused buffer of a single record
+    int32_t  capacity; // of record[]
+    int64_t  bytes;    // of the journal file including buffered records
+    int64_t  limit;    // journal bytes that allow compaction (default 1MB)
+    fp64_t   period;   // seconds between fsync() (default 1.0)
+    fp64_t   synced;   // ut_clock.seconds() of the last fsync()
+    errno_t  error;    // first failure: journal stops recording
+    bool     crlf;     // "\r\n" line endings of the compacted file
+    // counters:
+    int32_t  records;  // since the last compaction
+    int32_t  replayed; // records recovered by open()
+    int32_t  compactions;
+} ui_edit_journal_t;
+
+typedef struct ui_edit_journal_if {
+    // open() replays the journal of filename left by the previous
+    // session (if any) onto d just opened from filename and starts
+    // recording changes of d
+    errno_t (*open)(ui_edit_journal_t* j, ui_edit_doc_t* d,
+                    const char* filename);
+    errno_t (*sync)(ui_edit_journal_t* j); // writes and fsync() records
+    // compact() saves the document to filename and empties the journal
+    errno_t (*compact)(ui_edit_journal_t* j);
+    errno_t (*dispose)(ui_edit_journal_t* j); // syncs and unsubscribes
+} ui_edit_journal_if;
+
+extern ui_edit_journal_if ui_edit_journal;
+
 typedef struct ui_edit_range_if {
     int (*compare)(const ui_edit_pg_t pg1, const ui_edit_pg_t pg2);
     ui_edit_range_t (*all_on_null)(const ui_edit_text_t* t,
@@ -1137,28 +1318,50 @@ extern ui_edit_range_if ui_edit_range;
 
 typedef struct ui_edit_text_if {
     bool    (*init)(ui_edit_text_t* t, const uint8_t* s, int32_t b, bool heap);
+    // ps() paragraph pn in [0..t->np - 1] O(log(np)), the pointer
+    // is valid until the next modification of the text
+    ui_edit_str_t* (*ps)(const ui_edit_text_t* t, int32_t pn);
+    // bytes() and glyphs() of the range w/o "\n" between paragraphs,
+    // offset() of pg in utf8 text with "\n" after each paragraph and
+    // pg() of the offset are O(log(np)), see ui_edit_text.offset()
     int32_t (*bytes)(const ui_edit_text_t* t, const ui_edit_range_t* r);
+    int64_t (*glyphs)(const ui_edit_text_t* t, const ui_edit_range_t* r);
+    int64_t (*offset)(const ui_edit_text_t* t, const ui_edit_pg_t pg);
+    ui_edit_pg_t (*pg)(const ui_edit_text_t* t, int64_t offset);
     void    (*dispose)(ui_edit_text_t* t);
+    // threads: init() of huge (megabytes) texts splits paragraphs
+    // in parallel: 0 (default) ut_thread.processors(), 1 single thread
+    int32_t threads;
 } ui_edit_text_if;
 
 extern ui_edit_text_if ui_edit_text;
 
+enum { ui_edit_str_inline = 20 }; // bytes of short strings kept in place
+
 typedef struct ut_begin_packed ui_edit_str_s {
     uint8_t* u;    // always correct utf8 bytes not zero terminated(!) sequence
     // s.g2b[s.g + 1] glyph to byte position inside s.u[]
     // s.g2b[0] == 0, s.g2b[s.glyphs] == s.bytes
+    // or sparse: s.g2b[0] == -n, s.g2b[k] byte position of glyph k * n
+    // use ui_edit_str.g2b(s, gp) to read it
+    // ASCII only strings (g == b) share identity index of any length
     int32_t* g2b;  // g2b_0 or heap allocated glyphs to bytes indices
     int32_t  b;    // number of bytes
     int32_t  c;    // when capacity is zero .u is not heap allocated
+                   // negative: .u == .i short string stored in place
     int32_t  g;    // number of glyphs
+    uint8_t  i[ui_edit_str_inline]; // in place bytes of short strings
+                                    // or shared block, see dedup()
 } ut_end_packed ui_edit_str_t;
 
 typedef struct ui_edit_str_if {
     bool (*init)(ui_edit_str_t* s, const uint8_t* utf8, int32_t bytes, bool heap);
     void (*swap)(ui_edit_str_t* s1, ui_edit_str_t* s2);
+    void (*moved)(ui_edit_str_t* s); // re-points .u after struct copy
     int32_t (*utf8bytes)(const uint8_t* utf8, int32_t bytes); // 0 on error
     int32_t (*glyphs)(const uint8_t* utf8, int32_t bytes); // -1 on error
     int32_t (*gp_to_bp)(const uint8_t* s, int32_t bytes, int32_t gp); // -1
+    int32_t (*g2b)(const ui_edit_str_t* s, int32_t gp); // byte position
     int32_t (*bytes)(ui_edit_str_t* s, int32_t from, int32_t to); // glyphs
     bool (*expand)(ui_edit_str_t* s, int32_t capacity); // reallocate
     void (*shrink)(ui_edit_str_t* s); // get rid of extra heap memory
@@ -1167,6 +1370,9 @@ typedef struct ui_edit_str_if {
     void (*test)(void);
     void (*free)(ui_edit_str_t* s);
     const ui_edit_str_t* const empty;
+    // sparse: 0 (default) full s.g2b[s.g + 1] index, n > 0 strings
+    // longer than n glyphs keep one checkpoint every n glyphs
+    int32_t sparse;
 } ui_edit_str_if;
 
 extern ui_edit_str_if ui_edit_str;
@@ -1193,6 +1399,198 @@ extern ui_edit_str_if ui_edit_str;
             element is number of bytes in the s.u memory.
             Called must zero out the string struct before calling init().
 
+    ui_edit_doc.open()
+            maps the file read only with ut_mem.map_ro() and only
+            splits it into paragraphs by scanning for '\n' and counts
+            (validates) utf8 glyphs of each paragraph. Both passes are
+            split between ui_edit_text.threads. Glyphs are indexed
+            (.g2b[]) when the paragraph is first accessed via
+            ui_edit_text.ps() (by view or edit). Paragraphs with invalid
+            utf8 bytes get them replaced with U+FFFD on open.
+            Empty file opens as an empty document. The mapping is
+            released by ui_edit_doc.dispose().
+
+    ui_edit_doc.replace()
+            records reverse edit in the undo history. Adjacent typing
+            (until the next word starts) and adjacent backspacing or
+            deleting within a paragraph are merged into a single record.
+            Records keep replaced text as utf8 bytes in one allocation
+            from the document private heap. When d->history.budget is
+            not zero the oldest undo records are trimmed to fit it.
+
+    ui_edit_doc.replace_batch()
+            applies n replacements (e.g. replace all, multi-cursor
+            typing) in a single pass over paragraphs with a single
+            before()/after() notification where r and x span all
+            replacements and t is null. Whole batch is one undo step.
+            All or nothing: returns false on invalid utf8, invalid
+            or overlapping ranges or out of memory.
+
+    ui_edit_text.offset()
+    ui_edit_text.pg()
+            convert between ui_edit_pg_t and byte offset in the utf8
+            representation of the text (paragraphs joined by "\n" as
+            ui_edit_doc.copy() produces). Tree nodes keep subtree sums
+            of paragraph bytes and glyphs thus offset(), pg(), bytes()
+            and glyphs() only touch O(log(np)) nodes and do not
+            materialize lazy paragraphs except the ones at the ends.
+            pg() of an offset in the middle of multibyte glyph returns
+            that glyph, offset at "\n" or past the end of text returns
+            the end of the paragraph. Number of paragraphs (lines) is
+            t->np, totals are glyphs() and bytes() of all_on_null().
+
+    ui_edit_doc.snapshot()
+            returns immutable view of the document text in O(1).
+            Paragraphs tree nodes are reference counted and shared
+            between the document and its snapshots. Edits copy only
+            the nodes on the path to the modified paragraphs (and the
+            paragraphs of the copied leaves) so the snapshot text
+            stays consistent while the user keeps typing. Snapshot
+            text can be read with ui_edit_text.ps(), bytes(), offset()
+            etc. on one thread while the document is edited on another.
+            Each background reader should take its own snapshot.
+            A snapshot keeps the file mapping of ui_edit_doc.open()
+            alive and may outlive the document.
+
+    ui_edit_doc.write()
+            streams the range to any ut_stream_if without copying the
+            whole text: paragraphs are written directly from the tree
+            and are not materialized (except at the ends of the range).
+            Unmodified paragraphs of ui_edit_doc.open() that are adjacent
+            in the mapped file go out together with the original line
+            separators in a single out.write() call. Returns the first
+            error of out.write() and stops writing after it.
+
+    ui_edit_doc.save()
+            writes the document through buffered ut_streams.file_write()
+            stream in constant memory into "<filename>.tmp" in the same
+            folder, flushes it to the disk and only then renames it over
+            the filename. On any failure the temporary file is removed
+            and the original file is left intact. Note that Windows does
+            not allow to replace the file that is still mapped by the
+            ui_edit_doc.open() of this (or any other) document.
+
+    ui_edit_doc.find()
+    ui_edit_doc.find_all()
+            search raw paragraph bytes (lazy paragraphs of open() are not
+            materialized). Vectorized filter compares the first and
+            the last bytes of the pattern at 16 or 32 positions at once
+            and only the candidates that pass are compared in full.
+            Matches do not overlap and never span paragraphs. find() is
+            incremental: next search starts at the previous match.to.
+            find_all() of a large range (megabytes) is split between
+            ui_edit_text.threads worker threads, matches are returned in
+            the document order. Empty, invalid utf8 or multi-line
+            patterns have no matches.
+
+    ui_edit_doc.replace_all()
+            replaces find_all() matches via ui_edit_doc.replace_batch()
+            with a single notification and a single undo record.
+
+    ui_edit_index.init()
+            optional trigram index of the document for repeated searches
+            (e.g. on each keystroke in the search box). Posting lists map
+            case folded 3 bytes sequences to paragraphs. After each
+            replace only paragraphs [pnf..pnt] of ui_edit_notify_info_t
+            are indexed again. Paragraphs get new slot on every change,
+            postings of the old slots become stale and are removed when
+            the index is rebuilt after stale entries outnumber the live
+            ones. Patterns of 3 and more bytes only verify paragraphs
+            that contain all of the pattern trigrams, shorter patterns
+            fall back to ui_edit_doc.find_all().
+
+    ui_edit_journal.open()
+            durable autosave: every replace (including undo, redo,
+            batches and appends) is recorded as the replaced range and
+            the utf8 text that replaced it in "<filename>.journal" with
+            a checksum per record. Cost of recording is proportional
+            to the edit (a batch records the span of its replacements)
+            and not to the document. Records are buffered and fsync()ed
+            at most every j->period seconds. When the journal grows over
+            j->limit and over a half of the document compact() saves the
+            whole document to filename and starts an empty journal, so
+            the full saves are amortized O(1) per recorded byte. After
+            a crash open() replays the records on top of the last full
+            save up to the first torn or corrupted one, drops the rest
+            and keeps appending to the same journal. The journal header
+            keeps the length and hash of the file it applies to.
+            A journal of a different file content (e.g. the file was
+            saved by other means) is discarded. Save through compact()
+            instead of ui_edit_doc.save() while journaling. Windows
+            does not allow to replace the file still mapped by
+            ui_edit_doc.open(): such documents are not compacted
+            automatically and compact() fails like save() leaving the
+            file and the journal intact. Other failures are sticky in
+            j->error and stop the recording.
+
+    ui_edit_doc.dispose()
+            with ui_edit_doc.arena the text of the document lives in
+            a private heap (ut_heap.create()): allocations of the text
+            do not contend with other threads and documents, and when
+            no snapshot is alive dispose() releases the whole heap at
+            once instead of freeing paragraphs one by one. Snapshots
+            keep the heap alive until the last one is disposed.
+
+    ui_edit_doc.cool()
+            opt-in low memory mode for huge (read only) documents: when
+            d->cold.ceiling is not zero the leaves of the paragraphs tree
+            (up to 64 paragraphs) that were not accessed since the previous
+            cool() of the same document (d->cold.epoch) are compressed
+            with a fast LZ codec until the rest fits into the ceiling. Compressed leaves drop ps[] and .g2b[] and
+            keep only utf8 bytes of the edited paragraphs and pointers
+            into the file mapping for untouched ones. A leaf is restored
+            on demand when ui_edit_text.ps(), copy, write or find touches
+            it (on any thread). Leaves shared with snapshots are not
+            compressed. The view calls cool() from every_100ms() after
+            paint so the visible paragraphs stay hot. Like any modification cool() invalidates
+            pointers returned by ui_edit_text.ps().
+
+    ui_edit_doc.dedup()
+            opt-in interning of repeated paragraphs (logs, generated
+            code): heap allocated paragraphs with identical utf8 bytes
+            (found by 64-bit hash) share one reference counted immutable
+            block of bytes and .g2b[]. A shared paragraph is copied back
+            to its own heap memory on the first edit, the block is freed
+            with its last paragraph. Only paragraphs of leaves that are
+            not shared with snapshots and not compressed are considered.
+            Short (in place) and lazy paragraphs do not use heap bytes
+            and are left alone. dedup() is O(n) in the number of bytes
+            of the considered paragraphs, call it after init(), open()
+            (once paragraphs were touched) or a series of flush().
+            d->dedup counters report the saving. Like cool() it does not
+            change the text but invalidates ui_edit_text.ps() pointers.
+
+    ui_edit_doc.append()
+            streaming ("tail -f") mode for logs and consoles: append()
+            only copies bytes into d->tail.pending (amortized O(1)) and
+            flush() (e.g. once per frame or timer tick) inserts all of
+            them at the end of the text with one before()/after()
+            notification and without undo records. Incomplete trailing
+            utf8 sequence and '\r' are kept pending until the rest of
+            them arrives, invalid utf8 is replaced by U+FFFD. When
+            d->tail.lines or d->tail.bytes is set flush() drops the
+            oldest paragraphs above the limits with a single delete
+            (O(log(np)) in the paragraphs tree) and discards undo/redo
+            history because its ranges are no longer valid.
+            follow() reads the growing file on each flush() starting
+            from the last d->tail.bytes of it (at the beginning of a
+            line) and starts over when the file is truncated.
+
+    ui_edit_str.init()
+            with heap == true strings up to ui_edit_str_inline bytes
+            keep utf8 bytes in place (.c < 0 and .u == .i) and short
+            ASCII strings share the ui_edit_str_g2b_ascii index: no
+            heap allocations for blank lines, braces and alike. Edits
+            use the in place bytes while the result fits and shrink()
+            moves short results back from the heap. Because .u points
+            inside the struct, in place strings are moved with
+            ui_edit_str.swap() or re-pointed after memcpy() of structs.
+
+    ui_edit_str.g2b()
+            returns byte position of the glyph gp in [0..s.g]. For
+            sparse strings it decodes forward from the nearest
+            checkpoint: at most n - 1 glyphs.
+
     ui_edit_str.bytes()
             returns number of bytes in utf8 string in the exclusive
             range [from..to[ between string glyphs.
@@ -1205,6 +1603,13 @@ extern ui_edit_str_if ui_edit_str;
             heap allocation fails. The called must ensure that the
             range [from..to[ is valid, failure to do so is a fatal
             error. ui_edit_str.replace() moves string content to the heap.
+            Long paragraphs (minified JSON, single line logs) of 64KB
+            and more keep spare capacity and ASCII only paragraphs have
+            no .g2b[] at all. ui_edit_doc.replace() edits such paragraphs
+            in place with a gap at the caret: typing, backspace, undo
+            and redo cost the distance from the previous edit and the
+            tail of the paragraph is not moved. ui_edit_text.ps() closes
+            the gap and always returns contiguous .u[0..b - 1].
 
     ui_edit_str.free()
             deallocates all heap allocated memory and zero out string
@@ -1255,11 +1660,91 @@ typedef struct ui_edit_run_s {
 // with .allocated == 0; as text is modified it is copied to
 // heap and reallocated there.
 
+typedef struct ui_edit_metrics_s ui_edit_metrics_t;
+
+typedef struct ui_edit_background_s ui_edit_background_t;
+
+typedef struct ui_edit_metrics_s { // glyph advance widths provider
+    // advance() width in pixels of a single glyph utf8[bytes] in font fm
+    int32_t (*advance)(ui_edit_metrics_t* m, const ui_fm_t* fm,
+                       const uint8_t* utf8, int32_t bytes);
+    bool concurrent; // advance() may be called on background threads
+} ui_edit_metrics_t;
+
+extern ui_edit_metrics_t ui_edit_metrics_gdi;   // ui_gdi.text() measurements
+extern ui_edit_metrics_t ui_edit_metrics_fixed; // deterministic, see notes
+
+typedef struct ui_edit_width_s {
+    uint32_t glyph; // utf8 bytes of non-ASCII glyph, 0: empty slot
+    int32_t  width;
+} ui_edit_width_t;
+
+typedef struct ui_edit_widths_s { // advance widths cache of a font
+    ui_edit_metrics_t* metrics; // provider the cache was filled by
+    const ui_fm_t* fm;          // font metrics, .font and .height
+    ui_font_t font;             // at the time the cache was filled
+    int32_t height;
+    int32_t ascii[128];         // -1: not measured yet
+    ui_edit_width_t* entry;     // open addressing hash of entry[capacity]
+    int32_t capacity;           // power of 2
+    int32_t count;
+    int32_t cell;               // fm->mono: printable ASCII advance or 0
+} ui_edit_widths_t;
+
+typedef struct ui_edit_token_s { // colored span of paragraph bytes
+    int32_t bp;   // position in bytes since start of the paragraph
+    int32_t kind; // index of ui_edit_lexer_t.color[] (token ends where
+                  // the next token starts or at the end of paragraph)
+} ui_edit_token_t;
+
+enum { // token kinds of ui_edit_lexer_c
+    ui_edit_token_text         = 0,
+    ui_edit_token_keyword      = 1,
+    ui_edit_token_number       = 2,
+    ui_edit_token_string       = 3,
+    ui_edit_token_comment      = 4,
+    ui_edit_token_preprocessor = 5,
+    ui_edit_token_punctuation  = 6,
+    ui_edit_token_kinds        = 8  // countof(ui_edit_lexer_t.color)
+};
+
+typedef struct ui_edit_lexer_s ui_edit_lexer_t;
+
+typedef struct ui_edit_lexer_s { // pluggable syntax tokenizer
+    // lex() paragraph u[b] that starts in lexer `state` (0 for the first
+    // paragraph) and returns the state at the end of the paragraph.
+    // If tokens != null fills tokens[*count] (at most b) of the paragraph.
+    uint32_t (*lex)(ui_edit_lexer_t* x, uint32_t state,
+                    const uint8_t* u, int32_t b,
+                    ui_edit_token_t* tokens, int32_t* count);
+    ui_color_t color[ui_edit_token_kinds]; // undefined: ui_view_t.color
+} ui_edit_lexer_t;
+
+extern ui_edit_lexer_t ui_edit_lexer_c; // C, C++ and JSON
+
 typedef struct ui_edit_paragraph_s { // "paragraph" view consists of wrapped runs
-    int32_t runs;       // number of runs in this paragraph
-    ui_edit_run_t* run; // heap allocated array[runs]
+    int32_t runs;       // number of runs in this paragraph, 0: not laid out
+    ui_edit_run_t* run; // heap allocated array[runs] or null if evicted
+    int32_t prev;       // paragraphs with .run != null in most recently
+    int32_t next;       // used order (see ui_edit_t.mru) or -1
+    // syntax coloring (see ui_edit_t.lexer):
+    int32_t tokens;         // number of tokens in this paragraph
+    ui_edit_token_t* token; // heap allocated array[tokens] or null
+    uint32_t start;         // lexer state at the start of the paragraph
+    uint32_t state;         // lexer state at the end of the paragraph
+    bool lexed;             // .state is lexed from .start and the text
 } ui_edit_paragraph_t;
 
+typedef struct ui_edit_run_sums_s { // Fenwick tree node
+    int32_t runs; // partial sum of para[].runs
+    int32_t laid; // partial sum of paragraphs that have runs
+} ui_edit_run_sums_t;
+
+typedef struct ui_edit_run_index_s { // binary indexed tree of para[].runs
+    ui_edit_run_sums_t* sum; // sum[np + 1], sum[0] is not used
+    int32_t np;          // 0: not built or stale, rebuilt on demand
+} ui_edit_run_index_t;
+
 typedef struct ui_edit_notify_view_s {
     ui_edit_notify_t notify;
     void*            that; // specific for listener
@@ -1294,6 +1779,25 @@ typedef struct ui_edit_s {
     uint32_t fuzz_seed;   // fuzzer random32 seed (must start with odd number)
     // paragraphs memory:
     ui_edit_paragraph_t* para; // para[e->doc->text.np]
+    ui_edit_run_index_t run_index; // run counts of laid out paragraphs
+    int32_t mru;    // most recently used paragraph with run[] or -1
+    int32_t lru;    // least recently used paragraph with run[] or -1
+    int32_t cached; // number of paragraphs with run[]
+    // glyph advance widths: null metrics is ui_edit_metrics_gdi
+    ui_edit_metrics_t* metrics;
+    ui_edit_widths_t widths;
+    // background layout of runs (see notes):
+    ui_edit_background_t* background; // running layout job or null
+    int32_t generation; // incremented by edits and by relayout of all runs
+    int32_t quiet;      // generation at the previous every_100ms()
+    bool relayout;      // runs of all paragraphs were invalidated
+    bool painted;       // since the previous ui_edit_doc.cool()
+    // syntax coloring: null paints plain text
+    ui_edit_lexer_t* lexer;
+    ui_edit_lexer_t* lexed_by; // lexer of para[].state
+    int32_t lexed;    // para[0..lexed - 1].state is up to date
+    ui_edit_token_t* tokens; // lex() scratch buffer
+    int32_t capacity; // of tokens[]
 } ui_edit_t;
 
 typedef struct ui_edit_if {
@@ -1329,6 +1833,7 @@ typedef struct ui_edit_if {
     void (*fuzz)(ui_edit_t* e);      // start/stop fuzzing test
     void (*next_fuzz)(ui_edit_t* e); // next fuzz input event(s)
     void (*dispose)(ui_edit_t* e);
+    void (*test)(void); // headless layout tests with ui_edit_metrics_fixed
 } ui_edit_if;
 
 extern ui_edit_if ui_edit;
@@ -1342,6 +1847,64 @@ extern ui_edit_if ui_edit;
                  to set font via this function instead which also requests
                  edit UI element re-layout.
 
+    .metrics   - text widths are sums of glyph advances cached per font in
+                 .widths (an array for ASCII and a hash for the rest of
+                 glyphs) so each distinct glyph is measured only once per
+                 font instead of measuring text again and again during the
+                 word break search. ui_edit_metrics_fixed is a deterministic
+                 provider that does not need GDI: every glyph is fm->em.w
+                 wide and glyphs from U+3000 and above (CJK, emoji) are
+                 twice as wide. It allows headless layout tests and
+                 benchmarks. The cache is dropped when the font, its height
+                 or the provider changes. For monospaced fonts (fm->mono)
+                 only "m" is measured for all printable ASCII glyphs and
+                 their spans are broken into runs, hit tested and measured
+                 arithmetically. Wide, zero width and all other non-ASCII
+                 glyphs keep their measured advances from the cache.
+
+    background - after runs of all paragraphs are invalidated (resize or
+                 font change) of a document with thousands of paragraphs
+                 the view lays out the visible paragraphs on demand as
+                 before and, once the view stays unchanged for 100ms,
+                 starts worker threads that lay out the rest of them
+                 (starting below the visible ones) from snapshots of the
+                 text. Run counts of paragraphs are published and
+                 installed by every_100ms(). Edits or another resize
+                 cancel the job without waiting for it. Glyphs missing
+                 from the widths cache of not .concurrent metrics (GDI)
+                 are never measured on workers, such paragraphs are laid
+                 out on demand. Scrolling and paging count runs only up
+                 to a page thus never lay out the whole document.
+
+    .run_index - prefix sums of run counts of the paragraphs that are laid
+                 out (Fenwick tree). Counting runs between two positions,
+                 pg_to_xy() and scrolling by a number of runs are O(log n)
+                 when every paragraph in between is laid out and fall back
+                 to per paragraph loops otherwise. Laying out or dropping
+                 runs of a paragraph updates the index in O(log n). Edits
+                 that insert or delete paragraphs renumber para[] (O(n)
+                 memmove anyway) and the index is rebuilt in O(n) on the
+                 next query.
+
+    .mru       - run[] arrays (and syntax tokens) are kept only for the
+                 4K most recently used paragraphs, the ones around the
+                 viewport. Evicted paragraphs keep their .runs count, so
+                 .run_index stays intact, and run[] is laid out again on
+                 demand. Layout memory does not grow with the number of
+                 paragraphs scrolled through. Pointers returned for
+                 run[] stay valid until thousands of other paragraphs
+                 are laid out.
+
+    .lexer     - syntax coloring. Lexer state at the end of each paragraph
+                 is kept in para[]. An edit only moves e->lexed watermark
+                 back to the first modified paragraph. Paint re-lexes from
+                 the watermark to the painted paragraphs but skips every
+                 paragraph that is unchanged and starts in the same state
+                 it was lexed from: as soon as states converge after the
+                 edited paragraphs no more lexing is done. Tokens are
+                 cached per paragraph like run[] only for the paragraphs
+                 that were painted recently. Changing .lexer discards all states.
+
     .ro        - readonly edit->ro is used to control readonly mode.
                  If edit control is readonly its appearance does not change but it
                  refuses to accept any changes to the rendered text.
@@ -5928,10 +6491,18 @@ ui_if ui = {
 /* Copyright (c) Dmitry "Leo" Kuznetsov 2021-24 see LICENSE for details */
 #include "ut/ut.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
 #undef UI_EDIT_STR_TEST
 #undef UI_EDIT_DOC_TEST
 #undef UI_STR_TEST_REPLACE_ALL_PERMUTATIONS
 #undef UI_EDIT_DOC_TEST_PARAGRAPHS
+#undef UI_EDIT_STR_TEST_PERFORMANCE
 
 #if 0 // flip to 1 to run tests
 
@@ -5941,6 +6512,7 @@ ui_if ui = {
 #if 1 // flip to 1 to run exhausting lengthy tests
 #define UI_STR_TEST_REPLACE_ALL_PERMUTATIONS
 #define UI_EDIT_DOC_TEST_PARAGRAPHS
+#define UI_EDIT_STR_TEST_PERFORMANCE
 #endif
 
 #endif
@@ -5962,22 +6534,22 @@ ui_if ui = {
             "from {pn:%d gp:%d} to {pn:%d gp:%d}",       \
     (r)->from.pn, (r)->from.gp, (r)->to.pn, (r)->to.gp);
 
-#define ui_edit_text_dump(t) do {                        \
-    for (int32_t i_ = 0; i_ < (t)->np; i_++) {           \
-        const ui_edit_str_t* p_ = &t->ps[i_];            \
-        ut_debug.println(__FILE__, __LINE__, __func__,   \
-            "ps[%d].%d: %.*s", i_, p_->b, p_->b, p_->u); \
-    }                                                    \
+#define ui_edit_text_dump(t) do {                           \
+    for (int32_t i_ = 0; i_ < (t)->np; i_++) {              \
+        const ui_edit_str_t* p_ = ui_edit_text.ps(t, i_);   \
+        ut_debug.println(__FILE__, __LINE__, __func__,      \
+            "ps[%d].%d: %.*s", i_, p_->b, p_->b, p_->u);    \
+    }                                                       \
 } while (0)
 
 // TODO: undo/redo stacks and listeners
-#define ui_edit_doc_dump(d) do {                                \
-    for (int32_t i_ = 0; i_ < (d)->text.np; i_++) {             \
-        const ui_edit_str_t* p_ = &(d)->text.ps[i_];            \
-        ut_debug.println(__FILE__, __LINE__, __func__,          \
-            "ps[%d].b:%d.c:%d: %p %.*s", i_, p_->b, p_->c,      \
-            p_, p_->b, p_->u);                                  \
-    }                                                           \
+#define ui_edit_doc_dump(d) do {                                    \
+    for (int32_t i_ = 0; i_ < (d)->text.np; i_++) {                 \
+        const ui_edit_str_t* p_ = ui_edit_text.ps(&(d)->text, i_);  \
+        ut_debug.println(__FILE__, __LINE__, __func__,              \
+            "ps[%d].b:%d.c:%d: %p %.*s", i_, p_->b, p_->c,          \
+            p_, p_->b, p_->u);                                      \
+    }                                                               \
 } while (0)
 
 
@@ -5993,7 +6565,8 @@ ui_if ui = {
 
 #define ui_edit_check_pg_inside_text(t_, pg_)                               \
     assert(0 <= (pg_)->pn && (pg_)->pn < (t_)->np &&                        \
-           0 <= (pg_)->gp && (pg_)->gp <= (t_)->ps[(pg_)->pn].g)
+           0 <= (pg_)->gp &&                                                \
+           (pg_)->gp <= ui_edit_text_peek(t_, (pg_)->pn)->g)
 
 #define ui_edit_check_range_inside_text(t_, r_) do {                        \
     assert((r_)->from.pn <= (r_)->to.pn);                                   \
@@ -6010,6 +6583,8 @@ ui_if ui = {
 
 #endif
 
+static ui_edit_str_t* ui_edit_text_peek(const ui_edit_text_t* t, int32_t pn);
+
 static ui_edit_range_t ui_edit_range_all_on_null(const ui_edit_text_t* t,
         const ui_edit_range_t* range) {
     ui_edit_range_t r;
@@ -6020,7 +6595,7 @@ static ui_edit_range_t ui_edit_range_all_on_null(const ui_edit_text_t* t,
         r.from.pn = 0;
         r.from.gp = 0;
         r.to.pn = t->np - 1;
-        r.to.gp = t->ps[r.to.pn].g;
+        r.to.gp = ui_edit_text_peek(t, r.to.pn)->g;
     }
     return r;
 }
@@ -6065,12 +6640,13 @@ static bool ui_edit_range_is_empty(const ui_edit_range_t r) {
 }
 
 static ui_edit_pg_t ui_edit_range_end(const ui_edit_text_t* t) {
-    return (ui_edit_pg_t){ .pn = t->np - 1, .gp = t->ps[t->np - 1].g };
+    return (ui_edit_pg_t){ .pn = t->np - 1,
+                           .gp = ui_edit_text_peek(t, t->np - 1)->g };
 }
 
 static ui_edit_range_t ui_edit_range_end_range(const ui_edit_text_t* t) {
     ui_edit_pg_t e = (ui_edit_pg_t){ .pn = t->np - 1,
-                                     .gp = t->ps[t->np - 1].g };
+                                     .gp = ui_edit_text_peek(t, t->np - 1)->g };
     return (ui_edit_range_t){ .from = e, .to = e };
 }
 
@@ -6088,8 +6664,10 @@ static bool ui_edit_range_inside_text(const ui_edit_text_t* t,
         const ui_edit_range_t r) {
     return ui_edit_range.is_valid(r) &&
             0 <= r.from.pn && r.from.pn <= r.to.pn && r.to.pn < t->np &&
-            0 <= r.from.gp && r.from.gp <= r.to.gp &&
-            r.to.gp <= t->ps[r.to.pn - 1].g;
+            0 <= r.from.gp &&
+            r.from.gp <= ui_edit_text_peek(t, r.from.pn)->g &&
+            (r.from.pn < r.to.pn || r.from.gp <= r.to.gp) &&
+            r.to.gp <= ui_edit_text_peek(t, r.to.pn)->g;
 }
 
 static ui_edit_range_t ui_edit_range_intersect(const ui_edit_range_t r1,
@@ -6131,646 +6709,3888 @@ static ui_edit_range_t ui_edit_range_intersect(const ui_edit_range_t r1,
     }
 }
 
-static bool ui_edit_doc_realloc_ps_no_init(ui_edit_str_t* *ps,
-        int32_t old_np, int32_t new_np) { // reallocate paragraphs
-    for (int32_t i = new_np; i < old_np; i++) { ui_edit_str.free(&(*ps)[i]); }
-    bool ok = true;
-    if (new_np == 0) {
-        ut_heap.free(*ps);
-        *ps = null;
-    } else {
-        ok = ut_heap.realloc_zero((void**)ps, new_np * sizeof(ui_edit_str_t)) == 0;
-    }
-    return ok;
-}
+// Paragraphs are kept in a counted B+ tree. Leaves hold ps[] arrays of
+// up to ui_edit_node_ps_max paragraphs, inner nodes hold up to
+// ui_edit_node_child_max subtrees and each node knows the number of
+// paragraphs in its subtree. Lookup of paragraph by number, insertion
+// and removal of paragraphs are O(log(np)) instead of O(np) memmove()
+// of the whole ps[] array on each multi-line edit.
+// Nodes also keep sums of paragraph bytes and glyphs of the subtree
+// (like a Fenwick tree but surviving insertion and removal) which makes
+// conversions between utf8 offsets and ui_edit_pg_t O(log(np)).
+// Nodes are reference counted and shared between the document text and
+// its snapshots. Modifications copy shared nodes on the path from the
+// root (copy on write) and never modify nodes reachable from snapshots
+// except materialization of lazy paragraphs that only sets .g2b under
+// the ui_edit_text_lock spinlock.
+// Leaves that are not shared may be compressed by ui_edit_doc.cool()
+// (ps == null, z[zb] compressed paragraphs) and are decompressed under
+// the same spinlock on the first access (see ui_edit_node_ps()).
 
-static bool ui_edit_doc_realloc_ps(ui_edit_str_t* *ps,
-        int32_t old_np, int32_t new_np) { // reallocate paragraphs
-    bool ok = ui_edit_doc_realloc_ps_no_init(ps, old_np, new_np);
-    if (ok) {
-        for (int32_t i = old_np; i < new_np; i++) {
-            ok = ui_edit_str.init(&(*ps)[i], null, 0, false);
-            swear(ok, "because .init(\"\", 0) does NOT allocate memory");
-        }
-    }
-    return ok;
-}
+enum {
+    ui_edit_node_ps_max    = 64, // max paragraphs in a leaf
+    ui_edit_node_child_max = 32  // max children of an inner node
+};
 
-static bool ui_edit_text_init(ui_edit_text_t* t,
-        const uint8_t* s, int32_t b, bool heap) {
-    // When text comes from the source that lifetime is shorter
-    // than text itself (e.g. paste from clipboard) the parameter
-    // heap: true allows to make a copy of data on the heap
-    ui_edit_check_zeros(t, sizeof(*t));
-    memset(t, 0x00, sizeof(*t));
-    if (b < 0) { b = (int32_t)strlen((const char*)s); }
-    // if caller is concerned with best performance - it should pass b >= 0
-    int32_t np = 0; // number of paragraphs
-    int32_t n = ut_max(b / 64, 2); // initial number of allocated paragraphs
-    ui_edit_str_t* ps = null; // ps[n]
-    bool ok = ui_edit_doc_realloc_ps(&ps, 0, n);
-    if (ok) {
-        bool lf = false;
-        int32_t i = 0;
-        while (ok && i < b) {
-            int32_t k = i;
-            while (k < b && s[k] != '\n') { k++; }
-            lf = k < b && s[k] == '\n';
-            if (np >= n) {
-                int32_t n1_5 = n * 3 / 2; // n * 1.5
-                assert(n1_5 > n);
-                ok = ui_edit_doc_realloc_ps(&ps, n, n1_5);
-                if (ok) { n = n1_5; }
-            }
-            if (ok) {
-                // insider knowledge about ui_edit_str allocation behaviour:
-                assert(ps[np].c == 0 && ps[np].b == 0 &&
-                       ps[np].g2b[0] == 0);
-                ui_edit_str.free(&ps[np]);
-                // process "\r\n" strings
-                const int32_t  e = k > i && s[k - 1] == '\r' ? k - 1 : k;
-                const int32_t  bytes = e - i; assert(bytes >= 0);
-                const uint8_t* u = bytes == 0 ? null : s + i;
-                // str.init may allocate str.g2b[] on the heap and may fail
-                ok = ui_edit_str.init(&ps[np], u, bytes, heap && bytes > 0);
-                if (ok) { np++; }
-            }
-            i = k + lf;
-        }
-        if (ok && lf) { // last paragraph ended with line feed
-            if (np + 1 >= n) {
-                ok = ui_edit_doc_realloc_ps(&ps, n, n + 1);
-                if (ok) { n = n + 1; }
-            }
-            if (ok) { np++; }
-        }
-    }
-    if (ok && np == 0) { // special case empty string to a single paragraph
-        assert(b <= 0 && (b == 0 || s[0] == 0x00));
-        np = 1; // ps[0] is already initialized as empty str
-        ok = ui_edit_doc_realloc_ps(&ps, n, 1);
-        swear(ok, "shrinking ps[] above");
-    }
-    if (ok) {
-        assert(np > 0);
-        t->np = np;
-        t->ps = ps;
-    } else if (ps != null) {
-        ok = ui_edit_doc_realloc_ps(&ps, n, 0); // free()
-        swear(ok);
-        ut_heap.free(ps);
-        t->np = 0;
-        t->ps = null;
-    }
-    return ok;
+typedef struct ui_edit_node_s {
+    volatile int32_t rc; // reference count: > 1 shared with snapshots
+    int32_t np; // number of paragraphs in the subtree
+    int32_t n;  // number of ps[] (leaf) or child[] (inner node) entries
+    int64_t b;  // sum of paragraph bytes in the subtree (w/o "\n")
+    int64_t g;  // sum of paragraph glyphs in the subtree
+    int32_t c;  // capacity of ps[] or child[]
+    ui_edit_str_t*   ps;    // leaf: ps[c] paragraphs, null for inner nodes
+    ui_edit_node_t** child; // inner node: child[c], null for leaves
+    ut_heap_t* heap; // of the node, ps[] and paragraphs (null: process)
+    uint8_t* z;      // compressed paragraphs of a cold leaf (ps == null)
+    int32_t  zb;     // bytes in z[]
+    volatile int32_t cold;    // 1: leaf paragraphs are in z[]
+    volatile int64_t touched; // ui_edit_node_epoch of the last access
+} ui_edit_node_t;
+
+static bool ui_edit_str_init_in(ut_heap_t* h, ui_edit_str_t* s,
+        const uint8_t* u, int32_t b, bool heap);
+static void ui_edit_str_free_in(ut_heap_t* h, ui_edit_str_t* s);
+static void ui_edit_str_shrink_in(ut_heap_t* h, ui_edit_str_t* s);
+static bool ui_edit_str_replace_in(ut_heap_t* h, ui_edit_str_t* s,
+        int32_t f, int32_t t, const uint8_t* u, int32_t b);
+
+// Paragraphs shared by ui_edit_doc.dedup() have .c == 0 (bytes are not
+// owned) and refer to an immutable block with the utf8 bytes and .g2b[].
+// The block pointer is kept in .i[] which strings with .c >= 0 do not
+// use. Edits copy shared paragraph to its own heap memory first.
+
+typedef struct ui_edit_str_block_s {
+    volatile int32_t rc; // number of paragraphs referring to the block
+    int32_t  k;          // .g2b[] entries, 0: ui_edit_str_g2b_ascii
+    uint64_t hash;       // of utf8 bytes
+} ui_edit_str_block_t;   // followed by int32_t g2b[k] and utf8 bytes
+
+static ui_edit_str_block_t* ui_edit_str_block(const ui_edit_str_t* s) {
+    ui_edit_str_block_t* x = null;
+    if (s->c == 0) { memcpy(&x, s->i, sizeof(x)); }
+    return x;
 }
 
-static void ui_edit_text_dispose(ui_edit_text_t* t) {
-    if (t->np != 0) {
-        ui_edit_doc_realloc_ps(&t->ps, t->np, 0);
-        assert(t->ps == null);
-        t->np = 0;
-    } else {
-        assert(t->np == 0 && t->ps == null);
-    }
+// Long paragraphs edited in place by the document keep a gap at the
+// last edit position (see ui_edit_str_edit_in()). Heap strings (.c > 0)
+// do not use .i[] either and keep the gap there:
+//     .u[0..bp - 1] gap .u[bp + c - b..c - 1]
+//     .g2b[0..gp - 1] byte positions, gg unused entries and then
+//     .g2b[gp + gg..g + gg] distances from the end of the string (b - bp)
+// so edits at the gap neither move the tail nor rebase .g2b[]. Bytes of
+// such strings are only contiguous after ui_edit_str_close_in().
+
+typedef struct ui_edit_str_gap_s {
+    int32_t gp; // glyph position of the gap + 1, 0: no gap
+    int32_t bp; // byte position of the gap
+    int32_t gg; // unused .g2b[] entries in the gap
+} ui_edit_str_gap_t;
+
+static ui_edit_str_gap_t ui_edit_str_gap(const ui_edit_str_t* s) {
+    ui_edit_str_gap_t x = {0};
+    if (s->c > 0) { memcpy(&x, s->i, sizeof(x)); }
+    return x;
 }
 
-static void ui_edit_doc_dispose_to_do(ui_edit_to_do_t* to_do) {
-    if (to_do->text.np > 0) {
-        ui_edit_text_dispose(&to_do->text);
-    }
-    memset(&to_do->range, 0x00, sizeof(to_do->range));
-    ui_edit_check_zeros(to_do, sizeof(*to_do));
+static bool ui_edit_str_gapped(const ui_edit_str_t* s) {
+    return ui_edit_str_gap(s).gp > 0;
 }
 
-static int32_t ui_edit_text_bytes(const ui_edit_text_t* t,
-        const ui_edit_range_t* range) {
-    const ui_edit_range_t r = ui_edit_range.ordered(t, range);
-    ui_edit_check_range_inside_text(t, &r);
-    int32_t bytes = 0;
-    for (int32_t pn = r.from.pn; pn <= r.to.pn; pn++) {
-        const ui_edit_str_t* p = &t->ps[pn];
-        if (pn == r.from.pn && pn == r.to.pn) {
-            bytes += p->g2b[r.to.gp] - p->g2b[r.from.gp];
-        } else if (pn == r.from.pn) {
-            bytes += p->b - p->g2b[r.from.gp];
-        } else if (pn == r.to.pn) {
-            bytes += p->g2b[r.to.gp];
-        } else {
-            bytes += p->b;
-        }
-    }
-    return bytes;
-}
+static int64_t ui_edit_str_closed; // gaps closed so far (for tests)
 
-static int32_t ui_edit_doc_bytes(const ui_edit_doc_t* d,
-        const ui_edit_range_t* r) {
-    return ui_edit_text.bytes(&d->text, r);
-}
+static void ui_edit_str_close_in(ut_heap_t* h, ui_edit_str_t* s);
+static const uint8_t* ui_edit_str_at(const ui_edit_str_t* s, int32_t bp);
+static bool ui_edit_str_edit_in(ut_heap_t* h, ui_edit_str_t* s,
+        int32_t f, int32_t t, const uint8_t* u, int32_t b);
 
-static int32_t ui_edit_doc_utf8bytes(const ui_edit_doc_t* d,
-        const ui_edit_range_t* range) {
-    const ui_edit_range_t r = ui_edit_range.ordered(&d->text, range);
-    int32_t bytes = ui_edit_text.bytes(&d->text, &r);
-    // "\n" after each paragraph and 0x00
-    return bytes + r.to.pn - r.from.pn + 1;
+static void ui_edit_str_block_release(ut_heap_t* h, ui_edit_str_block_t* x) {
+    // paragraphs of snapshots may be freed on another thread
+    if (ut_atomics.decrement_int32(&x->rc) == 0) { ut_heap.deallocate(h, x); }
 }
 
-static void ui_edit_notify_before(ui_edit_doc_t* d,
-        const ui_edit_notify_info_t* ni) {
-    ui_edit_listener_t* o = d->listeners;
-    while (o != null) {
-        if (o->notify != null && o->notify->before != null) {
-            o->notify->before(o->notify, ni);
-        }
-        o = o->next;
-    }
+static volatile int64_t ui_edit_text_lock; // see ui_edit_text_ps()
+
+// incremented by cool() of any document, each document remembers its
+// value after its own cool() in d->cold.epoch
+static volatile int64_t ui_edit_node_epoch;
+
+static void ui_edit_node_unpack(ui_edit_node_t* n);
+
+static bool ui_edit_node_is_leaf(const ui_edit_node_t* n) {
+    return n->child == null;
 }
 
-static void ui_edit_notify_after(ui_edit_doc_t* d,
-        const ui_edit_notify_info_t* ni) {
-    ui_edit_listener_t* o = d->listeners;
-    while (o != null) {
-        if (o->notify != null && o->notify->after != null) {
-            o->notify->after(o->notify, ni);
-        }
-        o = o->next;
-    }
+static void ui_edit_node_moved(ui_edit_node_t* n, int32_t i, int32_t count) {
+    // re-points in place strings of ps[i..i + count - 1] after move
+    for (int32_t k = i; k < i + count; k++) { ui_edit_str.moved(&n->ps[k]); }
 }
 
-static bool ui_edit_doc_subscribe(ui_edit_doc_t* t, ui_edit_notify_t* notify) {
-    // TODO: not sure about double linked list.
-    // heap allocated resizable array may serve better and may be easier to maintain
+static bool ui_edit_node_reserve(ui_edit_node_t* n, int32_t c) {
+    // ensures leaf capacity ps[c], leaves start small and grow
+    assert(ui_edit_node_is_leaf(n) && c <= ui_edit_node_ps_max);
     bool ok = true;
-    ui_edit_listener_t* o = t->listeners;
-    if (o == null) {
-        ok = ut_heap.alloc_zero((void**)&t->listeners, sizeof(*o)) == 0;
-        if (ok) { o = t->listeners; }
-    } else {
-        while (o->next != null) { swear(o->notify != notify); o = o->next; }
-        ok = ut_heap.alloc_zero((void**)&o->next, sizeof(*o)) == 0;
-        if (ok) { o->next->prev = o; o = o->next; }
+    if (n->c < c) {
+        int32_t nc = ut_max(n->c, 4);
+        while (nc < c) { nc *= 2; }
+        nc = ut_min(nc, (int32_t)ui_edit_node_ps_max);
+        ok = ut_heap.reallocate(n->heap, (void**)&n->ps,
+                                nc * sizeof(ui_edit_str_t), false) == 0;
+        if (ok) { n->c = nc; ui_edit_node_moved(n, 0, n->n); }
     }
-    if (ok) { o->notify = notify; }
     return ok;
 }
 
-static void ui_edit_doc_unsubscribe(ui_edit_doc_t* t, ui_edit_notify_t* notify) {
-    ui_edit_listener_t* o = t->listeners;
-    bool removed = false;
-    while (o != null) {
-        ui_edit_listener_t* n = o->next;
-        if (o->notify == notify) {
-            assert(!removed);
-            if (o->prev != null) { o->prev->next = n; }
-            if (o->next != null) { o->next->prev = o->prev; }
-            if (o == t->listeners) { t->listeners = n; }
-            ut_heap.free(o);
-            removed = true;
+static bool ui_edit_node_new(ui_edit_node_t* *node, bool leaf,
+        ut_heap_t* heap) {
+    ui_edit_node_t* n = null;
+    bool ok = ut_heap.allocate(heap, (void**)&n, sizeof(ui_edit_node_t),
+                               true) == 0;
+    if (ok) {
+        n->heap = heap;
+        if (leaf) {
+            ok = ui_edit_node_reserve(n, 1);
+        } else {
+            // +1 for transient overflow before split
+            const int32_t c = ui_edit_node_child_max + 1;
+            ok = ut_heap.allocate(heap, (void**)&n->child,
+                                  c * sizeof(ui_edit_node_t*), true) == 0;
+            if (ok) { n->c = c; }
         }
-        o = n;
+        if (!ok) { ut_heap.deallocate(heap, n); n = null; }
     }
-    swear(removed);
+    if (ok) { n->rc = 1; }
+    *node = n;
+    return ok;
 }
 
-static bool ui_edit_doc_copy_text(const ui_edit_doc_t* d,
-        const ui_edit_range_t* range, ui_edit_text_t* t) {
-    ui_edit_check_zeros(t, sizeof(*t));
-    memset(t, 0x00, sizeof(*t));
-    const ui_edit_range_t r = ui_edit_range.ordered(&d->text, range);
-    ui_edit_check_range_inside_text(&d->text, &r);
-    int32_t np = r.to.pn - r.from.pn + 1;
-    bool ok = ui_edit_doc_realloc_ps(&t->ps, 0, np);
-    if (ok) { t->np = np; }
-    for (int32_t pn = r.from.pn; ok && pn <= r.to.pn; pn++) {
-        const ui_edit_str_t* p = &d->text.ps[pn];
-        const uint8_t* u = p->u;
-        int32_t bytes = 0;
-        if (pn == r.from.pn && pn == r.to.pn) {
-            bytes = p->g2b[r.to.gp] - p->g2b[r.from.gp];
-            u += p->g2b[r.from.gp];
-        } else if (pn == r.from.pn) {
-            bytes = p->b - p->g2b[r.from.gp];
-            u += p->g2b[r.from.gp];
-        } else if (pn == r.to.pn) {
-            bytes = p->g2b[r.to.gp];
-        } else {
-            bytes = p->b;
+static void ui_edit_node_count(ui_edit_node_t* n) { // recount
+    n->b = 0;
+    n->g = 0;
+    if (ui_edit_node_is_leaf(n)) {
+        n->np = n->n;
+        for (int32_t i = 0; i < n->n; i++) {
+            n->b += n->ps[i].b;
+            n->g += n->ps[i].g;
+        }
+    } else {
+        n->np = 0;
+        for (int32_t i = 0; i < n->n; i++) {
+            n->np += n->child[i]->np;
+            n->b  += n->child[i]->b;
+            n->g  += n->child[i]->g;
         }
-        assert(t->ps[pn - r.from.pn].g == 0);
-        const uint8_t* u_or_null = bytes == 0 ? null : u;
-        ui_edit_str.replace(&t->ps[pn - r.from.pn], 0, 0, u_or_null, bytes);
-    }
-    if (!ok) {
-        ui_edit_text.dispose(t);
-        ui_edit_check_zeros(t, sizeof(*t));
     }
-    return ok;
 }
 
-static void ui_edit_doc_copy(const ui_edit_doc_t* d,
-        const ui_edit_range_t* range, char* text) {
-    const ui_edit_range_t r = ui_edit_range.ordered(&d->text, range);
-    ui_edit_check_range_inside_text(&d->text, &r);
-    char* t = text;
-    for (int32_t pn = r.from.pn; pn <= r.to.pn; pn++) {
-        const ui_edit_str_t* p = &d->text.ps[pn];
-        const uint8_t* u = p->u;
-        int32_t bytes = 0;
-        if (pn == r.from.pn && pn == r.to.pn) {
-            bytes = p->g2b[r.to.gp] - p->g2b[r.from.gp];
-            u += p->g2b[r.from.gp];
-        } else if (pn == r.from.pn) {
-            bytes = p->b - p->g2b[r.from.gp];
-            u += p->g2b[r.from.gp];
-        } else if (pn == r.to.pn) {
-            bytes = p->g2b[r.to.gp];
+static void ui_edit_node_release(ui_edit_node_t* n) {
+    // snapshots release nodes on background threads
+    if (ut_atomics.decrement_int32(&n->rc) == 0) {
+        if (ui_edit_node_is_leaf(n) && n->cold) {
+            ut_heap.deallocate(n->heap, n->z);
+        } else if (ui_edit_node_is_leaf(n)) {
+            for (int32_t i = 0; i < n->n; i++) {
+                ui_edit_str_free_in(n->heap, &n->ps[i]);
+            }
+            ut_heap.deallocate(n->heap, n->ps);
         } else {
-            bytes = p->b;
-        }
-        if (bytes > 0) {
-            memmove(t, u, bytes);
-            t += bytes;
-            if (pn < r.to.pn) { *t++ = '\n'; }
+            for (int32_t i = 0; i < n->n; i++) { ui_edit_node_release(n->child[i]); }
+            ut_heap.deallocate(n->heap, n->child);
         }
+        ut_heap.deallocate(n->heap, n);
     }
-    *t++ = 0x00;
-    const int32_t utf8_bytes = (int32_t)(uintptr_t)(t - text);
-    assert(utf8_bytes == ui_edit_doc.utf8bytes(d, &r));
-    (void)utf8_bytes;
 }
 
-static bool ui_edit_doc_insert_2_or_more_lines(ui_edit_doc_t* d, int32_t pn,
-        const ui_edit_str_t* s, const ui_edit_text_t* t, const ui_edit_str_t* e) {
-    ui_edit_text_t* dt = &d->text;
-    assert(0 <= pn && pn < dt->np);
-    const int32_t np = dt->np + t->np - 1;
-    assert(np > 0);
-    ui_edit_str_t* ps = null; // ps[np]
-    bool ok = ui_edit_doc_realloc_ps_no_init(&ps, 0, np);
-    if (ok) {
-        memmove(ps, dt->ps, pn * sizeof(ui_edit_str_t));
-        // `s` first line of `t`
-        ok = ui_edit_str.init(&ps[pn], s->u, s->b, true);
-        // lines of `t` between `s` and `e`
-        for (int32_t i = 1; ok && i < t->np - 1; i++) {
-            ok = ui_edit_str.init(&ps[pn + i], t->ps[i].u, t->ps[i].b, true);
-        }
-        // `e` last line of `t`
+static bool ui_edit_node_clone(ui_edit_node_t* n, ui_edit_node_t* *clone) {
+    // inner node shares children, leaf copies paragraphs
+    if (ui_edit_node_is_leaf(n)) { ui_edit_node_unpack(n); }
+    bool ok = ui_edit_node_new(clone, ui_edit_node_is_leaf(n), n->heap);
+    ui_edit_node_t* c = *clone;
+    if (ok && ui_edit_node_is_leaf(n)) {
+        ok = ui_edit_node_reserve(c, ut_max(n->n, 1));
         if (ok) {
-            const int32_t ix = pn + t->np - 1; // last `it` index
-            ok = ui_edit_str.init(&ps[ix], e->u, e->b, true);
+            // another thread may materialize paragraphs of shared leaf
+            ut_atomics.spinlock_acquire(&ui_edit_text_lock);
+            memcpy(c->ps, n->ps, n->n * sizeof(ui_edit_str_t));
+            ut_atomics.spinlock_release(&ui_edit_text_lock);
         }
-        assert(dt->np - pn - 1 >= 0);
-        memmove(ps + pn + t->np, dt->ps + pn + 1,
-               (dt->np - pn - 1) * sizeof(ui_edit_str_t));
-        if (ok) {
-            // this two regions where moved to `ps`
-            memset(dt->ps, 0x00, pn * sizeof(ui_edit_str_t));
-            memset(dt->ps + pn + 1, 0x00, (dt->np - pn - 1) * sizeof(ui_edit_str_t));
-            // deallocate what was copied from `t`
-            ui_edit_doc_realloc_ps_no_init(&dt->ps, dt->np, 0);
-            dt->np = np;
-            dt->ps = ps;
-        } else { // free allocated memory:
-            ui_edit_doc_realloc_ps_no_init(&ps, np, 0);
+        int32_t i = 0;
+        while (ok && i < n->n) {
+            ui_edit_str_t* p = &c->ps[i];
+            ui_edit_str_block_t* x = ui_edit_str_block(p);
+            if (x != null) { // shared bytes are immutable
+                ut_atomics.increment_int32(&x->rc);
+            } else if (p->g2b != null) { // lazy paragraphs are copied as is
+                const ui_edit_str_t s = *p;
+                memset(p, 0x00, sizeof(*p));
+                ok = ui_edit_str_init_in(c->heap, p, s.b == 0 ? null : s.u,
+                                         s.b, s.c != 0);
+            }
+            if (ok) { i++; }
         }
+        c->n = i;
+    } else if (ok) {
+        memcpy(c->child, n->child, n->n * sizeof(ui_edit_node_t*));
+        for (int32_t i = 0; i < n->n; i++) {
+            ut_atomics.increment_int32(&c->child[i]->rc);
+        }
+        c->n = n->n;
+    }
+    if (ok) {
+        ui_edit_node_count(c);
+        assert(c->np == n->np && c->b == n->b && c->g == n->g);
+    } else if (c != null) {
+        ui_edit_node_release(c);
+        *clone = null;
     }
     return ok;
 }
 
-static bool ui_edit_doc_insert_1(ui_edit_doc_t* d,
-        const ui_edit_pg_t ip, // insertion point
-        const ui_edit_text_t* insert) {
-    ui_edit_text_t* dt = &d->text;
-    assert(0 <= ip.pn && ip.pn < dt->np);
-    ui_edit_str_t* str = &dt->ps[ip.pn]; // string in document text
-    assert(insert->np == 1);
-    ui_edit_str_t* ins = &insert->ps[0]; // string to insert
-    assert(0 <= ip.gp && ip.gp <= str->g);
-    // ui_edit_str.replace() is all or nothing:
-    return ui_edit_str.replace(str, ip.gp, ip.gp, ins->u, ins->b);
-}
-
-static bool ui_edit_substr_append(ui_edit_str_t* d, const ui_edit_str_t* s1, int32_t gp1,
-    const ui_edit_str_t* s2) { // s1[0:gp1] + s2
-    assert(d != s1 && d != s2 && s1 != s2);
-    const int32_t b = s1->g2b[gp1];
-    bool ok = ui_edit_str.init(d, b == 0 ? null : s1->u, b, true);
-    if (ok) {
-        ok = ui_edit_str.replace(d, d->g, d->g, s2->u, s2->b);
-    } else {
-        *d = *ui_edit_str.empty;
+static bool ui_edit_node_own(ui_edit_node_t* *n) {
+    // copy on write: shared node is replaced by its copy,
+    // must be applied from the root down the modified path
+    bool ok = true;
+    if (ut_atomics.load32(&(*n)->rc) > 1) {
+        ui_edit_node_t* c = null;
+        ok = ui_edit_node_clone(*n, &c);
+        if (ok) {
+            ui_edit_node_release(*n);
+            *n = c;
+        }
+    } else if (ui_edit_node_is_leaf(*n)) {
+        ui_edit_node_unpack(*n); // modified leaves are hot
     }
     return ok;
 }
 
-static bool ui_edit_append_substr(ui_edit_str_t* d, const ui_edit_str_t* s1,
-    const ui_edit_str_t* s2, int32_t gp2) {  // s1 + s2[gp1:*]
-    assert(d != s1 && d != s2 && s1 != s2);
-    bool ok = ui_edit_str.init(d, s1->b == 0 ? null : s1->u, s1->b, true);
+static bool ui_edit_node_split(ui_edit_node_t* n, int32_t k,
+        ui_edit_node_t* *split) {
+    // moves entries [k..n->n - 1] into new right sibling
+    bool ok = ui_edit_node_new(split, ui_edit_node_is_leaf(n), n->heap);
     if (ok) {
-        const int32_t o = s2->g2b[gp2]; // offset (bytes)
-        const int32_t b = s2->b - o;
-        ok = ui_edit_str.replace(d, d->g, d->g, b == 0 ? null : s2->u + o, b);
-    } else {
-        *d = *ui_edit_str.empty;
+        ui_edit_node_t* r = *split;
+        const int32_t m = n->n - k;
+        if (ui_edit_node_is_leaf(n)) {
+            ok = ui_edit_node_reserve(r, ut_max(m, 1));
+            if (ok && m > 0) {
+                memcpy(r->ps, n->ps + k, m * sizeof(ui_edit_str_t));
+                ui_edit_node_moved(r, 0, m);
+            }
+        } else {
+            memcpy(r->child, n->child + k, m * sizeof(ui_edit_node_t*));
+        }
+        if (ok) {
+            r->n = m;
+            n->n = k;
+            ui_edit_node_count(r);
+            ui_edit_node_count(n);
+        } else {
+            ui_edit_node_release(r);
+            *split = null;
+        }
     }
     return ok;
 }
 
-static bool ui_edit_doc_insert(ui_edit_doc_t* d, const ui_edit_pg_t ip,
-        const ui_edit_text_t* t) {
+static bool ui_edit_node_insert(ui_edit_node_t* n, int32_t pn,
+        const ui_edit_str_t* s, ui_edit_node_t* *split) {
+    // inserts (moves) *s at position pn, on overflow
+    // n is split in two and *split is the new right sibling
+    assert(0 <= pn && pn <= n->np);
+    *split = null;
     bool ok = true;
-    if (ok) {
-        if (t->np == 1) {
-            ok = ui_edit_doc_insert_1(d, ip, t);
-        } else {
-            ui_edit_text_t* dt = &d->text;
-            ui_edit_str_t* str = &dt->ps[ip.pn];
-            ui_edit_str_t s = {0}; // start line of insert text `t`
-            ui_edit_str_t e = {0}; // end   line
-            if (ui_edit_substr_append(&s, str, ip.gp, &t->ps[0])) {
-                if (ui_edit_append_substr(&e, &t->ps[t->np - 1], str, ip.gp)) {
-                    ok = ui_edit_doc_insert_2_or_more_lines(d, ip.pn, &s, t, &e);
-                    ui_edit_str.free(&e);
+    if (ui_edit_node_is_leaf(n)) {
+        ui_edit_node_t* leaf = n;
+        if (n->n == ui_edit_node_ps_max) {
+            // appending at the end keeps left leaf full (sequential load)
+            const int32_t k = pn == n->n ? n->n : n->n / 2;
+            ok = ui_edit_node_split(n, k, split);
+            if (ok && pn >= k) { leaf = *split; pn -= k; }
+        }
+        if (ok) { ok = ui_edit_node_reserve(leaf, leaf->n + 1); }
+        if (ok) {
+            memmove(leaf->ps + pn + 1, leaf->ps + pn,
+                    (leaf->n - pn) * sizeof(ui_edit_str_t));
+            leaf->ps[pn] = *s;
+            leaf->n++;
+            ui_edit_node_moved(leaf, pn, leaf->n - pn);
+            leaf->np++;
+            leaf->b += s->b;
+            leaf->g += s->g;
+        } else if (*split != null) { // undo the split
+            ui_edit_node_t* r = *split;
+            memcpy(n->ps + n->n, r->ps, r->n * sizeof(ui_edit_str_t));
+            ui_edit_node_moved(n, n->n, r->n);
+            n->n += r->n;
+            ui_edit_node_count(n);
+            r->n = 0;
+            ui_edit_node_release(r);
+            *split = null;
+        }
+    } else {
+        ui_edit_node_t* in = n; // inner node to insert into
+        if (n->n > ui_edit_node_child_max) {
+            // overflowed when previous split failed: split before insert
+            ok = ui_edit_node_split(n, n->n / 2, split);
+            if (ok && pn > n->np) { in = *split; pn -= n->np; }
+        }
+        int32_t i = 0;
+        while (ok && i < in->n - 1 && pn > in->child[i]->np) {
+            pn -= in->child[i]->np;
+            i++;
+        }
+        ui_edit_node_t* cs = null; // child split
+        if (ok) { ok = ui_edit_node_own(&in->child[i]); }
+        if (ok) { ok = ui_edit_node_insert(in->child[i], pn, s, &cs); }
+        if (ok) {
+            in->np++;
+            in->b += s->b;
+            in->g += s->g;
+            if (cs != null) {
+                assert(in->n < in->c);
+                memmove(in->child + i + 2, in->child + i + 1,
+                        (in->n - i - 1) * sizeof(ui_edit_node_t*));
+                in->child[i + 1] = cs;
+                in->n++;
+                if (in->n > ui_edit_node_child_max) {
+                    assert(*split == null);
+                    const int32_t k = i + 2 == in->n ? in->n - 1 : in->n / 2;
+                    // on failure node stays overflowed at child_max + 1
+                    // (within capacity) and is split on the next insert
+                    if (!ui_edit_node_split(in, k, split)) { *split = null; }
                 }
-                ui_edit_str.free(&s);
             }
         }
     }
     return ok;
 }
 
-static bool ui_edit_doc_remove_lines(ui_edit_doc_t* d,
-    ui_edit_str_t* merge, int32_t from, int32_t to) {
-    ui_edit_text_t* dt = &d->text;
-    bool ok = true;
-    for (int32_t pn = from + 1; pn <= to; pn++) {
-        ui_edit_str.free(&dt->ps[pn]);
-    }
-    if (dt->np - to - 1 > 0) {
-        memmove(&dt->ps[from + 1], &dt->ps[to + 1],
-                (dt->np - to - 1) * sizeof(ui_edit_str_t));
-    }
-    dt->np -= to - from;
-    if (ok) {
-        ui_edit_str.swap(&dt->ps[from], merge);
+static void ui_edit_node_merge(ui_edit_node_t* n) {
+    // merges adjacent children of an inner node when they fit into one
+    int32_t i = 0;
+    while (i < n->n - 1) {
+        const bool leaf = ui_edit_node_is_leaf(n->child[i]);
+        const int32_t max = leaf ? ui_edit_node_ps_max : ui_edit_node_child_max;
+        bool merge = n->child[i]->n + n->child[i + 1]->n <= max &&
+                     ui_edit_node_own(&n->child[i]) &&
+                     ui_edit_node_own(&n->child[i + 1]);
+        ui_edit_node_t* l = n->child[i];
+        ui_edit_node_t* r = n->child[i + 1];
+        if (merge && leaf) { merge = ui_edit_node_reserve(l, l->n + r->n); }
+        if (merge) {
+            if (leaf) {
+                memcpy(l->ps + l->n, r->ps, r->n * sizeof(ui_edit_str_t));
+                ui_edit_node_moved(l, l->n, r->n);
+            } else {
+                memcpy(l->child + l->n, r->child, r->n * sizeof(ui_edit_node_t*));
+            }
+            l->n += r->n;
+            l->np += r->np;
+            l->b += r->b;
+            l->g += r->g;
+            r->n = 0;
+            ui_edit_node_release(r);
+            memmove(n->child + i + 1, n->child + i + 2,
+                    (n->n - i - 2) * sizeof(ui_edit_node_t*));
+            n->n--;
+        } else {
+            i++;
+        }
     }
-    return ok;
 }
 
-static bool ui_edit_doc_insert_remove(ui_edit_doc_t* d,
-        const ui_edit_range_t r, const ui_edit_text_t* t) {
-    ui_edit_text_t* dt = &d->text;
-    bool ok = true;
-    ui_edit_str_t merge = {0};
-    const ui_edit_str_t* s = &dt->ps[r.from.pn];
-    const ui_edit_str_t* e = &dt->ps[r.to.pn];
-    const int32_t  o = e->g2b[r.to.gp];
-    const int32_t  b = e->b - o;
-    const uint8_t* u = b == 0 ? null : e->u + o;
-    ok = ui_edit_substr_append(&merge, s, r.from.gp, &t->ps[t->np - 1]) &&
-            ui_edit_str.replace(&merge, merge.g, merge.g, u, b);
-    if (ok) {
-        const bool empty_text = t->np == 1 && t->ps[0].g == 0;
-        if (!empty_text) {
-            ok = ui_edit_doc_insert(d, r.to, t);
-        }
-        if (ok) {
-            ok = ui_edit_doc_remove_lines(d, &merge, r.from.pn, r.to.pn);
+static bool ui_edit_node_own_range(ui_edit_node_t* *n, int32_t pn,
+        int32_t count) {
+    // copies shared nodes of the paths to partially removed children of
+    // paragraphs [pn..pn + count - 1] before ui_edit_node_remove()
+    assert(0 <= pn && count >= 0 && pn + count <= (*n)->np);
+    bool ok = ui_edit_node_own(n);
+    ui_edit_node_t* p = *n;
+    if (ok && !ui_edit_node_is_leaf(p)) {
+        int32_t i = 0;
+        while (pn >= p->child[i]->np) { pn -= p->child[i]->np; i++; }
+        while (ok && count > 0) {
+            const int32_t k = ut_min(count, p->child[i]->np - pn);
+            if (pn != 0 || k != p->child[i]->np) { // not whole subtree
+                ok = ui_edit_node_own_range(&p->child[i], pn, k);
+            }
+            pn = 0;
+            count -= k;
+            i++;
         }
     }
-    if (merge.c > 0 || merge.g > 0) { ui_edit_str.free(&merge); }
     return ok;
 }
 
-static void ui_edit_doc_before_replace_text(ui_edit_doc_t* d,
-        const ui_edit_range_t r, const ui_edit_text_t* t) {
-    ui_edit_check_range_inside_text(&d->text, &r);
+static void ui_edit_node_remove(ui_edit_node_t* n, int32_t pn, int32_t count) {
+    // removes and frees paragraphs [pn..pn + count - 1]
+    // see ui_edit_node_own_range() above
+    assert(0 <= pn && count >= 0 && pn + count <= n->np);
+    assert(n->rc == 1);
+    if (ui_edit_node_is_leaf(n)) {
+        for (int32_t i = pn; i < pn + count; i++) {
+            n->b -= n->ps[i].b;
+            n->g -= n->ps[i].g;
+            ui_edit_str_free_in(n->heap, &n->ps[i]);
+        }
+        memmove(n->ps + pn, n->ps + pn + count,
+                (n->n - pn - count) * sizeof(ui_edit_str_t));
+        n->n -= count;
+        ui_edit_node_moved(n, pn, n->n - pn);
+        n->np -= count;
+    } else {
+        int32_t i = 0;
+        while (pn >= n->child[i]->np) { pn -= n->child[i]->np; i++; }
+        while (count > 0) {
+            ui_edit_node_t* c = n->child[i];
+            const int32_t k = ut_min(count, c->np - pn);
+            if (pn == 0 && k == c->np) { // whole subtree
+                ui_edit_node_release(c);
+                memmove(n->child + i, n->child + i + 1,
+                        (n->n - i - 1) * sizeof(ui_edit_node_t*));
+                n->n--;
+            } else {
+                ui_edit_node_remove(n->child[i], pn, k);
+                i++;
+            }
+            pn = 0;
+            count -= k;
+        }
+        ui_edit_node_merge(n);
+        ui_edit_node_count(n);
+    }
+}
+
+static void ui_edit_node_update(ui_edit_node_t* n, int32_t pn) {
+    // recounts bytes and glyphs on the path to paragraph pn
+    // that was owned by ui_edit_text_pw()
+    assert(n->rc == 1);
+    if (!ui_edit_node_is_leaf(n)) {
+        int32_t i = 0;
+        while (pn >= n->child[i]->np) { pn -= n->child[i]->np; i++; }
+        ui_edit_node_update(n->child[i], pn);
+    }
+    ui_edit_node_count(n);
+}
+
+// Cold leaves: ui_edit_doc.cool() compresses paragraphs of the least
+// recently used leaves into a single z[] allocation. Paragraph entry is
+// varint bytes, varint glyphs and a kind byte followed by the utf8 bytes
+// of heap owned paragraphs or by the pointer to read only utf8 (file
+// mapping) that usually immediately follows the previous paragraph and
+// its "\n" or "\r\n" separator. The entries are compressed by a LZ4 like
+// byte oriented codec: [token][literals][offset:16][match length].
+
+enum {
+    ui_edit_lz_hash_bits = 12,
+    ui_edit_lz_min       = 4,    // shortest match
+    ui_edit_lz_window    = 0xFFFF
+};
+
+enum { // kinds of compressed paragraphs
+    ui_edit_cold_owned   = 0, // utf8 bytes follow
+    ui_edit_cold_pointer = 1, // sizeof(uint8_t*) pointer follows
+    ui_edit_cold_lf      = 2, // previous paragraph end + "\n"
+    ui_edit_cold_crlf    = 3  // previous paragraph end + "\r\n"
+};
+
+static uint32_t ui_edit_lz_hash(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761U) >> (32 - ui_edit_lz_hash_bits);
+}
+
+static int32_t ui_edit_lz_length(uint8_t* d, int32_t k, int32_t c,
+        int32_t v) {
+    // length over 15 continues in bytes of 255 and the final remainder
+    while (k >= 0 && v >= 255) {
+        if (k < c) { d[k++] = 255; v -= 255; } else { k = -1; }
+    }
+    if (k >= 0 && k < c) { d[k++] = (uint8_t)v; } else { k = -1; }
+    return k;
+}
+
+static int32_t ui_edit_lz_sequence(uint8_t* d, int32_t k, int32_t c,
+        const uint8_t* literals, int32_t ln, int32_t offset, int32_t ml) {
+    // ml == 0 for the last sequence that only has literals
+    if (k >= 0 && k < c) {
+        const int32_t mt = ml == 0 ? 0 : ml - ui_edit_lz_min;
+        d[k++] = (uint8_t)((ut_min(ln, 15) << 4) | ut_min(mt, 15));
+        if (ln >= 15) { k = ui_edit_lz_length(d, k, c, ln - 15); }
+        if (k >= 0 && k + ln <= c) {
+            memcpy(d + k, literals, (size_t)ln);
+            k += ln;
+        } else {
+            k = -1;
+        }
+        if (k >= 0 && ml > 0) {
+            if (k + 2 <= c) {
+                d[k++] = (uint8_t)(offset & 0xFF);
+                d[k++] = (uint8_t)(offset >> 8);
+            } else {
+                k = -1;
+            }
+            if (mt >= 15) { k = ui_edit_lz_length(d, k, c, mt - 15); }
+        }
+    } else {
+        k = -1;
+    }
+    return k;
+}
+
+static int32_t ui_edit_lz_compress(const uint8_t* s, int32_t n,
+        uint8_t* d, int32_t c) {
+    // returns number of bytes in d[] or -1 if it does not fit into c
+    int32_t table[1 << ui_edit_lz_hash_bits];
+    for (int32_t i = 0; i < countof(table); i++) { table[i] = -1; }
+    int32_t k = 0; // bytes written
+    int32_t a = 0; // anchor: first literal not yet written
+    int32_t i = 0;
+    while (k >= 0 && i + ui_edit_lz_min <= n) {
+        const uint32_t h = ui_edit_lz_hash(s + i);
+        const int32_t m = table[h];
+        table[h] = i;
+        if (m >= 0 && i - m <= ui_edit_lz_window &&
+            memcmp(s + m, s + i, ui_edit_lz_min) == 0) {
+            int32_t ml = ui_edit_lz_min;
+            while (i + ml < n && s[m + ml] == s[i + ml]) { ml++; }
+            k = ui_edit_lz_sequence(d, k, c, s + a, i - a, i - m, ml);
+            i += ml;
+            a = i;
+        } else {
+            i++;
+        }
+    }
+    if (k >= 0) { k = ui_edit_lz_sequence(d, k, c, s + a, n - a, 0, 0); }
+    return k;
+}
+
+static bool ui_edit_lz_extra(const uint8_t* s, int32_t n, int32_t* i,
+        int32_t* v) {
+    // reads continuation of the length that is 15 in the token
+    bool ok = true;
+    uint8_t b = 255;
+    while (ok && b == 255) {
+        ok = *i < n && *v <= INT32_MAX - 255;
+        if (ok) { b = s[(*i)++]; *v += b; }
+    }
+    return ok;
+}
+
+static bool ui_edit_lz_decompress(const uint8_t* s, int32_t n,
+        uint8_t* d, int32_t c) {
+    // d[c] must be exactly the size of the decompressed data
+    bool ok = true;
+    int32_t i = 0;
+    int32_t k = 0;
+    while (ok && i < n) {
+        const int32_t token = s[i++];
+        int32_t ln = token >> 4;
+        if (ln == 15) { ok = ui_edit_lz_extra(s, n, &i, &ln); }
+        ok = ok && ln <= n - i && ln <= c - k;
+        if (ok) {
+            memcpy(d + k, s + i, (size_t)ln);
+            i += ln;
+            k += ln;
+        }
+        if (ok && i < n) { // not the last sequence
+            ok = i + 2 <= n;
+            const int32_t offset = ok ? s[i] | (s[i + 1] << 8) : 0;
+            i += 2;
+            int32_t ml = token & 0x0F;
+            if (ok && ml == 15) { ok = ui_edit_lz_extra(s, n, &i, &ml); }
+            ml += ui_edit_lz_min;
+            ok = ok && 0 < offset && offset <= k && ml <= c - k;
+            // byte by byte: match may overlap the bytes it produces
+            for (int32_t j = 0; ok && j < ml; j++) { d[k + j] = d[k - offset + j]; }
+            k += ok ? ml : 0;
+        }
+    }
+    return ok && k == c;
+}
+
+static int32_t ui_edit_cold_put(uint8_t* d, int32_t k, uint32_t v) {
+    // LEB128 varint
+    while (v >= 0x80) { d[k++] = (uint8_t)(v | 0x80); v >>= 7; }
+    d[k++] = (uint8_t)v;
+    return k;
+}
+
+static bool ui_edit_cold_get(const uint8_t* s, int32_t n, int32_t* k,
+        int32_t* v) {
+    uint32_t r = 0;
+    int32_t shift = 0;
+    bool more = true;
+    while (more && *k < n && shift < 32) {
+        r |= (uint32_t)(s[*k] & 0x7F) << shift;
+        more = (s[*k] & 0x80) != 0;
+        (*k)++;
+        shift += 7;
+    }
+    *v = (int32_t)r;
+    return !more && *v >= 0;
+}
+
+static int64_t ui_edit_node_memory(const ui_edit_node_t* n) {
+    // heap bytes of uncompressed leaf: ps[], owned utf8 and .g2b[]
+    int64_t m = (int64_t)n->c * (int64_t)sizeof(ui_edit_str_t);
+    for (int32_t i = 0; i < n->n; i++) {
+        const ui_edit_str_t* p = &n->ps[i];
+        if (p->c > 0) { m += p->c; }
+        if (p->g2b != null && p->g2b != ui_edit_str.empty->g2b &&
+            ui_edit_str_block(p) == null) {
+            const int32_t k = p->g2b[0] < 0 ? p->g / -p->g2b[0] : p->g;
+            m += (k + 1) * (int64_t)sizeof(int32_t);
+        }
+    }
+    return m;
+}
+
+static bool ui_edit_node_pack(ui_edit_node_t* n) {
+    // compresses paragraphs of not shared leaf into n->z[n->zb]
+    assert(ui_edit_node_is_leaf(n) && n->rc == 1 && !n->cold && n->n > 0);
+    enum { entry = 5 + 5 + 1 + sizeof(uint8_t*) }; // max entry bytes
+    int64_t rb = 0; // raw bytes
+    for (int32_t i = 0; i < n->n; i++) {
+        const ui_edit_str_t* p = &n->ps[i];
+        const bool owned = p->c != 0 || ui_edit_str_block(p) != null;
+        rb += entry + (owned ? p->b : 0);
+    }
+    uint8_t* raw = null;
+    uint8_t* z = null;
+    bool ok = rb <= INT32_MAX - 16 && ut_heap.alloc((void**)&raw, rb) == 0;
+    int32_t k = 0;
+    const uint8_t* e = null; // end of the previous read only paragraph
+    for (int32_t i = 0; ok && i < n->n; i++) {
+        const ui_edit_str_t* p = &n->ps[i];
+        k = ui_edit_cold_put(raw, k, (uint32_t)p->b);
+        k = ui_edit_cold_put(raw, k, (uint32_t)p->g);
+        const bool owned = p->c != 0 || ui_edit_str_block(p) != null;
+        if (owned) {
+            raw[k++] = ui_edit_cold_owned;
+            memcpy(raw + k, p->u, (size_t)p->b);
+            k += p->b;
+        } else if (e != null && p->u == e + 1) {
+            raw[k++] = ui_edit_cold_lf;
+        } else if (e != null && p->u == e + 2) {
+            raw[k++] = ui_edit_cold_crlf;
+        } else {
+            raw[k++] = ui_edit_cold_pointer;
+            memcpy(raw + k, &p->u, sizeof(p->u));
+            k += (int32_t)sizeof(p->u);
+        }
+        if (!owned) { e = p->u + p->b; }
+    }
+    if (ok) { // z[] = [raw bytes:4][compressed or raw bytes]
+        ok = ut_heap.alloc((void**)&z, 4 + k) == 0;
+    }
+    if (ok) {
+        memcpy(z, &k, 4);
+        int32_t zb = ui_edit_lz_compress(raw, k, z + 4, k - 1);
+        if (zb < 0) { memcpy(z + 4, raw, (size_t)k); zb = k; }
+        ok = ut_heap.allocate(n->heap, (void**)&n->z, 4 + zb, false) == 0;
+        if (ok) {
+            memcpy(n->z, z, (size_t)(4 + zb));
+            n->zb = 4 + zb;
+            for (int32_t i = 0; i < n->n; i++) {
+                ui_edit_str_free_in(n->heap, &n->ps[i]);
+            }
+            ut_heap.deallocate(n->heap, n->ps);
+            n->ps = null;
+            n->c = 0;
+            ut_atomics.exchange_int32(&n->cold, 1);
+        }
+    }
+    if (z != null) { ut_heap.free(z); }
+    if (raw != null) { ut_heap.free(raw); }
+    return ok;
+}
+
+static void ui_edit_node_unpack(ui_edit_node_t* n) {
+    // restores ps[] of a cold leaf: owned paragraphs are copied to the
+    // heap, read only ones become lazy (.g2b == null) paragraphs
+    ut_atomics.spinlock_acquire(&ui_edit_text_lock);
+    if (ut_atomics.load32(&n->cold) != 0) {
+        int32_t rb = 0;
+        memcpy(&rb, n->z, 4);
+        const uint8_t* raw = n->z + 4;
+        uint8_t* buffer = null;
+        bool ok = true;
+        if (n->zb - 4 < rb) {
+            ok = ut_heap.alloc((void**)&buffer, rb) == 0 &&
+                 ui_edit_lz_decompress(n->z + 4, n->zb - 4, buffer, rb);
+            raw = buffer;
+        }
+        ui_edit_str_t* ps = null;
+        ok = ok && ut_heap.allocate(n->heap, (void**)&ps,
+                        n->n * (int64_t)sizeof(ui_edit_str_t), true) == 0;
+        int32_t k = 0;
+        const uint8_t* e = null;
+        for (int32_t i = 0; ok && i < n->n; i++) {
+            ui_edit_str_t* p = &ps[i];
+            int32_t b = 0;
+            int32_t g = 0;
+            ok = ui_edit_cold_get(raw, rb, &k, &b) &&
+                 ui_edit_cold_get(raw, rb, &k, &g) && k < rb;
+            const int32_t kind = ok ? raw[k++] : -1;
+            if (kind == ui_edit_cold_owned) {
+                ok = b <= rb - k &&
+                     ui_edit_str_init_in(n->heap, p, raw + k, b, true);
+                k += b;
+            } else if (ok) {
+                const uint8_t* u = null;
+                if (kind == ui_edit_cold_lf || kind == ui_edit_cold_crlf) {
+                    ok = e != null;
+                    u = ok ? e + (kind == ui_edit_cold_lf ? 1 : 2) : null;
+                } else {
+                    ok = kind == ui_edit_cold_pointer &&
+                         (int32_t)sizeof(u) <= rb - k;
+                    if (ok) { memcpy(&u, raw + k, sizeof(u)); }
+                    k += (int32_t)sizeof(u);
+                }
+                p->u = (uint8_t*)u;
+                p->b = b;
+                p->g = g;
+                e = u + b;
+            }
+            ok = ok && p->g == g;
+        }
+        swear(ok, "out of memory or corrupted leaf");
+        if (buffer != null) { ut_heap.free(buffer); }
+        ut_heap.deallocate(n->heap, n->z);
+        n->z  = null;
+        n->zb = 0;
+        n->ps = ps;
+        n->c  = n->n;
+        ut_atomics.exchange_int32(&n->cold, 0);
+    }
+    ut_atomics.spinlock_release(&ui_edit_text_lock);
+}
+
+static ui_edit_str_t* ui_edit_node_ps(const ui_edit_node_t* leaf) {
+    // ps[] of the leaf, decompressed if it was cold, and marks it used
+    ui_edit_node_t* n = (ui_edit_node_t*)leaf;
+    const int64_t epoch = ut_atomics.load64(&ui_edit_node_epoch);
+    if (ut_atomics.load64(&n->touched) != epoch) {
+        ut_atomics.exchange_int64(&n->touched, epoch);
+    }
+    if (ut_atomics.load32(&n->cold) != 0) { ui_edit_node_unpack(n); }
+    return n->ps;
+}
+
+static bool ui_edit_utf8_replace_invalid(const uint8_t* u, int32_t b,
+        uint8_t* *v, int32_t *k) {
+    // heap allocated *v (ut_heap.free() it) of *k bytes is a copy
+    // of u[b] with each byte of invalid utf8 replaced by U+FFFD
+    static const uint8_t replacement[] = { 0xEF, 0xBF, 0xBD }; // U+FFFD
+    const int64_t c = (int64_t)b * countof(replacement);
+    *v = null;
+    *k = 0;
+    bool ok = c <= INT32_MAX && ut_heap.alloc((void**)v, c) == 0;
+    int32_t i = 0;
+    while (ok && i < b) {
+        const int32_t n = ui_edit_str.utf8bytes(u + i, b - i);
+        if (n == 0) {
+            memcpy(*v + *k, replacement, countof(replacement));
+            *k += countof(replacement);
+            i++;
+        } else {
+            memcpy(*v + *k, u + i, n);
+            *k += n;
+            i += n;
+        }
+    }
+    return ok;
+}
+
+static void ui_edit_text_materialize(ut_heap_t* h, ui_edit_str_t* s) {
+    // Paragraphs of ui_edit_doc.open() are raw {.u .b .g} slices of
+    // the mapped file with .g2b == null. They are validated on open
+    // and indexed on the first touch. Invalid utf8 bytes are replaced
+    // by U+FFFD in a heap copy because mapped memory is read only.
+    assert(s->g2b == null && s->c == 0);
+    const uint8_t* u = s->u;
+    const int32_t  b = s->b;
+    memset(s, 0x00, sizeof(*s));
+    bool ok = ui_edit_str_init_in(h, s, b == 0 ? null : u, b, false);
+    if (!ok) {
+        uint8_t* v = null;
+        int32_t k = 0;
+        ok = ui_edit_utf8_replace_invalid(u, b, &v, &k) &&
+             ui_edit_str_init_in(h, s, v, k, true);
+        if (v != null) { ut_heap.free(v); }
+    }
+    swear(ok, "out of memory");
+}
+
+static ui_edit_str_t* ui_edit_text_paragraph(const ui_edit_text_t* t,
+        int32_t pn, bool close) {
+    // may materialize lazy paragraph in place (see ui_edit_doc.open())
+    // lazy paragraphs are valid utf8 and only .g2b is set, paragraphs
+    // of shared leaves may be materialized by another thread
+    assert(0 <= pn && pn < t->np);
+    ui_edit_node_t* n = t->root;
+    bool shared = ut_atomics.load32(&n->rc) > 1;
+    while (!ui_edit_node_is_leaf(n)) {
+        int32_t i = 0;
+        while (pn >= n->child[i]->np) { pn -= n->child[i]->np; i++; }
+        n = n->child[i];
+        shared = shared || ut_atomics.load32(&n->rc) > 1;
+    }
+    assert(pn < n->n);
+    ui_edit_str_t* s = &ui_edit_node_ps(n)[pn];
+    if (!shared) {
+        if (s->g2b == null) { ui_edit_text_materialize(n->heap, s); }
+        if (close) { ui_edit_str_close_in(n->heap, s); }
+    } else {
+        assert(!ui_edit_str_gapped(s), "see ui_edit_doc_snapshot()");
+        ut_atomics.spinlock_acquire(&ui_edit_text_lock);
+        ui_edit_str_t m = *s;
+        ut_atomics.spinlock_release(&ui_edit_text_lock);
+        if (m.g2b == null) {
+            ui_edit_text_materialize(n->heap, &m);
+            assert(m.u == s->u && m.b == s->b && m.g == s->g && m.c == 0);
+            ut_atomics.spinlock_acquire(&ui_edit_text_lock);
+            const bool lost = s->g2b != null; // to another thread
+            if (!lost) { s->g2b = m.g2b; }
+            ut_atomics.spinlock_release(&ui_edit_text_lock);
+            if (lost) { ui_edit_str_free_in(n->heap, &m); }
+        }
+    }
+    return s;
+}
+
+static ui_edit_str_t* ui_edit_text_ps(const ui_edit_text_t* t, int32_t pn) {
+    // paragraph with contiguous .u[0..b - 1], closes the gap if any
+    return ui_edit_text_paragraph(t, pn, true);
+}
+
+static ui_edit_str_t* ui_edit_text_peek(const ui_edit_text_t* t,
+        int32_t pn) {
+    // ps() that keeps the gap of the paragraph edited in place: .b .g
+    // and ui_edit_str.g2b() are valid, read bytes with ui_edit_str_at()
+    return ui_edit_text_paragraph(t, pn, false);
+}
+
+static const uint8_t* ui_edit_text_utf8(const ui_edit_text_t* t,
+        int32_t pn, int32_t f, int32_t e) {
+    // contiguous bytes [f..e[ of the paragraph pn, the gap is closed
+    // only when it is strictly inside the range
+    const ui_edit_str_t* s = ui_edit_text_peek(t, pn);
+    const ui_edit_str_gap_t x = ui_edit_str_gap(s);
+    if (x.gp > 0 && f < x.bp && x.bp < e) { s = ui_edit_text_ps(t, pn); }
+    return ui_edit_str_at(s, f);
+}
+
+static const ui_edit_str_t* ui_edit_text_raw(const ui_edit_text_t* t,
+        int32_t pn) {
+    // paragraph without materialization: only .u .b .g are valid when
+    // .g2b == null, safe to call on worker threads that only read
+    assert(0 <= pn && pn < t->np);
+    const ui_edit_node_t* n = t->root;
+    while (!ui_edit_node_is_leaf(n)) {
+        int32_t i = 0;
+        while (pn >= n->child[i]->np) { pn -= n->child[i]->np; i++; }
+        n = n->child[i];
+    }
+    assert(pn < n->n);
+    const ui_edit_str_t* s = &ui_edit_node_ps(n)[pn];
+    assert(!ui_edit_str_gapped(s), "see ui_edit_text_close()");
+    return s;
+}
+
+static ui_edit_str_t* ui_edit_text_pw(ui_edit_text_t* t, int32_t pn) {
+    // ps() for in place modification: copies shared nodes on the path,
+    // returns null on out of memory, call ui_edit_text_update() after
+    assert(0 <= pn && pn < t->np);
+    bool ok = ui_edit_node_own(&t->root);
+    ui_edit_node_t* n = t->root;
+    while (ok && !ui_edit_node_is_leaf(n)) {
+        int32_t i = 0;
+        while (pn >= n->child[i]->np) { pn -= n->child[i]->np; i++; }
+        ok = ui_edit_node_own(&n->child[i]);
+        n = n->child[i];
+    }
+    ui_edit_str_t* s = null;
+    if (ok) {
+        s = &n->ps[pn];
+        if (s->g2b == null) { ui_edit_text_materialize(n->heap, s); }
+    }
+    return s;
+}
+
+static void ui_edit_text_update(ui_edit_text_t* t, int32_t pn) {
+    // must be called after paragraph pw(t, pn) was modified in place
+    assert(0 <= pn && pn < t->np);
+    ui_edit_node_update(t->root, pn);
+}
+
+static void ui_edit_text_close(ui_edit_text_t* t) {
+    // closes the gap of the paragraph edited in place before its bytes
+    // are read directly from the leaves or shared with snapshots
+    if (t->gap > 0) {
+        const int32_t pn = t->gap - 1;
+        t->gap = 0;
+        if (pn < t->np) { ui_edit_text_ps(t, pn); }
+    }
+}
+
+static bool ui_edit_text_edit(ui_edit_text_t* t, int32_t pn,
+        int32_t f, int32_t to, const uint8_t* u, int32_t b) {
+    // in place replace of glyphs [f..to[ of the paragraph pn, at most one
+    // long paragraph keeps its gap (see ui_edit_str_edit_in())
+    if (t->gap > 0 && t->gap != pn + 1) { ui_edit_text_close(t); }
+    ui_edit_str_t* s = ui_edit_text_pw(t, pn);
+    const bool ok = s != null && ui_edit_str_edit_in(t->heap, s, f, to, u, b);
+    if (ok) {
+        ui_edit_text_update(t, pn);
+        if (ui_edit_str_gapped(s)) { t->gap = pn + 1; }
+    }
+    return ok;
+}
+
+static bool ui_edit_text_insert_ps(ui_edit_text_t* t, int32_t pn,
+        const ui_edit_str_t* s) {
+    // moves *s into t->ps(pn) on success, caller frees *s on failure
+    assert(0 <= pn && pn <= t->np);
+    bool ok = t->root != null || ui_edit_node_new(&t->root, true, t->heap);
+    ok = ok && ui_edit_node_own(&t->root);
+    ui_edit_node_t* root = null; // preallocated in case root splits
+    if (ok) {
+        const ui_edit_node_t* r = t->root;
+        const int32_t max = ui_edit_node_is_leaf(r) ?
+            ui_edit_node_ps_max : ui_edit_node_child_max;
+        if (r->n >= max) { ok = ui_edit_node_new(&root, false, t->heap); }
+    }
+    ui_edit_node_t* split = null;
+    if (ok) { ok = ui_edit_node_insert(t->root, pn, s, &split); }
+    if (ok) {
+        t->np++;
+        if (t->gap > pn) { t->gap++; }
+        if (split != null) {
+            assert(root != null);
+            root->child[0] = t->root;
+            root->child[1] = split;
+            root->n = 2;
+            ui_edit_node_count(root);
+            t->root = root;
+            root = null;
+        }
+    }
+    if (root != null) { ui_edit_node_release(root); }
+    return ok;
+}
+
+static bool ui_edit_text_remove_ps(ui_edit_text_t* t, int32_t pn, int32_t count) {
+    // removes and frees paragraphs [pn..pn + count - 1], all or nothing:
+    // on out of memory (shared nodes of snapshots) nothing is removed
+    assert(0 <= pn && 0 <= count && pn + count <= t->np);
+    const bool ok = count == 0 || ui_edit_node_own_range(&t->root, pn, count);
+    if (ok && count > 0) {
+        ui_edit_node_remove(t->root, pn, count);
+        t->np -= count;
+        if (t->gap > pn + count) {
+            t->gap -= count;
+        } else if (t->gap > pn) {
+            t->gap = 0; // paragraph with the gap was removed
+        }
+        while (!ui_edit_node_is_leaf(t->root) && t->root->n == 1) {
+            ui_edit_node_t* r = t->root;
+            t->root = r->child[0];
+            r->n = 0;
+            ui_edit_node_release(r);
+        }
+    }
+    return ok;
+}
+
+static bool ui_edit_text_append_ps(ui_edit_text_t* t,
+        const uint8_t* u, int32_t b, bool heap) {
+    ui_edit_str_t s = {0};
+    // str.init may allocate str.g2b[] on the heap and may fail
+    bool ok = ui_edit_str_init_in(t->heap, &s, b == 0 ? null : u, b,
+                                  heap && b > 0);
+    if (ok) {
+        ok = ui_edit_text_insert_ps(t, t->np, &s);
+        if (!ok) { ui_edit_str_free_in(t->heap, &s); }
+    }
+    return ok;
+}
+
+static void ui_edit_text_dispose(ui_edit_text_t* t) {
+    if (t->root != null) {
+        ui_edit_node_release(t->root);
+        t->root = null;
+        t->np = 0;
+        t->gap = 0;
+    } else {
+        assert(t->np == 0 && t->root == null);
+    }
+}
+
+// Huge inputs are split into chunks that start at paragraph boundaries.
+// Paragraphs are counted per chunk in parallel, all leaves are allocated
+// once and paragraphs (utf8 validation and g2b[]) are initialized in
+// parallel directly inside the leaves. Inner nodes are built on top.
+
+enum { ui_edit_text_parallel_min = 4 * 1024 * 1024 }; // bytes
+enum { ui_edit_text_chunk_min    = 1024 * 1024 };     // bytes per thread
+enum { ui_edit_text_chunks_max   = 64 };
+
+typedef struct ui_edit_text_chunk_s {
+    const uint8_t* s;   // [s..s + b[ starts at the paragraph boundary
+    int64_t b;
+    int64_t longest;    // bytes of the longest paragraph
+    int32_t pn;         // first paragraph of the chunk
+    int64_t np;         // number of paragraphs in the chunk
+    bool    last;       // paragraph after the last '\n' belongs to chunk
+    bool    heap;
+    bool    lazy;       // see ui_edit_text_init_lazy()
+    bool    ok;
+    ui_edit_node_t* const* leaves; // preallocated leaves
+    int32_t nl;         // number of leaves
+    int32_t total;      // number of paragraphs in all leaves
+} ui_edit_text_chunk_t;
+
+static void ui_edit_text_chunk_count(void* p) {
+    ui_edit_text_chunk_t* c = (ui_edit_text_chunk_t*)p;
+    const uint8_t* s = c->s;
+    const uint8_t* e = c->s + c->b;
+    int64_t np = c->last ? 1 : 0;
+    int64_t longest = 0;
+    for (;;) {
+        const uint8_t* nl = (const uint8_t*)memchr(s, '\n', (size_t)(e - s));
+        if (nl == null) { break; }
+        longest = ut_max(longest, nl - s);
+        np++;
+        s = nl + 1;
+    }
+    c->np = np;
+    c->longest = c->last ? ut_max(longest, e - s) : longest;
+}
+
+static ui_edit_str_t* ui_edit_text_chunk_ps(const ui_edit_text_chunk_t* c,
+        int32_t pn) {
+    // leaves are evenly filled: first (total % nl) leaves hold one extra
+    const int32_t n = c->total / c->nl;
+    const int32_t x = c->total % c->nl;
+    const int32_t k = x * (n + 1);
+    return pn < k ? &c->leaves[pn / (n + 1)]->ps[pn % (n + 1)] :
+                    &c->leaves[x + (pn - k) / n]->ps[(pn - k) % n];
+}
+
+static void ui_edit_text_chunk_init(void* p) {
+    ui_edit_text_chunk_t* c = (ui_edit_text_chunk_t*)p;
+    const uint8_t* s = c->s;
+    const int64_t  b = c->b;
+    ut_heap_t* h = c->leaves[0]->heap;
+    c->ok = true;
+    int64_t i = 0;
+    for (int32_t pn = c->pn; c->ok && pn < c->pn + c->np; pn++) {
+        const uint8_t* nl = (const uint8_t*)memchr(s + i, '\n', (size_t)(b - i));
+        const int64_t k = nl != null ? nl - s : b;
+        assert(nl != null || (c->last && pn == c->pn + c->np - 1));
+        // process "\r\n" strings
+        const int64_t e = k > i && s[k - 1] == '\r' ? k - 1 : k;
+        const int32_t bytes = (int32_t)(e - i); assert(bytes >= 0);
+        ui_edit_str_t* p = ui_edit_text_chunk_ps(c, pn);
+        if (c->lazy) {
+            *p = (ui_edit_str_t){ .u = (uint8_t*)(s + i), .b = bytes,
+                .g = ui_edit_str.glyphs(s + i, bytes) };
+            if (p->g < 0) { ui_edit_text_materialize(h, p); }
+        } else {
+            c->ok = ui_edit_str_init_in(h, p, bytes == 0 ? null : s + i,
+                                        bytes, c->heap && bytes > 0);
+        }
+        i = k + 1;
+    }
+}
+
+static void ui_edit_text_parallel(void* chunks, size_t size, int32_t n,
+        void (*func)(void*)) {
+    // chunks[0] is processed on the calling thread, size of each chunk
+    assert(0 < n && n <= ui_edit_text_chunks_max);
+    ut_thread_t threads[ui_edit_text_chunks_max];
+    for (int32_t i = 1; i < n; i++) {
+        threads[i] = ut_thread.start(func, (uint8_t*)chunks + i * size);
+    }
+    func(chunks);
+    for (int32_t i = 1; i < n; i++) {
+        fatal_if_not_zero(ut_thread.join(threads[i], -1));
+    }
+}
+
+static bool ui_edit_text_build(ui_edit_text_t* t, ui_edit_node_t** nodes,
+        int32_t n) {
+    // builds inner levels of the tree on top of n nodes,
+    // nodes are evenly distributed between parents
+    bool ok = true;
+    while (ok && n > 1) {
+        const int32_t m = (n + ui_edit_node_child_max - 1) /
+                          ui_edit_node_child_max;
+        int32_t i = 0; // next node to be adopted
+        int32_t j = 0; // next parent
+        while (ok && j < m) {
+            ui_edit_node_t* p = null;
+            ok = ui_edit_node_new(&p, false, t->heap);
+            if (ok) {
+                const int32_t k = n / m + (j < n % m);
+                memcpy(p->child, nodes + i, k * sizeof(nodes[0]));
+                p->n = k;
+                ui_edit_node_count(p);
+                nodes[j++] = p; // j <= i
+                i += k;
+            }
+        }
+        if (!ok) { // parents and not yet adopted nodes
+            memmove(nodes + j, nodes + i, (n - i) * sizeof(nodes[0]));
+            n = j + n - i;
+        } else {
+            n = m;
+        }
+    }
+    if (ok) {
+        t->root = nodes[0];
+        t->np = t->root->np;
+    } else {
+        for (int32_t i = 0; i < n; i++) { ui_edit_node_release(nodes[i]); }
+    }
+    return ok;
+}
+
+static errno_t ui_edit_text_init_chunks(ui_edit_text_t* t,
+        const uint8_t* s, int64_t b, bool heap, bool lazy, int32_t threads) {
+    // even single threaded it is faster than appending paragraphs
+    assert(threads > 0 && b > 0);
+    ui_edit_text_chunk_t chunks[ui_edit_text_chunks_max];
+    int32_t n = (int32_t)ut_max(1, ut_min(ut_min((int64_t)threads,
+                    b / ui_edit_text_chunk_min), ui_edit_text_chunks_max));
+    memset(chunks, 0x00, sizeof(chunks));
+    int64_t i = 0;
+    for (int32_t k = 0; k < n; k++) {
+        // chunk ends right after the first '\n' past the estimate
+        int64_t e = k == n - 1 ? b : b * (k + 1) / n;
+        if (e < b) {
+            e = ut_max(e, i);
+            const uint8_t* nl = (const uint8_t*)memchr(s + e, '\n', (size_t)(b - e));
+            e = nl != null ? nl - s + 1 : b;
+        }
+        chunks[k].s = s + i;
+        chunks[k].b = e - i;
+        chunks[k].heap = heap;
+        chunks[k].lazy = lazy;
+        i = e;
+        // a long last line may end the text before the estimate does:
+        if (i == b) {
+            chunks[k].last = true;
+            n = k + 1;
+        }
+    }
+    ui_edit_text_parallel(chunks, sizeof(chunks[0]), n,
+                          ui_edit_text_chunk_count);
+    int64_t total = 0;
+    int64_t longest = 0;
+    for (int32_t k = 0; k < n; k++) {
+        chunks[k].pn = (int32_t)ut_min(total, INT32_MAX);
+        total += chunks[k].np;
+        longest = ut_max(longest, chunks[k].longest);
+    }
+    assert(total > 0);
+    if (total > INT32_MAX - 1 || longest > INT32_MAX) { return EFBIG; }
+    const int32_t np = (int32_t)total;
+    const int32_t nl = (np + ui_edit_node_ps_max - 1) / ui_edit_node_ps_max;
+    ui_edit_node_t** leaves = null;
+    bool ok = ut_heap.alloc_zero((void**)&leaves, nl * sizeof(leaves[0])) == 0;
+    for (int32_t k = 0; ok && k < nl; k++) {
+        const int32_t c = np / nl + (k < np % nl);
+        ok = ui_edit_node_new(&leaves[k], true, t->heap) &&
+             ui_edit_node_reserve(leaves[k], c);
+        if (ok) {
+            memset(leaves[k]->ps, 0x00, c * sizeof(ui_edit_str_t));
+            leaves[k]->n = c;
+            leaves[k]->np = c;
+        }
+    }
+    if (ok) {
+        // initializes shared ui_edit_str_g2b_ascii[] before threads do
+        ui_edit_str_t e = {0};
+        swear(ui_edit_str.init(&e, null, 0, false));
+        ui_edit_str.free(&e);
+        for (int32_t k = 0; k < n; k++) {
+            chunks[k].leaves = leaves;
+            chunks[k].nl = nl;
+            chunks[k].total = np;
+        }
+        ui_edit_text_parallel(chunks, sizeof(chunks[0]), n,
+                              ui_edit_text_chunk_init);
+        for (int32_t k = 0; k < n; k++) { ok = ok && chunks[k].ok; }
+        for (int32_t k = 0; ok && k < nl; k++) { ui_edit_node_count(leaves[k]); }
+    }
+    if (ok) {
+        ok = ui_edit_text_build(t, leaves, nl);
+    } else if (leaves != null) {
+        // uninitialized paragraphs are zeroes and free() is no-op for them
+        for (int32_t k = 0; k < nl && leaves[k] != null; k++) {
+            ui_edit_node_release(leaves[k]);
+        }
+    }
+    if (leaves != null) { ut_heap.free(leaves); }
+    assert(!ok || t->np == np);
+    return ok ? 0 : ENOMEM;
+}
+
+static bool ui_edit_text_init_parallel(ui_edit_text_t* t,
+        const uint8_t* s, int32_t b, bool heap, int32_t threads) {
+    return ui_edit_text_init_chunks(t, s, b, heap, false, threads) == 0;
+}
+
+static bool ui_edit_text_init(ui_edit_text_t* t,
+        const uint8_t* s, int32_t b, bool heap) {
+    // When text comes from the source that lifetime is shorter
+    // than text itself (e.g. paste from clipboard) the parameter
+    // heap: true allows to make a copy of data on the heap
+    // t->heap may be preset to allocate from a private heap
+    assert(t->np == 0 && t->root == null);
+    if (b < 0) { b = (int32_t)strlen((const char*)s); }
+    // if caller is concerned with best performance - it should pass b >= 0
+    if (b >= ui_edit_text_parallel_min) {
+        const int32_t threads = ui_edit_text.threads > 0 ?
+            ui_edit_text.threads : ut_thread.processors();
+        return ui_edit_text_init_parallel(t, s, b, heap, threads);
+    }
+    bool ok = true;
+    bool lf = false;
+    int32_t i = 0;
+    while (ok && i < b) {
+        int32_t k = i;
+        while (k < b && s[k] != '\n') { k++; }
+        lf = k < b && s[k] == '\n';
+        // process "\r\n" strings
+        const int32_t e = k > i && s[k - 1] == '\r' ? k - 1 : k;
+        const int32_t bytes = e - i; assert(bytes >= 0);
+        ok = ui_edit_text_append_ps(t, s + i, bytes, heap);
+        i = k + lf;
+    }
+    if (ok && (lf || t->np == 0)) {
+        // last paragraph ended with line feed or
+        // special case empty string to a single paragraph
+        assert(lf || b <= 0 || s[0] == 0x00);
+        ok = ui_edit_text_append_ps(t, null, 0, false);
+    }
+    if (!ok) { ui_edit_text_dispose(t); }
+    assert(!ok || t->np > 0);
+    return ok;
+}
+
+static errno_t ui_edit_text_init_lazy(ui_edit_text_t* t,
+        const uint8_t* s, int64_t b) {
+    // paragraphs point inside s[b] which must outlive the text,
+    // g2b[] is built by ui_edit_text.ps() on the first access.
+    // Paragraphs with invalid utf8 are materialized right away thus
+    // materialization never changes bytes and glyphs of a paragraph.
+    // Both '\n' scan and glyphs counting are split between
+    // ui_edit_text.threads (see ui_edit_text_init_parallel())
+    assert(t->np == 0 && t->root == null); // t->heap may be preset
+    errno_t r = 0;
+    if (b == 0) {
+        if (!ui_edit_text_append_ps(t, null, 0, false)) { r = ENOMEM; }
+    } else {
+        const int32_t threads = ui_edit_text.threads > 0 ?
+            ui_edit_text.threads : ut_thread.processors();
+        r = ui_edit_text_init_chunks(t, s, b, false, true, threads);
+    }
+    return r;
+}
+
+static void ui_edit_doc_dispose_to_do(ui_edit_to_do_t* to_do) {
+    if (to_do->text.np > 0) {
+        ui_edit_text_dispose(&to_do->text);
+    }
+    memset(&to_do->range, 0x00, sizeof(to_do->range));
+    ui_edit_check_zeros(to_do, sizeof(*to_do));
+}
+
+static void ui_edit_text_prefix(const ui_edit_text_t* t, int32_t pn,
+        int64_t* bytes, int64_t* glyphs) {
+    // sums of bytes and glyphs of paragraphs [0..pn[ O(log(np))
+    assert(0 <= pn && pn <= t->np);
+    int64_t b = 0;
+    int64_t g = 0;
+    if (pn == t->np) {
+        if (t->root != null) { b = t->root->b; g = t->root->g; }
+    } else {
+        const ui_edit_node_t* n = t->root;
+        while (!ui_edit_node_is_leaf(n)) {
+            int32_t i = 0;
+            while (pn >= n->child[i]->np) {
+                b  += n->child[i]->b;
+                g  += n->child[i]->g;
+                pn -= n->child[i]->np;
+                i++;
+            }
+            n = n->child[i];
+        }
+        const ui_edit_str_t* ps = ui_edit_node_ps(n);
+        for (int32_t i = 0; i < pn; i++) { b += ps[i].b; g += ps[i].g; }
+    }
+    if (bytes  != null) { *bytes  = b; }
+    if (glyphs != null) { *glyphs = g; }
+}
+
+static int64_t ui_edit_text_offset(const ui_edit_text_t* t,
+        const ui_edit_pg_t pg) {
+    const int32_t o = ui_edit_str.g2b(ui_edit_text_peek(t, pg.pn), pg.gp);
+    int64_t bytes = 0;
+    ui_edit_text_prefix(t, pg.pn, &bytes, null);
+    return bytes + pg.pn + o; // "\n" after each preceding paragraph
+}
+
+static ui_edit_pg_t ui_edit_text_pg(const ui_edit_text_t* t, int64_t offset) {
+    assert(t->np > 0 && offset >= 0);
+    // each paragraph occupies b + 1 bytes including "\n"
+    ui_edit_pg_t pg = {0};
+    const ui_edit_node_t* n = t->root;
+    int64_t o = offset;
+    while (!ui_edit_node_is_leaf(n)) {
+        int32_t i = 0;
+        while (i < n->n - 1 && o >= n->child[i]->b + n->child[i]->np) {
+            o -= n->child[i]->b + n->child[i]->np;
+            pg.pn += n->child[i]->np;
+            i++;
+        }
+        n = n->child[i];
+    }
+    const ui_edit_str_t* ps = ui_edit_node_ps(n);
+    int32_t i = 0;
+    while (i < n->n - 1 && o >= (int64_t)ps[i].b + 1) {
+        o -= ps[i].b + 1;
+        pg.pn++;
+        i++;
+    }
+    const ui_edit_str_t* s = ui_edit_text_peek(t, pg.pn); // materialized
+    if (o >= s->b) {
+        pg.gp = s->g; // "\n" or past the end of text
+    } else { // last glyph that starts at or before byte o
+        int32_t lo = 0;
+        int32_t hi = s->g;
+        while (hi - lo > 1) {
+            const int32_t m = lo + (hi - lo) / 2;
+            if (ui_edit_str.g2b(s, m) <= o) { lo = m; } else { hi = m; }
+        }
+        pg.gp = lo;
+    }
+    return pg;
+}
+
+static int32_t ui_edit_text_bytes(const ui_edit_text_t* t,
+        const ui_edit_range_t* range) {
+    // bytes of range w/o "\n" between paragraphs O(log(np))
+    const ui_edit_range_t r = ui_edit_range.ordered(t, range);
+    ui_edit_check_range_inside_text(t, &r);
+    const int64_t f = ui_edit_text_offset(t, r.from) - r.from.pn;
+    const int64_t e = ui_edit_text_offset(t, r.to)   - r.to.pn;
+    assert(0 <= e - f && e - f <= INT32_MAX);
+    return (int32_t)(e - f);
+}
+
+static int64_t ui_edit_text_glyphs(const ui_edit_text_t* t,
+        const ui_edit_range_t* range) {
+    // glyphs of range w/o "\n" between paragraphs O(log(np))
+    const ui_edit_range_t r = ui_edit_range.ordered(t, range);
+    ui_edit_check_range_inside_text(t, &r);
+    int64_t f = 0;
+    int64_t e = 0;
+    ui_edit_text_prefix(t, r.from.pn, null, &f);
+    ui_edit_text_prefix(t, r.to.pn,   null, &e);
+    return e + r.to.gp - f - r.from.gp;
+}
+
+static int32_t ui_edit_doc_bytes(const ui_edit_doc_t* d,
+        const ui_edit_range_t* r) {
+    return ui_edit_text.bytes(&d->text, r);
+}
+
+static int32_t ui_edit_doc_utf8bytes(const ui_edit_doc_t* d,
+        const ui_edit_range_t* range) {
+    const ui_edit_range_t r = ui_edit_range.ordered(&d->text, range);
+    int32_t bytes = ui_edit_text.bytes(&d->text, &r);
+    // "\n" after each paragraph and 0x00
+    return bytes + r.to.pn - r.from.pn + 1;
+}
+
+static void ui_edit_notify_before(ui_edit_doc_t* d,
+        const ui_edit_notify_info_t* ni) {
+    ui_edit_listener_t* o = d->listeners;
+    while (o != null) {
+        if (o->notify != null && o->notify->before != null) {
+            o->notify->before(o->notify, ni);
+        }
+        o = o->next;
+    }
+}
+
+static void ui_edit_notify_after(ui_edit_doc_t* d,
+        const ui_edit_notify_info_t* ni) {
+    ui_edit_listener_t* o = d->listeners;
+    while (o != null) {
+        if (o->notify != null && o->notify->after != null) {
+            o->notify->after(o->notify, ni);
+        }
+        o = o->next;
+    }
+}
+
+static bool ui_edit_doc_subscribe(ui_edit_doc_t* t, ui_edit_notify_t* notify) {
+    // TODO: not sure about double linked list.
+    // heap allocated resizable array may serve better and may be easier to maintain
+    bool ok = true;
+    ui_edit_listener_t* o = t->listeners;
+    if (o == null) {
+        ok = ut_heap.alloc_zero((void**)&t->listeners, sizeof(*o)) == 0;
+        if (ok) { o = t->listeners; }
+    } else {
+        while (o->next != null) { swear(o->notify != notify); o = o->next; }
+        ok = ut_heap.alloc_zero((void**)&o->next, sizeof(*o)) == 0;
+        if (ok) { o->next->prev = o; o = o->next; }
+    }
+    if (ok) { o->notify = notify; }
+    return ok;
+}
+
+static void ui_edit_doc_unsubscribe(ui_edit_doc_t* t, ui_edit_notify_t* notify) {
+    ui_edit_listener_t* o = t->listeners;
+    bool removed = false;
+    while (o != null) {
+        ui_edit_listener_t* n = o->next;
+        if (o->notify == notify) {
+            assert(!removed);
+            if (o->prev != null) { o->prev->next = n; }
+            if (o->next != null) { o->next->prev = o->prev; }
+            if (o == t->listeners) { t->listeners = n; }
+            ut_heap.free(o);
+            removed = true;
+        }
+        o = n;
+    }
+    swear(removed);
+}
+
+static bool ui_edit_doc_copy_text(const ui_edit_doc_t* d,
+        const ui_edit_range_t* range, ui_edit_text_t* t) {
+    ui_edit_check_zeros(t, sizeof(*t));
+    memset(t, 0x00, sizeof(*t));
+    const ui_edit_range_t r = ui_edit_range.ordered(&d->text, range);
+    ui_edit_check_range_inside_text(&d->text, &r);
+    bool ok = true;
+    for (int32_t pn = r.from.pn; ok && pn <= r.to.pn; pn++) {
+        const ui_edit_str_t* p = ui_edit_text_peek(&d->text, pn);
+        const int32_t f = pn == r.from.pn ? ui_edit_str.g2b(p, r.from.gp) : 0;
+        const int32_t e = pn == r.to.pn   ? ui_edit_str.g2b(p, r.to.gp) : p->b;
+        const uint8_t* u = ui_edit_text_utf8(&d->text, pn, f, e);
+        const int32_t bytes = e - f;
+        assert(t->np == pn - r.from.pn);
+        ok = ui_edit_text_append_ps(t, u, bytes, true);
+    }
+    if (!ok) {
+        ui_edit_text.dispose(t);
+        ui_edit_check_zeros(t, sizeof(*t));
+    }
+    return ok;
+}
+
+static void ui_edit_doc_copy(const ui_edit_doc_t* d,
+        const ui_edit_range_t* range, char* text) {
+    const ui_edit_range_t r = ui_edit_range.ordered(&d->text, range);
+    ui_edit_check_range_inside_text(&d->text, &r);
+    char* t = text;
+    for (int32_t pn = r.from.pn; pn <= r.to.pn; pn++) {
+        const ui_edit_str_t* p = ui_edit_text_peek(&d->text, pn);
+        const int32_t f = pn == r.from.pn ? ui_edit_str.g2b(p, r.from.gp) : 0;
+        const int32_t e = pn == r.to.pn   ? ui_edit_str.g2b(p, r.to.gp) : p->b;
+        const uint8_t* u = ui_edit_text_utf8(&d->text, pn, f, e);
+        const int32_t bytes = e - f;
+        if (bytes > 0) {
+            memmove(t, u, bytes);
+            t += bytes;
+        }
+        if (pn < r.to.pn) { *t++ = '\n'; }
+    }
+    *t++ = 0x00;
+    const int32_t utf8_bytes = (int32_t)(uintptr_t)(t - text);
+    assert(utf8_bytes == ui_edit_doc.utf8bytes(d, &r));
+    (void)utf8_bytes;
+}
+
+static bool ui_edit_doc_insert_2_or_more_lines(ui_edit_doc_t* d, int32_t pn,
+        const ui_edit_str_t* s, const ui_edit_text_t* t, const ui_edit_str_t* e) {
+    ui_edit_text_t* dt = &d->text;
+    assert(0 <= pn && pn < dt->np);
+    assert(t->np >= 2);
+    // `s` first line of `t` replaces ps[pn] after all insertions succeed
+    ui_edit_str_t first = {0};
+    bool ok = ui_edit_str_init_in(dt->heap, &first, s->u, s->b, true);
+    int32_t inserted = 0; // paragraphs inserted after pn
+    // lines of `t` between `s` and `e`
+    for (int32_t i = 1; ok && i < t->np - 1; i++) {
+        const ui_edit_str_t* p = ui_edit_text.ps(t, i);
+        ui_edit_str_t str = {0};
+        ok = ui_edit_str_init_in(dt->heap, &str, p->u, p->b, true);
+        if (ok) {
+            ok = ui_edit_text_insert_ps(dt, pn + i, &str);
+            if (ok) { inserted++; } else { ui_edit_str_free_in(dt->heap, &str); }
+        }
+    }
+    // `e` last line of `t`
+    if (ok) {
+        ui_edit_str_t last = {0};
+        ok = ui_edit_str_init_in(dt->heap, &last, e->u, e->b, true);
+        if (ok) {
+            ok = ui_edit_text_insert_ps(dt, pn + t->np - 1, &last);
+            if (ok) { inserted++; } else { ui_edit_str_free_in(dt->heap, &last); }
+        }
+    }
+    ui_edit_str_t* p = ok ? ui_edit_text_pw(dt, pn) : null;
+    ok = p != null;
+    if (ok) {
+        ui_edit_str.swap(p, &first);
+        ui_edit_text_update(dt, pn);
+    } else { // all or nothing: remove what was inserted
+        // cannot fail: nodes of the inserted paragraphs are already owned
+        const bool removed = ui_edit_text_remove_ps(dt, pn + 1, inserted);
+        swear(removed);
+    }
+    if (first.c != 0 || first.g > 0) { ui_edit_str_free_in(dt->heap, &first); }
+    return ok;
+}
+
+static bool ui_edit_doc_insert_1(ui_edit_doc_t* d,
+        const ui_edit_pg_t ip, // insertion point
+        const ui_edit_text_t* insert) {
+    ui_edit_text_t* dt = &d->text;
+    assert(0 <= ip.pn && ip.pn < dt->np);
+    assert(insert->np == 1);
+    ui_edit_str_t* ins = ui_edit_text.ps(insert, 0); // string to insert
+    // ui_edit_str.replace() is all or nothing:
+    return ui_edit_text_edit(dt, ip.pn, ip.gp, ip.gp, ins->u, ins->b);
+}
+
+static bool ui_edit_substr_append(ut_heap_t* h, ui_edit_str_t* d,
+    const ui_edit_str_t* s1, int32_t gp1,
+    const ui_edit_str_t* s2) { // s1[0:gp1] + s2
+    assert(d != s1 && d != s2 && s1 != s2);
+    const int32_t b = ui_edit_str.g2b(s1, gp1);
+    bool ok = ui_edit_str_init_in(h, d, b == 0 ? null : s1->u, b, true);
+    if (ok) {
+        ok = ui_edit_str_replace_in(h, d, d->g, d->g, s2->u, s2->b);
+    } else {
+        *d = *ui_edit_str.empty;
+    }
+    return ok;
+}
+
+static bool ui_edit_append_substr(ut_heap_t* h, ui_edit_str_t* d,
+    const ui_edit_str_t* s1,
+    const ui_edit_str_t* s2, int32_t gp2) {  // s1 + s2[gp1:*]
+    assert(d != s1 && d != s2 && s1 != s2);
+    bool ok = ui_edit_str_init_in(h, d, s1->b == 0 ? null : s1->u, s1->b, true);
+    if (ok) {
+        const int32_t o = ui_edit_str.g2b(s2, gp2); // offset (bytes)
+        const int32_t b = s2->b - o;
+        ok = ui_edit_str_replace_in(h, d, d->g, d->g,
+                                    b == 0 ? null : s2->u + o, b);
+    } else {
+        *d = *ui_edit_str.empty;
+    }
+    return ok;
+}
+
+static bool ui_edit_doc_insert(ui_edit_doc_t* d, const ui_edit_pg_t ip,
+        const ui_edit_text_t* t) {
+    bool ok = true;
+    if (ok) {
+        if (t->np == 1) {
+            ok = ui_edit_doc_insert_1(d, ip, t);
+        } else {
+            ui_edit_text_t* dt = &d->text;
+            ui_edit_str_t* str = ui_edit_text.ps(dt, ip.pn);
+            ui_edit_str_t s = {0}; // start line of insert text `t`
+            ui_edit_str_t e = {0}; // end   line
+            if (ui_edit_substr_append(dt->heap, &s, str, ip.gp,
+                                      ui_edit_text.ps(t, 0))) {
+                const ui_edit_str_t* l = ui_edit_text.ps(t, t->np - 1);
+                if (ui_edit_append_substr(dt->heap, &e, l, str, ip.gp)) {
+                    ok = ui_edit_doc_insert_2_or_more_lines(d, ip.pn, &s, t, &e);
+                    ui_edit_str_free_in(dt->heap, &e);
+                }
+                ui_edit_str_free_in(dt->heap, &s);
+            }
+        }
+    }
+    return ok;
+}
+
+static bool ui_edit_doc_remove_lines(ui_edit_doc_t* d,
+    ui_edit_str_t* merge, int32_t from, int32_t to) {
+    ui_edit_text_t* dt = &d->text;
+    // copies shared nodes on the path to `from` before removal
+    // so that pw() below cannot fail after paragraphs are removed
+    bool ok = ui_edit_text_pw(dt, from) != null &&
+              ui_edit_text_remove_ps(dt, from + 1, to - from);
+    if (ok) {
+        ui_edit_str_t* p = ui_edit_text_pw(dt, from);
+        swear(p != null);
+        ui_edit_str.swap(p, merge);
+        ui_edit_text_update(dt, from);
+    }
+    return ok;
+}
+
+static bool ui_edit_doc_insert_remove(ui_edit_doc_t* d,
+        const ui_edit_range_t r, const ui_edit_text_t* t) {
+    ui_edit_text_t* dt = &d->text;
+    bool ok = true;
+    ui_edit_str_t merge = {0};
+    const ui_edit_str_t* s = ui_edit_text.ps(dt, r.from.pn);
+    if (t->np == 1) { // merge = s[0:from.gp] + t[0] + e[to.gp:]
+        const ui_edit_str_t* e = ui_edit_text.ps(dt, r.to.pn);
+        const int32_t  o = ui_edit_str.g2b(e, r.to.gp);
+        const int32_t  b = e->b - o;
+        const uint8_t* u = b == 0 ? null : e->u + o;
+        ok = ui_edit_substr_append(dt->heap, &merge, s, r.from.gp,
+                                   ui_edit_text.ps(t, 0)) &&
+             ui_edit_str_replace_in(dt->heap, &merge, merge.g, merge.g, u, b);
+    } else {
+        // insert() at r.to leaves t[last] + e[to.gp:] in the last
+        // inserted paragraph, merge = s[0:from.gp] + t[0]
+        ok = ui_edit_substr_append(dt->heap, &merge, s, r.from.gp,
+                                   ui_edit_text.ps(t, 0));
+    }
+    if (ok) { // owned paths of the removed lines: remove cannot fail
+        ok = ui_edit_text_pw(dt, r.from.pn) != null &&
+             ui_edit_node_own_range(&dt->root, r.from.pn + 1,
+                                    r.to.pn - r.from.pn);
+    }
+    if (ok) {
+        const bool empty_text = t->np == 1 && ui_edit_text.ps(t, 0)->g == 0;
+        if (!empty_text) {
+            ok = ui_edit_doc_insert(d, r.to, t);
+        }
+        if (ok) {
+            ok = ui_edit_doc_remove_lines(d, &merge, r.from.pn, r.to.pn);
+        }
+    }
+    if (merge.c != 0 || merge.g > 0) { ui_edit_str_free_in(dt->heap, &merge); }
+    return ok;
+}
+
+static void ui_edit_doc_before_replace_text(ui_edit_doc_t* d,
+        const ui_edit_range_t r, const ui_edit_text_t* t) {
+    ui_edit_check_range_inside_text(&d->text, &r);
     ui_edit_range_t x = r;
     x.to.pn = r.from.pn + t->np - 1;
     if (r.from.pn == r.to.pn && t->np == 1) {
-        x.to.gp = r.from.gp + t->ps[0].g;
+        x.to.gp = r.from.gp + ui_edit_text.ps(t, 0)->g;
+    } else {
+        x.to.gp = ui_edit_text.ps(t, t->np - 1)->g;
+    }
+    const ui_edit_notify_info_t ni_before = {
+        .ok = true, .d = d, .r = &r, .x = &x, .t = t,
+        .pnf = r.from.pn, .pnt = r.to.pn,
+        .deleted = 0, .inserted = 0
+    };
+    ui_edit_notify_before(d, &ni_before);
+}
+
+static void ui_edit_doc_after_replace_text(ui_edit_doc_t* d,
+        bool ok,
+        const ui_edit_range_t r,
+        const ui_edit_range_t x,
+        const ui_edit_text_t* t) {
+    const ui_edit_notify_info_t ni_after = {
+        .ok = ok, .d = d, .r = &r, .x = &x, .t = t,
+        .pnf = r.from.pn, .pnt = x.to.pn,
+        .deleted = r.to.pn - r.from.pn,
+        .inserted = t->np - 1
+    };
+    ui_edit_notify_after(d, &ni_after);
+}
+
+static bool ui_edit_doc_replace_core(ui_edit_doc_t* d,
+        const ui_edit_range_t r, const ui_edit_text_t* t,
+        ui_edit_range_t* extended) {
+    // replaces ordered range `r` w/o notifications and undo
+    ui_edit_text_t* dt = &d->text;
+    bool ok = true;
+    ui_edit_range_t x = r;
+    if (ui_edit_range.is_empty(r)) {
+        x.to.pn = r.from.pn + t->np - 1;
+        x.to.gp = t->np == 1 ?
+                  r.from.gp + ui_edit_text.ps(t, 0)->g :
+                  ui_edit_text.ps(t, t->np - 1)->g;
+        ok = ui_edit_doc_insert(d, r.from, t);
+    } else if (t->np == 1 && r.from.pn == r.to.pn) {
+        x.to.pn = r.from.pn + t->np - 1;
+        x.to.gp = r.from.gp + ui_edit_text.ps(t, 0)->g;
+        const ui_edit_str_t* p = ui_edit_text.ps(t, 0);
+        ok = ui_edit_text_edit(dt, r.from.pn, r.from.gp, r.to.gp, p->u, p->b);
+    } else {
+        x.to.pn = r.from.pn + t->np - 1;
+        x.to.gp = t->np == 1 ?
+                  r.from.gp + ui_edit_text.ps(t, 0)->g :
+                  ui_edit_text.ps(t, t->np - 1)->g;
+        ok = ui_edit_doc_insert_remove(d, r, t);
+    }
+    *extended = x;
+    return ok;
+}
+
+static bool ui_edit_doc_replace_range(ui_edit_doc_t* d,
+        const ui_edit_range_t* range, const ui_edit_text_t* t,
+        ui_edit_to_do_t* undo, ui_edit_range_t* extended) {
+    ui_edit_text_t* dt = &d->text;
+    const ui_edit_range_t r = ui_edit_range.ordered(dt, range);
+    ui_edit_doc_before_replace_text(d, r, t);
+    bool ok = undo == null ? true :
+              ui_edit_doc.copy_text(d, &r, &undo->text);
+    ui_edit_range_t x = r;
+    if (ok) { ok = ui_edit_doc_replace_core(d, r, t, &x); }
+    if (undo != null) { undo->range = x; }
+    if (extended != null) { *extended = x; }
+    ui_edit_doc_after_replace_text(d, ok, r, x, t);
+    return ok;
+}
+
+static bool ui_edit_doc_replace_text(ui_edit_doc_t* d,
+        const ui_edit_range_t* range, const ui_edit_text_t* t,
+        ui_edit_to_do_t* undo) {
+    return ui_edit_doc_replace_range(d, range, t, undo, null);
+}
+
+// Undo/redo history records keep the text to be put back into the range
+// as zero terminated utf8 (paragraphs separated by '\n') right after the
+// record header in a single allocation from the document private heap.
+
+enum { // ui_edit_record_t.kind
+    ui_edit_record_replace = 0,
+    ui_edit_record_insert  = 1, // typing of a single glyph
+    ui_edit_record_delete  = 2, // backspace or delete of a glyph or '\n'
+    ui_edit_record_batch   = 3  // reverse of ui_edit_doc.replace_batch()
+};
+
+typedef struct ui_edit_record_s {
+    ui_edit_range_t   range; // to be replaced by utf8 on undo/redo
+    ui_edit_record_t* next;  // older record in the stack
+    int32_t kind;
+    int32_t bytes;           // utf8 bytes excluding trailing 0x00
+    int32_t count;           // batch: number of entries
+} ui_edit_record_t;
+
+// batch record: entry[count] followed by zero terminated utf8 of each entry
+
+typedef struct ui_edit_record_entry_s {
+    ui_edit_range_t range;
+    int32_t bytes; // utf8 bytes excluding trailing 0x00
+} ui_edit_record_entry_t;
+
+static uint8_t* ui_edit_record_utf8(ui_edit_record_t* r) {
+    return (uint8_t*)(r + 1);
+}
+
+static int64_t ui_edit_record_size(int32_t bytes) {
+    return (int64_t)sizeof(ui_edit_record_t) + bytes + 1;
+}
+
+static bool ui_edit_history_alloc(ui_edit_history_t* h,
+        ui_edit_record_t* *r, int32_t bytes) {
+    if (h->heap == null) { h->heap = ut_heap.create(false); }
+    bool ok = h->heap != null && ut_heap.allocate(h->heap, (void**)r,
+                  ui_edit_record_size(bytes), true) == 0;
+    if (ok) {
+        (*r)->bytes = bytes;
+        h->bytes += ui_edit_record_size(bytes);
+        h->records++;
+    }
+    return ok;
+}
+
+static void ui_edit_history_free(ui_edit_history_t* h, ui_edit_record_t* r) {
+    h->bytes -= ui_edit_record_size(r->bytes);
+    h->records--;
+    ut_heap.deallocate(h->heap, r);
+}
+
+static void ui_edit_history_free_stack(ui_edit_history_t* h,
+        ui_edit_record_t* *stack) {
+    while (*stack != null) {
+        ui_edit_record_t* next = (*stack)->next;
+        ui_edit_history_free(h, *stack);
+        *stack = next;
+    }
+}
+
+static void ui_edit_history_trim(ui_edit_history_t* h) {
+    // trims oldest undo records down to 3/4 of the budget, so the
+    // walk is amortized over many edits. The most recent undo
+    // record is kept even if it does not fit into the budget.
+    if (h->budget > 0 && h->bytes > h->budget && h->undo != null) {
+        int64_t undo = 0; // bytes used by undo stack
+        for (ui_edit_record_t* r = h->undo; r != null; r = r->next) {
+            undo += ui_edit_record_size(r->bytes);
+        }
+        const int64_t limit = h->budget - h->budget / 4 - (h->bytes - undo);
+        ui_edit_record_t* r = h->undo;
+        int64_t kept = ui_edit_record_size(r->bytes);
+        while (r->next != null &&
+               kept + ui_edit_record_size(r->next->bytes) <= limit) {
+            r = r->next;
+            kept += ui_edit_record_size(r->bytes);
+        }
+        while (r->next != null) {
+            ui_edit_record_t* next = r->next->next;
+            ui_edit_history_free(h, r->next);
+            h->trimmed++;
+            r->next = next;
+        }
+    }
+}
+
+static bool ui_edit_doc_record(ui_edit_doc_t* d, const ui_edit_range_t* r,
+        int32_t extra, int32_t offset, ui_edit_record_t* *record) {
+    // new record with utf8 of the range at offset and extra bytes
+    const int32_t bytes = ui_edit_doc.utf8bytes(d, r) - 1;
+    bool ok = ui_edit_history_alloc(&d->history, record, bytes + extra);
+    if (ok) {
+        ui_edit_doc.copy(d, r, (char*)ui_edit_record_utf8(*record) + offset);
+    }
+    return ok;
+}
+
+static int32_t ui_edit_doc_record_kind(const ui_edit_doc_t* d,
+        const ui_edit_range_t* r, const ui_edit_text_t* t) {
+    const ui_edit_text_t* dt = &d->text;
+    const ui_edit_str_t* s = ui_edit_text.ps(t, 0);
+    int32_t kind = ui_edit_record_replace;
+    if (t->np == 1 && s->g == 1 && ui_edit_range.is_empty(*r)) {
+        kind = ui_edit_record_insert;
+    } else if (t->np == 1 && s->g == 0) {
+        const bool glyph = r->from.pn == r->to.pn &&
+                           r->to.gp == r->from.gp + 1;
+        const bool lf = r->to.pn == r->from.pn + 1 && r->to.gp == 0 &&
+                        r->from.gp == ui_edit_text_peek(dt, r->from.pn)->g;
+        if (glyph || lf) { kind = ui_edit_record_delete; }
+    }
+    return kind;
+}
+
+static bool ui_edit_doc_space_at(const ui_edit_doc_t* d, ui_edit_pg_t pg) {
+    const ui_edit_str_t* s = ui_edit_text_peek(&d->text, pg.pn);
+    const int32_t bp = pg.gp < s->g ? ui_edit_str.g2b(s, pg.gp) : 0;
+    const uint8_t ch = pg.gp < s->g ?
+        *ui_edit_text_utf8(&d->text, pg.pn, bp, bp + 1) : '\n';
+    return ch == 0x20 || ch == '\t' || ch == '\n';
+}
+
+static bool ui_edit_doc_typing(ui_edit_doc_t* d, const ui_edit_range_t* r,
+        const ui_edit_text_t* t) {
+    // appends typed glyph to the top undo record unless new word starts
+    ui_edit_history_t* h = &d->history;
+    ui_edit_record_t* top = h->undo;
+    bool merged = false;
+    if (top->kind == ui_edit_record_insert &&
+        ui_edit_range.compare(top->range.to, r->from) == 0) {
+        assert(r->from.gp > 0);
+        const ui_edit_pg_t prev = { .pn = r->from.pn, .gp = r->from.gp - 1 };
+        const uint8_t ch = ui_edit_text.ps(t, 0)->u[0];
+        const bool space = ch == 0x20 || ch == '\t';
+        if (!ui_edit_doc_space_at(d, prev) || space) {
+            ui_edit_range_t x = {0};
+            if (ui_edit_doc_replace_range(d, r, t, null, &x)) {
+                top->range.to = x.to;
+                merged = true;
+            }
+        }
+    }
+    return merged;
+}
+
+static bool ui_edit_doc_deleting(ui_edit_doc_t* d, const ui_edit_range_t* r,
+        const ui_edit_text_t* t) {
+    // backspace prepends and delete appends removed text to the top record
+    ui_edit_history_t* h = &d->history;
+    ui_edit_record_t* top = h->undo;
+    bool merged = false;
+    if (top->kind == ui_edit_record_delete) {
+        const bool backspace = ui_edit_range.compare(r->to, top->range.from) == 0;
+        const bool forward = ui_edit_range.compare(r->from, top->range.from) == 0;
+        assert(ui_edit_range.is_empty(top->range));
+        ui_edit_record_t* m = null;
+        if (backspace || forward) {
+            const int32_t b = ui_edit_doc.utf8bytes(d, r) - 1;
+            const int32_t offset = backspace ? 0 : top->bytes;
+            if (ui_edit_doc_record(d, r, top->bytes, offset, &m)) {
+                uint8_t* u = ui_edit_record_utf8(m);
+                if (backspace) { // 0x00 is copied too
+                    memcpy(u + b, ui_edit_record_utf8(top), top->bytes + 1);
+                } else {
+                    memcpy(u, ui_edit_record_utf8(top), top->bytes);
+                }
+            }
+        }
+        if (m != null) {
+            ui_edit_range_t x = {0};
+            if (ui_edit_doc_replace_range(d, r, t, null, &x)) {
+                m->range = x;
+                m->kind = ui_edit_record_delete;
+                m->next = top->next;
+                h->undo = m;
+                ui_edit_history_free(h, top);
+                merged = true;
+            } else {
+                ui_edit_history_free(h, m);
+            }
+        }
+    }
+    return merged;
+}
+
+static bool ui_edit_utf8_to_heap_text(const uint8_t* u, int32_t b,
+        ui_edit_text_t* it) {
+    assert((b == 0) == (u == null || u[0] == 0x00));
+    return ui_edit_text.init(it, b != 0 ? u : null, b, true);
+}
+
+static bool ui_edit_doc_replace(ui_edit_doc_t* d,
+        const ui_edit_range_t* range, const uint8_t* u, int32_t b) {
+    ui_edit_text_t* dt = &d->text;
+    ui_edit_history_t* h = &d->history;
+    const ui_edit_range_t r = ui_edit_range.ordered(dt, range);
+    ui_edit_text_t t = {0};
+    bool ok = ui_edit_utf8_to_heap_text(u, b, &t);
+    if (ok) {
+        const int32_t kind = ui_edit_doc_record_kind(d, &r, &t);
+        // coalesce only with the most recent edit:
+        const bool top = h->undo != null && h->redo == null;
+        bool merged = false;
+        if (top && kind == ui_edit_record_insert) {
+            merged = ui_edit_doc_typing(d, &r, &t);
+        } else if (top && kind == ui_edit_record_delete) {
+            merged = ui_edit_doc_deleting(d, &r, &t);
+        }
+        if (merged) {
+            h->merged++;
+        } else {
+            ui_edit_record_t* undo = null;
+            ui_edit_range_t x = {0};
+            ok = ui_edit_doc_record(d, &r, 0, 0, &undo) &&
+                 ui_edit_doc_replace_range(d, &r, &t, null, &x);
+            if (ok) {
+                undo->range = x;
+                undo->kind = kind;
+                undo->next = h->undo;
+                h->undo = undo;
+                // redo stack is not valid after new replace, empty it:
+                ui_edit_history_free_stack(h, &h->redo);
+            } else if (undo != null) {
+                ui_edit_history_free(h, undo);
+            }
+        }
+        if (ok) { ui_edit_history_trim(h); }
+        ui_edit_text.dispose(&t);
+    }
+    return ok;
+}
+
+static bool ui_edit_text_dup(ui_edit_text_t* d, const ui_edit_text_t* s) {
+    ui_edit_check_zeros(d, sizeof(*d));
+    memset(d, 0x00, sizeof(*d));
+    bool ok = true;
+    for (int32_t i = 0; ok && i < s->np; i++) {
+        const ui_edit_str_t* p = ui_edit_text.ps(s, i);
+        ok = ui_edit_text_append_ps(d, p->u, p->b, true);
+    }
+    if (!ok) {
+        ui_edit_text.dispose(d);
+    }
+    return ok;
+}
+
+static bool ui_edit_text_equal(ui_edit_text_t* s1, const ui_edit_text_t* s2) {
+    bool equal =  s1->np != s2->np;
+    for (int32_t i = 0; equal && i < s1->np; i++) {
+        const ui_edit_str_t* p1 = ui_edit_text.ps(s1, i);
+        const ui_edit_str_t* p2 = ui_edit_text.ps(s2, i);
+        equal = p1->b == p2->b &&
+                memcmp(p1->u, p2->u, p1->b) == 0;
+    }
+    return true;
+}
+
+// ui_edit_doc.replace_batch() applies ordered not overlapping replacements
+// front to back in a single pass with a single notification. Consecutive
+// single line replacements inside the same paragraph rebuild it once.
+// Reverse of the whole batch is a single undo record.
+
+typedef struct ui_edit_batch_s { // replacement state
+    ui_edit_range_t r;  // original range
+    ui_edit_range_t x;  // replacement text range after the batch
+    const uint8_t*  u;  // replacement utf8
+    int32_t b;          // bytes
+    int32_t lines;      // number of paragraphs in the replacement text
+    int32_t dp;         // paragraphs delta of preceding replacements
+    int32_t shift;      // glyphs delta of preceding replacement in r.from.pn
+} ui_edit_batch_t;
+
+static bool ui_edit_batch_prepare(const ui_edit_doc_t* d,
+        const ui_edit_replacement_t* rs, int32_t n, ui_edit_batch_t* b) {
+    bool ok = true;
+    for (int32_t i = 0; ok && i < n; i++) {
+        ui_edit_batch_t* e = &b[i];
+        const ui_edit_batch_t* p = i > 0 ? &b[i - 1] : null;
+        e->r = ui_edit_range.ordered(&d->text, &rs[i].range);
+        e->u = rs[i].utf8;
+        e->b = e->u == null ? 0 : rs[i].bytes >= 0 ? rs[i].bytes :
+               (int32_t)strlen((const char*)e->u);
+        ok = ui_edit_range.inside(&d->text, e->r) &&
+             (p == null || ui_edit_range.compare(p->r.to, e->r.from) <= 0) &&
+             (e->b == 0 || ui_edit_str.glyphs(e->u, e->b) >= 0);
+        if (ok) {
+            // first line [0..f[ and last line [l..b[ of the text
+            int32_t f = e->b;
+            int32_t l = 0;
+            e->lines = 1;
+            const uint8_t* nl = e->b == 0 ? null : memchr(e->u, '\n', e->b);
+            while (nl != null) {
+                if (e->lines == 1) { f = (int32_t)(nl - e->u); }
+                e->lines++;
+                l = (int32_t)(nl - e->u) + 1;
+                nl = memchr(e->u + l, '\n', e->b - l);
+            }
+            if (e->lines > 1 && f > 0 && e->u[f - 1] == '\r') { f--; }
+            e->dp = p == null ? 0 :
+                    p->dp + p->lines - 1 - (p->r.to.pn - p->r.from.pn);
+            e->shift = p != null && p->r.to.pn == e->r.from.pn ?
+                       p->x.to.gp - p->r.to.gp : 0;
+            e->x.from.pn = e->r.from.pn + e->dp;
+            e->x.from.gp = e->r.from.gp + e->shift;
+            e->x.to.pn = e->x.from.pn + e->lines - 1;
+            e->x.to.gp = e->lines == 1 ?
+                e->x.from.gp + ui_edit_str.glyphs(e->u, e->b) :
+                ui_edit_str.glyphs(e->u + l, e->b - l);
+        }
+    }
+    return ok;
+}
+
+static ui_edit_range_t ui_edit_batch_current(const ui_edit_batch_t* e) {
+    // range before replacement after all preceding replacements
+    const ui_edit_range_t r = {
+        .from = e->x.from,
+        .to = { .pn = e->r.to.pn + e->dp,
+                .gp = e->r.to.pn == e->r.from.pn ?
+                      e->r.to.gp + e->shift : e->r.to.gp }
+    };
+    return r;
+}
+
+static bool ui_edit_batch_paragraph(ui_edit_doc_t* d,
+        const ui_edit_batch_t* b, int32_t n) {
+    // n single line replacements inside the same paragraph:
+    // glyph positions are shifted by the replacement preceding b[0]
+    ui_edit_str_t* s = ui_edit_text_pw(&d->text, b[0].x.from.pn);
+    if (s != null) { ui_edit_str_close_in(d->text.heap, s); }
+    const int32_t shift = b[0].shift;
+    int64_t bytes = s == null ? 0 : s->b;
+    for (int32_t i = 0; s != null && i < n; i++) {
+        bytes += b[i].b - ui_edit_str.bytes(s, b[i].r.from.gp + shift,
+                                               b[i].r.to.gp + shift);
+    }
+    uint8_t* u = null;
+    bool ok = s != null && bytes <= INT32_MAX &&
+              ut_heap.alloc((void**)&u, ut_max(bytes, 1)) == 0;
+    if (ok) {
+        int32_t k = 0; // bytes in u[]
+        int32_t a = 0; // next byte of s->u[] to copy
+        for (int32_t i = 0; i < n; i++) {
+            const int32_t f = ui_edit_str.g2b(s, b[i].r.from.gp + shift);
+            const int32_t e = ui_edit_str.g2b(s, b[i].r.to.gp + shift);
+            memcpy(u + k, s->u + a, f - a);
+            k += f - a;
+            if (b[i].b > 0) { memcpy(u + k, b[i].u, b[i].b); }
+            k += b[i].b;
+            a = e;
+        }
+        memcpy(u + k, s->u + a, s->b - a);
+        k += s->b - a;
+        assert(k == bytes);
+        ok = ui_edit_str_replace_in(d->text.heap, s, 0, s->g,
+                                    k == 0 ? null : u, k);
+        if (ok) { ui_edit_text_update(&d->text, b[0].x.from.pn); }
+        ut_heap.free(u);
+    }
+    return ok;
+}
+
+static int32_t ui_edit_batch_apply(ui_edit_doc_t* d,
+        const ui_edit_batch_t* b, int32_t n) {
+    // returns number of applied replacements, n on success
+    bool ok = true;
+    int32_t i = 0;
+    while (ok && i < n) {
+        const ui_edit_batch_t* e = &b[i];
+        const int32_t pn = e->r.from.pn;
+        if (e->lines == 1 && e->r.to.pn == pn) {
+            int32_t j = i + 1;
+            while (j < n && b[j].lines == 1 &&
+                   b[j].r.from.pn == pn && b[j].r.to.pn == pn) {
+                j++;
+            }
+            ok = ui_edit_batch_paragraph(d, e, j - i);
+            if (ok) { i = j; }
+        } else {
+            ui_edit_text_t t = {0};
+            ok = ui_edit_text.init(&t, e->b == 0 ? null : e->u, e->b, false);
+            if (ok) {
+                ui_edit_range_t x = {0};
+                ok = ui_edit_doc_replace_core(d, ui_edit_batch_current(e), &t, &x);
+                assert(!ok || memcmp(&x, &e->x, sizeof(x)) == 0);
+                ui_edit_text.dispose(&t);
+            }
+            if (ok) { i++; }
+        }
+    }
+    return i;
+}
+
+static void ui_edit_record_replacements(ui_edit_record_t* r,
+        ui_edit_replacement_t* rs) {
+    assert(r->kind == ui_edit_record_batch);
+    const ui_edit_record_entry_t* entry = (ui_edit_record_entry_t*)(r + 1);
+    const uint8_t* u = (const uint8_t*)(entry + r->count);
+    for (int32_t i = 0; i < r->count; i++) {
+        rs[i].range = entry[i].range;
+        rs[i].utf8  = entry[i].bytes == 0 ? null : u;
+        rs[i].bytes = entry[i].bytes;
+        u += entry[i].bytes + 1;
+    }
+}
+
+static bool ui_edit_doc_batch(ui_edit_doc_t* d,
+        const ui_edit_replacement_t* rs, int32_t n,
+        ui_edit_record_t* *reverse) {
+    // all or nothing: partially applied batch is rolled back
+    ui_edit_batch_t* b = null;
+    bool ok = ut_heap.alloc((void**)&b, n * sizeof(b[0])) == 0;
+    ok = ok && ui_edit_batch_prepare(d, rs, n, b);
+    int64_t bytes = n * (int64_t)sizeof(ui_edit_record_entry_t);
+    for (int32_t i = 0; ok && i < n; i++) {
+        bytes += ui_edit_doc.utf8bytes(d, &b[i].r); // including 0x00
+    }
+    ok = ok && bytes - 1 <= INT32_MAX &&
+         ui_edit_history_alloc(&d->history, reverse, (int32_t)(bytes - 1));
+    if (ok) {
+        ui_edit_record_t* r = *reverse;
+        r->kind  = ui_edit_record_batch;
+        r->count = n;
+        r->range.from = b[0].x.from;
+        r->range.to   = b[n - 1].x.to;
+        ui_edit_record_entry_t* entry = (ui_edit_record_entry_t*)(r + 1);
+        char* u = (char*)(entry + n);
+        for (int32_t i = 0; i < n; i++) {
+            entry[i].range = b[i].x;
+            entry[i].bytes = ui_edit_doc.utf8bytes(d, &b[i].r) - 1;
+            ui_edit_doc.copy(d, &b[i].r, u);
+            u += entry[i].bytes + 1;
+        }
+        const ui_edit_range_t all = { .from = b[0].r.from, .to = b[n - 1].r.to };
+        const ui_edit_range_t x = r->range;
+        int32_t deleted  = 0;
+        int32_t inserted = 0;
+        for (int32_t i = 0; i < n; i++) {
+            deleted  += b[i].r.to.pn - b[i].r.from.pn;
+            inserted += b[i].lines - 1;
+        }
+        const ui_edit_notify_info_t before = {
+            .ok = true, .d = d, .r = &all, .x = &x, .t = null,
+            .pnf = all.from.pn, .pnt = all.to.pn,
+            .deleted = 0, .inserted = 0
+        };
+        ui_edit_notify_before(d, &before);
+        const int32_t applied = ui_edit_batch_apply(d, b, n);
+        ok = applied == n;
+        if (!ok && applied > 0) {
+            // roll back applied replacements using reverse record entries,
+            // b[] is not needed anymore and is reused to avoid allocations
+            // when the failure was caused by out of memory condition
+            static_assertion(sizeof(ui_edit_replacement_t) <= sizeof(*b));
+            ui_edit_replacement_t* rb = (ui_edit_replacement_t*)b;
+            ui_edit_batch_t* rev = b + applied;
+            if (applied > n - applied) { // rev[applied] does not fit
+                swear(ut_heap.alloc((void**)&rev, applied * sizeof(rev[0])) == 0);
+            }
+            ui_edit_record_replacements(r, rb); // r->count == n >= applied
+            swear(ui_edit_batch_prepare(d, rb, applied, rev) &&
+                  ui_edit_batch_apply(d, rev, applied) == applied,
+                  "failed to roll back");
+            if (rev != b + applied) { ut_heap.free(rev); }
+        }
+        const ui_edit_range_t* ax = ok ? &x : &all;
+        const ui_edit_notify_info_t after = {
+            .ok = ok, .d = d, .r = &all, .x = ax, .t = null,
+            .pnf = all.from.pn, .pnt = ok ? x.to.pn : all.to.pn,
+            .deleted  = ok ? deleted  : 0,
+            .inserted = ok ? inserted : 0
+        };
+        ui_edit_notify_after(d, &after);
+        if (!ok) {
+            ui_edit_history_free(&d->history, r);
+            *reverse = null;
+        }
+    }
+    if (b != null) { ut_heap.free(b); }
+    return ok;
+}
+
+static bool ui_edit_doc_replace_batch(ui_edit_doc_t* d,
+        const ui_edit_replacement_t* rs, int32_t n) {
+    ui_edit_history_t* h = &d->history;
+    ui_edit_record_t* undo = null;
+    bool ok = n == 0 || ui_edit_doc_batch(d, rs, n, &undo);
+    if (ok && undo != null) {
+        undo->next = h->undo;
+        h->undo = undo;
+        ui_edit_history_free_stack(h, &h->redo);
+        ui_edit_history_trim(h);
+    }
+    return ok;
+}
+
+static bool ui_edit_doc_do(ui_edit_doc_t* d, ui_edit_record_t* *from,
+        ui_edit_record_t* *to) {
+    // pops record from one stack and pushes the reverse into other
+    ui_edit_history_t* h = &d->history;
+    ui_edit_record_t* r = *from;
+    bool ok = r != null;
+    if (ok && r->kind == ui_edit_record_batch) {
+        ui_edit_replacement_t* rs = null;
+        ui_edit_record_t* reverse = null;
+        ok = ut_heap.alloc((void**)&rs, r->count * sizeof(rs[0])) == 0;
+        if (ok) {
+            ui_edit_record_replacements(r, rs);
+            ok = ui_edit_doc_batch(d, rs, r->count, &reverse);
+            ut_heap.free(rs);
+        }
+        if (ok) {
+            *from = r->next;
+            ui_edit_history_free(h, r);
+            reverse->next = *to;
+            *to = reverse;
+        }
+    } else if (ok) {
+        // paragraphs of `t` point inside the record and are
+        // copied into the document text by replace
+        ui_edit_text_t t = {0};
+        const int32_t b = r->bytes;
+        ok = ui_edit_text.init(&t, b == 0 ? null : ui_edit_record_utf8(r),
+                               b, false);
+        ui_edit_record_t* reverse = null;
+        ui_edit_range_t x = {0};
+        ok = ok && ui_edit_doc_record(d, &r->range, 0, 0, &reverse) &&
+             ui_edit_doc_replace_range(d, &r->range, &t, null, &x);
+        if (t.np > 0) { ui_edit_text.dispose(&t); }
+        if (ok) {
+            *from = r->next;
+            ui_edit_history_free(h, r);
+            reverse->range = x;
+            reverse->next = *to;
+            *to = reverse;
+        } else if (reverse != null) {
+            ui_edit_history_free(h, reverse);
+        }
+    }
+    return ok;
+}
+
+static bool ui_edit_doc_redo(ui_edit_doc_t* d) {
+    return ui_edit_doc_do(d, &d->history.redo, &d->history.undo);
+}
+
+static bool ui_edit_doc_undo(ui_edit_doc_t* d) {
+    return ui_edit_doc_do(d, &d->history.undo, &d->history.redo);
+}
+
+// Nodes and paragraphs of the document text are allocated from the
+// private heap of the document. It is serialized because snapshots are
+// released on background threads and huge texts are initialized in
+// parallel. Snapshots share the arena, when the document holds the
+// only reference dispose() releases the whole heap at once.
+
+typedef struct ui_edit_arena_s { // shared by document and snapshots
+    ut_heap_t* heap;
+    volatile int32_t rc;
+} ui_edit_arena_t;
+
+static void ui_edit_arena_release(ui_edit_arena_t* a) {
+    if (ut_atomics.decrement_int32(&a->rc) == 0) {
+        ut_heap.dispose(a->heap);
+        ut_heap.free(a);
+    }
+}
+
+static void ui_edit_arena_create(ui_edit_doc_t* d) {
+    // on failure the document falls back to the process heap
+    ui_edit_arena_t* a = null;
+    if (ui_edit_doc.arena &&
+        ut_heap.alloc_zero((void**)&a, sizeof(*a)) == 0) {
+        a->heap = ut_heap.create(true);
+        if (a->heap == null) {
+            ut_heap.free(a);
+            a = null;
+        } else {
+            a->rc = 1;
+        }
+    }
+    d->arena = a;
+    d->text.heap = a != null ? a->heap : null;
+}
+
+static void ui_edit_arena_dispose(ui_edit_doc_t* d) {
+    if (d->arena != null) {
+        ui_edit_arena_release(d->arena);
+        d->arena = null;
+    }
+    d->text.heap = null;
+}
+
+static bool ui_edit_doc_init(ui_edit_doc_t* d, const uint8_t* utf8,
+        int32_t bytes, bool heap) {
+    bool ok = true;
+    ui_edit_check_zeros(d, sizeof(*d));
+    memset(d, 0x00, sizeof(*d));
+    assert(bytes >= 0);
+    assert((utf8 == null) == (bytes == 0));
+    ui_edit_arena_create(d);
+    if (ok) {
+        if (bytes == 0) { // empty string
+            ok = ui_edit_text.init(&d->text, null, 0, false);
+        } else {
+            ok = ui_edit_text.init(&d->text, utf8, bytes, heap);
+        }
+    }
+    if (!ok) { ui_edit_arena_dispose(d); }
+    return ok;
+}
+
+typedef struct ui_edit_mapping_s { // shared by document and snapshots
+    void*   data;
+    int64_t bytes;
+    volatile int32_t rc;
+} ui_edit_mapping_t;
+
+static void ui_edit_mapping_release(ui_edit_mapping_t* m) {
+    if (ut_atomics.decrement_int32(&m->rc) == 0) {
+        ut_mem.unmap(m->data, m->bytes);
+        ut_heap.free(m);
+    }
+}
+
+static errno_t ui_edit_doc_open(ui_edit_doc_t* d, const char* filename) {
+    ui_edit_check_zeros(d, sizeof(*d));
+    memset(d, 0x00, sizeof(*d));
+    ui_edit_arena_create(d);
+    // mapping of zero bytes file fails, check the size first:
+    ut_file_t* f = null;
+    ut_files_stat_t st = {0};
+    errno_t r = ut_files.open(&f, filename, ut_files.o_rd);
+    if (r == 0) {
+        r = ut_files.stat(f, &st, true);
+        ut_files.close(f);
+    }
+    if (r == 0 && st.size == 0) {
+        if (!ui_edit_text.init(&d->text, null, 0, false)) { r = ENOMEM; }
+    } else if (r == 0) {
+        ui_edit_mapping_t* m = null;
+        r = ut_heap.alloc_zero((void**)&m, sizeof(*m));
+        if (r == 0) {
+            m->rc = 1;
+            r = ut_mem.map_ro(filename, &m->data, &m->bytes);
+            if (r != 0) { ut_heap.free(m); m = null; }
+        }
+        if (r == 0) {
+            r = ui_edit_text_init_lazy(&d->text, (const uint8_t*)m->data,
+                                       m->bytes);
+            if (r == 0) {
+                d->mapping = m;
+            } else {
+                ui_edit_mapping_release(m);
+            }
+        }
+    }
+    if (r != 0) { ui_edit_arena_dispose(d); }
+    return r;
+}
+
+// Append only ("tail -f") mode: ui_edit_doc.append() collects bytes in
+// d->tail.pending and ui_edit_doc.flush() inserts them at the end of the
+// text in one replace w/o undo. The paragraphs tree makes both append
+// at the end and delete of the oldest paragraphs O(log(np)).
+
+enum { ui_edit_tail_read_max = 16 * 1024 * 1024 }; // file bytes per flush()
+
+static bool ui_edit_doc_tail_reserve(ui_edit_tail_t* t, int64_t bytes) {
+    bool ok = (int64_t)t->count + bytes <= INT32_MAX;
+    if (ok && t->count + bytes > t->capacity) {
+        int64_t c = t->capacity > 0 ? (int64_t)t->capacity * 2 : 4096;
+        while (c < t->count + bytes) { c *= 2; }
+        if (c > INT32_MAX) { c = INT32_MAX; }
+        ok = ut_heap.realloc((void**)&t->pending, c) == 0;
+        if (ok) { t->capacity = (int32_t)c; }
+    }
+    return ok;
+}
+
+static bool ui_edit_doc_append(ui_edit_doc_t* d, const uint8_t* u,
+        int32_t b) {
+    ui_edit_tail_t* t = &d->tail;
+    if (b < 0) { b = (int32_t)strlen((const char*)u); }
+    bool ok = ui_edit_doc_tail_reserve(t, b);
+    if (ok && b > 0) {
+        memcpy(t->pending + t->count, u, (size_t)b);
+        t->count += b;
+    }
+    return ok;
+}
+
+static errno_t ui_edit_doc_tail_read(ui_edit_tail_t* t) {
+    ut_files_stat_t st = {0};
+    errno_t r = ut_files.stat(t->file, &st, false);
+    if (r == 0 && st.size < t->position) { // truncated: start over
+        int64_t position = 0;
+        r = ut_files.seek(t->file, &position, ut_files.seek_set);
+        if (r == 0) { t->position = 0; t->skip = false; }
+    }
+    int64_t bytes = r == 0 ? st.size - t->position : 0;
+    if (bytes > ui_edit_tail_read_max) { bytes = ui_edit_tail_read_max; }
+    if (bytes > 0 && !ui_edit_doc_tail_reserve(t, bytes)) { r = ENOMEM; }
+    while (r == 0 && bytes > 0) {
+        int64_t transferred = 0;
+        r = ut_files.read(t->file, t->pending + t->count, bytes,
+                          &transferred);
+        if (r == 0 && transferred == 0) { break; } // not written yet
+        if (r == 0) {
+            t->count += (int32_t)transferred;
+            t->position += transferred;
+            bytes -= transferred;
+        }
+    }
+    if (t->skip) {
+        const uint8_t* nl = (const uint8_t*)memchr(t->pending, '\n',
+                                                   (size_t)t->count);
+        const int32_t k = nl != null ?
+            (int32_t)(nl - t->pending) + 1 : t->count;
+        memmove(t->pending, t->pending + k, (size_t)(t->count - k));
+        t->count -= k;
+        t->skip = nl == null;
+    }
+    return r;
+}
+
+static int32_t ui_edit_doc_tail_complete(const uint8_t* u, int32_t b) {
+    // number of leading bytes that can be flushed: incomplete utf8
+    // sequence at the end and '\r' (of "\r\n") wait for more bytes
+    int32_t k = b;
+    if (k > 0 && u[k - 1] == '\r') { k--; }
+    int32_t i = k;
+    while (i > 0 && k - i < 3 && (u[i - 1] & 0xC0u) == 0x80u) { i--; }
+    if (i > 0) {
+        const uint8_t c = u[i - 1];
+        const int32_t n = (c & 0xE0u) == 0xC0u ? 2 :
+                          (c & 0xF0u) == 0xE0u ? 3 :
+                          (c & 0xF8u) == 0xF0u ? 4 : 0;
+        if (n > k - (i - 1)) { k = i - 1; }
+    }
+    return k;
+}
+
+static bool ui_edit_doc_tail_insert(ui_edit_doc_t* d,
+        const uint8_t* u, int32_t b) {
+    uint8_t* v = null;
+    int32_t k = b;
+    bool ok = true;
+    if (ui_edit_str.glyphs(u, b) < 0) {
+        ok = ui_edit_utf8_replace_invalid(u, b, &v, &k);
+    }
+    ui_edit_text_t t = {0};
+    if (ok) { ok = ui_edit_text.init(&t, v != null ? v : u, k, true); }
+    if (ok) {
+        const ui_edit_range_t r = ui_edit_range.end_range(&d->text);
+        ok = ui_edit_doc_replace_text(d, &r, &t, null);
+        ui_edit_text.dispose(&t);
+    }
+    if (v != null) { ut_heap.free(v); }
+    return ok;
+}
+
+static bool ui_edit_doc_tail_trim(ui_edit_doc_t* d) {
+    // drops oldest paragraphs above d->tail.lines and d->tail.bytes
+    ui_edit_text_t* dt = &d->text;
+    ui_edit_tail_t* t = &d->tail;
+    int32_t pn = 0; // paragraphs to drop
+    if (t->lines > 0 && dt->np > t->lines) { pn = dt->np - t->lines; }
+    if (t->bytes > 0) {
+        const int64_t total = ui_edit_text.offset(dt,
+                                  ui_edit_range.end(dt));
+        if (total > t->bytes) {
+            const ui_edit_pg_t pg = ui_edit_text.pg(dt, total - t->bytes);
+            pn = ut_max(pn, pg.pn + (pg.gp > 0));
+        }
+    }
+    pn = ut_min(pn, dt->np - 1);
+    bool ok = true;
+    if (pn > 0) {
+        const ui_edit_range_t r = { .from = {0, 0}, .to = {pn, 0} };
+        ui_edit_text_t e = {0};
+        ok = ui_edit_text.init(&e, null, 0, false) &&
+             ui_edit_doc_replace_text(d, &r, &e, null);
+        ui_edit_text.dispose(&e);
+        if (ok) {
+            // undo and redo ranges are not valid after the drop:
+            ui_edit_history_t* h = &d->history;
+            ui_edit_history_free_stack(h, &h->undo);
+            ui_edit_history_free_stack(h, &h->redo);
+            t->dropped += pn;
+        }
+    }
+    return ok;
+}
+
+static errno_t ui_edit_doc_flush(ui_edit_doc_t* d) {
+    ui_edit_tail_t* t = &d->tail;
+    errno_t r = t->file != null ? ui_edit_doc_tail_read(t) : 0;
+    const int32_t k = ui_edit_doc_tail_complete(t->pending, t->count);
+    if (r == 0 && k > 0) {
+        if (ui_edit_doc_tail_insert(d, t->pending, k)) {
+            memmove(t->pending, t->pending + k, (size_t)(t->count - k));
+            t->count -= k;
+        } else {
+            r = ENOMEM;
+        }
+    }
+    if (r == 0 && !ui_edit_doc_tail_trim(d)) { r = ENOMEM; }
+    return r;
+}
+
+static errno_t ui_edit_doc_follow(ui_edit_doc_t* d, const char* filename) {
+    ui_edit_tail_t* t = &d->tail;
+    if (t->file != null) { ut_files.close(t->file); t->file = null; }
+    ut_file_t* f = null;
+    ut_files_stat_t st = {0};
+    errno_t r = ut_files.open(&f, filename, ut_files.o_rd);
+    if (r == 0) { r = ut_files.stat(f, &st, false); }
+    // start from the last d->tail.bytes of the file at the line start:
+    int64_t position = t->bytes > 0 && st.size > t->bytes ?
+                       st.size - t->bytes : 0;
+    if (r == 0 && position > 0) {
+        r = ut_files.seek(f, &position, ut_files.seek_set);
+    }
+    if (r == 0) {
+        t->file = f;
+        t->position = position;
+        t->skip = position > 0;
+    } else if (f != null) {
+        ut_files.close(f);
+    }
+    return r;
+}
+
+static ui_edit_snapshot_t* ui_edit_doc_snapshot(ui_edit_doc_t* d) {
+    // O(1): shares the root, later edits copy the nodes they modify
+    ui_edit_snapshot_t* s = null;
+    if (ut_heap.alloc_zero((void**)&s, sizeof(*s)) == 0) {
+        ui_edit_text_close(&d->text); // shared paragraphs are immutable
+        s->text = d->text;
+        ut_atomics.increment_int32(&d->text.root->rc);
+        s->mapping = d->mapping;
+        if (s->mapping != null) {
+            ut_atomics.increment_int32(&s->mapping->rc);
+        }
+        s->arena = d->arena;
+        if (s->arena != null) {
+            ut_atomics.increment_int32(&s->arena->rc);
+        }
+    }
+    return s;
+}
+
+static void ui_edit_doc_dispose_snapshot(ui_edit_snapshot_t* s) {
+    // may be called on any thread
+    ui_edit_text.dispose(&s->text);
+    if (s->mapping != null) { ui_edit_mapping_release(s->mapping); }
+    if (s->arena != null) { ui_edit_arena_release(s->arena); }
+    ut_heap.free(s);
+}
+
+// ui_edit_doc.write() streams paragraphs straight from the tree leaves
+// without materializing them. Adjacent slices of the mapped file with
+// matching line separators between them coalesce into a single write.
+
+enum { ui_edit_doc_save_buffer = 1024 * 1024 }; // bytes
+
+typedef struct ui_edit_writer_s {
+    ut_stream_if*   out;
+    ui_edit_range_t r;     // ordered range to write
+    const uint8_t*  u;     // pending run of contiguous bytes
+    int64_t         b;
+    const uint8_t*  data;  // mapped file or null
+    int64_t         bytes;
+    errno_t         error;
+    bool            crlf;
+} ui_edit_writer_t;
+
+static void ui_edit_writer_flush(ui_edit_writer_t* w) {
+    while (w->error == 0 && w->b > 0) {
+        int64_t transferred = 0;
+        w->error = w->out->write(w->out, w->u, w->b, &transferred);
+        if (w->error == 0 && transferred <= 0) {
+            w->error = ut_runtime.error.io_error;
+        } else if (w->error == 0) {
+            w->u += transferred;
+            w->b -= transferred;
+        }
+    }
+    w->b = 0;
+}
+
+static void ui_edit_writer_append(ui_edit_writer_t* w,
+        const uint8_t* u, int64_t b) {
+    if (b > 0) {
+        if (w->b > 0 && w->u + w->b != u) { ui_edit_writer_flush(w); }
+        if (w->b == 0) { w->u = u; }
+        w->b += b;
+    }
+}
+
+static bool ui_edit_writer_mapped(const ui_edit_writer_t* w,
+        const uint8_t* u, int64_t b) {
+    const uintptr_t a = (uintptr_t)u;
+    const uintptr_t d = (uintptr_t)w->data;
+    return w->data != null && d <= a &&
+           a + (uint64_t)b <= d + (uint64_t)w->bytes;
+}
+
+static void ui_edit_writer_separator(ui_edit_writer_t* w, const uint8_t* e) {
+    // e: end of the paragraph just written
+    const uint8_t* s = (const uint8_t*)(w->crlf ? "\r\n" : "\n");
+    const int64_t  n = w->crlf ? 2 : 1;
+    // the line separator that follows the paragraph in the mapped file:
+    const bool in_place = e != null && ui_edit_writer_mapped(w, e, n) &&
+                          memcmp(e, s, (size_t)n) == 0;
+    ui_edit_writer_append(w, in_place ? e : s, n);
+}
+
+static void ui_edit_writer_paragraph(ui_edit_writer_t* w,
+        const ui_edit_text_t* t, const ui_edit_str_t* p, int32_t pn) {
+    const ui_edit_range_t* r = &w->r;
+    int32_t f = 0;
+    int32_t e = p->b;
+    // only the ends of the range need glyph to byte positions:
+    if ((pn == r->from.pn && r->from.gp > 0) ||
+        (pn == r->to.pn && r->to.gp < p->g)) {
+        p = ui_edit_text.ps(t, pn);
+        if (pn == r->from.pn) { f = ui_edit_str.g2b(p, r->from.gp); }
+        if (pn == r->to.pn)   { e = ui_edit_str.g2b(p, r->to.gp); }
+    }
+    ui_edit_writer_append(w, p->u + f, e - f);
+    if (pn < r->to.pn) { ui_edit_writer_separator(w, p->u + e); }
+}
+
+static void ui_edit_writer_node(ui_edit_writer_t* w, const ui_edit_text_t* t,
+        const ui_edit_node_t* n, int32_t pn) {
+    // pn: number of the first paragraph of the subtree
+    if (ui_edit_node_is_leaf(n)) {
+        const ui_edit_str_t* ps = ui_edit_node_ps(n);
+        for (int32_t i = 0; w->error == 0 && i < n->n; i++) {
+            if (w->r.from.pn <= pn + i && pn + i <= w->r.to.pn) {
+                ui_edit_writer_paragraph(w, t, &ps[i], pn + i);
+            }
+        }
     } else {
-        x.to.gp = t->ps[t->np - 1].g;
+        for (int32_t i = 0; w->error == 0 && i < n->n; i++) {
+            const int32_t np = n->child[i]->np;
+            if (w->r.from.pn < pn + np && pn <= w->r.to.pn) {
+                ui_edit_writer_node(w, t, n->child[i], pn);
+            }
+            pn += np;
+        }
     }
-    const ui_edit_notify_info_t ni_before = {
-        .ok = true, .d = d, .r = &r, .x = &x, .t = t,
-        .pnf = r.from.pn, .pnt = r.to.pn,
-        .deleted = 0, .inserted = 0
-    };
-    ui_edit_notify_before(d, &ni_before);
 }
 
-static void ui_edit_doc_after_replace_text(ui_edit_doc_t* d,
-        bool ok,
-        const ui_edit_range_t r,
-        const ui_edit_range_t x,
-        const ui_edit_text_t* t) {
-    const ui_edit_notify_info_t ni_after = {
-        .ok = ok, .d = d, .r = &r, .x = &x, .t = t,
-        .pnf = r.from.pn, .pnt = x.to.pn,
-        .deleted = r.to.pn - r.from.pn,
-        .inserted = t->np - 1
+static errno_t ui_edit_doc_write(ui_edit_doc_t* d, const ui_edit_range_t* range,
+        ut_stream_if* out, bool crlf) {
+    ui_edit_writer_t w = {
+        .out  = out,
+        .r    = ui_edit_range.ordered(&d->text, range),
+        .crlf = crlf
     };
-    ui_edit_notify_after(d, &ni_after);
+    ui_edit_check_range_inside_text(&d->text, &w.r);
+    ui_edit_text_close(&d->text); // writer reads bytes from the leaves
+    if (d->mapping != null) {
+        w.data  = (const uint8_t*)d->mapping->data;
+        w.bytes = d->mapping->bytes;
+    }
+    ui_edit_writer_node(&w, &d->text, d->text.root, 0);
+    ui_edit_writer_flush(&w);
+    return w.error;
+}
+
+static errno_t ui_edit_doc_save(ui_edit_doc_t* d, const char* filename,
+        bool crlf) {
+    // writes "<filename>.tmp" next to the file and renames it over the
+    // file only after all the data is flushed to the disk
+    ut_file_name_t tmp = {0};
+    errno_t r = strlen(filename) + 5 > countof(tmp.s) ?
+                ut_runtime.error.name_too_long : 0;
+    ut_stream_file_if fs = {0};
+    if (r == 0) {
+        ut_str.format(tmp.s, countof(tmp.s), "%s.tmp", filename);
+        r = ut_streams.file_write(&fs, tmp.s, ui_edit_doc_save_buffer);
+    }
+    if (r == 0) {
+        r = ui_edit_doc_write(d, null, &fs.stream, crlf);
+        if (r == 0) { r = ut_streams.file_flush(&fs); }
+        const errno_t close = ut_streams.file_close(&fs);
+        if (r == 0) { r = close; }
+        if (r == 0) { r = ut_files.move(tmp.s, filename); }
+        if (r != 0) { ut_files.unlink(tmp.s); }
+    }
+    return r;
 }
 
-static bool ui_edit_doc_replace_text(ui_edit_doc_t* d,
-        const ui_edit_range_t* range, const ui_edit_text_t* t,
-        ui_edit_to_do_t* undo) {
-    ui_edit_text_t* dt = &d->text;
-    const ui_edit_range_t r = ui_edit_range.ordered(dt, range);
-    ui_edit_doc_before_replace_text(d, r, t);
-    bool ok = undo == null ? true :
-              ui_edit_doc.copy_text(d, &r, &undo->text);
-    ui_edit_range_t x = r;
+// ui_edit_doc.find() scans raw paragraph bytes: vectorized filter
+// compares the first and the last bytes of the pattern (in both ASCII
+// cases) at 32 or 16 positions at once and only the candidates that
+// pass both are verified in full.
+
+typedef struct ui_edit_finder_s {
+    const uint8_t* p; // pattern
+    int32_t m;        // pattern bytes
+    int32_t g;        // pattern glyphs
+    uint8_t f[2];     // first byte of the pattern in both cases
+    uint8_t l[2];     // last byte of the pattern in both cases
+    bool    ignore_case;
+    bool    whole_word;
+} ui_edit_finder_t;
+
+static uint8_t ui_edit_find_fold(uint8_t c) { // ASCII lower case
+    return 'A' <= c && c <= 'Z' ? (uint8_t)(c + 0x20) : c;
+}
+
+static bool ui_edit_find_word(uint8_t c) {
+    const uint8_t l = ui_edit_find_fold(c);
+    return c >= 0x80 || c == '_' || ('0' <= c && c <= '9') ||
+           ('a' <= l && l <= 'z');
+}
+
+static int32_t ui_edit_find_glyphs(const uint8_t* u, int32_t b) {
+    // valid utf8: every byte except 10xxxxxx continuation starts a glyph
+    int32_t g = 0;
+    for (int32_t i = 0; i < b; i++) { g += (u[i] & 0xC0) != 0x80; }
+    return g;
+}
+
+static bool ui_edit_finder_init(ui_edit_finder_t* fi, const ui_edit_find_t* f) {
+    memset(fi, 0x00, sizeof(*fi));
+    const uint8_t* p = f->utf8;
+    const int32_t m = p == null ? 0 :
+        (f->bytes < 0 ? (int32_t)strlen((const char*)p) : f->bytes);
+    const bool ok = m > 0 && memchr(p, '\n', (size_t)m) == null &&
+                    ui_edit_str.glyphs(p, m) > 0;
     if (ok) {
-        if (ui_edit_range.is_empty(r)) {
-            x.to.pn = r.from.pn + t->np - 1;
-            x.to.gp = t->np == 1 ?
-                      r.from.gp + t->ps[0].g :
-                      t->ps[t->np - 1].g;
-            ok = ui_edit_doc_insert(d, r.from, t);
-        } else if (t->np == 1 && r.from.pn == r.to.pn) {
-            x.to.pn = r.from.pn + t->np - 1;
-            x.to.gp = r.from.gp + t->ps[0].g;
-            ok = ui_edit_str.replace(&dt->ps[r.from.pn],
-                                r.from.gp, r.to.gp,
-                                t->ps[0].u, t->ps[0].b);
-        } else {
-            x.to.pn = r.from.pn + t->np - 1;
-            x.to.gp = t->np == 1 ? r.from.gp + t->ps[0].g : t->ps[0].g;
-            ok = ui_edit_doc_insert_remove(d, r, t);
+        fi->p = p;
+        fi->m = m;
+        fi->g = ui_edit_str.glyphs(p, m);
+        fi->ignore_case = f->ignore_case;
+        fi->whole_word  = f->whole_word;
+        for (int32_t i = 0; i < 2; i++) {
+            const uint8_t c = i == 0 ? p[0] : p[m - 1];
+            const uint8_t l = ui_edit_find_fold(c);
+            const bool letter = f->ignore_case && 'a' <= l && l <= 'z';
+            uint8_t* b = i == 0 ? fi->f : fi->l;
+            b[0] = c;
+            b[1] = !letter ? c : (l == c ? (uint8_t)(c - 0x20) : l);
         }
     }
-    if (undo != null) { undo->range = x; }
-    ui_edit_doc_after_replace_text(d, ok, r, x, t);
     return ok;
 }
 
-static bool ui_edit_doc_replace_undoable(ui_edit_doc_t* d,
-        const ui_edit_range_t* r, const ui_edit_text_t* t,
-        ui_edit_to_do_t* undo) {
-    bool ok = ui_edit_doc_replace_text(d, r, t, undo);
-    if (ok && undo != null) {
-        undo->next = d->undo;
-        d->undo = undo;
-        // redo stack is not valid after new replace, empty it:
-        while (d->redo != null) {
-            ui_edit_to_do_t* next = d->redo->next;
-            ui_edit_doc.dispose_to_do(d->redo);
-            ut_heap.free(d->redo);
-            d->redo = next;
+static bool ui_edit_finder_match(const ui_edit_finder_t* fi,
+        const uint8_t* u, int32_t b, int32_t i) {
+    // verifies candidate u[i..i + m[ with u[0..b[ context for whole words
+    bool match = true;
+    if (!fi->ignore_case) {
+        match = memcmp(u + i, fi->p, (size_t)fi->m) == 0;
+    } else {
+        for (int32_t k = 0; match && k < fi->m; k++) {
+            match = ui_edit_find_fold(u[i + k]) == ui_edit_find_fold(fi->p[k]);
+        }
+    }
+    if (match && fi->whole_word) {
+        match = (i == 0 || !ui_edit_find_word(u[i - 1])) &&
+                (i + fi->m == b || !ui_edit_find_word(u[i + fi->m]));
+    }
+    return match;
+}
+
+static int32_t ui_edit_finder_scan(const ui_edit_finder_t* fi,
+        const uint8_t* u, int32_t b, int32_t from, int32_t to) {
+    // returns position of the first match inside u[from..to[ or -1
+    const int32_t m = fi->m;
+    const int32_t last = to - m; // last candidate position
+    int32_t i = from;
+    int32_t found = -1;
+    #if defined(__AVX2__)
+        const __m256i f0 = _mm256_set1_epi8((char)fi->f[0]);
+        const __m256i f1 = _mm256_set1_epi8((char)fi->f[1]);
+        const __m256i l0 = _mm256_set1_epi8((char)fi->l[0]);
+        const __m256i l1 = _mm256_set1_epi8((char)fi->l[1]);
+        while (found < 0 && i + 31 <= last) {
+            const __m256i a = _mm256_loadu_si256((const __m256i*)(u + i));
+            const __m256i z = _mm256_loadu_si256((const __m256i*)(u + i + m - 1));
+            const __m256i e = _mm256_and_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(a, f0), _mm256_cmpeq_epi8(a, f1)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(z, l0), _mm256_cmpeq_epi8(z, l1)));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(e);
+            for (int32_t k = i; found < 0 && mask != 0; k++, mask >>= 1) {
+                if ((mask & 1) && ui_edit_finder_match(fi, u, b, k)) { found = k; }
+            }
+            i += 32;
+        }
+    #endif
+    #if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        const __m128i f2 = _mm_set1_epi8((char)fi->f[0]);
+        const __m128i f3 = _mm_set1_epi8((char)fi->f[1]);
+        const __m128i l2 = _mm_set1_epi8((char)fi->l[0]);
+        const __m128i l3 = _mm_set1_epi8((char)fi->l[1]);
+        while (found < 0 && i + 15 <= last) {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(u + i));
+            const __m128i z = _mm_loadu_si128((const __m128i*)(u + i + m - 1));
+            const __m128i e = _mm_and_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(a, f2), _mm_cmpeq_epi8(a, f3)),
+                _mm_or_si128(_mm_cmpeq_epi8(z, l2), _mm_cmpeq_epi8(z, l3)));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(e);
+            for (int32_t k = i; found < 0 && mask != 0; k++, mask >>= 1) {
+                if ((mask & 1) && ui_edit_finder_match(fi, u, b, k)) { found = k; }
+            }
+            i += 16;
+        }
+    #endif
+    // portable fallback (e.g. ARM64) and the tail:
+    while (found < 0 && i <= last) {
+        if ((u[i] == fi->f[0] || u[i] == fi->f[1]) &&
+            (u[i + m - 1] == fi->l[0] || u[i + m - 1] == fi->l[1]) &&
+             ui_edit_finder_match(fi, u, b, i)) {
+            found = i;
+        }
+        i++;
+    }
+    return found;
+}
+
+typedef struct ui_edit_find_chunk_s { // paragraphs [pf..pt] of the range
+    const ui_edit_text_t*   t;
+    const ui_edit_finder_t* fi;
+    int32_t pf;     // first paragraph
+    int32_t fb;     // first byte in the first paragraph
+    int32_t fg;     // glyph at the first byte
+    int32_t pt;     // last paragraph
+    int32_t tb;     // end byte (exclusive) in the last paragraph
+    int32_t limit;  // maximum number of matches
+    int32_t count;  // number of matches
+    ui_edit_range_t  first;   // first match
+    ui_edit_range_t* matches; // heap allocated matches when limit > 1
+    int32_t capacity;
+    bool    ok;     // false on out of memory
+} ui_edit_find_chunk_t;
+
+static bool ui_edit_find_add(ui_edit_find_chunk_t* c,
+        const ui_edit_range_t* r) {
+    bool ok = true;
+    if (c->limit > 1 && c->count == c->capacity) {
+        const int32_t n = c->capacity == 0 ? 16 : c->capacity * 2;
+        ok = c->capacity < INT32_MAX / 2 &&
+             ut_heap.realloc((void**)&c->matches, n * (int64_t)sizeof(*r)) == 0;
+        if (ok) { c->capacity = n; }
+    }
+    if (ok) {
+        if (c->count == 0) { c->first = *r; }
+        if (c->limit > 1) { c->matches[c->count] = *r; }
+        c->count++;
+    }
+    return ok;
+}
+
+static void ui_edit_find_chunk(void* p) {
+    // may run on a worker thread thus only reads raw paragraphs
+    ui_edit_find_chunk_t* c = (ui_edit_find_chunk_t*)p;
+    const ui_edit_finder_t* fi = c->fi;
+    for (int32_t pn = c->pf; c->ok && c->count < c->limit && pn <= c->pt; pn++) {
+        const ui_edit_str_t* s = ui_edit_text_raw(c->t, pn);
+        const int32_t e = pn == c->pt ? c->tb : s->b;
+        int32_t i = pn == c->pf ? c->fb : 0; // byte
+        int32_t g = pn == c->pf ? c->fg : 0; // glyph at byte i
+        bool more = true;
+        while (c->ok && more && c->count < c->limit) {
+            const int32_t k = ui_edit_finder_scan(fi, s->u, s->b, i, e);
+            more = k >= 0;
+            if (more) {
+                g += ui_edit_find_glyphs(s->u + i, k - i);
+                const ui_edit_range_t r = {
+                    .from = { .pn = pn, .gp = g },
+                    .to   = { .pn = pn, .gp = g + fi->g }
+                };
+                c->ok = ui_edit_find_add(c, &r);
+                i = k + fi->m;
+                g += fi->g;
+            }
+        }
+    }
+}
+
+static bool ui_edit_doc_find(ui_edit_doc_t* d, const ui_edit_find_t* f,
+        const ui_edit_pg_t pg, ui_edit_range_t* match) {
+    ui_edit_text_close(&d->text);
+    const ui_edit_text_t* t = &d->text;
+    ui_edit_check_pg_inside_text(t, &pg);
+    ui_edit_finder_t fi;
+    bool found = false;
+    if (ui_edit_finder_init(&fi, f)) {
+        ui_edit_find_chunk_t c = {
+            .t = t, .fi = &fi, .limit = 1, .ok = true,
+            .pf = pg.pn, .fg = pg.gp,
+            .fb = ui_edit_str.g2b(ui_edit_text.ps(t, pg.pn), pg.gp),
+            .pt = t->np - 1, .tb = ui_edit_text_raw(t, t->np - 1)->b
+        };
+        ui_edit_find_chunk(&c);
+        found = c.count > 0;
+        if (found) { *match = c.first; }
+    }
+    return found;
+}
+
+static int32_t ui_edit_doc_find_all(ui_edit_doc_t* d, const ui_edit_find_t* f,
+        const ui_edit_range_t* range, ui_edit_range_t* *matches) {
+    // range is split at paragraph boundaries into chunks of about
+    // the same number of bytes searched on ui_edit_text.threads
+    *matches = null;
+    ui_edit_text_close(&d->text);
+    const ui_edit_text_t* t = &d->text;
+    const ui_edit_range_t r = ui_edit_range.ordered(t, range);
+    ui_edit_check_range_inside_text(t, &r);
+    ui_edit_finder_t fi;
+    if (!ui_edit_finder_init(&fi, f)) { return 0; }
+    const int64_t fo = ui_edit_text.offset(t, r.from);
+    const int64_t bytes = ui_edit_text.offset(t, r.to) - fo;
+    const int32_t threads = ui_edit_text.threads > 0 ?
+        ui_edit_text.threads : ut_thread.processors();
+    const int32_t n = bytes < ui_edit_text_parallel_min ? 1 :
+        ut_max(1, ut_min(ut_min(threads,
+            (int32_t)(bytes / ui_edit_text_chunk_min)),
+            (int32_t)ui_edit_text_chunks_max));
+    ui_edit_find_chunk_t chunks[ui_edit_text_chunks_max];
+    memset(chunks, 0x00, sizeof(chunks));
+    int32_t k = 0; // number of not empty chunks
+    int32_t pn = r.from.pn;
+    for (int32_t i = 0; i < n; i++) {
+        // first paragraph of the next chunk:
+        const int32_t next = i == n - 1 ? r.to.pn + 1 :
+            ui_edit_text.pg(t, fo + bytes * (i + 1) / n).pn;
+        if (next > pn) {
+            ui_edit_find_chunk_t* c = &chunks[k++];
+            c->t = t;
+            c->fi = &fi;
+            c->limit = INT32_MAX;
+            c->ok = true;
+            c->pf = pn;
+            c->pt = next - 1;
+            c->tb = ui_edit_text_raw(t, c->pt)->b;
+            pn = next;
+        }
+    }
+    assert(k > 0 && chunks[0].pf == r.from.pn && chunks[k - 1].pt == r.to.pn);
+    chunks[0].fg = r.from.gp;
+    chunks[0].fb = ui_edit_str.g2b(ui_edit_text.ps(t, r.from.pn), r.from.gp);
+    chunks[k - 1].tb = ui_edit_str.g2b(ui_edit_text.ps(t, r.to.pn), r.to.gp);
+    ui_edit_text_parallel(chunks, sizeof(chunks[0]), k, ui_edit_find_chunk);
+    bool ok = true;
+    int64_t count = 0;
+    for (int32_t i = 0; i < k; i++) {
+        ok = ok && chunks[i].ok;
+        count += chunks[i].count;
+    }
+    ok = ok && count <= INT32_MAX;
+    if (ok && count > 0) {
+        ok = ut_heap.alloc((void**)matches, count * (int64_t)sizeof(**matches)) == 0;
+    }
+    int32_t m = 0;
+    for (int32_t i = 0; i < k; i++) {
+        if (ok && chunks[i].count > 0) {
+            memcpy(*matches + m, chunks[i].matches,
+                   chunks[i].count * sizeof(chunks[i].matches[0]));
+            m += chunks[i].count;
+        }
+        if (chunks[i].matches != null) { ut_heap.free(chunks[i].matches); }
+    }
+    if (!ok) { *matches = null; }
+    return ok ? m : -1;
+}
+
+static int32_t ui_edit_doc_replace_all(ui_edit_doc_t* d,
+        const ui_edit_find_t* f, const ui_edit_range_t* range,
+        const uint8_t* utf8, int32_t bytes) {
+    ui_edit_range_t* matches = null;
+    const int32_t n = ui_edit_doc_find_all(d, f, range, &matches);
+    ui_edit_replacement_t* replacements = null;
+    bool ok = n >= 0;
+    if (ok && n > 0) {
+        ok = ut_heap.alloc((void**)&replacements,
+                           n * (int64_t)sizeof(replacements[0])) == 0;
+    }
+    if (ok && n > 0) {
+        for (int32_t i = 0; i < n; i++) {
+            replacements[i].range = matches[i];
+            replacements[i].utf8  = utf8;
+            replacements[i].bytes = bytes;
+        }
+        ok = ui_edit_doc.replace_batch(d, replacements, n);
+    }
+    if (replacements != null) { ut_heap.free(replacements); }
+    if (matches != null) { ut_heap.free(matches); }
+    return ok ? n : -1;
+}
+
+// Trigram index: lists[] is open addressing hash table of posting lists.
+// Slots are assigned to paragraphs in increasing order thus posting
+// lists are always sorted and the slot is appended to a list only once.
+
+typedef struct ui_edit_index_list_s {
+    uint32_t key;   // 0: empty entry, otherwise trigram | 0x01000000
+    int32_t  n;     // number of slots
+    int32_t  c;     // capacity of slots[]
+    int32_t* slots; // sorted
+} ui_edit_index_list_t;
+
+typedef struct ui_edit_index_slot_s {
+    int32_t pn;      // paragraph number or -1 for stale slot
+    int32_t entries; // number of lists the slot was appended to
+} ui_edit_index_slot_t;
+
+enum { ui_edit_index_stale_min = 64 * 1024 }; // entries
+
+static uint32_t ui_edit_index_key(const uint8_t* u) {
+    return 0x01000000U | ((uint32_t)ui_edit_find_fold(u[0]) << 16) |
+           ((uint32_t)ui_edit_find_fold(u[1]) << 8) | ui_edit_find_fold(u[2]);
+}
+
+static ui_edit_index_list_t* ui_edit_index_lookup(const ui_edit_index_t* x,
+        uint32_t key) {
+    // returns the list of the key or the empty entry where it belongs
+    const uint32_t mask = (uint32_t)x->capacity - 1;
+    uint32_t i = (key * 0x9E3779B1U) & mask;
+    while (x->lists[i].key != 0 && x->lists[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &x->lists[i];
+}
+
+static bool ui_edit_index_grow(ui_edit_index_t* x) {
+    const int32_t c = x->capacity == 0 ? 1024 : x->capacity * 2;
+    ui_edit_index_list_t* lists = null;
+    bool ok = x->capacity < INT32_MAX / 2 &&
+        ut_heap.alloc_zero((void**)&lists, c * (int64_t)sizeof(lists[0])) == 0;
+    if (ok) {
+        ui_edit_index_list_t* old = x->lists;
+        const int32_t n = x->capacity;
+        x->lists = lists;
+        x->capacity = c;
+        for (int32_t i = 0; i < n; i++) {
+            if (old[i].key != 0) { *ui_edit_index_lookup(x, old[i].key) = old[i]; }
         }
+        if (old != null) { ut_heap.free(old); }
     }
     return ok;
 }
 
-static bool ui_edit_utf8_to_heap_text(const uint8_t* u, int32_t b,
-        ui_edit_text_t* it) {
-    assert((b == 0) == (u == null || u[0] == 0x00));
-    return ui_edit_text.init(it, b != 0 ? u : null, b, true);
+static bool ui_edit_index_add(ui_edit_index_t* x, uint32_t key, int32_t slot) {
+    bool ok = (x->count + 1) * 2 <= x->capacity || ui_edit_index_grow(x);
+    ui_edit_index_list_t* l = ok ? ui_edit_index_lookup(x, key) : null;
+    if (ok && (l->n == 0 || l->slots[l->n - 1] != slot)) {
+        if (l->key == 0) { l->key = key; x->count++; }
+        if (l->n == l->c) {
+            const int32_t c = l->c == 0 ? 4 : l->c * 2;
+            ok = l->c < INT32_MAX / 2 &&
+                 ut_heap.realloc((void**)&l->slots, c * (int64_t)sizeof(int32_t)) == 0;
+            if (ok) { l->c = c; }
+        }
+        if (ok) {
+            l->slots[l->n++] = slot;
+            x->slot[slot].entries++;
+            x->entries++;
+        }
+    }
+    return ok;
 }
 
-static bool ui_edit_doc_replace(ui_edit_doc_t* d,
-        const ui_edit_range_t* range, const uint8_t* u, int32_t b) {
-    ui_edit_text_t* dt = &d->text;
-    const ui_edit_range_t r = ui_edit_range.ordered(dt, range);
-    ui_edit_to_do_t* undo = null;
-    bool ok = ut_heap.alloc_zero((void**)&undo, sizeof(ui_edit_to_do_t)) == 0;
+static bool ui_edit_index_paragraph(ui_edit_index_t* x, int32_t pn) {
+    // assigns new slot to the paragraph pn and indexes its trigrams
+    bool ok = x->ns < x->nc;
+    if (!ok && x->nc < INT32_MAX / 2) {
+        const int32_t c = ut_max(x->nc * 2, 1024);
+        ok = ut_heap.realloc((void**)&x->slot, c * (int64_t)sizeof(x->slot[0])) == 0;
+        if (ok) { x->nc = c; }
+    }
+    if (ok) {
+        const int32_t slot = x->ns++;
+        x->slot[slot].pn = pn;
+        x->slot[slot].entries = 0;
+        x->slots[pn] = slot;
+        // lazy paragraphs are indexed without materialization:
+        const ui_edit_str_t* s = ui_edit_text_raw(&x->d->text, pn);
+        for (int32_t i = 0; ok && i + 3 <= s->b; i++) {
+            ok = ui_edit_index_add(x, ui_edit_index_key(s->u + i), slot);
+        }
+    }
+    return ok;
+}
+
+static bool ui_edit_index_reserve(ui_edit_index_t* x, int32_t np) {
+    bool ok = np <= x->sc;
+    if (!ok) {
+        const int32_t c = ut_max(np, ut_min(x->sc, INT32_MAX / 2) * 2);
+        ok = ut_heap.realloc((void**)&x->slots, c * (int64_t)sizeof(int32_t)) == 0;
+        if (ok) { x->sc = c; }
+    }
+    return ok;
+}
+
+static void ui_edit_index_free(ui_edit_index_t* x) {
+    for (int32_t i = 0; i < x->capacity; i++) {
+        if (x->lists[i].slots != null) { ut_heap.free(x->lists[i].slots); }
+    }
+    if (x->lists != null) { ut_heap.free(x->lists); }
+    if (x->slots != null) { ut_heap.free(x->slots); }
+    if (x->slot  != null) { ut_heap.free(x->slot); }
+    ui_edit_notify_t notify = x->notify;
+    ui_edit_doc_t* d = x->d;
+    memset(x, 0x00, sizeof(*x));
+    x->notify = notify;
+    x->d = d;
+}
+
+static bool ui_edit_index_build(ui_edit_index_t* x) {
+    ui_edit_index_free(x);
+    ui_edit_text_close(&x->d->text);
+    const int32_t np = x->d->text.np;
+    bool ok = ui_edit_index_reserve(x, np);
+    if (ok) { x->np = np; }
+    for (int32_t pn = 0; ok && pn < np; pn++) {
+        ok = ui_edit_index_paragraph(x, pn);
+    }
+    if (!ok) { ui_edit_index_free(x); }
+    x->valid = ok;
+    return ok;
+}
+
+static void ui_edit_index_after(ui_edit_notify_t* notify,
+        const ui_edit_notify_info_t* ni) {
+    // paragraphs [pnf..pnf + removed - 1] were replaced by [pnf..pnt]
+    ui_edit_index_t* x = (ui_edit_index_t*)notify;
+    if (!ni->ok) { x->valid = false; } // may be partially applied
+    if (x->valid) {
+        ui_edit_text_close(&x->d->text); // trigrams of contiguous bytes
+        const int32_t inserted = ni->pnt - ni->pnf + 1;
+        const int32_t removed  = inserted - ni->inserted + ni->deleted;
+        assert(x->np - removed + inserted == ni->d->text.np);
+        for (int32_t i = 0; i < removed; i++) {
+            ui_edit_index_slot_t* s = &x->slot[x->slots[ni->pnf + i]];
+            x->stale += s->entries;
+            s->pn = -1;
+        }
+        bool ok = ui_edit_index_reserve(x, x->np - removed + inserted);
+        if (ok && inserted != removed) {
+            memmove(x->slots + ni->pnf + inserted,
+                    x->slots + ni->pnf + removed,
+                    (x->np - ni->pnf - removed) * sizeof(x->slots[0]));
+            x->np += inserted - removed;
+            x->dirty = true;
+        }
+        for (int32_t pn = ni->pnf; ok && pn <= ni->pnt; pn++) {
+            ok = ui_edit_index_paragraph(x, pn);
+        }
+        if (ok && x->stale > ui_edit_index_stale_min &&
+                  x->stale > x->entries - x->stale) {
+            ok = ui_edit_index_build(x);
+        }
+        x->valid = ok;
+    }
+}
+
+static bool ui_edit_index_init(ui_edit_index_t* x, ui_edit_doc_t* d) {
+    memset(x, 0x00, sizeof(*x));
+    x->d = d;
+    x->notify.after = ui_edit_index_after;
+    bool ok = ui_edit_index_build(x);
+    if (ok) {
+        ok = ui_edit_doc.subscribe(d, &x->notify);
+        if (!ok) { ui_edit_index_free(x); }
+    }
+    return ok;
+}
+
+static void ui_edit_index_dispose(ui_edit_index_t* x) {
+    ui_edit_doc.unsubscribe(x->d, &x->notify);
+    ui_edit_index_free(x);
+    memset(x, 0x00, sizeof(*x));
+}
+
+static bool ui_edit_index_contains(const ui_edit_index_list_t* l,
+        int32_t slot) {
+    int32_t lo = 0;
+    int32_t hi = l->n;
+    while (lo < hi) {
+        const int32_t m = lo + (hi - lo) / 2;
+        if (l->slots[m] < slot) { lo = m + 1; } else { hi = m; }
+    }
+    return lo < l->n && l->slots[lo] == slot;
+}
+
+static int ui_edit_index_compare(const void* a, const void* b) {
+    const int32_t x = *(const int32_t*)a;
+    const int32_t y = *(const int32_t*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int32_t ui_edit_index_find_all(ui_edit_index_t* x,
+        const ui_edit_find_t* f, ui_edit_range_t* *matches) {
+    *matches = null;
+    if (!x->valid) { ui_edit_index_build(x); }
+    ui_edit_finder_t fi;
+    if (!ui_edit_finder_init(&fi, f)) { return 0; }
+    if (fi.m < 3 || !x->valid) {
+        return ui_edit_doc.find_all(x->d, f, null, matches);
+    }
+    if (x->dirty) {
+        for (int32_t pn = 0; pn < x->np; pn++) { x->slot[x->slots[pn]].pn = pn; }
+        x->dirty = false;
+    }
+    // up to 16 trigrams of the pattern and the shortest posting list:
+    enum { n = 16 };
+    const ui_edit_index_list_t* lists[n];
+    const int32_t k = ut_min(fi.m - 2, (int32_t)n);
+    const ui_edit_index_list_t* shortest = null;
+    bool none = false;
+    for (int32_t i = 0; !none && i < fi.m - 2; i++) {
+        const ui_edit_index_list_t* l =
+            ui_edit_index_lookup(x, ui_edit_index_key(fi.p + i));
+        none = l->key == 0;
+        if (!none && (shortest == null || l->n < shortest->n)) { shortest = l; }
+    }
+    for (int32_t i = 0; !none && i < k; i++) {
+        const int32_t j = k == 1 ? 0 : i * (fi.m - 3) / (k - 1);
+        lists[i] = ui_edit_index_lookup(x, ui_edit_index_key(fi.p + j));
+    }
+    int32_t* candidates = null;
+    int32_t nc = 0;
+    bool ok = none || ut_heap.alloc((void**)&candidates,
+                          shortest->n * (int64_t)sizeof(int32_t)) == 0;
+    for (int32_t i = 0; ok && !none && i < shortest->n; i++) {
+        const int32_t slot = shortest->slots[i];
+        bool all = x->slot[slot].pn >= 0;
+        for (int32_t j = 0; all && j < k; j++) {
+            all = lists[j] == shortest || ui_edit_index_contains(lists[j], slot);
+        }
+        if (all) { candidates[nc++] = x->slot[slot].pn; }
+    }
+    if (nc > 1) {
+        qsort(candidates, (size_t)nc, sizeof(candidates[0]), ui_edit_index_compare);
+    }
+    ui_edit_find_chunk_t c = {
+        .t = &x->d->text, .fi = &fi, .limit = INT32_MAX, .ok = true
+    };
+    for (int32_t i = 0; ok && c.ok && i < nc; i++) {
+        c.pf = candidates[i];
+        c.pt = candidates[i];
+        c.tb = ui_edit_text_raw(c.t, c.pt)->b;
+        ui_edit_find_chunk(&c);
+    }
+    ok = ok && c.ok;
+    if (candidates != null) { ut_heap.free(candidates); }
+    if (ok && c.count > 0) {
+        *matches = c.matches;
+    } else if (c.matches != null) {
+        ut_heap.free(c.matches);
+    }
+    return ok ? c.count : -1;
+}
+
+// "<filename>.journal" starts with a header:
+//     magic[8], bytes[8] and hash[8] (FNV-1a 64) of the file content
+// followed by the records:
+//     varint n, payload[n], checksum[4] (low 32 bits of ut_num.hash64()
+//     of the payload)
+// payload: varints from.pn, from.gp, to.pn, to.gp of the replaced range
+// and the utf8 (paragraphs separated by '\n') that replaced it.
+
+enum {
+    ui_edit_journal_header = 24,
+    ui_edit_journal_buffer = 64 * 1024,   // file stream buffer bytes
+    ui_edit_journal_limit  = 1024 * 1024  // default j->limit
+};
+
+static const uint8_t ui_edit_journal_magic[8] =
+    { 'u', 'i', 'e', 'j', 'r', 'n', 'l', '1' };
+
+typedef struct ui_edit_journal_hash_s { // stream that only hashes
+    ut_stream_if stream;
+    uint64_t hash;
+    int64_t  bytes;
+} ui_edit_journal_hash_t;
+
+static errno_t ui_edit_journal_hash_write(ut_stream_if* s, const void* data,
+        int64_t bytes, int64_t *transferred) {
+    ui_edit_journal_hash_t* h = (ui_edit_journal_hash_t*)s;
+    const uint8_t* u = (const uint8_t*)data;
+    for (int64_t i = 0; i < bytes; i++) {
+        h->hash = (h->hash ^ u[i]) * 0x100000001B3ULL;
+    }
+    h->bytes += bytes;
+    if (transferred != null) { *transferred = bytes; }
+    return 0;
+}
+
+static errno_t ui_edit_journal_header_of(ui_edit_doc_t* d,
+        uint8_t header[ui_edit_journal_header]) {
+    // content of the document exactly as compaction saves it ("\n")
+    ui_edit_journal_hash_t h = {
+        .stream = { .write = ui_edit_journal_hash_write },
+        .hash = 0xCBF29CE484222325ULL
+    };
+    errno_t r = ui_edit_doc.write(d, null, &h.stream, false);
+    memcpy(header, ui_edit_journal_magic, sizeof(ui_edit_journal_magic));
+    memcpy(header + 8,  &h.bytes, sizeof(h.bytes));
+    memcpy(header + 16, &h.hash,  sizeof(h.hash));
+    return r;
+}
+
+static errno_t ui_edit_journal_start(ui_edit_journal_t* j) {
+    // truncates the journal to the header of the current content
+    uint8_t header[ui_edit_journal_header];
+    errno_t r = ui_edit_journal_header_of(j->d, header);
+    if (j->fs.file != null || j->fs.data != null) {
+        const errno_t close = ut_streams.file_close(&j->fs);
+        if (r == 0) { r = close; }
+    }
+    if (r == 0) {
+        r = ut_streams.file_write(&j->fs, j->name.s, ui_edit_journal_buffer);
+    }
+    if (r == 0) { r = j->fs.stream.write(&j->fs.stream, header, sizeof(header), null); }
+    if (r == 0) { r = ut_streams.file_flush(&j->fs); }
+    if (r == 0) {
+        j->bytes   = ui_edit_journal_header;
+        j->records = 0;
+        j->synced  = ut_clock.seconds();
+    }
+    return r;
+}
+
+static errno_t ui_edit_journal_sync(ui_edit_journal_t* j) {
+    errno_t r = j->error;
+    if (r == 0) {
+        r = ut_streams.file_flush(&j->fs);
+        j->synced = ut_clock.seconds();
+        if (r != 0) { j->error = r; }
+    }
+    return r;
+}
+
+static errno_t ui_edit_journal_compact(ui_edit_journal_t* j) {
+    // the file is replaced first: crash in between leaves the old
+    // journal that does not match the new file and is discarded.
+    // Failed save() leaves both the file and the journal intact and
+    // the recording goes on (e.g. Windows fails to replace the file
+    // still mapped by ui_edit_doc.open())
+    errno_t r = j->error;
+    if (r == 0) { r = ui_edit_doc.save(j->d, j->base.s, j->crlf); }
+    if (r == 0) {
+        r = ui_edit_journal_start(j);
+        if (r == 0) { j->compactions++; } else { j->error = r; }
+    }
+    return r;
+}
+
+static errno_t ui_edit_journal_resume(ui_edit_journal_t* j) {
+    // keeps the replayed records: the journal still applies to the file
+    errno_t r = ut_streams.file_append(&j->fs, j->name.s,
+                                       ui_edit_journal_buffer);
+    if (r == 0) {
+        j->records = j->replayed;
+        j->synced  = ut_clock.seconds();
+    }
+    return r;
+}
+
+static errno_t ui_edit_journal_keep(ui_edit_journal_t* j,
+        const uint8_t* data, int32_t bytes) {
+    // replaces the journal with its intact records (without torn tail)
+    ut_file_name_t tmp = {0};
+    ut_str.format(tmp.s, countof(tmp.s), "%s.tmp", j->name.s);
+    ut_stream_file_if fs = {0};
+    errno_t r = ut_streams.file_write(&fs, tmp.s, ui_edit_journal_buffer);
+    if (r == 0) {
+        r = fs.stream.write(&fs.stream, data, bytes, null);
+        if (r == 0) { r = ut_streams.file_flush(&fs); }
+        const errno_t close = ut_streams.file_close(&fs);
+        if (r == 0) { r = close; }
+        if (r == 0) { r = ut_files.move(tmp.s, j->name.s); }
+        if (r != 0) { ut_files.unlink(tmp.s); }
+    }
+    return r;
+}
+
+static uint32_t ui_edit_journal_checksum(const uint8_t* p, int32_t n) {
+    // ut_num.hash32() skips the first byte, every payload byte counts
+    assert(n > 0);
+    return (uint32_t)ut_num.hash64((const char*)p, n);
+}
+
+static errno_t ui_edit_journal_record(ui_edit_journal_t* j,
+        const ui_edit_range_t* range, const ui_edit_range_t* x) {
+    ui_edit_doc_t* d = j->d;
+    const int32_t bytes = ui_edit_doc.utf8bytes(d, x) - 1; // w/o 0x00
+    // length varint, 4 range varints, utf8 with 0x00, checksum:
+    const int64_t n = 5 + 4 * 5 + (int64_t)bytes + 1 + 4;
+    errno_t r = n <= INT32_MAX ? 0 : EFBIG;
+    if (r == 0 && n > j->capacity) {
+        r = ut_heap.realloc((void**)&j->record, n);
+        if (r == 0) { j->capacity = (int32_t)n; }
+    }
+    if (r == 0) {
+        uint8_t* p = j->record;
+        int32_t k = 5; // payload starts after the longest length varint
+        k = ui_edit_cold_put(p, k, (uint32_t)range->from.pn);
+        k = ui_edit_cold_put(p, k, (uint32_t)range->from.gp);
+        k = ui_edit_cold_put(p, k, (uint32_t)range->to.pn);
+        k = ui_edit_cold_put(p, k, (uint32_t)range->to.gp);
+        ui_edit_doc.copy(d, x, (char*)p + k); // 0x00 is overwritten below
+        k += bytes;
+        const int32_t payload = k - 5;
+        uint8_t length[5];
+        const int32_t lb = ui_edit_cold_put(length, 0, (uint32_t)payload);
+        memcpy(p + 5 - lb, length, lb);
+        const uint32_t checksum = ui_edit_journal_checksum(p + 5, payload);
+        memcpy(p + k, &checksum, sizeof(checksum));
+        k += sizeof(checksum);
+        r = j->fs.stream.write(&j->fs.stream, p + 5 - lb, k - (5 - lb), null);
+        if (r == 0) {
+            j->bytes += k - (5 - lb);
+            j->records++;
+        }
+    }
+    return r;
+}
+
+static void ui_edit_journal_after(ui_edit_notify_t* notify,
+        const ui_edit_notify_info_t* ni) {
+    ui_edit_journal_t* j = (ui_edit_journal_t*)notify;
+    if (ni->ok && j->error == 0) {
+        ui_edit_doc_t* d = j->d;
+        const ui_edit_range_t r = ui_edit_range.order(*ni->r);
+        errno_t e = ui_edit_journal_record(j, &r, ni->x);
+        if (e == 0) {
+            const ui_edit_pg_t end = ui_edit_range.end(&d->text);
+            const int64_t half = ui_edit_text.offset(&d->text, end) / 2;
+            // Windows cannot replace the file mapped by ui_edit_doc.open()
+            if (d->mapping == null && j->bytes > j->limit && j->bytes > half) {
+                e = ui_edit_journal_compact(j);
+            } else if (ut_clock.seconds() - j->synced >= j->period) {
+                e = ui_edit_journal_sync(j);
+            }
+        }
+        if (e != 0 && j->error == 0) { j->error = e; }
+    }
+}
+
+static bool ui_edit_journal_apply(ui_edit_journal_t* j, const uint8_t* p,
+        int32_t n) {
+    ui_edit_doc_t* d = j->d;
+    ui_edit_range_t r = {0};
+    int32_t k = 0;
+    bool ok = ui_edit_cold_get(p, n, &k, &r.from.pn) &&
+              ui_edit_cold_get(p, n, &k, &r.from.gp) &&
+              ui_edit_cold_get(p, n, &k, &r.to.pn) &&
+              ui_edit_cold_get(p, n, &k, &r.to.gp);
+    ok = ok && ui_edit_range.compare(r.from, r.to) <= 0 &&
+         ui_edit_range_inside_text(&d->text, r);
     if (ok) {
         ui_edit_text_t t = {0};
-        ok = ui_edit_utf8_to_heap_text(u, b, &t);
+        ok = ui_edit_text.init(&t, n > k ? p + k : null, n - k, false);
         if (ok) {
-            ok = ui_edit_doc_replace_undoable(d, &r, &t, undo);
+            ok = ui_edit_doc_replace_text(d, &r, &t, null);
             ui_edit_text.dispose(&t);
         }
-        if (!ok) {
-            ui_edit_doc.dispose_to_do(undo);
-            ut_heap.free(undo);
-        }
     }
     return ok;
 }
 
-static bool ui_edit_text_dup(ui_edit_text_t* d, const ui_edit_text_t* s) {
-    ui_edit_check_zeros(d, sizeof(*d));
-    memset(d, 0x00, sizeof(*d));
-    bool ok = ui_edit_doc_realloc_ps(&d->ps, 0, s->np);
-    if (ok) {
-        d->np = s->np;
-        for (int32_t i = 0; ok && i < s->np; i++) {
-            const ui_edit_str_t* p = &s->ps[i];
-            ok = ui_edit_str.replace(&d->ps[i], 0, 0, p->u, p->b);
-        }
-    }
-    if (!ok) {
-        ui_edit_text.dispose(d);
+static errno_t ui_edit_journal_replay(ui_edit_journal_t* j) {
+    // applies intact records of the journal that matches the file
+    ut_file_t* f = null;
+    ut_files_stat_t st = {0};
+    uint8_t* data = null;
+    errno_t r = ut_files.open(&f, j->name.s, ut_files.o_rd);
+    if (r == 0) { r = ut_files.stat(f, &st, false); }
+    if (r == 0 && st.size > INT32_MAX) { r = EFBIG; }
+    const int32_t n = r == 0 ? (int32_t)st.size : 0;
+    if (n > ui_edit_journal_header) {
+        r = ut_heap.alloc((void**)&data, n);
+        int64_t k = 0;
+        while (r == 0 && k < n) {
+            int64_t transferred = 0;
+            r = ut_files.read(f, data + k, n - k, &transferred);
+            if (r == 0 && transferred == 0) { r = EIO; }
+            k += transferred;
+        }
+    }
+    if (f != null) { ut_files.close(f); }
+    if (r == 0 && n > ui_edit_journal_header) {
+        uint8_t header[ui_edit_journal_header];
+        r = ui_edit_journal_header_of(j->d, header);
+        bool ok = r == 0 && memcmp(header, data, sizeof(header)) == 0;
+        int32_t k = ui_edit_journal_header;
+        while (ok && k < n) {
+            int32_t payload = 0;
+            int32_t at = k;
+            ok = ui_edit_cold_get(data, n, &at, &payload) &&
+                 payload <= n - at - (int32_t)sizeof(uint32_t);
+            if (ok) {
+                uint32_t checksum = 0;
+                memcpy(&checksum, data + at + payload, sizeof(checksum));
+                ok = payload > 0 &&
+                     checksum == ui_edit_journal_checksum(data + at, payload);
+            }
+            ok = ok && ui_edit_journal_apply(j, data + at, payload);
+            if (ok) {
+                k = at + payload + (int32_t)sizeof(uint32_t);
+                j->replayed++;
+            }
+        }
+        j->bytes = k;
+        if (j->replayed > 0 && k < n) { r = ui_edit_journal_keep(j, data, k); }
+    }
+    if (data != null) { ut_heap.free(data); }
+    return r;
+}
+
+static errno_t ui_edit_journal_dispose(ui_edit_journal_t* j) {
+    ui_edit_doc.unsubscribe(j->d, &j->notify);
+    errno_t r = ui_edit_journal_sync(j);
+    const errno_t close = ut_streams.file_close(&j->fs);
+    if (r == 0) { r = close; }
+    if (j->record != null) { ut_heap.free(j->record); }
+    memset(j, 0x00, sizeof(*j));
+    return r;
+}
+
+static errno_t ui_edit_journal_open(ui_edit_journal_t* j, ui_edit_doc_t* d,
+        const char* filename) {
+    memset(j, 0x00, sizeof(*j));
+    j->d = d;
+    j->limit  = ui_edit_journal_limit;
+    j->period = 1.0;
+    j->notify.after = ui_edit_journal_after;
+    errno_t r = strlen(filename) + 13 > countof(j->name.s) ? // ".journal.tmp"
+                ut_runtime.error.name_too_long : 0;
+    if (r == 0) {
+        ut_str.format(j->base.s, countof(j->base.s), "%s", filename);
+        ut_str.format(j->name.s, countof(j->name.s), "%s.journal", filename);
+        if (ut_files.exists(j->name.s)) { r = ui_edit_journal_replay(j); }
+    }
+    if (r == 0) {
+        r = j->replayed > 0 ? ui_edit_journal_resume(j) :
+                              ui_edit_journal_start(j);
+    }
+    if (r == 0 && !ui_edit_doc.subscribe(d, &j->notify)) { r = ENOMEM; }
+    if (r != 0) {
+        ut_streams.file_close(&j->fs);
+        if (j->record != null) { ut_heap.free(j->record); }
+        memset(j, 0x00, sizeof(*j));
+    }
+    return r;
+}
+
+typedef struct ui_edit_cold_leaf_s {
+    ui_edit_node_t* n;
+    int64_t touched;
+    int64_t bytes; // ui_edit_node_memory()
+} ui_edit_cold_leaf_t;
+
+static void ui_edit_doc_cold_leaves(ui_edit_cold_t* c, ui_edit_node_t* n,
+        bool exclusive, ui_edit_cold_leaf_t* leaves, int32_t* count) {
+    // counts (leaves == null) or collects leaves that may be compressed:
+    // not shared with snapshots on the whole path from the root
+    exclusive = exclusive && ut_atomics.load32(&n->rc) == 1;
+    if (!ui_edit_node_is_leaf(n)) {
+        for (int32_t i = 0; i < n->n; i++) {
+            ui_edit_doc_cold_leaves(c, n->child[i], exclusive, leaves, count);
+        }
+    } else if (ut_atomics.load32(&n->cold) != 0) {
+        if (leaves != null) { c->bytes += n->zb; c->leaves++; }
+    } else {
+        if (leaves != null) {
+            const int64_t bytes = ui_edit_node_memory(n);
+            c->hot += bytes;
+            if (exclusive && n->n > 0) {
+                leaves[*count] = (ui_edit_cold_leaf_t){
+                    .n = n, .touched = ut_atomics.load64(&n->touched),
+                    .bytes = bytes
+                };
+                (*count)++;
+            }
+        } else {
+            (*count)++;
+        }
+    }
+}
+
+static int ui_edit_doc_cold_compare(const void* p1, const void* p2) {
+    const ui_edit_cold_leaf_t* l1 = (const ui_edit_cold_leaf_t*)p1;
+    const ui_edit_cold_leaf_t* l2 = (const ui_edit_cold_leaf_t*)p2;
+    return l1->touched < l2->touched ? -1 : l1->touched > l2->touched ? 1 : 0;
+}
+
+static void ui_edit_doc_cool(ui_edit_doc_t* d) {
+    // compresses least recently used leaves until hot ones fit into
+    // the ceiling, leaves used since the previous cool() of the same
+    // document stay hot (cool() of other documents does not matter)
+    ui_edit_cold_t* c = &d->cold;
+    const int64_t epoch = c->epoch > 0 ? c->epoch :
+                          ut_atomics.load64(&ui_edit_node_epoch);
+    ui_edit_text_close(&d->text); // leaves are packed with their bytes
+    if (c->ceiling > 0 && d->text.root != null) {
+        int32_t n = 0;
+        ui_edit_doc_cold_leaves(c, d->text.root, true, null, &n);
+        ui_edit_cold_leaf_t* leaves = null;
+        if (n > 0 && ut_heap.alloc((void**)&leaves,
+                        n * (int64_t)sizeof(ui_edit_cold_leaf_t)) == 0) {
+            c->hot = 0;
+            c->bytes = 0;
+            c->leaves = 0;
+            int32_t k = 0;
+            ui_edit_doc_cold_leaves(c, d->text.root, true, leaves, &k);
+            qsort(leaves, (size_t)k, sizeof(leaves[0]),
+                  ui_edit_doc_cold_compare);
+            for (int32_t i = 0; i < k && c->hot > c->ceiling &&
+                                leaves[i].touched < epoch; i++) {
+                if (ui_edit_node_pack(leaves[i].n)) {
+                    c->hot -= leaves[i].bytes;
+                    c->bytes += leaves[i].n->zb;
+                    c->leaves++;
+                }
+            }
+            ut_heap.free(leaves);
+        }
+    }
+    c->epoch = ut_atomics.increment_int64(&ui_edit_node_epoch);
+}
+
+// dedup(): open addressing hash table of the first paragraph with
+// given utf8 bytes, every following paragraph with the same bytes
+// is pointed to the block of the first one (made on demand).
+
+typedef struct ui_edit_dedup_entry_s {
+    uint64_t hash;
+    ui_edit_str_t* p; // null: empty entry
+} ui_edit_dedup_entry_t;
+
+typedef struct ui_edit_dedup_table_s {
+    ut_heap_t* heap; // of the text
+    ui_edit_dedup_entry_t* entry; // null: count paragraphs only
+    int32_t capacity; // power of 2
+    int32_t count;    // number of paragraphs to consider
+    ui_edit_dedup_t* stats;
+    bool ok;
+} ui_edit_dedup_table_t;
+
+static bool ui_edit_doc_dedup_candidate(const ui_edit_str_t* p) {
+    // heap allocated or already shared utf8 bytes
+    return p->g2b != null && (p->c > 0 || ui_edit_str_block(p) != null);
+}
+
+static int64_t ui_edit_doc_dedup_bytes(const ui_edit_str_t* p) {
+    // utf8 and .g2b[] bytes of the paragraph if it was not shared
+    int64_t k = 0;
+    if (p->g2b != ui_edit_str.empty->g2b) {
+        k = (p->g2b[0] < 0 ? p->g / -p->g2b[0] : p->g) + 1;
     }
-    return ok;
+    return p->b + k * (int64_t)sizeof(int32_t);
 }
 
-static bool ui_edit_text_equal(ui_edit_text_t* s1, const ui_edit_text_t* s2) {
-    bool equal =  s1->np != s2->np;
-    for (int32_t i = 0; equal && i < s1->np; i++) {
-        const ui_edit_str_t* p1 = &s1->ps[i];
-        const ui_edit_str_t* p2 = &s2->ps[i];
-        equal = p1->b == p2->b &&
-                memcmp(p1->u, p2->u, p1->b) == 0;
+static ui_edit_str_block_t* ui_edit_doc_dedup_block(ut_heap_t* h,
+        const ui_edit_str_t* p, uint64_t hash) {
+    // immutable copy of the paragraph utf8 bytes and .g2b[]
+    const int32_t k = p->g2b == ui_edit_str.empty->g2b ? 0 :
+        (p->g2b[0] < 0 ? p->g / -p->g2b[0] : p->g) + 1;
+    const int64_t g2b = k * (int64_t)sizeof(int32_t);
+    ui_edit_str_block_t* x = null;
+    if (ut_heap.allocate(h, (void**)&x, sizeof(*x) + g2b + p->b,
+                         false) == 0) {
+        x->rc = 0;
+        x->k = k;
+        x->hash = hash;
+        memcpy(x + 1, p->g2b, (size_t)g2b);
+        memcpy((uint8_t*)(x + 1) + g2b, p->u, (size_t)p->b);
     }
-    return true;
+    return x;
 }
 
-static bool ui_edit_doc_do(ui_edit_doc_t* d, ui_edit_to_do_t* to_do,
-        ui_edit_to_do_t* *stack) {
-    const ui_edit_range_t* r = &to_do->range;
-    ui_edit_to_do_t* redo = null;
-    bool ok = ut_heap.alloc_zero((void**)&redo, sizeof(ui_edit_to_do_t)) == 0;
-    if (ok) {
-        ok = ui_edit_doc.replace_text(d, r, &to_do->text, redo);
-        if (ok) {
-            ui_edit_doc.dispose_to_do(to_do);
-            ut_heap.free(to_do);
-        }
-        if (ok) {
-            redo->next = *stack;
-            *stack = redo;
+static void ui_edit_doc_dedup_share(ut_heap_t* h, ui_edit_str_t* p,
+        ui_edit_str_block_t* x) {
+    // p with the same utf8 bytes as x releases its memory and refers to x
+    const int32_t b = p->b;
+    const int32_t g = p->g;
+    ut_atomics.increment_int32(&x->rc);
+    ui_edit_str_free_in(h, p);
+    p->g2b = x->k == 0 ? ui_edit_str.empty->g2b : (int32_t*)(x + 1);
+    p->u = (uint8_t*)(x + 1) + x->k * (int64_t)sizeof(int32_t);
+    p->b = b;
+    p->g = g;
+    p->c = 0;
+    memcpy(p->i, &x, sizeof(x));
+}
+
+static void ui_edit_doc_dedup_add(ui_edit_dedup_table_t* t,
+        ui_edit_str_t* p) {
+    ui_edit_str_block_t* x = ui_edit_str_block(p);
+    const uint64_t hash = x != null ? x->hash :
+        ut_num.hash64((const char*)p->u, p->b);
+    const uint32_t mask = (uint32_t)t->capacity - 1;
+    uint32_t i = (uint32_t)hash & mask;
+    ui_edit_dedup_entry_t* e = &t->entry[i];
+    while (e->p != null && (e->hash != hash || e->p->b != p->b ||
+                            memcmp(e->p->u, p->u, (size_t)p->b) != 0)) {
+        i = (i + 1) & mask;
+        e = &t->entry[i];
+    }
+    if (e->p == null) {
+        e->hash = hash;
+        e->p = p;
+    } else {
+        // the first paragraph may already be shared, otherwise reuse
+        // the block of p or make a new one:
+        ui_edit_str_block_t* s = ui_edit_str_block(e->p);
+        if (s == null) { s = x; }
+        if (s == null) { s = ui_edit_doc_dedup_block(t->heap, e->p, hash); }
+        if (s == null) {
+            t->ok = false;
         } else {
-            if (redo != null) {
-                ui_edit_doc.dispose_to_do(redo);
-                ut_heap.free(redo);
+            if (ui_edit_str_block(e->p) != s) {
+                ui_edit_doc_dedup_share(t->heap, e->p, s);
             }
+            if (x != s) { ui_edit_doc_dedup_share(t->heap, p, s); }
         }
     }
-    return ok;
-}
-
-static bool ui_edit_doc_redo(ui_edit_doc_t* d) {
-    ui_edit_to_do_t* to_do = d->redo;
-    if (to_do == null) {
-        return false;
-    } else {
-        d->redo = d->redo->next;
-        return ui_edit_doc_do(d, to_do, &d->undo);
-    }
 }
 
-static bool ui_edit_doc_undo(ui_edit_doc_t* d) {
-    ui_edit_to_do_t* to_do = d->undo;
-    if (to_do == null) {
-        return false;
-    } else {
-        d->undo = d->undo->next;
-        return ui_edit_doc_do(d, to_do, &d->redo);
+static void ui_edit_doc_dedup_leaves(ui_edit_dedup_table_t* t,
+        ui_edit_node_t* n, bool exclusive) {
+    // counts (t->entry == null), dedups or counts shared paragraphs
+    // (t->stats != null) of the leaves that are not shared with
+    // snapshots on the whole path from the root and not compressed
+    exclusive = exclusive && ut_atomics.load32(&n->rc) == 1;
+    if (!exclusive) {
+        // paragraphs may be shared with a snapshot
+    } else if (!ui_edit_node_is_leaf(n)) {
+        for (int32_t i = 0; i < n->n; i++) {
+            ui_edit_doc_dedup_leaves(t, n->child[i], exclusive);
+        }
+    } else if (ut_atomics.load32(&n->cold) == 0) {
+        for (int32_t i = 0; i < n->n && t->ok; i++) {
+            ui_edit_str_t* p = &n->ps[i];
+            if (t->stats != null) {
+                if (ui_edit_str_block(p) != null) {
+                    t->stats->paragraphs++;
+                    t->stats->bytes += ui_edit_doc_dedup_bytes(p);
+                }
+            } else if (ui_edit_doc_dedup_candidate(p)) {
+                if (t->entry == null) {
+                    t->count++;
+                } else {
+                    ui_edit_doc_dedup_add(t, p);
+                }
+            }
+        }
     }
 }
 
-static bool ui_edit_doc_init(ui_edit_doc_t* d, const uint8_t* utf8,
-        int32_t bytes, bool heap) {
-    bool ok = true;
-    ui_edit_check_zeros(d, sizeof(*d));
-    memset(d, 0x00, sizeof(d));
-    assert(bytes >= 0);
-    assert((utf8 == null) == (bytes == 0));
-    if (ok) {
-        if (bytes == 0) { // empty string
-            ok = ut_heap.alloc_zero((void**)&d->text.ps, sizeof(ui_edit_str_t)) == 0;
-            if (ok) {
-                d->text.np = 1;
-                ok = ui_edit_str.init(&d->text.ps[0], null, 0, false);
+static void ui_edit_doc_dedup(ui_edit_doc_t* d) {
+    ui_edit_dedup_table_t t = { .heap = d->text.heap, .ok = true };
+    ui_edit_dedup_t* s = &d->dedup;
+    memset(s, 0x00, sizeof(*s));
+    ui_edit_text_close(&d->text);
+    if (d->text.root != null) {
+        ui_edit_doc_dedup_leaves(&t, d->text.root, true);
+    }
+    if (t.count > 0) {
+        int64_t c = 16;
+        while (c < (int64_t)t.count * 2) { c *= 2; }
+        t.ok = c <= INT32_MAX && ut_heap.alloc_zero((void**)&t.entry,
+                    c * (int64_t)sizeof(ui_edit_dedup_entry_t)) == 0;
+        t.capacity = (int32_t)c;
+        if (t.ok) {
+            ui_edit_doc_dedup_leaves(&t, d->text.root, true);
+            for (int32_t i = 0; i < t.capacity; i++) {
+                const ui_edit_str_t* p = t.entry[i].p;
+                ui_edit_str_block_t* x = p != null ?
+                                         ui_edit_str_block(p) : null;
+                if (x != null) {
+                    s->blocks++;
+                    s->shared += (int64_t)sizeof(*x) +
+                        x->k * (int64_t)sizeof(int32_t) + p->b;
+                }
             }
-        } else {
-            ok = ui_edit_text.init(&d->text, utf8, bytes, heap);
+            t.stats = s;
+            t.ok = true;
+            ui_edit_doc_dedup_leaves(&t, d->text.root, true);
         }
+        if (t.entry != null) { ut_heap.free(t.entry); }
     }
-    return ok;
 }
 
 static void ui_edit_doc_dispose(ui_edit_doc_t* d) {
-    for (int32_t i = 0; i < d->text.np; i++) {
-        ui_edit_str.free(&d->text.ps[i]);
-    }
-    if (d->text.ps != null) {
-        ut_heap.free(d->text.ps);
-        d->text.ps = null;
-    }
-    d->text.np  = 0;
-    while (d->undo != null) {
-        ui_edit_to_do_t* next = d->undo->next;
-        d->undo->next = null;
-        ui_edit_doc.dispose_to_do(d->undo);
-        ut_heap.free(d->undo);
-        d->undo = next;
-    }
-    while (d->redo != null) {
-        ui_edit_to_do_t* next = d->redo->next;
-        d->redo->next = null;
-        ui_edit_doc.dispose_to_do(d->redo);
-        ut_heap.free(d->redo);
-        d->redo = next;
-    }
+    if (d->arena != null && ut_atomics.load32(&d->arena->rc) == 1) {
+        // no snapshots: all nodes and paragraphs go with the heap
+        d->text.root = null;
+        d->text.np = 0;
+        d->text.gap = 0;
+    } else {
+        ui_edit_text.dispose(&d->text);
+    }
+    ui_edit_arena_dispose(d);
+    if (d->mapping != null) {
+        ui_edit_mapping_release(d->mapping);
+        d->mapping = null;
+    }
+    ui_edit_history_t* h = &d->history;
+    ui_edit_history_free_stack(h, &h->undo);
+    ui_edit_history_free_stack(h, &h->redo);
+    assert(h->bytes == 0 && h->records == 0);
+    if (h->heap != null) { ut_heap.dispose(h->heap); }
+    memset(h, 0x00, sizeof(*h));
+    memset(&d->cold, 0x00, sizeof(d->cold));
+    memset(&d->dedup, 0x00, sizeof(d->dedup));
+    ui_edit_tail_t* t = &d->tail;
+    if (t->file != null) { ut_files.close(t->file); }
+    if (t->pending != null) { ut_heap.free(t->pending); }
+    memset(t, 0x00, sizeof(*t));
     assert(d->listeners == null, "unsubscribe listeners?");
     while (d->listeners != null) {
         ui_edit_listener_t* next = d->listeners->next;
@@ -6784,6 +10604,12 @@ static void ui_edit_doc_dispose(ui_edit_doc_t* d) {
 // ui_edit_str
 
 static int32_t ui_edit_str_g2b_ascii[1024]; // ui_edit_str_g2b_ascii[i] == i for all "i"
+// ASCII only strings (.g == .b) of any length share ui_edit_str_g2b_ascii
+// and never index it directly: ui_edit_str_g2b(s, gp) == gp for them.
+// Strings of ui_edit_str_long bytes and more keep capacity slack so that
+// typing in the middle of a multi-megabyte line does not reallocate.
+
+enum { ui_edit_str_long = 64 * 1024 };
 static int8_t  ui_edit_str_empty_utf8[1] = {0x00};
 
 static const ui_edit_str_t ui_edit_str_empty = {
@@ -6797,6 +10623,7 @@ static void    ui_edit_str_swap(ui_edit_str_t* s1, ui_edit_str_t* s2);
 static int32_t ui_edit_str_utf8_bytes(const uint8_t* u, int32_t b);
 static int32_t ui_edit_str_glyphs(const uint8_t* utf8, int32_t bytes);
 static int32_t ui_edit_str_gp_to_bp(const uint8_t* s, int32_t bytes, int32_t gp);
+static int32_t ui_edit_str_g2b(const ui_edit_str_t* s, int32_t gp);
 static int32_t ui_edit_str_bytes(ui_edit_str_t* s, int32_t f, int32_t t);
 static bool    ui_edit_str_expand(ui_edit_str_t* s, int32_t c);
 static void    ui_edit_str_shrink(ui_edit_str_t* s);
@@ -6804,20 +10631,24 @@ static bool    ui_edit_str_replace(ui_edit_str_t* s, int32_t f, int32_t t,
                               const uint8_t* u, int32_t b);
 static void    ui_edit_str_test(void);
 static void    ui_edit_str_free(ui_edit_str_t* s);
+static void    ui_edit_str_moved(ui_edit_str_t* s);
 
 ui_edit_str_if ui_edit_str = {
     .init        = ui_edit_str_init,
     .swap        = ui_edit_str_swap,
+    .moved       = ui_edit_str_moved,
     .utf8bytes   = ui_edit_str_utf8_bytes,
     .glyphs      = ui_edit_str_glyphs,
     .gp_to_bp    = ui_edit_str_gp_to_bp,
+    .g2b         = ui_edit_str_g2b,
     .bytes       = ui_edit_str_bytes,
     .expand      = ui_edit_str_expand,
     .shrink      = ui_edit_str_shrink,
     .replace     = ui_edit_str_replace,
     .test        = ui_edit_str_test,
     .free        = ui_edit_str_free,
-    .empty       = &ui_edit_str_empty
+    .empty       = &ui_edit_str_empty,
+    .sparse      = 0
 };
 
 #pragma push_macro("ui_edit_str_check")
@@ -6831,14 +10662,40 @@ ui_edit_str_if ui_edit_str = {
 #define ui_edit_str_check(s) do {                                   \
     /* check the s struct constrains */                             \
     assert(s->b >= 0);                                              \
-    assert(s->c == 0 || s->c >= s->b);                              \
+    assert(s->c <= 0 || s->c >= s->b);                              \
+    if (s->c < 0) { /* short string in place */                     \
+        assert(s->u == s->i && s->b <= ui_edit_str_inline);         \
+    }                                                               \
     assert(s->g >= 0);                                              \
     /* s->g2b[] may be null (not heap allocated) when .b == 0 */    \
     if (s->g == 0) { assert(s->b == 0); }                           \
-    if (s->g > 0) {                                                 \
+    const bool sparse_ = ui_edit_str_is_sparse(s);                  \
+    const bool ascii_ = s->g2b == ui_edit_str_g2b_ascii;            \
+    const ui_edit_str_gap_t gap_ = ui_edit_str_gap(s);              \
+    if (ascii_) { assert(s->g == s->b); }                           \
+    if (gap_.gp > 0) { /* edited in place, see ui_edit_str_gap_t */ \
+        assert(s->c > s->b && 0 <= gap_.bp && gap_.bp <= s->b);     \
+        assert(gap_.gp - 1 <= s->g && gap_.gg >= 0);                \
+        assert(ui_edit_str_g2b(s, gap_.gp - 1) == gap_.bp);         \
+        for (int32_t i = 1; i <= s->g && !ascii_; i++) {            \
+            const int32_t f_ = ui_edit_str_g2b(s, i - 1);           \
+            const int32_t n_ = ui_edit_str_g2b(s, i) - f_;          \
+            assert(0 < n_ && n_ <= 4);                              \
+            assert(n_ == ui_edit_str_utf8_bytes(                    \
+                ui_edit_str_at(s, f_), n_));                        \
+        }                                                           \
+    } else if (s->g > 0 && sparse_) { /* checkpoints every n_ */    \
+        const int32_t n_ = -s->g2b[0];                              \
+        int32_t bp_ = 0;                                            \
+        for (int32_t i = 1; i <= s->g / n_; i++) {                  \
+            bp_ += ui_edit_str_gp_to_bp(s->u + bp_, s->b - bp_, n_);\
+            assert(s->g2b[i] == bp_);                               \
+        }                                                           \
+    } else if (s->g > 0 && !ascii_) {                               \
         assert(s->g2b[0] == 0 && s->g2b[s->g] == s->b);             \
     }                                                               \
-    for (int32_t i = 1; i < s->g; i++) {                            \
+    for (int32_t i = 1; i < s->g && !sparse_ && !ascii_ &&          \
+                        gap_.gp == 0; i++) {                        \
         assert(0 < s->g2b[i] - s->g2b[i - 1] &&                     \
                    s->g2b[i] - s->g2b[i - 1] <= 4);                 \
         assert(s->g2b[i] - s->g2b[i - 1] ==                         \
@@ -6916,15 +10773,52 @@ static int32_t ui_edit_str_utf8_bytes(const uint8_t* u, int32_t b) {
     return 0; // invalid utf8 sequence
 }
 
+static int32_t ui_edit_str_ascii(const uint8_t* u, int32_t b) {
+    // returns number of leading ASCII bytes (< 0x80) in u[0..b - 1]
+    // skipping whole 32/16/8 bytes blocks without high bit set
+    // and leaving the block that has it to the byte loop below
+    int32_t i = 0;
+    #if defined(__AVX2__)
+        while (i + 32 <= b &&
+               _mm256_movemask_epi8(_mm256_loadu_si256(
+                   (const __m256i*)(u + i))) == 0) {
+            i += 32;
+        }
+    #endif
+    #if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || \
+        (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        while (i + 16 <= b &&
+               _mm_movemask_epi8(_mm_loadu_si128(
+                   (const __m128i*)(u + i))) == 0) {
+            i += 16;
+        }
+    #endif
+    // portable fallback (e.g. ARM64) and the tail:
+    while (i + 8 <= b) {
+        uint64_t w;
+        memcpy(&w, u + i, sizeof(w)); // unaligned load
+        if ((w & 0x8080808080808080ULL) != 0) { break; }
+        i += 8;
+    }
+    while (i < b && u[i] < 0x80) { i++; }
+    return i;
+}
+
 static int32_t ui_edit_str_glyphs(const uint8_t* utf8, int32_t bytes) {
     swear(bytes >= 0);
     bool ok = true;
     int32_t i = 0;
     int32_t k = 1;
     while (i < bytes && ok) {
-        const int32_t b = ui_edit_str_utf8_bytes(utf8 + i, bytes - i);
-        ok = 0 < b && i + b <= bytes;
-        if (ok) { i += b; k++; }
+        if (utf8[i] < 0x80) {
+            const int32_t a = ui_edit_str_ascii(utf8 + i, bytes - i);
+            i += a;
+            k += a;
+        } else {
+            const int32_t b = ui_edit_str_utf8_bytes(utf8 + i, bytes - i);
+            ok = 0 < b && i + b <= bytes;
+            if (ok) { i += b; k++; }
+        }
     }
     return ok ? k - 1 : -1;
 }
@@ -6937,18 +10831,98 @@ static int32_t ui_edit_str_gp_to_bp(const uint8_t* utf8, int32_t bytes, int32_t
     if (bytes > 0) {
         while (c < gp && ok) {
             assert(i < bytes);
-            const int32_t b = ui_edit_str_utf8_bytes(utf8 + i, bytes - i);
-            ok = 0 < b && i + b <= bytes;
-            if (ok) { i += b; c++; }
+            if (utf8[i] < 0x80) {
+                // ASCII glyph is a single byte: do not look past gp
+                const int32_t a = ui_edit_str_ascii(utf8 + i,
+                                      ut_min(bytes - i, gp - c));
+                i += a;
+                c += a;
+            } else {
+                const int32_t b = ui_edit_str_utf8_bytes(utf8 + i, bytes - i);
+                ok = 0 < b && i + b <= bytes;
+                if (ok) { i += b; c++; }
+            }
         }
     }
     assert(i <= bytes);
     return ok ? i : -1;
 }
 
-static void ui_edit_str_free(ui_edit_str_t* s) {
+static bool ui_edit_str_is_sparse(const ui_edit_str_t* s) {
+    // sparse g2b[0] is negative checkpoints interval (dense g2b[0] == 0)
+    return s->g2b != null && !ui_edit_str_gapped(s) && s->g2b[0] < 0;
+}
+
+static const uint8_t* ui_edit_str_at(const ui_edit_str_t* s, int32_t bp) {
+    // byte at position bp, bytes are contiguous on each side of the gap
+    const ui_edit_str_gap_t x = ui_edit_str_gap(s);
+    return x.gp > 0 && bp >= x.bp ? s->u + bp + (s->c - s->b) : s->u + bp;
+}
+
+static int32_t ui_edit_str_g2b(const ui_edit_str_t* s, int32_t gp) {
+    assert(0 <= gp && gp <= s->g);
+    const ui_edit_str_gap_t x = ui_edit_str_gap(s);
+    if (gp == s->g) {
+        return s->b;
+    } else if (s->g2b == ui_edit_str_g2b_ascii) {
+        return gp;
+    } else if (x.gp > 0) {
+        return gp < x.gp - 1 ? s->g2b[gp] : s->b - s->g2b[gp + x.gg];
+    } else if (!ui_edit_str_is_sparse(s)) {
+        return s->g2b[gp];
+    } else { // decode forward from the nearest checkpoint
+        const int32_t n = -s->g2b[0];
+        const int32_t k = gp / n;
+        const int32_t bp = k == 0 ? 0 : s->g2b[k];
+        return bp + ui_edit_str_gp_to_bp(s->u + bp, s->b - bp, gp - k * n);
+    }
+}
+
+static bool ui_edit_str_dense(ut_heap_t* h, ui_edit_str_t* s) {
+    // expands sparse checkpoints back to g2b[g + 1] before edits
+    bool ok = true;
+    if (ui_edit_str_is_sparse(s)) {
+        int32_t* g2b = null;
+        ok = ut_heap.allocate(h, (void**)&g2b, (s->g + 1) * sizeof(int32_t),
+                              false) == 0;
+        if (ok) {
+            g2b[0] = 0;
+            int32_t bp = 0;
+            for (int32_t gp = 1; gp <= s->g; gp++) {
+                bp += ui_edit_str_utf8_bytes(s->u + bp, s->b - bp);
+                g2b[gp] = bp;
+            }
+            assert(bp == s->b);
+            ut_heap.deallocate(h, s->g2b);
+            s->g2b = g2b;
+        }
+    }
+    return ok;
+}
+
+static bool ui_edit_str_own(ut_heap_t* h, ui_edit_str_t* s) {
+    // copy on write: shared paragraph gets its own heap copy
+    bool ok = true;
+    if (ui_edit_str_block(s) != null) {
+        ui_edit_str_t c = {0};
+        ok = ui_edit_str_init_in(h, &c, s->u, s->b, true);
+        if (ok) {
+            ui_edit_str_free_in(h, s);
+            *s = c;
+            ui_edit_str.moved(s);
+        }
+    }
+    return ok;
+}
+
+static void ui_edit_str_free_in(ut_heap_t* h, ui_edit_str_t* s) {
+    ui_edit_str_block_t* x = ui_edit_str_block(s);
+    if (x != null) { // .u and .g2b[] belong to the shared block
+        memset(s, 0x00, sizeof(*s));
+        ui_edit_str_block_release(h, x);
+    }
     if (s->g2b != null && s->g2b != ui_edit_str_g2b_ascii) {
-        ut_heap.free(s->g2b);
+        ut_heap.deallocate(h, s->g2b);
     } else {
         #ifdef UI_EDIT_STR_TEST // check ui_edit_str_g2b_ascii integrity
             for (int32_t i = 0; i < countof(ui_edit_str_g2b_ascii); i++) {
@@ -6959,7 +10933,13 @@ static void ui_edit_str_free(ui_edit_str_t* s) {
     s->g2b = null;
     s->g = 0;
     if (s->c > 0) {
-        ut_heap.free(s->u);
+        ut_heap.deallocate(h, s->u);
+        memset(s->i, 0x00, sizeof(s->i)); // gap of long string
+        s->u = null;
+        s->c = 0;
+        s->b = 0;
+    } else if (s->c < 0) {
+        memset(s->i, 0x00, sizeof(s->i));
         s->u = null;
         s->c = 0;
         s->b = 0;
@@ -6970,13 +10950,23 @@ static void ui_edit_str_free(ui_edit_str_t* s) {
     ui_edit_str_check_zeros(s, sizeof(*s));
 }
 
-static bool ui_edit_str_init_g2b(ui_edit_str_t* s) {
+static bool ui_edit_str_init_g2b(ut_heap_t* h, ui_edit_str_t* s) {
     const int64_t _4_bytes = (int64_t)sizeof(int32_t);
+    int32_t i = ui_edit_str_ascii(s->u, s->b); // index in u[] string
+    if (i == s->b) {
+        // ASCII only string does not need .g2b[] allocated
+        s->g2b = ui_edit_str_g2b_ascii;
+        s->g = s->b;
+        return true;
+    }
     // start with number of glyphs == number of bytes (ASCII text):
-    bool ok = ut_heap.alloc(&s->g2b, (s->b + 1) * _4_bytes) == 0;
-    int32_t i = 0; // index in u[] string
+    bool ok = ut_heap.allocate(h, &s->g2b, (s->b + 1) * _4_bytes, false) == 0;
     int32_t k = 1; // glyph number
     // g2b[k] start postion in uint8_t offset from utf8 text of glyph[k]
+    if (ok) {
+        for (int32_t j = 1; j <= i; j++) { s->g2b[j] = j; }
+        k += i;
+    }
     while (i < s->b && ok) {
         const int32_t b = ui_edit_str_utf8_bytes(s->u + i, s->b - i);
         ok = b > 0 && i + b <= s->b;
@@ -6984,6 +10974,12 @@ static bool ui_edit_str_init_g2b(ui_edit_str_t* s) {
             i += b;
             s->g2b[k] = i;
             k++;
+            if (i < s->b && s->u[i] < 0x80) {
+                const int32_t a = ui_edit_str_ascii(s->u + i, s->b - i);
+                for (int32_t j = 0; j < a; j++) { s->g2b[k + j] = i + j + 1; }
+                i += a;
+                k += a;
+            }
         }
     }
     if (ok) {
@@ -6992,14 +10988,15 @@ static bool ui_edit_str_init_g2b(ui_edit_str_t* s) {
         assert(s->g2b[k - 1] == s->b);
         s->g = k - 1;
         if (k < s->b + 1) {
-            ok = ut_heap.realloc(&s->g2b, k * _4_bytes) == 0;
+            ok = ut_heap.reallocate(h, &s->g2b, k * _4_bytes, false) == 0;
             assert(ok, "shrinking - should always be ok");
         }
     }
     return ok;
 }
 
-static bool ui_edit_str_init(ui_edit_str_t* s, const uint8_t* u, int32_t b,
+static bool ui_edit_str_init_in(ut_heap_t* h, ui_edit_str_t* s,
+        const uint8_t* u, int32_t b,
         bool heap) {
     enum { n = countof(ui_edit_str_g2b_ascii) };
     if (ui_edit_str_g2b_ascii[n - 1] != n - 1) {
@@ -7014,8 +11011,12 @@ static bool ui_edit_str_init(ui_edit_str_t* s, const uint8_t* u, int32_t b,
         s->u = (uint8_t*)u;
         assert(s->c == 0 && u[0] == 0x00);
     } else {
-        if (heap) {
-            ok = ut_heap.alloc((void**)&s->u, b) == 0;
+        if (heap && b <= ui_edit_str_inline) {
+            memmove(s->i, u, b);
+            s->u = s->i;
+            s->c = -1;
+        } else if (heap) {
+            ok = ut_heap.allocate(h, (void**)&s->u, b, false) == 0;
             if (ok) { s->c = b; memmove(s->u, u, b); }
         } else {
             s->u = (uint8_t*)u;
@@ -7026,61 +11027,76 @@ static bool ui_edit_str_init(ui_edit_str_t* s, const uint8_t* u, int32_t b,
                 s->g2b = (int32_t*)ui_edit_str_g2b_ascii;
                 s->g = 1;
             } else {
-                ok = ui_edit_str_init_g2b(s);
+                ok = ui_edit_str_init_g2b(h, s);
             }
         }
     }
-    if (ok) { ui_edit_str.shrink(s); } else { ui_edit_str.free(s); }
+    if (ok) { ui_edit_str_shrink_in(h, s); } else { ui_edit_str_free_in(h, s); }
     return ok;
 }
 
+static void ui_edit_str_moved(ui_edit_str_t* s) {
+    // struct with in place bytes was copied: .u must point to own .i[]
+    if (s->c < 0) { s->u = s->i; }
+}
+
 static void ui_edit_str_swap(ui_edit_str_t* s1, ui_edit_str_t* s2) {
     ui_edit_str_t s = *s1; *s1 = *s2; *s2 = s;
+    ui_edit_str_moved(s1);
+    ui_edit_str_moved(s2);
 }
 
 static int32_t ui_edit_str_bytes(ui_edit_str_t* s,
         int32_t f, int32_t t) { // glyph positions
     ui_edit_str_check_from_to(s, f, t);
     ui_edit_str_check(s);
-    return s->g2b[t] - s->g2b[f];
+    return ui_edit_str_g2b(s, t) - ui_edit_str_g2b(s, f);
 }
 
-static bool ui_edit_str_move_g2b_to_heap(ui_edit_str_t* s) {
+static bool ui_edit_str_move_g2b_to_heap(ut_heap_t* h, ui_edit_str_t* s) {
     bool ok = true;
     if (s->g2b == ui_edit_str_g2b_ascii) { // even for s->g == 0
-        if (s->b == s->g && s->g < countof(ui_edit_str_g2b_ascii) - 1) {
-//          traceln("forcefully moving to heap");
-            // this is usually done in the process of concatenation
-            // of 2 ascii strings when result is known to be longer
-            // than countof(ui_edit_str_g2b_ascii) - 1 but the
-            // first string in concatenation is short. It's OK.
-        }
+        // this is done in the process of concatenation of ASCII
+        // and none ASCII strings. Shared ui_edit_str_g2b_ascii
+        // is shorter than long ASCII strings, fill the identity:
         const int32_t bytes = (s->g + 1) * (int32_t)sizeof(int32_t);
-        ok = ut_heap.alloc(&s->g2b, bytes) == 0;
-        if (ok) { memmove(s->g2b, ui_edit_str_g2b_ascii, bytes); }
+        ok = ut_heap.allocate(h, &s->g2b, bytes, false) == 0;
+        if (ok) {
+            for (int32_t i = 0; i <= s->g; i++) { s->g2b[i] = i; }
+        }
     }
     return ok;
 }
 
-static bool ui_edit_str_move_to_heap(ui_edit_str_t* s, int32_t c) {
+static bool ui_edit_str_move_to_heap(ut_heap_t* h, ui_edit_str_t* s,
+        int32_t c) {
+    // makes s->u[c] writable, in place bytes stay when c fits
     bool ok = true;
     assert(c >= s->b, "can expand cannot shrink");
-    if (s->c == 0) { // s->u points outside of the heap
+    if (s->c < 0 && c <= ui_edit_str_inline) {
+        // short string in place is writable as is
+    } else if (s->c <= 0) { // s->u points outside of the heap or in place
         const uint8_t* o = s->u;
-        ok = ut_heap.alloc((void**)&s->u, c) == 0;
-        if (ok) { memmove(s->u, o, s->b); }
+        ok = ut_heap.allocate(h, (void**)&s->u, c, false) == 0;
+        if (ok) {
+            memmove(s->u, o, s->b);
+            if (s->c < 0) { memset(s->i, 0x00, sizeof(s->i)); }
+            s->c = c;
+        }
     } else if (s->c < c) {
-        ok = ut_heap.realloc((void**)&s->u, c) == 0;
+        ok = ut_heap.reallocate(h, (void**)&s->u, c, false) == 0;
+        if (ok) { s->c = c; }
     }
-    if (ok) { s->c = c; }
     return ok;
 }
 
-static bool ui_edit_str_expand(ui_edit_str_t* s, int32_t c) {
+static bool ui_edit_str_expand_in(ut_heap_t* h, ui_edit_str_t* s,
+        int32_t c) {
     swear(c > 0);
-    bool ok = ui_edit_str_move_to_heap(s, c);
-    if (ok && c > s->c) {
-        if (ut_heap.realloc((void**)&s->u, c) == 0) {
+    ui_edit_str_close_in(h, s);
+    bool ok = ui_edit_str_own(h, s) && ui_edit_str_move_to_heap(h, s, c);
+    if (ok && s->c > 0 && c > s->c) {
+        if (ut_heap.reallocate(h, (void**)&s->u, c, false) == 0) {
             s->c = c;
         } else {
             ok = false;
@@ -7089,25 +11105,44 @@ static bool ui_edit_str_expand(ui_edit_str_t* s, int32_t c) {
     return ok;
 }
 
-static void ui_edit_str_shrink(ui_edit_str_t* s) {
-    if (s->c > s->b) { // s->c == 0 for empty and single byte ASCII strings
+static bool ui_edit_str_slack(const ui_edit_str_t* s) {
+    // long strings keep up to 1/4 of .b spare capacity for edits
+    return s->b >= ui_edit_str_long && s->c - s->b <= s->b / 4;
+}
+
+static void ui_edit_str_shrink_in(ut_heap_t* h, ui_edit_str_t* s) {
+    if (ui_edit_str_block(s) != null) { return; } // immutable shared bytes
+    if (ui_edit_str_gapped(s)) { return; } // see ui_edit_str_close_in()
+    if ((s->c > s->b && !ui_edit_str_slack(s)) ||
+        (s->c > 0 && s->b <= ui_edit_str_inline)) {
+        // s->c == 0 for empty strings, s->c < 0 for strings in place
         assert(s->u != (const uint8_t*)ui_edit_str_empty_utf8);
         if (s->b == 0) {
-            ut_heap.free(s->u);
+            ut_heap.deallocate(h, s->u);
             s->u = (uint8_t*)ui_edit_str_empty_utf8;
+            s->c = 0;
+        } else if (s->b <= ui_edit_str_inline) {
+            memcpy(s->i, s->u, s->b);
+            ut_heap.deallocate(h, s->u);
+            s->u = s->i;
+            s->c = -1;
         } else {
-            bool ok = ut_heap.realloc((void**)&s->u, s->b) == 0;
+            bool ok = ut_heap.reallocate(h, (void**)&s->u, s->b, false) == 0;
             swear(ok, "smaller size is always expected to be ok");
+            s->c = s->b;
         }
-        s->c = s->b;
+    } else if (s->c < 0 && s->b == 0) {
+        memset(s->i, 0x00, sizeof(s->i));
+        s->u = (uint8_t*)ui_edit_str_empty_utf8;
+        s->c = 0;
     }
-    // Optimize memory for short ASCII only strings:
+    // Optimize memory for ASCII only strings:
     if (s->g2b != ui_edit_str_g2b_ascii) {
-        if (s->g == s->b && s->g < countof(ui_edit_str_g2b_ascii) - 1) {
-            // If this is an ascii only utf8 string shorter than
-            // ui_edit_str_g2b_ascii it does not need .g2b[] allocated:
+        if (s->g == s->b) {
+            // If this is an ascii only utf8 string it does not
+            // need .g2b[] allocated:
             if (s->g2b != ui_edit_str_g2b_ascii) {
-                ut_heap.free(s->g2b);
+                ut_heap.deallocate(h, s->g2b);
                 s->g2b = ui_edit_str_g2b_ascii;
             }
         } else {
@@ -7115,28 +11150,160 @@ static void ui_edit_str_shrink(ui_edit_str_t* s) {
 //          traceln("none ASCII: .b:%d .g:%d %*.*s", s->b, s->g, b64, b64, s->u);
         }
     }
+    // Keep only every n-th g2b[] entry for long strings in sparse mode:
+    const int32_t n = ui_edit_str.sparse;
+    if (n > 0 && s->g > n && s->g2b != ui_edit_str_g2b_ascii &&
+        !ui_edit_str_is_sparse(s)) {
+        const int32_t k = s->g / n; // number of checkpoints
+        for (int32_t i = 1; i <= k; i++) { s->g2b[i] = s->g2b[i * n]; }
+        s->g2b[0] = -n;
+        bool ok = ut_heap.reallocate(h, (void**)&s->g2b,
+                                     (k + 1) * sizeof(int32_t), false) == 0;
+        swear(ok, "smaller size is always expected to be ok");
+    }
 }
 
-static bool ui_edit_str_remove(ui_edit_str_t* s, int32_t f, int32_t t) {
-    bool ok = true; // optimistic approach
+static bool ui_edit_str_gap_open(ut_heap_t* h, ui_edit_str_t* s) {
+    // heap copy of the string with an empty gap at the end
+    bool ok = ui_edit_str_own(h, s) && ui_edit_str_dense(h, s);
+    if (ok && s->c <= s->b) {
+        const int32_t c = s->b <= INT32_MAX - s->b / 8 - 1 ?
+                          s->b + s->b / 8 + 1 : INT32_MAX;
+        ok = s->b < c && ui_edit_str_move_to_heap(h, s, c);
+    }
+    if (ok) {
+        // g2b[g] == b is the only entry after the gap: b - b == 0
+        if (s->g2b != ui_edit_str_g2b_ascii) { s->g2b[s->g] = 0; }
+        const ui_edit_str_gap_t x = { .gp = s->g + 1, .bp = s->b, .gg = 0 };
+        memcpy(s->i, &x, sizeof(x));
+    }
+    return ok;
+}
+
+static bool ui_edit_str_gap_bytes(ut_heap_t* h, ui_edit_str_t* s,
+        int32_t n) {
+    // at least n + 1 bytes in the gap, the tail moves to the new end
+    bool ok = true;
+    if (s->c - s->b <= n) {
+        const ui_edit_str_gap_t x = ui_edit_str_gap(s);
+        const int64_t want = (int64_t)s->b + n + 1 + s->b / 8;
+        const int32_t c = (int32_t)ut_min(want, (int64_t)INT32_MAX);
+        ok = s->b + (int64_t)n < c &&
+             ut_heap.reallocate(h, (void**)&s->u, c, false) == 0;
+        if (ok) {
+            const int32_t tail = s->b - x.bp;
+            memmove(s->u + c - tail, s->u + s->c - tail, tail);
+            s->c = c;
+        }
+    }
+    return ok;
+}
+
+static bool ui_edit_str_gap_glyphs(ut_heap_t* h, ui_edit_str_t* s,
+        int32_t n) {
+    // at least n unused .g2b[] entries in the gap, converts ASCII only
+    // string to the .g2b[] with the gap
+    const int64_t _4_bytes = (int64_t)sizeof(int32_t);
+    ui_edit_str_gap_t x = ui_edit_str_gap(s);
+    const int32_t gp = x.gp - 1;
+    bool ok = true;
+    if (s->g2b == ui_edit_str_g2b_ascii || x.gg < n) {
+        const int32_t gg = n + ut_min(s->g / 8, INT32_MAX / 8);
+        ok = (int64_t)s->g + 1 + gg < INT32_MAX / _4_bytes;
+        if (ok && s->g2b == ui_edit_str_g2b_ascii) {
+            int32_t* g2b = null;
+            ok = ut_heap.allocate(h, (void**)&g2b,
+                    (s->g + 1 + gg) * _4_bytes, false) == 0;
+            if (ok) {
+                for (int32_t i = 0; i < gp; i++) { g2b[i] = i; }
+                for (int32_t i = gp; i <= s->g; i++) {
+                    g2b[i + gg] = s->b - i;
+                }
+                s->g2b = g2b;
+            }
+        } else if (ok) {
+            ok = ut_heap.reallocate(h, (void**)&s->g2b,
+                    (s->g + 1 + gg) * _4_bytes, false) == 0;
+            if (ok) {
+                memmove(s->g2b + gp + gg, s->g2b + gp + x.gg,
+                        (s->g - gp + 1) * _4_bytes);
+            }
+        }
+        if (ok) {
+            x.gg = gg;
+            memcpy(s->i, &x, sizeof(x));
+        }
+    }
+    return ok;
+}
+
+static void ui_edit_str_gap_move(ui_edit_str_t* s, int32_t gp) {
+    // moves the gap to the glyph position gp: O(distance)
+    ui_edit_str_gap_t x = ui_edit_str_gap(s);
+    const bool ascii = s->g2b == ui_edit_str_g2b_ascii;
+    const int32_t bp = ui_edit_str_g2b(s, gp);
+    const int32_t gb = s->c - s->b; // bytes in the gap
+    if (gp < x.gp - 1) {
+        memmove(s->u + bp + gb, s->u + bp, x.bp - bp);
+        for (int32_t i = x.gp - 2; i >= gp && !ascii; i--) {
+            s->g2b[i + x.gg] = s->b - s->g2b[i];
+        }
+    } else if (gp > x.gp - 1) {
+        memmove(s->u + x.bp, s->u + x.bp + gb, bp - x.bp);
+        for (int32_t i = x.gp - 1; i < gp && !ascii; i++) {
+            s->g2b[i] = s->b - s->g2b[i + x.gg];
+        }
+    }
+    x.gp = gp + 1;
+    x.bp = bp;
+    memcpy(s->i, &x, sizeof(x));
+}
+
+static void ui_edit_str_close_in(ut_heap_t* h, ui_edit_str_t* s) {
+    // makes .u[0..b - 1] contiguous again, O(bytes after the gap)
+    if (ui_edit_str_gapped(s)) {
+        const ui_edit_str_gap_t x = ui_edit_str_gap(s);
+        memmove(s->u + x.bp, s->u + x.bp + (s->c - s->b), s->b - x.bp);
+        if (s->g2b != ui_edit_str_g2b_ascii) {
+            for (int32_t i = x.gp - 1; i <= s->g; i++) {
+                s->g2b[i] = s->b - s->g2b[i + x.gg];
+            }
+            if (x.gg > 0) {
+                bool ok = ut_heap.reallocate(h, (void**)&s->g2b,
+                        (s->g + 1) * (int64_t)sizeof(int32_t), false) == 0;
+                swear(ok, "smaller size is always expected to be ok");
+            }
+        }
+        memset(s->i, 0x00, sizeof(s->i));
+        ui_edit_str_shrink_in(h, s);
+        ui_edit_str_check(s);
+        ui_edit_str_closed++;
+    }
+}
+
+static bool ui_edit_str_remove(ut_heap_t* h, ui_edit_str_t* s,
+        int32_t f, int32_t t) {
     ui_edit_str_check_from_to(s, f, t);
     ui_edit_str_check(s);
-    const int32_t bytes_to_remove = s->g2b[t] - s->g2b[f];
+    bool ok = ui_edit_str_dense(h, s);
+    const int32_t bf = ok ? ui_edit_str_g2b(s, f) : 0;
+    const int32_t bt = ok ? ui_edit_str_g2b(s, t) : 0;
+    const int32_t bytes_to_remove = bt - bf;
     assert(bytes_to_remove >= 0);
     if (bytes_to_remove > 0) {
-        ok = ui_edit_str_move_to_heap(s, s->b);
+        ok = ui_edit_str_move_to_heap(h, s, s->b);
         if (ok) {
-            const int32_t bytes_to_shift = s->b - s->g2b[t];
+            const int32_t bytes_to_shift = s->b - bt;
             assert(0 <= bytes_to_shift && bytes_to_shift <= s->b);
-            memmove(s->u + s->g2b[f], s->u + s->g2b[t], bytes_to_shift);
+            memmove(s->u + bf, s->u + bt, bytes_to_shift);
             if (s->g2b != ui_edit_str_g2b_ascii) {
                 memmove(s->g2b + f, s->g2b + t, (s->g - t + 1) * sizeof(int32_t));
                 for (int32_t i = f; i <= s->g; i++) {
                     s->g2b[i] -= bytes_to_remove;
                 }
             } else {
-                // no need to shrink g2b[] for ASCII only strings:
-                for (int32_t i = 0; i <= s->g; i++) { assert(s->g2b[i] == i); }
+                // no need to touch g2b[] for ASCII only strings:
+                assert(s->g == s->b);
             }
             s->b -= bytes_to_remove;
             s->g -= t - f;
@@ -7146,45 +11313,60 @@ static bool ui_edit_str_remove(ui_edit_str_t* s, int32_t f, int32_t t) {
     return ok;
 }
 
-static bool ui_edit_str_replace(ui_edit_str_t* s,
+static bool ui_edit_str_replace_in(ut_heap_t* h, ui_edit_str_t* s,
         int32_t f, int32_t t, const uint8_t* u, int32_t b) {
     const int64_t _4_bytes = (int64_t)sizeof(int32_t);
     bool ok = true; // optimistic approach
+    ui_edit_str_close_in(h, s);
     ui_edit_str_check_from_to(s, f, t);
     ui_edit_str_check(s);
     ui_edit_str_parameters(u, b);
+    // sparse checkpoints are expanded here and restored by shrink():
+    if (!ui_edit_str_own(h, s) || !ui_edit_str_dense(h, s)) { return false; }
     // we are inserting "b" bytes and removing "t - f" glyphs
-    const int32_t bytes_to_remove = s->g2b[t] - s->g2b[f];
+    const int32_t bf = ui_edit_str_g2b(s, f); // byte positions
+    const int32_t bt = ui_edit_str_g2b(s, t);
+    const int32_t bytes_to_remove = bt - bf;
     const int32_t bytes_to_insert = b; // only for readability
     if (b == 0) { // just remove glyphs
-        ok = ui_edit_str_remove(s, f, t);
+        ok = ui_edit_str_remove(h, s, f, t);
     } else { // remove and insert
         ui_edit_str_t ins = {0};
         // ui_edit_str_init_ro() verifies utf-8 and calculates g2b[]:
-        ok = ui_edit_str_init(&ins, u, b, false);
+        ok = ui_edit_str_init_in(h, &ins, u, b, false) && ui_edit_str_dense(h, &ins);
         const int32_t glyphs_to_insert = ins.g; // only for readability
         const int32_t glyphs_to_remove = t - f; // only for readability
         if (ok) {
             const int32_t bytes = s->b + bytes_to_insert - bytes_to_remove;
             assert(ins.g2b != null); // pacify code analysis
             assert(bytes > 0);
-            const int32_t c = ut_max(s->b, bytes);
+            int32_t c = ut_max(s->b, bytes);
+            if (c > s->c && c >= ui_edit_str_long && c <= INT32_MAX - c / 8) {
+                c += c / 8; // slack for the next edits of a long string
+            }
             // keep g2b == ui_edit_str_g2b_ascii as much as possible
             const bool all_ascii = s->g2b == ui_edit_str_g2b_ascii &&
-                                   ins.g2b == ui_edit_str_g2b_ascii &&
-                                   bytes < countof(ui_edit_str_g2b_ascii) - 1;
-            ok = ui_edit_str_move_to_heap(s, c);
-            if (ok) {
-                if (!all_ascii) {
-                    ui_edit_str_move_g2b_to_heap(s);
+                                   ins.g2b == ui_edit_str_g2b_ascii;
+            ok = ui_edit_str_move_to_heap(h, s, c);
+            if (ok && !all_ascii) {
+                ok = ui_edit_str_move_g2b_to_heap(h, s);
+                // g2b[] must fit the larger of old and new number of
+                // glyphs for memmove() below (fewer bytes may still
+                // be more glyphs and vice versa):
+                const int32_t g = s->g + glyphs_to_insert - glyphs_to_remove;
+                if (ok && g > s->g) {
+                    ok = ut_heap.reallocate(h, &s->g2b, (g + 1) * _4_bytes,
+                                            false) == 0;
                 }
+            }
+            if (ok) {
                 // insert ui_edit_str_t "ins" at glyph position "f"
                 // reusing ins.u[0..ins.b-1] and ins.g2b[0..ins.g]
                 // moving memory using memmove() left to right:
                 if (bytes_to_insert <= bytes_to_remove) {
-                    memmove(s->u + s->g2b[f] + bytes_to_insert,
-                           s->u + s->g2b[f] + bytes_to_remove,
-                           s->b - s->g2b[f] - bytes_to_remove);
+                    memmove(s->u + bf + bytes_to_insert,
+                           s->u + bf + bytes_to_remove,
+                           s->b - bf - bytes_to_remove);
                     if (all_ascii) {
                         assert(s->g2b == ui_edit_str_g2b_ascii);
                     } else {
@@ -7193,22 +11375,13 @@ static bool ui_edit_str_replace(ui_edit_str_t* s,
                                s->g2b + f + glyphs_to_remove,
                                (s->g - t + 1) * _4_bytes);
                     }
-                    memmove(s->u + s->g2b[f], ins.u, ins.b);
+                    memmove(s->u + bf, ins.u, ins.b);
                 } else {
-                    if (all_ascii) {
-                        assert(s->g2b == ui_edit_str_g2b_ascii);
-                    } else {
-                        assert(s->g2b != ui_edit_str_g2b_ascii);
-                        const int32_t g = s->g + glyphs_to_insert -
-                                                 glyphs_to_remove;
-                        assert(g > s->g);
-                        ok = ut_heap.realloc(&s->g2b, (g + 1) * _4_bytes) == 0;
-                    }
                     // need to shift bytes staring with s.g2b[t] toward the end
                     if (ok) {
-                        memmove(s->u + s->g2b[f] + bytes_to_insert,
-                                s->u + s->g2b[f] + bytes_to_remove,
-                                s->b - s->g2b[f] - bytes_to_remove);
+                        memmove(s->u + bf + bytes_to_insert,
+                                s->u + bf + bytes_to_remove,
+                                s->b - bf - bytes_to_remove);
                         if (all_ascii) {
                             assert(s->g2b == ui_edit_str_g2b_ascii);
                         } else {
@@ -7217,21 +11390,18 @@ static bool ui_edit_str_replace(ui_edit_str_t* s,
                                     s->g2b + f + glyphs_to_remove,
                                     (s->g - t + 1) * _4_bytes);
                         }
-                        memmove(s->u + s->g2b[f], ins.u, ins.b);
+                        memmove(s->u + bf, ins.u, ins.b);
                     }
                 }
                 if (ok) {
                     if (!all_ascii) {
                         assert(s->g2b != ui_edit_str_g2b_ascii);
                         for (int32_t i = f; i <= f + glyphs_to_insert; i++) {
-                            s->g2b[i] = ins.g2b[i - f] + s->g2b[f];
+                            s->g2b[i] = ui_edit_str_g2b(&ins, i - f) + bf;
                         }
                     } else {
                         assert(s->g2b == ui_edit_str_g2b_ascii);
-                        for (int32_t i = f; i <= f + glyphs_to_insert; i++) {
-                            assert(ui_edit_str_g2b_ascii[i] == i);
-                            assert(ins.g2b[i - f] + s->g2b[f] == i);
-                        }
+                        assert(bf == f && ins.g == ins.b);
                     }
                     s->b += bytes_to_insert - bytes_to_remove;
                     s->g += glyphs_to_insert - glyphs_to_remove;
@@ -7244,22 +11414,87 @@ static bool ui_edit_str_replace(ui_edit_str_t* s,
                         s->g2b[s->g] = s->b;
                     } else {
                         assert(s->g2b == ui_edit_str_g2b_ascii);
-                        for (int32_t i = f + glyphs_to_insert + 1; i <= s->g; i++) {
-                            assert(s->g2b[i] == i);
-                            assert(ui_edit_str_g2b_ascii[i] == i);
-                        }
-                        assert(s->g2b[s->g] == s->b);
+                        assert(s->g == s->b);
                     }
                 }
             }
-            ui_edit_str_free(&ins);
+            ui_edit_str_free_in(h, &ins);
         }
     }
-    ui_edit_str_shrink(s);
+    ui_edit_str_shrink_in(h, s);
+    ui_edit_str_check(s);
+    return ok;
+}
+
+static bool ui_edit_str_edit_in(ut_heap_t* h, ui_edit_str_t* s,
+        int32_t f, int32_t t, const uint8_t* u, int32_t b) {
+    // replace_in() for paragraphs of the document text: strings of
+    // ui_edit_str_long bytes and more keep the gap at the edit position
+    // and typing next to it is O(glyphs typed) instead of O(bytes).
+    // All or nothing: allocations happen before the string is modified.
+    ui_edit_str_check_from_to(s, f, t);
+    ui_edit_str_parameters(u, b);
+    if (!ui_edit_str_gapped(s) && s->b < ui_edit_str_long) {
+        return ui_edit_str_replace_in(h, s, f, t, u, b);
+    }
+    ui_edit_str_check(s);
+    ui_edit_str_t ins = {0};
+    bool ok = b == 0 || (ui_edit_str_init_in(h, &ins, u, b, false) &&
+                         ui_edit_str_dense(h, &ins));
+    if (ok && !ui_edit_str_gapped(s)) { ok = ui_edit_str_gap_open(h, s); }
+    const bool ascii = ins.g2b == ui_edit_str_g2b_ascii ||
+                       ins.g2b == null; // b == 0
+    if (ok && (s->g2b != ui_edit_str_g2b_ascii || !ascii)) {
+        ok = ui_edit_str_gap_glyphs(h, s, ins.g);
+    }
+    ok = ok && ui_edit_str_gap_bytes(h, s, b);
+    if (ok) {
+        ui_edit_str_gap_move(s, f);
+        ui_edit_str_gap_t x = ui_edit_str_gap(s);
+        // removed glyphs [f..t[ join the gap:
+        const int32_t removed = ui_edit_str_g2b(s, t) - x.bp;
+        if (s->g2b != ui_edit_str_g2b_ascii) { x.gg += t - f; }
+        s->b -= removed;
+        s->g -= t - f;
+        // inserted glyphs take the beginning of the gap:
+        if (b > 0) { memcpy(s->u + x.bp, ins.u, b); }
+        for (int32_t i = 0; i < ins.g && s->g2b != ui_edit_str_g2b_ascii; i++) {
+            s->g2b[x.gp - 1 + i] = x.bp + ui_edit_str_g2b(&ins, i);
+        }
+        if (s->g2b != ui_edit_str_g2b_ascii) { x.gg -= ins.g; }
+        x.gp += ins.g;
+        x.bp += b;
+        s->b += b;
+        s->g += ins.g;
+        memcpy(s->i, &x, sizeof(x));
+    }
+    if (b > 0) { ui_edit_str_free_in(h, &ins); }
     ui_edit_str_check(s);
     return ok;
 }
 
+static bool ui_edit_str_init(ui_edit_str_t* s, const uint8_t* u, int32_t b,
+        bool heap) {
+    return ui_edit_str_init_in(null, s, u, b, heap);
+}
+
+static void ui_edit_str_free(ui_edit_str_t* s) {
+    ui_edit_str_free_in(null, s);
+}
+
+static bool ui_edit_str_expand(ui_edit_str_t* s, int32_t c) {
+    return ui_edit_str_expand_in(null, s, c);
+}
+
+static void ui_edit_str_shrink(ui_edit_str_t* s) {
+    ui_edit_str_shrink_in(null, s);
+}
+
+static bool ui_edit_str_replace(ui_edit_str_t* s,
+        int32_t f, int32_t t, const uint8_t* u, int32_t b) {
+    return ui_edit_str_replace_in(null, s, f, t, u, b);
+}
+
 #pragma push_macro("ui_edit_usd")
 #pragma push_macro("ui_edit_gbp")
 #pragma push_macro("ui_edit_euro")
@@ -7401,8 +11636,280 @@ static void ui_edit_str_test_glyph_bytes(void) {
     #pragma pop_macro("glyph_bytes_test")
 }
 
+static int32_t ui_edit_str_test_glyphs_scalar(const uint8_t* utf8,
+        int32_t bytes) { // reference: one glyph at a time
+    bool ok = true;
+    int32_t i = 0;
+    int32_t k = 0;
+    while (i < bytes && ok) {
+        const int32_t b = ui_edit_str_utf8_bytes(utf8 + i, bytes - i);
+        ok = 0 < b && i + b <= bytes;
+        if (ok) { i += b; k++; }
+    }
+    return ok ? k : -1;
+}
+
+static int32_t ui_edit_str_test_random_text(uint8_t* u, int32_t n,
+        int32_t ascii_percent, uint32_t* seed) {
+    static const char* glyphs[] = { ui_edit_gbp, ui_edit_euro,
+                                    ui_edit_gothic_hwair };
+    int32_t b = 0;
+    while (b < n - 4) {
+        if ((int32_t)(ut_num.random32(seed) % 100) < ascii_percent) {
+            u[b++] = (uint8_t)(0x20 + ut_num.random32(seed) % 0x5F);
+        } else {
+            const char* g = glyphs[ut_num.random32(seed) % countof(glyphs)];
+            const int32_t k = (int32_t)strlen(g);
+            memcpy(u + b, g, k);
+            b += k;
+        }
+    }
+    return b;
+}
+
+static void ui_edit_str_test_ascii(void) {
+    // ASCII fast path must agree with one glyph at a time decoding
+    enum { n = 4 * 1024 };
+    static uint8_t u[n];
+    uint32_t seed = 1;
+    const int32_t percents[] = { 0, 50, 90, 99, 100 };
+    for (int32_t i = 0; i < countof(percents); i++) {
+        const int32_t b = ui_edit_str_test_random_text(u, n, percents[i], &seed);
+        const int32_t g = ui_edit_str_glyphs(u, b);
+        swear(g == ui_edit_str_test_glyphs_scalar(u, b));
+        ui_edit_str_t s = {0};
+        swear(ui_edit_str_init(&s, u, b, false));
+        swear(s.g == g && (s.g2b == ui_edit_str_g2b_ascii) == (g == b));
+        for (int32_t gp = 0; gp <= g; gp++) {
+            const int32_t bp = ui_edit_str_g2b(&s, gp);
+            swear(ui_edit_str_gp_to_bp(u, b, gp) == bp);
+            if (gp > 0) {
+                const int32_t k = bp - ui_edit_str_g2b(&s, gp - 1);
+                swear(k == ui_edit_str_utf8_bytes(u + bp - k, k));
+            }
+        }
+        ui_edit_str_free(&s);
+    }
+    // invalid utf8 after a long ASCII run must still be detected:
+    memset(u, 'a', 100);
+    u[77] = 0xFF;
+    swear(ui_edit_str_glyphs(u, 100) == -1);
+    swear(ui_edit_str_gp_to_bp(u, 100, 77) == 77);
+    swear(ui_edit_str_gp_to_bp(u, 100, 78) == -1);
+}
+
+static void ui_edit_str_test_sparse(void) {
+    // random replace() in sparse mode against plain utf8 bytes model
+    enum { n = 4 * 1024 };
+    static uint8_t m[n * 2]; // model
+    static uint8_t u[64];
+    const int32_t sparse = ui_edit_str.sparse;
+    ui_edit_str.sparse = 4;
+    uint32_t seed = 1;
+    int32_t mb = ui_edit_str_test_random_text(m, n, 50, &seed);
+    ui_edit_str_t s = {0};
+    swear(ui_edit_str_init(&s, m, mb, true));
+    swear(ui_edit_str_is_sparse(&s));
+    for (int32_t i = 0; i < 1000; i++) {
+        const int32_t mg = ui_edit_str_glyphs(m, mb);
+        int32_t f = (int32_t)(ut_num.random32(&seed) % (uint32_t)(mg + 1));
+        int32_t t = (int32_t)(ut_num.random32(&seed) % (uint32_t)(mg + 1));
+        if (f > t) { int32_t swap = f; f = t; t = swap; }
+        const int32_t ub = mb + 64 < n * 2 ?
+            ui_edit_str_test_random_text(u, (int32_t)countof(u), 50, &seed) : 0;
+        swear(ui_edit_str_replace(&s, f, t, ub == 0 ? null : u, ub));
+        const int32_t bf = ui_edit_str_gp_to_bp(m, mb, f);
+        const int32_t bt = ui_edit_str_gp_to_bp(m, mb, t);
+        memmove(m + bf + ub, m + bt, mb - bt);
+        memcpy(m + bf, u, ub);
+        mb += ub - (bt - bf);
+        swear(s.b == mb && memcmp(s.u, m, mb) == 0);
+        swear(s.g == ui_edit_str_glyphs(m, mb));
+        swear(ui_edit_str_is_sparse(&s) == (s.g > ui_edit_str.sparse &&
+              s.g2b != ui_edit_str_g2b_ascii));
+        for (int32_t gp = 0; gp <= s.g; gp++) {
+            swear(ui_edit_str_g2b(&s, gp) == ui_edit_str_gp_to_bp(m, mb, gp));
+        }
+    }
+    ui_edit_str_free(&s);
+    ui_edit_str.sparse = sparse;
+}
+
+static void ui_edit_str_test_performance(void) {
+    enum { n = 64 * 1024 * 1024 };
+    uint8_t* u = null;
+    swear(ut_heap.alloc((void**)&u, n) == 0);
+    uint32_t seed = 1;
+    const int32_t percents[] = { 100, 99, 90, 0 };
+    for (int32_t i = 0; i < countof(percents); i++) {
+        const int32_t b = ui_edit_str_test_random_text(u, n, percents[i], &seed);
+        fp64_t time = ut_clock.seconds();
+        const int32_t g0 = ui_edit_str_test_glyphs_scalar(u, b);
+        const fp64_t scalar = ut_clock.seconds() - time;
+        time = ut_clock.seconds();
+        const int32_t g1 = ui_edit_str_glyphs(u, b);
+        const fp64_t fast = ut_clock.seconds() - time;
+        swear(g0 == g1);
+        const fp64_t mb = b / (1024.0 * 1024.0);
+        traceln("%3d%% ASCII glyphs() %7.1f MB/s scalar %7.1f MB/s x%.1f",
+                percents[i], mb / fast, mb / scalar, scalar / fast);
+    }
+    ut_heap.free(u);
+}
+
+static void ui_edit_str_test_long(void) {
+    // long ASCII line: shared g2b[] and spare capacity for typing
+    enum { n = 1024 * 1024 };
+    uint8_t* u = null;
+    swear(ut_heap.alloc((void**)&u, n) == 0);
+    for (int32_t i = 0; i < n; i++) { u[i] = (uint8_t)('a' + i % 26); }
+    ui_edit_str_t s = {0};
+    swear(ui_edit_str_init(&s, u, n, true));
+    swear(s.g2b == ui_edit_str_g2b_ascii && s.g == n && s.c == n);
+    swear(ui_edit_str_g2b(&s, n / 2) == n / 2);
+    swear(ui_edit_str_replace(&s, n / 2, n / 2, (const uint8_t*)"x", 1));
+    const int32_t c = s.c;
+    swear(s.g2b == ui_edit_str_g2b_ascii && c > s.b && s.b == n + 1);
+    for (int32_t i = 0; i < 1000; i++) { // no reallocations
+        swear(ui_edit_str_replace(&s, n / 2 + i, n / 2 + i,
+                                  (const uint8_t*)"y", 1));
+    }
+    swear(s.c == c && s.b == n + 1001 && s.u[n / 2 + 1000] == 'x');
+    // none ASCII glyph needs g2b[] and removing it restores sharing:
+    swear(ui_edit_str_replace(&s, 1, 1, (const uint8_t*)"\xC3\xA9", -1));
+    swear(s.g2b != ui_edit_str_g2b_ascii && s.g == n + 1002);
+    swear(ui_edit_str_g2b(&s, 2) == 3 && ui_edit_str_g2b(&s, s.g) == s.b);
+    swear(ui_edit_str_replace(&s, 1, 2, null, 0));
+    swear(s.g2b == ui_edit_str_g2b_ascii && s.g == s.b);
+    // removing most of the string trims capacity:
+    swear(ui_edit_str_replace(&s, 100, s.g - 100, null, 0));
+    swear(s.b == 200 && s.c == s.b && memcmp(s.u, u, 100) == 0);
+    ui_edit_str_free(&s);
+    ut_heap.free(u);
+}
+
+static void ui_edit_str_test_gap_same(const ui_edit_str_t* s,
+        const ui_edit_str_t* r) {
+    // string with the gap has the same glyphs as contiguous r
+    swear(s->b == r->b && s->g == r->g);
+    for (int32_t gp = 0; gp < s->g; gp++) {
+        const int32_t bp = ui_edit_str_g2b(r, gp);
+        swear(ui_edit_str_g2b(s, gp) == bp);
+        swear(*ui_edit_str_at(s, bp) == r->u[bp]);
+    }
+}
+
+static void ui_edit_str_test_gap(void) {
+    // random edits of long string next to its gap and far from it
+    // match contiguous ui_edit_str.replace() of the same string
+    enum { n = ui_edit_str_long + 4 * 1024 };
+    uint32_t seed = 1;
+    uint8_t* u = null;
+    swear(ut_heap.alloc((void**)&u, n) == 0);
+    for (int32_t pass = 0; pass < 2; pass++) { // ASCII and mixed text
+        const int32_t b = ui_edit_str_test_random_text(u, n,
+                              pass == 0 ? 100 : 90, &seed);
+        ui_edit_str_t s = {0};
+        ui_edit_str_t r = {0};
+        swear(ui_edit_str_init(&s, u, b, true));
+        swear(ui_edit_str_init(&r, u, b, true));
+        int32_t gp = s.g / 2;
+        for (int32_t i = 0; i < 200; i++) {
+            const int32_t k = (int32_t)(ut_num.random32(&seed) % 8);
+            if (k == 0) { gp = (int32_t)(ut_num.random32(&seed) % (s.g + 1)); }
+            uint8_t ins[8];
+            const int32_t ascii = pass == 0 && i < 100 ? 100 : 50;
+            const int32_t ib = k >= 5 ? 0 :
+                ui_edit_str_test_random_text(ins, countof(ins), ascii,
+                                             &seed);
+            int32_t f = gp;
+            int32_t t = gp;
+            if (k == 5) { f = ut_max(0, gp - 2); } // backspace
+            if (k >= 6) { t = ut_min(s.g, gp + k - 5); } // delete
+            const uint8_t* v = ib == 0 ? null : ins;
+            swear(ui_edit_str_edit_in(null, &s, f, t, v, ib));
+            swear(ui_edit_str_replace(&r, f, t, v, ib));
+            gp = f + (ib == 0 ? 0 : ui_edit_str_glyphs(ins, ib));
+            const ui_edit_str_gap_t x = ui_edit_str_gap(&s);
+            swear(x.gp - 1 == gp && x.bp == ui_edit_str_g2b(&r, gp));
+            if (i % 50 == 0) { ui_edit_str_test_gap_same(&s, &r); }
+        }
+        ui_edit_str_test_gap_same(&s, &r);
+        // typing next to the gap neither moves nor reallocates the tail:
+        const uint8_t* last = ui_edit_str_at(&s, s.b - 1);
+        swear(ui_edit_str_edit_in(null, &s, gp - 1, gp, null, 0));
+        swear(ui_edit_str_edit_in(null, &s, gp - 1, gp - 1,
+                                  (const uint8_t*)"z", 1));
+        swear(ui_edit_str_at(&s, s.b - 1) == last);
+        swear(ui_edit_str_replace(&r, gp - 1, gp, (const uint8_t*)"z", 1));
+        ui_edit_str_close_in(null, &s);
+        swear(!ui_edit_str_gapped(&s));
+        swear(s.b == r.b && s.g == r.g && memcmp(s.u, r.u, s.b) == 0);
+        for (int32_t i = 0; i <= s.g; i++) {
+            swear(ui_edit_str_g2b(&s, i) == ui_edit_str_g2b(&r, i));
+        }
+        ui_edit_str_free(&s);
+        ui_edit_str_free(&r);
+    }
+    ut_heap.free(u);
+}
+
+static void ui_edit_str_test_inline(void) {
+    ui_edit_str_t s = {0};
+    swear(ui_edit_str_init(&s, (const uint8_t*)"{", -1, true));
+    swear(s.c < 0 && s.u == s.i && s.g2b == ui_edit_str_g2b_ascii);
+    // grows in place up to ui_edit_str_inline bytes:
+    swear(ui_edit_str_replace(&s, 1, 1, (const uint8_t*)"0123456789", -1));
+    swear(s.c < 0 && s.u == s.i && s.b == 11);
+    swear(ui_edit_str_replace(&s, 0, 0, (const uint8_t*)"\xC3\xA9", -1));
+    swear(s.c < 0 && s.u == s.i && s.b == 13 && s.g == 12);
+    // moves to the heap when it does not fit:
+    swear(ui_edit_str_replace(&s, 12, 12, (const uint8_t*)"0123456789", -1));
+    swear(s.c > 0 && s.u != s.i && s.b == 23 && s.g == 22);
+    // and back in place when it fits again:
+    swear(ui_edit_str_replace(&s, 0, 12, null, 0));
+    swear(s.c < 0 && s.u == s.i && s.b == 10 && memcmp(s.u, "0123456789", 10) == 0);
+    ui_edit_str_t t = {0};
+    swear(ui_edit_str_init(&t, (const uint8_t*)"}", -1, true));
+    ui_edit_str_swap(&s, &t);
+    swear(s.u == s.i && s.b == 1 && s.u[0] == '}');
+    swear(t.u == t.i && t.b == 10 && t.u[0] == '0');
+    swear(ui_edit_str_replace(&t, 0, 10, null, 0));
+    swear(t.c == 0 && t.b == 0 && t.u[0] == 0x00);
+    ui_edit_str_free(&t);
+    ui_edit_str_free(&s);
+    // paragraphs of the text tree are moved by value:
+    ui_edit_text_t x = {0};
+    swear(ui_edit_text.init(&x, null, 0, true));
+    for (int32_t i = 0; i < 1000; i++) {
+        char line[32];
+        ut_str_printf(line, "%d", i);
+        swear(ui_edit_text_append_ps(&x, (const uint8_t*)line,
+                                     (int32_t)strlen(line), true));
+        const int32_t pn = i * 7 % x.np; // insert in the middle
+        swear(ui_edit_text_insert_ps(&x, pn, ui_edit_str.empty));
+    }
+    swear(ui_edit_text_remove_ps(&x, 1, x.np / 3));
+    for (int32_t pn = 0; pn < x.np; pn++) {
+        const ui_edit_str_t* p = ui_edit_text.ps(&x, pn);
+        swear(p->b == 0 || (p->c < 0 && p->u == p->i));
+        swear(p->b == 0 || (p->u[0] >= '0' && p->u[0] <= '9'));
+    }
+    ui_edit_text.dispose(&x);
+}
+
 static void ui_edit_str_test(void) {
     ui_edit_str_test_glyph_bytes();
+    ui_edit_str_test_ascii();
+    ui_edit_str_test_sparse();
+    ui_edit_str_test_inline();
+    ui_edit_str_test_long();
+    ui_edit_str_test_gap();
+    #ifdef UI_EDIT_STR_TEST_PERFORMANCE
+        ui_edit_str_test_performance();
+    #else
+        (void)(void*)ui_edit_str_test_performance; // unused
+    #endif
     {
         ui_edit_str_t s = {0};
         bool ok = ui_edit_str_init(&s, (const uint8_t*)"hello", -1, false);
@@ -7422,7 +11929,7 @@ static void ui_edit_str_test(void) {
         const int32_t n = (int32_t)strlen(currencies);
         bool ok = ui_edit_str_init(&s, money, n, true);
         swear(ok);
-        swear(s.b == n && s.c == s.b && memcmp(s.u, money, s.b) == 0);
+        swear(s.b == n && s.c < 0 && s.u == s.i && memcmp(s.u, money, s.b) == 0);
         swear(s.g == 4 && s.g2b != null);
         const int32_t g2b[] = {0, 1, 3, 6, 10};
         for (int32_t i = 0; i <= s.g; i++) {
@@ -7484,6 +11991,7 @@ static void ui_edit_str_test(void) {
 // tests:
 
 static void ui_edit_doc_test_big_text(void) {
+    // benchmark: ui_edit_text.init() of 10MB text on 1..N threads
     enum { MB10 = 10 * 1000 * 1000 };
     uint8_t* text = null;
     ut_heap.alloc(&text, MB10);
@@ -7497,13 +12005,185 @@ static void ui_edit_doc_test_big_text(void) {
         *p = '\n';
     }
     text[MB10 - 1] = 0x00;
+    const int32_t threads = ui_edit_text.threads;
+    const int32_t processors = ut_min(ut_thread.processors(),
+                                      (int32_t)ui_edit_text_chunks_max);
+    fp64_t single = 0;
+    for (int32_t n = 1; n <= processors; n++) {
+        ui_edit_text.threads = n;
+        ui_edit_text_t t = {0};
+        fp64_t time = ut_clock.seconds();
+        bool ok = ui_edit_text.init(&t, text, MB10, false);
+        time = ut_clock.seconds() - time;
+        swear(ok);
+        if (n == 1) { single = time; }
+        traceln("%2d threads %7.1f MB/s x%.1f", n,
+                MB10 / (time * 1000 * 1000), single / time);
+        ui_edit_text.dispose(&t);
+    }
+    ui_edit_text.threads = threads;
+    ut_heap.free(text);
+}
+
+static void ui_edit_doc_test_parallel_text(const uint8_t* text, int32_t k,
+        bool lazy) {
+    // paragraphs of ui_edit_text.init() or ui_edit_doc.open() (lazy)
+    // against text split on '\n'
+    ui_edit_text_t t = {0};
+    if (lazy) {
+        swear(ui_edit_text_init_lazy(&t, text, k) == 0);
+    } else {
+        swear(ui_edit_text.init(&t, text, k, false));
+    }
+    int32_t pn = 0;
+    int32_t f = 0; // paragraph [f..e[ bytes
+    while (f <= k) {
+        int32_t e = f;
+        while (e < k && text[e] != '\n') { e++; }
+        const int32_t n = e > f && text[e - 1] == '\r' ? e - 1 - f : e - f;
+        const ui_edit_str_t* p = ui_edit_text.ps(&t, pn++);
+        swear(p->b == n && (n == 0 || p->u == text + f));
+        swear(p->g == ui_edit_str.glyphs(text + f, n));
+        f = e + 1;
+    }
+    swear(t.np == pn);
+    ui_edit_text.dispose(&t);
+}
+
+static void ui_edit_doc_test_parallel_long_lines(void) {
+    // last line longer than a chunk estimate must not be dropped
+    const int32_t bytes = ui_edit_text_parallel_min * 3 / 2;
+    uint8_t* text = null;
+    swear(ut_heap.alloc((void**)&text, bytes) == 0);
+    memset(text, 'x', bytes);
+    const int32_t threads = ui_edit_text.threads;
+    for (int32_t i = 0; i < 8; i++) {
+        // single line or short line before it, with and without last '\n'
+        text[10] = i % 4 < 2 ? 'x' : '\n';
+        text[bytes - 1] = i % 2 == 0 ? 'x' : '\n';
+        ui_edit_text.threads = i < 4 ? 1 : 4;
+        ui_edit_doc_test_parallel_text(text, bytes, i % 3 == 0);
+    }
+    ui_edit_text.threads = threads;
+    ut_heap.free(text);
+}
+
+static void ui_edit_doc_test_parallel(void) {
+    // parallel and single threaded ui_edit_text.init() must agree
+    static const char* lines[] = {
+        "", "Hello", "\xC3\xA9t\xC3\xA9\r", "\xE2\x82\xAC 100",
+        "\xF0\x9F\x98\x80", "\r", "0123456789abcdefghijklmnopqrstuvwxyz"
+    };
+    const int32_t bytes = ui_edit_text_parallel_min + 4096;
+    uint8_t* text = null;
+    swear(ut_heap.alloc((void**)&text, bytes) == 0);
+    uint32_t seed = 0x1;
+    int32_t b = 0;
+    for (;;) {
+        const char* line = lines[ut_num.random32(&seed) % countof(lines)];
+        const int32_t n = (int32_t)strlen(line);
+        if (b + n + 1 > bytes) { break; }
+        memcpy(text + b, line, n);
+        b += n;
+        text[b++] = '\n';
+    }
+    const int32_t threads = ui_edit_text.threads;
+    for (int32_t i = 0; i < 8; i++) {
+        // with and without last '\n', on 1 and 5 threads, init and open
+        const int32_t k = i % 2 == 0 ? b : b - 1;
+        ui_edit_text.threads = i % 4 < 2 ? 1 : 5;
+        ui_edit_doc_test_parallel_text(text, k, i >= 4);
+    }
+    text[bytes / 2] = 0xFF; // invalid utf8 fails as single threaded
     ui_edit_text_t t = {0};
-    bool ok = ui_edit_text.init(&t, text, MB10, false);
-    swear(ok);
-    ui_edit_text.dispose(&t);
+    swear(!ui_edit_text.init(&t, text, b, true));
+    swear(t.np == 0 && t.root == null);
+    // while open() replaces it with U+FFFD on any number of threads:
+    ui_edit_text_t lazy[2] = {0};
+    for (int32_t i = 0; i < 2; i++) {
+        ui_edit_text.threads = i == 0 ? 1 : 5;
+        swear(ui_edit_text_init_lazy(&lazy[i], text, b) == 0);
+    }
+    swear(lazy[0].np == lazy[1].np);
+    swear(lazy[0].root->b == lazy[1].root->b &&
+          lazy[0].root->g == lazy[1].root->g);
+    for (int32_t i = 0; i < 2; i++) { ui_edit_text.dispose(&lazy[i]); }
+    ui_edit_text.threads = threads;
     ut_heap.free(text);
 }
 
+static void ui_edit_doc_test_long_line_same(ui_edit_doc_t* d, int32_t pn,
+        const ui_edit_str_t* r) {
+    // paragraph pn still has the gap and the same glyphs as r
+    const ui_edit_str_t* p = ui_edit_text_peek(&d->text, pn);
+    swear(d->text.gap == pn + 1 && ui_edit_str_gapped(p));
+    ui_edit_str_test_gap_same(p, r);
+}
+
+static void ui_edit_doc_test_long_line(void) {
+    // typing, backspace, undo and redo inside a long paragraph do not
+    // close its gap, ps() and snapshots see contiguous bytes
+    enum { n = ui_edit_str_long * 2 };
+    uint8_t* u = null;
+    swear(ut_heap.alloc((void**)&u, n + 6) == 0);
+    memcpy(u, "head\n", 5);
+    for (int32_t i = 0; i < n; i++) { u[5 + i] = (uint8_t)('a' + i % 26); }
+    u[5 + n] = '\n';
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    swear(ui_edit_doc.init(d, u, n + 6, false));
+    ui_edit_str_t r = {0};
+    swear(ui_edit_str_init(&r, u + 5, n, true));
+    const char* typed = "typing in the middle \xC3\xA9 ";
+    const int64_t closed = ui_edit_str_closed;
+    int32_t gp = n / 2;
+    for (int32_t i = 0; typed[i] != 0x00; i += ui_edit_str.utf8bytes(
+            (const uint8_t*)typed + i, 4)) {
+        const int32_t k = ui_edit_str.utf8bytes((const uint8_t*)typed + i, 4);
+        const ui_edit_range_t c = { .from = {1, gp}, .to = {1, gp} };
+        swear(ui_edit_doc.replace(d, &c, (const uint8_t*)typed + i, k));
+        swear(ui_edit_str_replace(&r, gp, gp, (const uint8_t*)typed + i, k));
+        gp++;
+        ui_edit_doc_test_long_line_same(d, 1, &r);
+    }
+    for (int32_t i = 0; i < 3; i++) { // backspace x 3
+        const ui_edit_range_t c = { .from = {1, gp - 1}, .to = {1, gp} };
+        swear(ui_edit_doc.replace(d, &c, null, 0));
+        swear(ui_edit_str_replace(&r, gp - 1, gp, null, 0));
+        gp--;
+        ui_edit_doc_test_long_line_same(d, 1, &r);
+    }
+    swear(ui_edit_doc.undo(d) && ui_edit_doc.redo(d));
+    ui_edit_doc_test_long_line_same(d, 1, &r);
+    // paragraph inserted before moves the gap with its paragraph:
+    const ui_edit_range_t h = { .from = {0, 2}, .to = {0, 2} };
+    swear(ui_edit_doc.replace(d, &h, (const uint8_t*)"\n", 1));
+    swear(d->text.np == 4);
+    ui_edit_doc_test_long_line_same(d, 2, &r);
+    swear(ui_edit_str_closed == closed); // not even once
+    // ps() closes the gap:
+    const ui_edit_str_t* p = ui_edit_text.ps(&d->text, 2);
+    swear(!ui_edit_str_gapped(p) && ui_edit_str_closed == closed + 1);
+    swear(p->b == r.b && p->g == r.g && memcmp(p->u, r.u, r.b) == 0);
+    // typing reopens it and snapshot closes it:
+    const ui_edit_range_t c = { .from = {2, 1}, .to = {2, 1} };
+    swear(ui_edit_doc.replace(d, &c, (const uint8_t*)"x", 1));
+    swear(ui_edit_str_replace(&r, 1, 1, (const uint8_t*)"x", 1));
+    ui_edit_doc_test_long_line_same(d, 2, &r);
+    ui_edit_snapshot_t* s = ui_edit_doc.snapshot(d);
+    swear(s != null && d->text.gap == 0);
+    p = ui_edit_text.ps(&s->text, 2);
+    swear(p->b == r.b && memcmp(p->u, r.u, r.b) == 0);
+    ui_edit_doc.dispose_snapshot(s);
+    // dispose() with the gap still open:
+    swear(ui_edit_doc.replace(d, &c, (const uint8_t*)"y", 1));
+    swear(ui_edit_str_replace(&r, 1, 1, (const uint8_t*)"y", 1));
+    ui_edit_doc_test_long_line_same(d, 2, &r);
+    ui_edit_str_free(&r);
+    ui_edit_doc.dispose(d);
+    ut_heap.free(u);
+}
+
 static void ui_edit_doc_test_paragraphs(void) {
     // ui_edit_doc_to_paragraphs() is about 1 microsecond
     for (int i = 0; i < 100; i++)
@@ -7512,11 +12192,11 @@ static void ui_edit_doc_test_paragraphs(void) {
             ui_edit_text_t t = {0};
             bool ok = ui_edit_text.init(&t, null, 0, false);
             swear(ok);
-            swear(t.ps != null && t.np == 1);
-            swear(t.ps[0].u[0] == 0 &&
-                  t.ps[0].c == 0);
-            swear(t.ps[0].b == 0 &&
-                  t.ps[0].g == 0);
+            swear(t.root != null && t.np == 1);
+            swear(ui_edit_text.ps(&t, 0)->u[0] == 0 &&
+                  ui_edit_text.ps(&t, 0)->c == 0);
+            swear(ui_edit_text.ps(&t, 0)->b == 0 &&
+                  ui_edit_text.ps(&t, 0)->g == 0);
             ui_edit_text.dispose(&t);
         }
         {   // string without "\n"
@@ -7525,11 +12205,11 @@ static void ui_edit_doc_test_paragraphs(void) {
             ui_edit_text_t t = {0};
             bool ok = ui_edit_text.init(&t, hello, n, false);
             swear(ok);
-            swear(t.ps != null && t.np == 1);
-            swear(t.ps[0].u == hello);
-            swear(t.ps[0].c == 0);
-            swear(t.ps[0].b == n);
-            swear(t.ps[0].g == n);
+            swear(t.root != null && t.np == 1);
+            swear(ui_edit_text.ps(&t, 0)->u == hello);
+            swear(ui_edit_text.ps(&t, 0)->c == 0);
+            swear(ui_edit_text.ps(&t, 0)->b == n);
+            swear(ui_edit_text.ps(&t, 0)->g == n);
             ui_edit_text.dispose(&t);
         }
         {   // string with "\n" at the end
@@ -7537,15 +12217,15 @@ static void ui_edit_doc_test_paragraphs(void) {
             ui_edit_text_t t = {0};
             bool ok = ui_edit_text.init(&t, hello, -1, false);
             swear(ok);
-            swear(t.ps != null && t.np == 2);
-            swear(t.ps[0].u == hello);
-            swear(t.ps[0].c == 0);
-            swear(t.ps[0].b == 5);
-            swear(t.ps[0].g == 5);
-            swear(t.ps[1].u[0] == 0x00);
-            swear(t.ps[0].c == 0);
-            swear(t.ps[1].b == 0);
-            swear(t.ps[1].g == 0);
+            swear(t.root != null && t.np == 2);
+            swear(ui_edit_text.ps(&t, 0)->u == hello);
+            swear(ui_edit_text.ps(&t, 0)->c == 0);
+            swear(ui_edit_text.ps(&t, 0)->b == 5);
+            swear(ui_edit_text.ps(&t, 0)->g == 5);
+            swear(ui_edit_text.ps(&t, 1)->u[0] == 0x00);
+            swear(ui_edit_text.ps(&t, 0)->c == 0);
+            swear(ui_edit_text.ps(&t, 1)->b == 0);
+            swear(ui_edit_text.ps(&t, 1)->g == 0);
             ui_edit_text.dispose(&t);
         }
         {   // two string separated by "\n"
@@ -7554,21 +12234,19 @@ static void ui_edit_doc_test_paragraphs(void) {
             ui_edit_text_t t = {0};
             bool ok = ui_edit_text.init(&t, hello, -1, false);
             swear(ok);
-            swear(t.ps != null && t.np == 2);
-            swear(t.ps[0].u == hello);
-            swear(t.ps[0].c == 0);
-            swear(t.ps[0].b == 5);
-            swear(t.ps[0].g == 5);
-            swear(t.ps[1].u == world);
-            swear(t.ps[0].c == 0);
-            swear(t.ps[1].b == 5);
-            swear(t.ps[1].g == 5);
+            swear(t.root != null && t.np == 2);
+            swear(ui_edit_text.ps(&t, 0)->u == hello);
+            swear(ui_edit_text.ps(&t, 0)->c == 0);
+            swear(ui_edit_text.ps(&t, 0)->b == 5);
+            swear(ui_edit_text.ps(&t, 0)->g == 5);
+            swear(ui_edit_text.ps(&t, 1)->u == world);
+            swear(ui_edit_text.ps(&t, 0)->c == 0);
+            swear(ui_edit_text.ps(&t, 1)->b == 5);
+            swear(ui_edit_text.ps(&t, 1)->g == 5);
             ui_edit_text.dispose(&t);
         }
     }
-    for (int i = 0; i < 10; i++) {
-        ui_edit_doc_test_big_text();
-    }
+    ui_edit_doc_test_big_text();
 }
 
 typedef struct ui_edit_doc_test_notify_s {
@@ -7639,12 +12317,12 @@ static void ui_edit_doc_test_2(void) {
         ui_edit_text_t t = {0};
         swear(ui_edit_doc.copy_text(d, null, &t));
         swear(t.np == 2);
-        swear(t.ps[0].b == 5);
-        swear(t.ps[0].g == 5);
-        swear(memcmp(t.ps[0].u, "hello", 5) == 0);
-        swear(t.ps[1].b == 5);
-        swear(t.ps[1].g == 5);
-        swear(memcmp(t.ps[1].u, "world", 5) == 0);
+        swear(ui_edit_text.ps(&t, 0)->b == 5);
+        swear(ui_edit_text.ps(&t, 0)->g == 5);
+        swear(memcmp(ui_edit_text.ps(&t, 0)->u, "hello", 5) == 0);
+        swear(ui_edit_text.ps(&t, 1)->b == 5);
+        swear(ui_edit_text.ps(&t, 1)->g == 5);
+        swear(memcmp(ui_edit_text.ps(&t, 1)->u, "world", 5) == 0);
         ui_edit_text.dispose(&t);
         ui_edit_doc.unsubscribe(d, &notify1);
         ui_edit_doc.unsubscribe(d, &before_and_after.notify);
@@ -7665,13 +12343,13 @@ static void ui_edit_doc_test_2(void) {
                               .to   = {.pn = 2, .gp = 3} };
         swear(ui_edit_doc.replace(d, &r, null, 0));
         swear(d->text.np == 1);
-        swear(d->text.ps[0].b == 9);
-        swear(d->text.ps[0].g == 9);
-        swear(memcmp(d->text.ps[0].u, "Goodverse", 9) == 0);
+        swear(ui_edit_text.ps(&d->text, 0)->b == 9);
+        swear(ui_edit_text.ps(&d->text, 0)->g == 9);
+        swear(memcmp(ui_edit_text.ps(&d->text, 0)->u, "Goodverse", 9) == 0);
         swear(ui_edit_doc.replace(d, null, null, 0)); // remove all
         swear(d->text.np == 1);
-        swear(d->text.ps[0].b == 0);
-        swear(d->text.ps[0].g == 0);
+        swear(ui_edit_text.ps(&d->text, 0)->b == 0);
+        swear(ui_edit_text.ps(&d->text, 0)->g == 0);
         ui_edit_doc.dispose(d);
     }
     // TODO: "GoodbyeCruelUniverse" insert 2x"\n" splitting in 3 paragraphs
@@ -7723,9 +12401,10 @@ static void ui_edit_doc_test_3(void) {
         ui_edit_text_t t = {0};
         swear(ui_edit_doc.copy_text(d, null, &t));
         swear(t.np == 1);
-        swear(t.ps[0].b == bytes);
-        swear(t.ps[0].g == bytes);
-        swear(memcmp(t.ps[0].u, s, t.ps[0].b) == 0);
+        swear(ui_edit_text.ps(&t, 0)->b == bytes);
+        swear(ui_edit_text.ps(&t, 0)->g == bytes);
+        const ui_edit_str_t* p0 = ui_edit_text.ps(&t, 0);
+        swear(memcmp(p0->u, s, p0->b) == 0);
         // with "\n" and 0x00 at the end:
         int32_t utf8bytes = ui_edit_doc.utf8bytes(d, null);
         char* p = null;
@@ -7788,6 +12467,1515 @@ static void ui_edit_doc_test_4(void) {
     }
 }
 
+static void ui_edit_doc_test_node_check(const ui_edit_node_t* n) {
+    // subtree sums must match the sums of the entries
+    int64_t np = 0;
+    int64_t b  = 0;
+    int64_t g  = 0;
+    for (int32_t i = 0; i < n->n; i++) {
+        if (ui_edit_node_is_leaf(n)) {
+            np++;
+            b += ui_edit_node_ps(n)[i].b;
+            g += ui_edit_node_ps(n)[i].g;
+        } else {
+            ui_edit_doc_test_node_check(n->child[i]);
+            np += n->child[i]->np;
+            b  += n->child[i]->b;
+            g  += n->child[i]->g;
+        }
+    }
+    swear(n->np == np && n->b == b && n->g == g);
+}
+
+static void ui_edit_doc_test_tree_check(const ui_edit_text_t* t,
+        const int32_t* ref, int32_t n) {
+    swear(t->np == n && t->root->np == n);
+    ui_edit_doc_test_node_check(t->root);
+    int64_t offset = 0;
+    for (int32_t pn = 0; pn < n; pn++) {
+        const ui_edit_str_t* p = ui_edit_text.ps(t, pn);
+        char s[16];
+        ut_str_printf(s, "%d", ref[pn]);
+        swear(p->b == (int32_t)strlen(s) && memcmp(p->u, s, p->b) == 0);
+        if (pn % 97 == 0) {
+            const ui_edit_pg_t pg = { .pn = pn, .gp = p->g };
+            swear(ui_edit_text.offset(t, pg) == offset + p->b);
+            const ui_edit_pg_t r = ui_edit_text.pg(t, offset + p->b);
+            swear(r.pn == pn && r.gp == p->g);
+        }
+        offset += p->b + 1;
+    }
+}
+
+static void ui_edit_doc_test_tree(void) {
+    // random multi-line inserts and deletes against a flat reference
+    enum { n = 5000, ops = 500 };
+    static int32_t ref[n * 4];
+    static char text[n * 8]; // document text (heap: false)
+    static char lines[300 * 8]; // inserted lines
+    int32_t np = 0;
+    int32_t next = 0; // next unique paragraph number
+    char* u = text;
+    for (int32_t i = 0; i < n; i++) {
+        ref[np++] = next;
+        const size_t left = (size_t)(text + countof(text) - u);
+        u += snprintf(u, left, i < n - 1 ? "%d\n" : "%d", next++);
+    }
+    ui_edit_doc_t edit_doc = {0};
+    ui_edit_doc_t* d = &edit_doc;
+    swear(ui_edit_doc.init(d, (const uint8_t*)text,
+                         (int32_t)(u - text), false));
+    ui_edit_doc_test_tree_check(&d->text, ref, np);
+    uint32_t seed = 1;
+    for (int32_t i = 0; i < ops; i++) {
+        const int32_t pn = (int32_t)(ut_num.random32(&seed) % (uint32_t)np);
+        if (np < n * 2 && ut_num.random32(&seed) % 2 == 0) {
+            // insert k new paragraphs in front of paragraph pn
+            const int32_t k = (int32_t)(ut_num.random32(&seed) % 200) + 1;
+            u = lines;
+            for (int32_t j = 0; j < k; j++) {
+                const size_t left = (size_t)(lines + countof(lines) - u);
+                u += snprintf(u, left, "%d\n", next + j);
+            }
+            memmove(ref + pn + k, ref + pn, (np - pn) * sizeof(ref[0]));
+            for (int32_t j = 0; j < k; j++) { ref[pn + j] = next++; }
+            np += k;
+            const ui_edit_range_t r = { .from = {pn, 0}, .to = {pn, 0} };
+            swear(ui_edit_doc.replace(d, &r, (const uint8_t*)lines,
+                                     (int32_t)(u - lines)));
+        } else if (np > 1) { // remove k paragraphs [pn..pn + k - 1]
+            int32_t k = (int32_t)(ut_num.random32(&seed) % 300) + 1;
+            k = ut_min(k, np - 1 - pn);
+            const ui_edit_range_t r = { .from = {pn, 0}, .to = {pn + k, 0} };
+            memmove(ref + pn, ref + pn + k, (np - pn - k) * sizeof(ref[0]));
+            np -= k;
+            swear(ui_edit_doc.replace(d, &r, null, 0));
+        }
+        ui_edit_doc_test_tree_check(&d->text, ref, np);
+    }
+    while (ui_edit_doc.undo(d)) { }
+    swear(d->text.np == n);
+    for (int32_t i = 0; i < n; i++) { ref[i] = i; }
+    ui_edit_doc_test_tree_check(&d->text, ref, n);
+    ui_edit_doc.dispose(d);
+}
+
+static void ui_edit_doc_test_lazy(void) {
+    // text of ui_edit_doc.open() with a memory buffer instead of mapping
+    static const uint8_t text[] = "Hello\r\n\xC3\xA9t\xC3\xA9\n"
+                                  "bad \xFF\xC3 utf8\n\nWorld";
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    swear(ui_edit_text_init_lazy(&d->text, text, countof(text) - 1) == 0);
+    swear(d->text.np == 5);
+    // nothing is indexed before the first access except invalid utf8:
+    for (int32_t i = 0; i < d->text.root->n; i++) {
+        const ui_edit_str_t* p = &d->text.root->ps[i];
+        swear(i == 2 ? p->c != 0 : p->g2b == null && p->c == 0);
+    }
+    swear(d->text.root->b == 30 && d->text.root->g == 24);
+    const ui_edit_str_t* s = ui_edit_text.ps(&d->text, 1);
+    swear(s->b == 5 && s->g == 3 && s->c == 0 && s->u == text + 7);
+    swear(d->text.root->ps[0].g2b == null); // untouched
+    s = ui_edit_text.ps(&d->text, 2); // invalid utf8 bytes -> U+FFFD
+    swear(s->c < 0 && s->g == 11 && s->b == 15);
+    swear(memcmp(s->u, "bad \xEF\xBF\xBD\xEF\xBF\xBD utf8", 15) == 0);
+    s = ui_edit_text.ps(&d->text, 3);
+    swear(s->b == 0 && s->g == 0);
+    const ui_edit_range_t r = { .from = {0, 5}, .to = {4, 0} };
+    swear(ui_edit_doc.replace(d, &r, (const uint8_t*)", ", -1));
+    swear(d->text.np == 1);
+    s = ui_edit_text.ps(&d->text, 0);
+    swear(s->b == 12 && memcmp(s->u, "Hello, World", 12) == 0);
+    swear(ui_edit_doc.undo(d)); // multi-line text into non-empty range
+    swear(d->text.np == 5);
+    s = ui_edit_text.ps(&d->text, 0);
+    swear(s->b == 5 && memcmp(s->u, "Hello", 5) == 0);
+    s = ui_edit_text.ps(&d->text, 4);
+    swear(s->b == 5 && memcmp(s->u, "World", 5) == 0);
+    swear(ui_edit_doc.utf8bytes(d, null) == 30 + 4 + 1); // "\n" x 4 and 0x00
+    ui_edit_doc.dispose(d);
+}
+
+static void ui_edit_doc_test_offsets(void) {
+    // offset() and pg() against brute force over every byte of the text
+    static const char* text = "\xC3\xA9t\xC3\xA9\n\nHello\r\n"
+                              "\xE2\x82\xAC\xF0\x9F\x98\x80\nWorld";
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    swear(ui_edit_doc.init(d, (const uint8_t*)text, (int32_t)strlen(text),
+                           false));
+    const ui_edit_text_t* t = &d->text;
+    const int32_t bytes = ui_edit_doc.utf8bytes(d, null) - 1; // w/o 0x00
+    swear(bytes == (int32_t)strlen(text) - 1); // w/o "\r"
+    int64_t offset = 0;
+    for (int32_t pn = 0; pn < t->np; pn++) {
+        const ui_edit_str_t* s = ui_edit_text.ps(t, pn);
+        for (int32_t gp = 0; gp <= s->g; gp++) {
+            const ui_edit_pg_t pg = { .pn = pn, .gp = gp };
+            const int64_t o = offset + ui_edit_str.g2b(s, gp);
+            swear(ui_edit_text.offset(t, pg) == o);
+            // all bytes of the glyph (and "\n") map back to pg
+            const int64_t e = gp < s->g ? offset + ui_edit_str.g2b(s, gp + 1) :
+                                          o + 1;
+            for (int64_t k = o; k < e; k++) {
+                const ui_edit_pg_t r = ui_edit_text.pg(t, k);
+                swear(r.pn == pn && r.gp == gp);
+            }
+        }
+        offset += s->b + 1;
+    }
+    const ui_edit_pg_t end = ui_edit_range.end(t);
+    const ui_edit_pg_t past = ui_edit_text.pg(t, bytes + 100);
+    swear(past.pn == end.pn && past.gp == end.gp);
+    const ui_edit_range_t all = ui_edit_range.all_on_null(t, null);
+    swear(ui_edit_text.bytes(t, &all) == bytes - (t->np - 1));
+    swear(ui_edit_text.glyphs(t, &all) == 3 + 0 + 5 + 2 + 5);
+    const ui_edit_range_t r = { .from = {0, 1}, .to = {3, 1} };
+    swear(ui_edit_text.glyphs(t, &r) == 2 + 0 + 5 + 1);
+    swear(ui_edit_text.bytes(t, &r) == 3 + 0 + 5 + 3);
+    ui_edit_doc.dispose(d);
+}
+
+typedef struct ui_edit_doc_test_reader_s {
+    ui_edit_snapshot_t* snapshot;
+    int64_t bytes; // sum of paragraph bytes seen by the reader
+} ui_edit_doc_test_reader_t;
+
+static void ui_edit_doc_test_reader(void* p) {
+    ui_edit_doc_test_reader_t* r = (ui_edit_doc_test_reader_t*)p;
+    const ui_edit_text_t* t = &r->snapshot->text;
+    for (int32_t pass = 0; pass < 4; pass++) {
+        int64_t bytes = 0;
+        for (int32_t pn = 0; pn < t->np; pn++) {
+            const ui_edit_str_t* s = ui_edit_text.ps(t, pn);
+            swear(ui_edit_str.g2b(s, s->g) == s->b);
+            bytes += s->b;
+        }
+        swear(pass == 0 || bytes == r->bytes);
+        r->bytes = bytes;
+    }
+    ui_edit_doc.dispose_snapshot(r->snapshot);
+}
+
+static void ui_edit_doc_test_snapshot_text(const ui_edit_text_t* t,
+        const char* expected) {
+    int64_t offset = 0;
+    for (int32_t pn = 0; pn < t->np; pn++) {
+        const ui_edit_str_t* s = ui_edit_text.ps(t, pn);
+        swear(memcmp(s->u, expected + offset, s->b) == 0);
+        offset += s->b;
+        swear(expected[offset] == (pn < t->np - 1 ? '\n' : 0x00));
+        offset++;
+    }
+    ui_edit_doc_test_node_check(t->root);
+}
+
+static void ui_edit_doc_test_snapshot(void) {
+    enum { n = 3000 };
+    static char text[n * 8];
+    char* u = text;
+    for (int32_t i = 0; i < n; i++) {
+        const size_t left = (size_t)(text + countof(text) - u);
+        u += snprintf(u, left, i < n - 1 ? "%d\xC3\xA9\n" : "%d", i);
+    }
+    const int32_t bytes = (int32_t)(u - text);
+    char fn[ut_files_max_path];
+    swear(ut_files.create_tmp(fn, countof(fn)) == 0);
+    int64_t transferred = 0;
+    swear(ut_files.write_fully(fn, text, bytes, &transferred) == 0);
+    for (int32_t lazy = 0; lazy < 2; lazy++) {
+        ui_edit_doc_t doc = {0};
+        ui_edit_doc_t* d = &doc;
+        if (lazy) {
+            swear(ui_edit_doc.open(d, fn) == 0);
+        } else {
+            swear(ui_edit_doc.init(d, (const uint8_t*)text, bytes, false));
+        }
+        ui_edit_snapshot_t* s = ui_edit_doc.snapshot(d);
+        swear(s != null && s->text.root == d->text.root);
+        // edit at the end copies only the path to the last leaf:
+        const ui_edit_range_t e = ui_edit_range.end_range(&d->text);
+        swear(ui_edit_doc.replace(d, &e, (const uint8_t*)"!", -1));
+        swear(s->text.root != d->text.root);
+        swear(ui_edit_text.ps(&s->text, 0) == ui_edit_text.ps(&d->text, 0));
+        swear(ui_edit_text.ps(&d->text, n - 1)->b ==
+              ui_edit_text.ps(&s->text, n - 1)->b + 1);
+        // background reader of a snapshot while document is edited:
+        ui_edit_doc_test_reader_t reader = {
+            .snapshot = ui_edit_doc.snapshot(d), .bytes = 0
+        };
+        swear(reader.snapshot != null);
+        const int64_t reader_bytes = reader.snapshot->text.root->b;
+        ut_thread_t thread = ut_thread.start(ui_edit_doc_test_reader, &reader);
+        uint32_t seed = 1;
+        for (int32_t i = 0; i < 200; i++) {
+            const uint32_t np = (uint32_t)d->text.np;
+            const int32_t pn = (int32_t)(ut_num.random32(&seed) % (np - 2));
+            const ui_edit_range_t r = { .from = {pn, 1}, .to = {pn + 2, 0} };
+            swear(ui_edit_doc.replace(d, &r, (const uint8_t*)"x\ny", -1));
+            ui_edit_doc_test_node_check(d->text.root);
+        }
+        fatal_if_not_zero(ut_thread.join(thread, -1));
+        swear(reader.bytes == reader_bytes);
+        while (ui_edit_doc.undo(d)) { }
+        // the first snapshot outlives the document:
+        ui_edit_doc.dispose(d);
+        ui_edit_doc_test_snapshot_text(&s->text, text);
+        ui_edit_doc.dispose_snapshot(s);
+    }
+    swear(ut_files.unlink(fn) == 0);
+}
+
+static ut_heap_if ui_edit_doc_test_heap; // ut_heap while allocations fail
+static int32_t ui_edit_doc_test_budget;  // allocations before out of memory
+
+static bool ui_edit_doc_test_spend(void) {
+    return ui_edit_doc_test_budget-- > 0;
+}
+
+static errno_t ui_edit_doc_test_alloc(void* *a, int64_t bytes) {
+    return ui_edit_doc_test_spend() ?
+        ui_edit_doc_test_heap.alloc(a, bytes) : ENOMEM;
+}
+
+static errno_t ui_edit_doc_test_alloc_zero(void* *a, int64_t bytes) {
+    return ui_edit_doc_test_spend() ?
+        ui_edit_doc_test_heap.alloc_zero(a, bytes) : ENOMEM;
+}
+
+static errno_t ui_edit_doc_test_realloc(void* *a, int64_t bytes) {
+    return ui_edit_doc_test_spend() ?
+        ui_edit_doc_test_heap.realloc(a, bytes) : ENOMEM;
+}
+
+static errno_t ui_edit_doc_test_allocate(ut_heap_t* heap, void* *a,
+        int64_t bytes, bool zero) {
+    return ui_edit_doc_test_spend() ?
+        ui_edit_doc_test_heap.allocate(heap, a, bytes, zero) : ENOMEM;
+}
+
+static errno_t ui_edit_doc_test_reallocate(ut_heap_t* heap, void* *a,
+        int64_t bytes, bool zero) {
+    return ui_edit_doc_test_spend() ?
+        ui_edit_doc_test_heap.reallocate(heap, a, bytes, zero) : ENOMEM;
+}
+
+static bool ui_edit_doc_test_replace_oom(ui_edit_doc_t* d,
+        const ui_edit_range_t* r, const char* utf8, int32_t budget) {
+    // replace() with only `budget` allocations succeeding
+    ui_edit_doc_test_heap = ut_heap;
+    ui_edit_doc_test_budget = budget;
+    ut_heap.alloc       = ui_edit_doc_test_alloc;
+    ut_heap.alloc_zero  = ui_edit_doc_test_alloc_zero;
+    ut_heap.realloc     = ui_edit_doc_test_realloc;
+    ut_heap.allocate    = ui_edit_doc_test_allocate;
+    ut_heap.reallocate  = ui_edit_doc_test_reallocate;
+    const int32_t b = (int32_t)strlen(utf8);
+    const bool ok = ui_edit_doc.replace(d, r,
+        b == 0 ? null : (const uint8_t*)utf8, b);
+    ut_heap = ui_edit_doc_test_heap;
+    return ok;
+}
+
+static void ui_edit_doc_test_out_of_memory(void) {
+    // nodes shared with a snapshot are copied before paragraphs are
+    // removed or updated: replace() that runs out of memory at any
+    // allocation returns false and leaves the document as it was
+    enum { n = 3000 };
+    static char text[n * 8];
+    char* u = text;
+    for (int32_t i = 0; i < n; i++) {
+        const size_t left = (size_t)(text + countof(text) - u);
+        u += snprintf(u, left, i < n - 1 ? "%d\n" : "%d", i);
+    }
+    const int32_t bytes = (int32_t)(u - text);
+    static const struct {
+        ui_edit_range_t r;
+        const char* utf8;
+    } edits[] = {
+        { { .from = {  100, 1 }, .to = { 2000, 1 } }, "m\nn"     },
+        { { .from = {   10, 1 }, .to = { 1000, 1 } }, ""          },
+        { { .from = {    5, 0 }, .to = {    7, 1 } }, "a\nb\nc"   },
+        { { .from = {   50, 0 }, .to = {   51, 0 } }, "x"         },
+        { { .from = {    1, 0 }, .to = {    1, 1 } }, "y"         },
+        { { .from = {   20, 1 }, .to = {   20, 1 } }, "p\nq"      },
+    };
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    swear(ui_edit_doc.init(d, (const uint8_t*)text, bytes, false));
+    char* before = null;
+    char* after  = null;
+    swear(ut_heap.alloc((void**)&before, bytes + 1) == 0);
+    swear(ut_heap.alloc((void**)&after,  bytes + 1) == 0);
+    for (int32_t i = 0; i < countof(edits); i++) {
+        ui_edit_snapshot_t* s = ui_edit_doc.snapshot(d);
+        swear(s != null && s->text.root == d->text.root);
+        const int32_t b = ui_edit_doc.utf8bytes(d, null);
+        ui_edit_doc.copy(d, null, before);
+        int32_t budget = 0;
+        while (!ui_edit_doc_test_replace_oom(d, &edits[i].r, edits[i].utf8,
+                                             budget)) {
+            swear(ui_edit_doc.utf8bytes(d, null) == b);
+            ui_edit_doc.copy(d, null, after);
+            swear(memcmp(before, after, (size_t)b) == 0);
+            ui_edit_doc_test_node_check(d->text.root);
+            budget++;
+        }
+        swear(budget > 0 && s->text.root != d->text.root);
+        ui_edit_doc_test_snapshot_text(&s->text, before);
+        ui_edit_doc.dispose_snapshot(s);
+        ui_edit_doc_test_node_check(d->text.root);
+    }
+    while (ui_edit_doc.undo(d)) { }
+    swear(ui_edit_doc.utf8bytes(d, null) == bytes + 1);
+    ui_edit_doc.copy(d, null, after);
+    swear(memcmp(text, after, (size_t)bytes + 1) == 0);
+    ut_heap.free(before);
+    ut_heap.free(after);
+    ui_edit_doc.dispose(d);
+}
+
+static void ui_edit_doc_test_open(void) {
+    static const char* text[] = { "", "Hello\nWorld\n" };
+    for (int32_t i = 0; i < countof(text); i++) {
+        char fn[ut_files_max_path];
+        swear(ut_files.create_tmp(fn, countof(fn)) == 0);
+        const int64_t bytes = (int64_t)strlen(text[i]);
+        int64_t transferred = 0;
+        swear(ut_files.write_fully(fn, text[i], bytes, &transferred) == 0);
+        swear(transferred == bytes);
+        ui_edit_doc_t doc = {0};
+        ui_edit_doc_t* d = &doc;
+        swear(ui_edit_doc.open(d, fn) == 0);
+        swear(d->text.np == (i == 0 ? 1 : 3));
+        swear(ui_edit_doc.utf8bytes(d, null) == bytes + 1);
+        ui_edit_doc.dispose(d);
+        swear(ut_files.unlink(fn) == 0);
+    }
+}
+
+typedef struct ui_edit_doc_test_stream_s { // memory stream counting writes
+    ut_stream_memory_if ms;
+    errno_t (*write)(ut_stream_if* s, const void* data, int64_t bytes,
+                     int64_t *transferred);
+    int32_t writes;
+} ui_edit_doc_test_stream_t;
+
+static errno_t ui_edit_doc_test_stream_write(ut_stream_if* s,
+        const void* data, int64_t bytes, int64_t *transferred) {
+    ui_edit_doc_test_stream_t* ts = (ui_edit_doc_test_stream_t*)s;
+    ts->writes++;
+    return ts->write(s, data, bytes, transferred);
+}
+
+static void ui_edit_doc_test_write_range(ui_edit_doc_t* d,
+        const ui_edit_range_t* r, bool crlf, char* copy, char* out,
+        int32_t bytes) {
+    // write(r) must produce copy(r) with optional "\r\n" separators
+    const int32_t n = ui_edit_doc.utf8bytes(d, r);
+    swear(n <= bytes);
+    ui_edit_doc.copy(d, r, copy);
+    ut_stream_memory_if ms;
+    ut_streams.write_only(&ms, out, bytes);
+    swear(ui_edit_doc.write(d, r, &ms.stream, crlf) == 0);
+    int64_t k = 0;
+    for (int32_t i = 0; i < n - 1; i++) {
+        if (crlf && copy[i] == '\n') {
+            swear(k < ms.pos_write && out[k++] == '\r');
+        }
+        swear(k < ms.pos_write && out[k++] == copy[i]);
+    }
+    swear(k == ms.pos_write);
+}
+
+static void ui_edit_doc_test_write(void) {
+    enum { n = 1000 };
+    static char text[n * 8];
+    char* u = text;
+    for (int32_t i = 0; i < n; i++) {
+        const size_t left = (size_t)(text + countof(text) - u);
+        u += snprintf(u, left, i % 7 == 3 ? "\r\n" : "%d\xC3\xA9\r\n", i);
+    }
+    const int32_t bytes = (int32_t)(u - text);
+    static char copy[countof(text) * 2];
+    static char out[countof(copy)];
+    char fn[ut_files_max_path];
+    swear(ut_files.create_tmp(fn, countof(fn)) == 0);
+    int64_t transferred = 0;
+    swear(ut_files.write_fully(fn, text, bytes, &transferred) == 0);
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    swear(ui_edit_doc.open(d, fn) == 0);
+    // unmodified mapped document is a single write of the file content
+    ui_edit_doc_test_stream_t ts = {0};
+    ut_streams.write_only(&ts.ms, out, countof(out));
+    ts.write = ts.ms.stream.write;
+    ts.ms.stream.write = ui_edit_doc_test_stream_write;
+    swear(ui_edit_doc.write(d, null, &ts.ms.stream, true) == 0);
+    swear(ts.writes == 1 && ts.ms.pos_write == bytes);
+    swear(memcmp(out, text, (size_t)bytes) == 0);
+    // out of stream space error is returned:
+    ut_stream_memory_if ms;
+    ut_streams.write_only(&ms, out, bytes / 2);
+    swear(ui_edit_doc.write(d, null, &ms.stream, true) != 0);
+    uint32_t seed = 1;
+    for (int32_t i = 0; i < 100; i++) {
+        if (i == 50) {
+            const int32_t pn = n / 2 + 1; // not empty
+            const ui_edit_range_t r = { .from = {pn, 0}, .to = {pn, 1} };
+            swear(ui_edit_doc.replace(d, &r, (const uint8_t*)"\xE2\x82\xAC", -1));
+        }
+        const int32_t np = d->text.np;
+        ui_edit_range_t r = {0};
+        for (int32_t j = 0; j < 2; j++) {
+            r.a[j].pn = (int32_t)(ut_num.random32(&seed) % (uint32_t)np);
+            const int32_t g = ui_edit_text.ps(&d->text, r.a[j].pn)->g;
+            r.a[j].gp = (int32_t)(ut_num.random32(&seed) % (uint32_t)(g + 1));
+        }
+        ui_edit_doc_test_write_range(d, &r, i % 2 == 0, copy, out, countof(out));
+    }
+    ui_edit_doc_test_write_range(d, null, false, copy, out, countof(out));
+    ui_edit_doc_test_write_range(d, null, true, copy, out, countof(out));
+    // save() and reopen:
+    char saved[ut_files_max_path];
+    swear(ut_files.create_tmp(saved, countof(saved)) == 0);
+    for (int32_t crlf = 0; crlf < 2; crlf++) {
+        swear(ui_edit_doc.save(d, saved, crlf) == 0);
+        ut_streams.write_only(&ms, out, countof(out));
+        swear(ui_edit_doc.write(d, null, &ms.stream, crlf) == 0);
+        ui_edit_doc_t reopened = {0};
+        swear(ui_edit_doc.open(&reopened, saved) == 0);
+        swear(reopened.text.np == d->text.np);
+        ut_stream_memory_if rs; // reopened document stream
+        ut_streams.write_only(&rs, copy, countof(copy));
+        swear(ui_edit_doc.write(&reopened, null, &rs.stream, crlf) == 0);
+        swear(rs.pos_write == ms.pos_write);
+        swear(memcmp(out, copy, (size_t)ms.pos_write) == 0);
+        ui_edit_doc.dispose(&reopened);
+    }
+    swear(ut_files.unlink(saved) == 0);
+    ui_edit_doc.dispose(d);
+    swear(ut_files.unlink(fn) == 0);
+}
+
+static void ui_edit_doc_test_history_text(ui_edit_doc_t* d,
+        const char* expected) {
+    char text[128];
+    swear(ui_edit_doc.utf8bytes(d, null) <= countof(text));
+    ui_edit_doc.copy(d, null, text);
+    swear(strcmp(text, expected) == 0, "\"%s\" != \"%s\"", text, expected);
+}
+
+static void ui_edit_doc_test_history(void) {
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    ui_edit_history_t* h = &d->history;
+    swear(ui_edit_doc.init(d, null, 0, false));
+    const char* typed = "hello world";
+    for (int32_t i = 0; typed[i] != 0x00; i++) { // typing coalesced by words
+        const ui_edit_range_t r = { .from = {0, i}, .to = {0, i} };
+        swear(ui_edit_doc.replace(d, &r, (const uint8_t*)typed + i, 1));
+    }
+    swear(h->records == 2 && h->merged == 9);
+    swear(ui_edit_doc.undo(d));
+    ui_edit_doc_test_history_text(d, "hello ");
+    swear(ui_edit_doc.undo(d));
+    ui_edit_doc_test_history_text(d, "");
+    swear(!ui_edit_doc.undo(d));
+    swear(ui_edit_doc.redo(d) && ui_edit_doc.redo(d) && !ui_edit_doc.redo(d));
+    ui_edit_doc_test_history_text(d, "hello world");
+    for (int32_t i = 11; i > 8; i--) { // backspace x 3
+        const ui_edit_range_t r = { .from = {0, i - 1}, .to = {0, i} };
+        swear(ui_edit_doc.replace(d, &r, null, 0));
+    }
+    for (int32_t i = 0; i < 2; i++) { // delete x 2 at the start
+        const ui_edit_range_t r = { .from = {0, 0}, .to = {0, 1} };
+        swear(ui_edit_doc.replace(d, &r, null, 0));
+    }
+    ui_edit_doc_test_history_text(d, "llo wo");
+    swear(h->records == 4);
+    swear(ui_edit_doc.undo(d));
+    ui_edit_doc_test_history_text(d, "hello wo");
+    swear(ui_edit_doc.undo(d));
+    ui_edit_doc_test_history_text(d, "hello world");
+    // backspace over paragraph break merges too:
+    const ui_edit_range_t e = ui_edit_range.end_range(&d->text);
+    swear(ui_edit_doc.replace(d, &e, (const uint8_t*)"\n\nx", -1));
+    for (int32_t pn = 2; pn > 0; pn--) {
+        const ui_edit_range_t r = { .from = {pn - 1, pn == 1 ? 11 : 0},
+                                    .to = {pn, 0} };
+        swear(ui_edit_doc.replace(d, &r, null, 0));
+    }
+    ui_edit_doc_test_history_text(d, "hello worldx");
+    swear(ui_edit_doc.undo(d));
+    ui_edit_doc_test_history_text(d, "hello world\n\nx");
+    // counters:
+    int64_t bytes = 0;
+    int32_t records = 0;
+    for (ui_edit_record_t* r = h->undo; r != null; r = r->next) {
+        bytes += ui_edit_record_size(r->bytes);
+        records++;
+    }
+    for (ui_edit_record_t* r = h->redo; r != null; r = r->next) {
+        bytes += ui_edit_record_size(r->bytes);
+        records++;
+    }
+    swear(h->bytes == bytes && h->records == records);
+    // budget trims oldest undo records:
+    h->budget = 1024;
+    for (int32_t i = 0; i < 100; i++) {
+        const ui_edit_range_t r = ui_edit_range.end_range(&d->text);
+        swear(ui_edit_doc.replace(d, &r, (const uint8_t*)"\nline", -1));
+        swear(h->bytes <= h->budget);
+    }
+    swear(h->trimmed > 0 && h->redo == null);
+    while (ui_edit_doc.undo(d)) { }
+    swear(d->text.np > 3 && h->undo == null);
+    ui_edit_doc.dispose(d);
+}
+
+static void ui_edit_doc_test_batch_random(uint32_t* seed) {
+    // batch must agree with the same replacements applied one by one
+    // in reverse order, single undo() must restore the original text
+    static const char* texts[] = {
+        "", "x", "bar", "\xC3\xA9t\xC3\xA9", "a\nb", "\n", "one\ntwo\nthree"
+    };
+    char original[1024];
+    int32_t k = 0;
+    const int32_t lines = (int32_t)(ut_num.random32(seed) % 8) + 1;
+    for (int32_t i = 0; i < lines; i++) {
+        const int32_t n = (int32_t)(ut_num.random32(seed) % 12);
+        for (int32_t j = 0; j < n; j++) {
+            original[k++] = (char)('a' + ut_num.random32(seed) % 26);
+        }
+        if (i < lines - 1) { original[k++] = '\n'; }
+    }
+    original[k] = 0x00;
+    ui_edit_doc_t batch = {0};
+    ui_edit_doc_t serial = {0};
+    const uint8_t* u = k == 0 ? null : (const uint8_t*)original;
+    swear(ui_edit_doc.init(&batch, u, k, true));
+    swear(ui_edit_doc.init(&serial, u, k, true));
+    ui_edit_replacement_t rs[16];
+    int32_t n = 0;
+    ui_edit_pg_t pg = { .pn = 0, .gp = 0 };
+    const ui_edit_pg_t end = ui_edit_range.end(&batch.text);
+    while (n < countof(rs) && ui_edit_range.compare(pg, end) < 0) {
+        ui_edit_pg_t pgs[2];
+        for (int32_t i = 0; i < 2; i++) { // advance 0..5 glyphs
+            int32_t steps = (int32_t)(ut_num.random32(seed) % 6);
+            while (steps > 0 && ui_edit_range.compare(pg, end) < 0) {
+                const ui_edit_str_t* s = ui_edit_text.ps(&batch.text, pg.pn);
+                if (pg.gp < s->g) {
+                    pg.gp++;
+                } else {
+                    pg.pn++;
+                    pg.gp = 0;
+                }
+                steps--;
+            }
+            pgs[i] = pg;
+        }
+        const char* r = texts[ut_num.random32(seed) % countof(texts)];
+        rs[n].range = (ui_edit_range_t){ .from = pgs[0], .to = pgs[1] };
+        rs[n].utf8 = *r == 0x00 ? null : (const uint8_t*)r;
+        rs[n].bytes = -1;
+        n++;
+    }
+    swear(ui_edit_doc.replace_batch(&batch, rs, n));
+    for (int32_t i = n - 1; i >= 0; i--) {
+        const int32_t b = rs[i].utf8 == null ? 0 : rs[i].bytes;
+        swear(ui_edit_doc.replace(&serial, &rs[i].range, rs[i].utf8, b));
+    }
+    char* expected = null;
+    char* text = null;
+    const int32_t bytes = ui_edit_doc.utf8bytes(&serial, null);
+    swear(ui_edit_doc.utf8bytes(&batch, null) == bytes);
+    swear(ut_heap.alloc((void**)&expected, bytes) == 0);
+    swear(ut_heap.alloc((void**)&text, ut_max(bytes, k + 1)) == 0);
+    ui_edit_doc.copy(&serial, null, expected);
+    ui_edit_doc.copy(&batch, null, text);
+    swear(strcmp(text, expected) == 0, "\"%s\" != \"%s\"", text, expected);
+    swear(n == 0 || batch.history.records == 1);
+    swear(n == 0 || ui_edit_doc.undo(&batch));
+    swear(ui_edit_doc.utf8bytes(&batch, null) == k + 1);
+    ui_edit_doc.copy(&batch, null, text);
+    swear(strcmp(text, original) == 0, "\"%s\" != \"%s\"", text, original);
+    swear(n == 0 || ui_edit_doc.redo(&batch));
+    ui_edit_doc.copy(&batch, null, text);
+    swear(strcmp(text, expected) == 0, "\"%s\" != \"%s\"", text, expected);
+    ut_heap.free(text);
+    ut_heap.free(expected);
+    ui_edit_doc.dispose(&serial);
+    ui_edit_doc.dispose(&batch);
+}
+
+static void ui_edit_doc_test_batch_all(void) {
+    // benchmark: replace all 50,000 occurrences as a single batch
+    enum { lines = 10 * 1000, per_line = 5 };
+    static const char* line = "foo = foo + foo * foo - foo;\n";
+    const int32_t line_bytes = (int32_t)strlen(line);
+    const int32_t bytes = lines * line_bytes;
+    uint8_t* text = null;
+    ui_edit_replacement_t* rs = null;
+    swear(ut_heap.alloc((void**)&text, bytes) == 0);
+    swear(ut_heap.alloc((void**)&rs, lines * per_line * sizeof(rs[0])) == 0);
+    int32_t n = 0;
+    for (int32_t i = 0; i < lines; i++) {
+        memcpy(text + i * line_bytes, line, line_bytes);
+        for (int32_t j = 0; j + 3 <= line_bytes; j++) {
+            if (memcmp(line + j, "foo", 3) == 0) {
+                rs[n].range = (ui_edit_range_t){ .from = {i, j},
+                                                 .to = {i, j + 3} };
+                rs[n].utf8 = (const uint8_t*)"a_longer_name";
+                rs[n].bytes = -1;
+                n++;
+            }
+        }
+    }
+    swear(n == lines * per_line);
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    swear(ui_edit_doc.init(d, text, bytes, true));
+    ui_edit_doc_test_notify_t before_and_after = {0};
+    before_and_after.notify.before = ui_edit_doc_test_before;
+    before_and_after.notify.after  = ui_edit_doc_test_after;
+    swear(ui_edit_doc.subscribe(d, &before_and_after.notify));
+    fp64_t time = ut_clock.seconds();
+    swear(ui_edit_doc.replace_batch(d, rs, n));
+    time = ut_clock.seconds() - time;
+    swear(before_and_after.count_before == 1 &&
+          before_and_after.count_after  == 1);
+    const int32_t delta = (int32_t)strlen("a_longer_name") - 3;
+    swear(ui_edit_doc.utf8bytes(d, null) == bytes + n * delta + 1);
+    swear(ui_edit_text.ps(&d->text, lines - 1)->g ==
+          line_bytes - 1 + per_line * delta);
+    swear(d->history.records == 1);
+    #ifdef UI_EDIT_STR_TEST_PERFORMANCE
+        traceln("replace_batch() %d replacements %.3fms", n, time * 1000);
+    #endif
+    swear(ui_edit_doc.undo(d));
+    swear(ui_edit_doc.utf8bytes(d, null) == bytes + 1);
+    swear(before_and_after.count_before == 2 &&
+          before_and_after.count_after  == 2);
+    ui_edit_doc.unsubscribe(d, &before_and_after.notify);
+    ui_edit_doc.dispose(d);
+    ut_heap.free(rs);
+    ut_heap.free(text);
+}
+
+static void ui_edit_doc_test_batch(void) {
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    const char* foo = "foo bar foo\nfoo";
+    swear(ui_edit_doc.init(d, (const uint8_t*)foo, (int32_t)strlen(foo), false));
+    const ui_edit_replacement_t rs[] = {
+        { .range = { .from = {0, 0}, .to = {0, 3} }, .utf8 = (const uint8_t*)"baz",    .bytes = -1 },
+        { .range = { .from = {0, 8}, .to = {1, 0} }, .utf8 = (const uint8_t*)"x\ny\nz", .bytes = -1 },
+        { .range = { .from = {1, 0}, .to = {1, 3} }, .utf8 = null,                     .bytes = 0 },
+    };
+    swear(ui_edit_doc.replace_batch(d, rs, countof(rs)));
+    ui_edit_doc_test_history_text(d, "baz bar x\ny\nz");
+    swear(ui_edit_doc.undo(d));
+    ui_edit_doc_test_history_text(d, "foo bar foo\nfoo");
+    swear(ui_edit_doc.redo(d));
+    ui_edit_doc_test_history_text(d, "baz bar x\ny\nz");
+    swear(ui_edit_doc.undo(d));
+    // overlapping, out of order and outside of text ranges are rejected:
+    const ui_edit_replacement_t overlap[] = {
+        { .range = { .from = {0, 0}, .to = {0, 5} }, .utf8 = null },
+        { .range = { .from = {0, 4}, .to = {0, 6} }, .utf8 = null },
+    };
+    swear(!ui_edit_doc.replace_batch(d, overlap, countof(overlap)));
+    const ui_edit_replacement_t outside[] = {
+        { .range = { .from = {0, 0}, .to = {0, 1} }, .utf8 = null },
+        { .range = { .from = {5, 0}, .to = {5, 1} }, .utf8 = null },
+    };
+    swear(!ui_edit_doc.replace_batch(d, outside, countof(outside)));
+    ui_edit_doc_test_history_text(d, "foo bar foo\nfoo");
+    swear(ui_edit_doc.replace_batch(d, null, 0));
+    ui_edit_doc.dispose(d);
+    uint32_t seed = 1;
+    for (int32_t i = 0; i < 1000; i++) { ui_edit_doc_test_batch_random(&seed); }
+    ui_edit_doc_test_batch_all();
+}
+
+static int32_t ui_edit_doc_test_find_naive(ui_edit_doc_t* d,
+        const ui_edit_find_t* f, const ui_edit_range_t* range,
+        ui_edit_range_t* matches, int32_t count) {
+    // byte by byte reference for ui_edit_doc.find_all()
+    const ui_edit_range_t r = ui_edit_range.ordered(&d->text, range);
+    const int32_t m = (int32_t)strlen((const char*)f->utf8);
+    const int32_t pg = ui_edit_str.glyphs(f->utf8, m);
+    int32_t n = 0;
+    for (int32_t pn = r.from.pn; pn <= r.to.pn; pn++) {
+        const ui_edit_str_t* s = ui_edit_text.ps(&d->text, pn);
+        const int32_t e = pn == r.to.pn ? r.to.gp : s->g;
+        int32_t gp = pn == r.from.pn ? r.from.gp : 0;
+        while (gp + pg <= e) {
+            const int32_t b = ui_edit_str.g2b(s, gp);
+            bool match = true;
+            for (int32_t i = 0; match && i < m; i++) {
+                const uint8_t c = s->u[b + i];
+                const uint8_t p = f->utf8[i];
+                match = c == p || (f->ignore_case && c < 0x80 &&
+                        tolower(c) == tolower(p));
+            }
+            if (match && f->whole_word) {
+                const uint8_t before = b > 0 ? s->u[b - 1] : 0x20;
+                const uint8_t after  = b + m < s->b ? s->u[b + m] : 0x20;
+                match = !(isalnum(before) || before == '_' || before >= 0x80) &&
+                        !(isalnum(after)  || after  == '_' || after  >= 0x80);
+            }
+            if (match) {
+                swear(n < count);
+                matches[n].from = (ui_edit_pg_t){ .pn = pn, .gp = gp };
+                matches[n].to   = (ui_edit_pg_t){ .pn = pn, .gp = gp + pg };
+                n++;
+                gp += pg;
+            } else {
+                gp++;
+            }
+        }
+    }
+    return n;
+}
+
+static void ui_edit_doc_test_find_random(uint32_t* seed) {
+    static const char* glyphs[] = { "a", "b", "A", "B", " ", "_", "\xC3\xA9" };
+    char text[4 * 1024];
+    char* u = text;
+    const int32_t lines = (int32_t)(ut_num.random32(seed) % 4) + 1;
+    for (int32_t i = 0; i < lines; i++) {
+        const int32_t k = (int32_t)(ut_num.random32(seed) % 300);
+        for (int32_t j = 0; j < k; j++) {
+            const char* g = glyphs[ut_num.random32(seed) % countof(glyphs)];
+            memcpy(u, g, strlen(g));
+            u += strlen(g);
+        }
+        if (i < lines - 1) { *u++ = '\n'; }
+    }
+    *u = 0x00;
+    char pattern[16];
+    char* p = pattern;
+    const int32_t k = (int32_t)(ut_num.random32(seed) % 3) + 1;
+    for (int32_t j = 0; j < k; j++) {
+        const char* g = glyphs[ut_num.random32(seed) % countof(glyphs)];
+        memcpy(p, g, strlen(g));
+        p += strlen(g);
+    }
+    *p = 0x00;
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    const int32_t bytes = (int32_t)(u - text);
+    swear(ui_edit_doc.init(d, bytes == 0 ? null : (const uint8_t*)text,
+                           bytes, false));
+    static ui_edit_range_t expected[countof(text)];
+    for (int32_t mode = 0; mode < 4; mode++) {
+        const ui_edit_find_t f = {
+            .utf8 = (const uint8_t*)pattern, .bytes = -1,
+            .ignore_case = (mode & 1) != 0, .whole_word = (mode & 2) != 0
+        };
+        ui_edit_range_t r = ui_edit_range.all_on_null(&d->text, null);
+        if (mode == 3) { // random sub range
+            for (int32_t j = 0; j < 2; j++) {
+                r.a[j].pn = (int32_t)(ut_num.random32(seed) % d->text.np);
+                const int32_t g = ui_edit_text.ps(&d->text, r.a[j].pn)->g;
+                r.a[j].gp = (int32_t)(ut_num.random32(seed) % (g + 1));
+            }
+            r = ui_edit_range.order(r);
+        }
+        const int32_t n = ui_edit_doc_test_find_naive(d, &f, &r, expected,
+                                                      countof(expected));
+        ui_edit_range_t* matches = null;
+        swear(ui_edit_doc.find_all(d, &f, &r, &matches) == n);
+        swear(n == 0 || memcmp(matches, expected, n * sizeof(expected[0])) == 0);
+        if (matches != null) { ut_heap.free(matches); }
+        // incremental find() from the start of the range:
+        ui_edit_range_t match = {0};
+        ui_edit_pg_t pg = r.from;
+        int32_t i = 0;
+        while (ui_edit_doc.find(d, &f, pg, &match) &&
+               ui_edit_range.compare(match.to, r.to) <= 0) {
+            swear(i < n && memcmp(&match, &expected[i], sizeof(match)) == 0);
+            pg = match.to;
+            i++;
+        }
+        swear(i == n);
+    }
+    ui_edit_doc.dispose(d);
+}
+
+static void ui_edit_doc_test_find_parallel(void) {
+    // worker threads must find exactly what a single thread finds
+    enum { n = 160 * 1024 }; // lines, ~5MB
+    const char* line = "Lorem ipsum dolor sit amet, consectetur \xC3\xA9lit\n";
+    const int32_t k = (int32_t)strlen(line);
+    uint8_t* text = null;
+    swear(ut_heap.alloc((void**)&text, (int64_t)n * k) == 0);
+    for (int32_t i = 0; i < n; i++) { memcpy(text + i * k, line, k); }
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    swear(ui_edit_doc.init(d, text, n * k, false));
+    const ui_edit_find_t f = { .utf8 = (const uint8_t*)"LIT", .bytes = -1,
+                               .ignore_case = true, .whole_word = true };
+    const int32_t threads = ui_edit_text.threads;
+    ui_edit_range_t* m[2] = { null, null };
+    int32_t count[2] = {0};
+    for (int32_t i = 0; i < 2; i++) {
+        ui_edit_text.threads = i == 0 ? 1 : 4;
+        count[i] = ui_edit_doc.find_all(d, &f, null, &m[i]);
+    }
+    ui_edit_text.threads = threads;
+    swear(count[0] == 0, "\xC3\xA9lit is not a whole word");
+    const ui_edit_find_t a = { .utf8 = (const uint8_t*)"AMET,", .bytes = -1,
+                               .ignore_case = true };
+    for (int32_t i = 0; i < 2; i++) {
+        ui_edit_text.threads = i == 0 ? 1 : 4;
+        count[i] = ui_edit_doc.find_all(d, &a, null, &m[i]);
+    }
+    ui_edit_text.threads = threads;
+    swear(count[0] == n && count[1] == n);
+    swear(memcmp(m[0], m[1], n * sizeof(m[0][0])) == 0);
+    for (int32_t i = 0; i < n; i += 997) {
+        swear(m[1][i].from.pn == i && m[1][i].from.gp == 22 &&
+              m[1][i].to.gp == 27);
+    }
+    for (int32_t i = 0; i < 2; i++) { ut_heap.free(m[i]); }
+    ui_edit_doc.dispose(d);
+    ut_heap.free(text);
+}
+
+static void ui_edit_doc_test_find(void) {
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    const char* text = "Hello hello HELLO\n"
+                       "say hello_world \xC3\xA9hello\n"
+                       "hello";
+    swear(ui_edit_doc.init(d, (const uint8_t*)text, (int32_t)strlen(text),
+                           false));
+    ui_edit_find_t f = { .utf8 = (const uint8_t*)"hello", .bytes = -1 };
+    ui_edit_range_t* m = null;
+    swear(ui_edit_doc.find_all(d, &f, null, &m) == 4);
+    swear(m[0].from.pn == 0 && m[0].from.gp == 6 && m[0].to.gp == 11);
+    swear(m[2].from.pn == 1 && m[2].from.gp == 17 && m[2].to.gp == 22);
+    ut_heap.free(m);
+    f.ignore_case = true;
+    swear(ui_edit_doc.find_all(d, &f, null, &m) == 6);
+    ut_heap.free(m);
+    f.whole_word = true;
+    swear(ui_edit_doc.find_all(d, &f, null, &m) == 4);
+    swear(m[3].from.pn == 2 && m[3].from.gp == 0);
+    ut_heap.free(m);
+    ui_edit_range_t match = {0};
+    swear(ui_edit_doc.find(d, &f, (ui_edit_pg_t){ .pn = 0, .gp = 1 }, &match));
+    swear(match.from.pn == 0 && match.from.gp == 6);
+    swear(!ui_edit_doc.find(d, &f, (ui_edit_pg_t){ .pn = 2, .gp = 1 }, &match));
+    f.utf8 = (const uint8_t*)"a\nb"; // multi-line patterns are not supported
+    swear(!ui_edit_doc.find(d, &f, (ui_edit_pg_t){ .pn = 0, .gp = 0 }, &match));
+    ui_edit_doc.dispose(d);
+    // replace_all() is a single undo step:
+    text = "foo bar foo\nfoo foobar";
+    swear(ui_edit_doc.init(d, (const uint8_t*)text, (int32_t)strlen(text),
+                           false));
+    f = (ui_edit_find_t){ .utf8 = (const uint8_t*)"foo", .bytes = -1,
+                          .whole_word = true };
+    swear(ui_edit_doc.replace_all(d, &f, null, (const uint8_t*)"x\ny", -1) == 3);
+    ui_edit_doc_test_history_text(d, "x\ny bar x\ny\nx\ny foobar");
+    swear(ui_edit_doc.undo(d));
+    ui_edit_doc_test_history_text(d, "foo bar foo\nfoo foobar");
+    swear(!ui_edit_doc.undo(d));
+    swear(ui_edit_doc.redo(d));
+    ui_edit_doc_test_history_text(d, "x\ny bar x\ny\nx\ny foobar");
+    ui_edit_doc.dispose(d);
+    uint32_t seed = 1;
+    for (int32_t i = 0; i < 1000; i++) { ui_edit_doc_test_find_random(&seed); }
+    ui_edit_doc_test_find_parallel();
+}
+
+static void ui_edit_doc_test_index_compare(ui_edit_index_t* x,
+        uint32_t* seed) {
+    // indexed find_all() must find exactly what ui_edit_doc.find_all() does
+    static const char* glyphs[] = { "a", "b", "A", " ", "\xC3\xA9" };
+    for (int32_t i = 0; i < 8; i++) {
+        char pattern[16];
+        char* p = pattern;
+        const int32_t k = (int32_t)(ut_num.random32(seed) % 4) + 1;
+        for (int32_t j = 0; j < k; j++) {
+            const char* g = glyphs[ut_num.random32(seed) % countof(glyphs)];
+            memcpy(p, g, strlen(g));
+            p += strlen(g);
+        }
+        *p = 0x00;
+        const ui_edit_find_t f = {
+            .utf8 = (const uint8_t*)pattern, .bytes = -1,
+            .ignore_case = (i & 1) != 0, .whole_word = (i & 2) != 0
+        };
+        ui_edit_range_t* expected = null;
+        ui_edit_range_t* matches = null;
+        const int32_t n = ui_edit_doc.find_all(x->d, &f, null, &expected);
+        swear(ui_edit_index.find_all(x, &f, &matches) == n);
+        swear(n == 0 || memcmp(matches, expected, n * sizeof(matches[0])) == 0);
+        if (expected != null) { ut_heap.free(expected); }
+        if (matches  != null) { ut_heap.free(matches); }
+    }
+}
+
+static void ui_edit_doc_test_index(void) {
+    static const char* glyphs[] = { "a", "b", "A", " ", "\xC3\xA9", "\n" };
+    uint32_t seed = 1;
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    const char* text = "aba\nAbA ab\xC3\xA9 \nbaa";
+    swear(ui_edit_doc.init(d, (const uint8_t*)text, (int32_t)strlen(text),
+                           false));
+    ui_edit_index_t index = {0};
+    ui_edit_index_t* x = &index;
+    swear(ui_edit_index.init(x, d));
+    ui_edit_doc_test_index_compare(x, &seed);
+    for (int32_t i = 0; i < 300; i++) {
+        char u[64];
+        char* p = u;
+        const int32_t k = (int32_t)(ut_num.random32(&seed) % 12);
+        for (int32_t j = 0; j < k; j++) {
+            const char* g = glyphs[ut_num.random32(&seed) % countof(glyphs)];
+            memcpy(p, g, strlen(g));
+            p += strlen(g);
+        }
+        *p = 0x00;
+        ui_edit_range_t r = {0};
+        for (int32_t j = 0; j < 2; j++) {
+            r.a[j].pn = (int32_t)(ut_num.random32(&seed) % d->text.np);
+            const int32_t g = ui_edit_text.ps(&d->text, r.a[j].pn)->g;
+            r.a[j].gp = (int32_t)(ut_num.random32(&seed) % (g + 1));
+        }
+        r = ui_edit_range.order(r);
+        const uint32_t op = ut_num.random32(&seed) % 8;
+        if (op == 0) {
+            ui_edit_doc.undo(d);
+        } else if (op == 1) {
+            ui_edit_doc.redo(d);
+        } else if (op == 2 && r.from.pn < r.to.pn) {
+            const ui_edit_replacement_t b[2] = {
+                { .range = { .from = r.from, .to = r.from }, .utf8 = null },
+                { .range = { .from = r.to,   .to = r.to   },
+                  .utf8 = (const uint8_t*)u, .bytes = (int32_t)(p - u) }
+            };
+            swear(ui_edit_doc.replace_batch(d, b, countof(b)));
+        } else {
+            swear(ui_edit_doc.replace(d, &r, (const uint8_t*)u, (int32_t)(p - u)));
+        }
+        ui_edit_doc_test_index_compare(x, &seed);
+    }
+    ui_edit_index.dispose(x);
+    ui_edit_doc.dispose(d);
+    // editing a long paragraph accumulates stale postings until rebuild:
+    enum { n = 4 * 1024 };
+    uint8_t line[n];
+    for (int32_t i = 0; i < n; i++) {
+        line[i] = (uint8_t)('a' + ut_num.random32(&seed) % 25); // no 'z'
+    }
+    swear(ui_edit_doc.init(d, line, n, false));
+    swear(ui_edit_index.init(x, d));
+    bool rebuilt = false;
+    for (int32_t i = 0; i < 64; i++) {
+        const int64_t stale = x->stale;
+        const ui_edit_range_t r = { .from = {0, i}, .to = {0, i + 1} };
+        swear(ui_edit_doc.replace(d, &r, (const uint8_t*)"Z", 1));
+        swear(x->valid && x->stale <= x->entries - x->stale +
+              ui_edit_index_stale_min);
+        rebuilt |= x->stale < stale;
+    }
+    swear(rebuilt);
+    const ui_edit_find_t f = { .utf8 = (const uint8_t*)"zzz", .bytes = -1,
+                               .ignore_case = true };
+    ui_edit_range_t* m = null;
+    swear(ui_edit_index.find_all(x, &f, &m) == 21);
+    swear(m[20].from.pn == 0 && m[20].from.gp == 60 && m[20].to.gp == 63);
+    ut_heap.free(m);
+    ui_edit_index.dispose(x);
+    ui_edit_doc.dispose(d);
+}
+
+static void ui_edit_doc_test_arena(void) {
+    const char* text = "{\n    int x = 0;\n}\n\xC3\xA9t\xC3\xA9";
+    const bool arena = ui_edit_doc.arena;
+    for (int32_t i = 0; i < 2; i++) {
+        ui_edit_doc.arena = i == 0;
+        ui_edit_doc_t doc = {0};
+        ui_edit_doc_t* d = &doc;
+        swear(ui_edit_doc.init(d, (const uint8_t*)text, (int32_t)strlen(text),
+                               false));
+        swear(i == 0 ? d->arena != null && d->text.heap != null :
+                       d->arena == null && d->text.heap == null);
+        swear(d->text.root->heap == d->text.heap);
+        const ui_edit_range_t r = { .from = {1, 4}, .to = {2, 1} };
+        swear(ui_edit_doc.replace(d, &r, (const uint8_t*)"return;\n}\n", -1));
+        ui_edit_snapshot_t* s = ui_edit_doc.snapshot(d);
+        swear(s != null && s->arena == d->arena);
+        const ui_edit_range_t e = ui_edit_range.end_range(&d->text);
+        swear(ui_edit_doc.replace(d, &e, (const uint8_t*)"!", -1));
+        // the snapshot outlives the document and keeps its heap:
+        ui_edit_doc.dispose(d);
+        ui_edit_doc_test_snapshot_text(&s->text,
+            "{\n    return;\n}\n\n\xC3\xA9t\xC3\xA9");
+        ui_edit_doc.dispose_snapshot(s);
+        // without snapshots dispose() releases the heap at once:
+        swear(ui_edit_doc.init(d, (const uint8_t*)text, (int32_t)strlen(text),
+                               true));
+        swear(ui_edit_doc.replace(d, &r, null, 0));
+        swear(ui_edit_doc.undo(d));
+        ui_edit_doc_test_history_text(d, text);
+        ui_edit_doc.dispose(d);
+    }
+    ui_edit_doc.arena = arena;
+}
+
+static void ui_edit_doc_test_cold_same(ui_edit_doc_t* d, ui_edit_doc_t* m) {
+    const int32_t bytes = ui_edit_doc.utf8bytes(d, null);
+    swear(bytes == ui_edit_doc.utf8bytes(m, null));
+    char* u = null;
+    char* v = null;
+    swear(ut_heap.alloc((void**)&u, bytes + 1) == 0);
+    swear(ut_heap.alloc((void**)&v, bytes + 1) == 0);
+    ui_edit_doc.copy(d, null, u);
+    ui_edit_doc.copy(m, null, v);
+    swear(memcmp(u, v, (size_t)bytes) == 0);
+    ut_heap.free(u);
+    ut_heap.free(v);
+    ui_edit_doc_test_node_check(d->text.root);
+}
+
+static void ui_edit_doc_test_cold(void) {
+    // LZ codec round trip of compressible and random bytes:
+    enum { n = 64 * 1024 };
+    uint8_t* a = null;
+    uint8_t* b = null;
+    swear(ut_heap.alloc((void**)&a, n) == 0);
+    swear(ut_heap.alloc((void**)&b, n * 2) == 0);
+    uint32_t seed = 1;
+    for (int32_t i = 0; i < n; i++) {
+        // repeated 97 bytes with every 50th byte random, then random:
+        const bool random = i >= n / 2 || i % 50 == 0 || i < 97;
+        a[i] = (uint8_t)(random ? ut_num.random32(&seed) : a[i - 97]);
+    }
+    const int32_t zb = ui_edit_lz_compress(a, n / 2, b, n);
+    swear(0 < zb && zb < n / 4);
+    swear(ui_edit_lz_decompress(b, zb, b + n, n / 2));
+    swear(memcmp(a, b + n, n / 2) == 0);
+    swear(ui_edit_lz_compress(a + n / 2, n / 2, b, n / 2 - 1) < 0);
+    swear(!ui_edit_lz_decompress(b, zb, b + n, n / 2 - 1));
+    ut_heap.free(b);
+    // document with read only, owned and empty paragraphs:
+    for (int32_t i = 0; i < n; i++) {
+        const bool lf = (i % 37 == 36 || i % 1001 == 2) && i % 11 > 1;
+        a[i] = lf ? '\n' : i % 11 == 0 ? 0xC3 : i % 11 == 1 ? 0xA9 :
+               (uint8_t)('a' + i % 7);
+    }
+    a[n - 1] = 'z';
+    ui_edit_doc_t cold = {0};
+    ui_edit_doc_t* d = &cold;
+    ui_edit_doc_t model = {0};
+    ui_edit_doc_t* m = &model;
+    swear(ui_edit_doc.init(d, a, n, false));
+    swear(ui_edit_doc.init(m, a, n, false));
+    d->cold.ceiling = 4 * 1024;
+    for (int32_t i = 0; i < 100; i++) {
+        ui_edit_doc.cool(d);
+        ui_edit_doc.cool(d); // nothing was touched since the previous one
+        swear(d->cold.leaves > 0 && d->cold.hot <= d->cold.ceiling);
+        ui_edit_range_t r = {0}; // within paragraph or across "\n"
+        r.from.pn = (int32_t)(ut_num.random32(&seed) % d->text.np);
+        r.to.pn = ut_min(r.from.pn + i % 2, d->text.np - 1);
+        for (int32_t j = 0; j < 2; j++) {
+            const int32_t g = ui_edit_text.ps(&m->text, r.a[j].pn)->g;
+            r.a[j].gp = (int32_t)(ut_num.random32(&seed) % (g + 1));
+        }
+        r = ui_edit_range.order(r);
+        const char* s = i % 3 == 0 ? "\xC3\xA9\n" : i % 3 == 1 ? "x" : null;
+        const int32_t k = s == null ? 0 : (int32_t)strlen(s);
+        swear(ui_edit_doc.replace(d, &r, (const uint8_t*)s, k));
+        swear(ui_edit_doc.replace(m, &r, (const uint8_t*)s, k));
+        if (i % 10 == 0) { ui_edit_doc_test_cold_same(d, m); }
+    }
+    ui_edit_doc.cool(d);
+    ui_edit_doc.cool(d);
+    swear(d->cold.leaves > 0 && d->cold.bytes > 0);
+    // cold leaves are decompressed by any thread that touches them:
+    ui_edit_doc_test_reader_t reader = {
+        .snapshot = ui_edit_doc.snapshot(d), .bytes = 0
+    };
+    swear(reader.snapshot != null);
+    ut_thread_t thread = ut_thread.start(ui_edit_doc_test_reader, &reader);
+    for (int32_t pn = 0; pn < d->text.np; pn++) {
+        swear(ui_edit_text.ps(&d->text, pn)->b >= 0);
+    }
+    fatal_if_not_zero(ut_thread.join(thread, -1));
+    swear(reader.bytes == d->text.root->b);
+    // leaves shared with snapshots stay uncompressed:
+    ui_edit_doc_test_cold_same(d, m); // decompresses all leaves
+    ui_edit_snapshot_t* s = ui_edit_doc.snapshot(d);
+    ui_edit_doc.cool(d);
+    ui_edit_doc.cool(d);
+    swear(d->cold.leaves == 0);
+    ui_edit_doc.dispose_snapshot(s);
+    ui_edit_doc.cool(d);
+    ui_edit_doc.cool(d);
+    swear(d->cold.leaves > 0 && d->cold.hot <= d->cold.ceiling);
+    ui_edit_doc_test_cold_same(d, m);
+    // leaf used after the previous cool() stays hot even when another
+    // document is cooled in between:
+    d->cold.ceiling = 1;
+    ui_edit_doc.cool(d);
+    ui_edit_doc.cool(d);
+    const int32_t leaves = d->cold.leaves;
+    swear(ui_edit_text.ps(&d->text, 0)->b >= 0);
+    ui_edit_doc.cool(m);
+    ui_edit_doc.cool(d);
+    swear(d->cold.leaves == leaves - 1);
+    ui_edit_doc.dispose(d);
+    ui_edit_doc.dispose(m);
+    ut_heap.free(a);
+}
+
+static bool ui_edit_doc_test_tail_ps(ui_edit_doc_t* d, int32_t pn,
+        const char* utf8) {
+    const ui_edit_str_t* s = ui_edit_text.ps(&d->text, pn);
+    return s->b == (int32_t)strlen(utf8) && memcmp(s->u, utf8, s->b) == 0;
+}
+
+static void ui_edit_doc_test_tail(void) {
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    swear(ui_edit_doc.init(d, null, 0, false));
+    ui_edit_doc_test_notify_t before_and_after = {0};
+    before_and_after.notify.before = ui_edit_doc_test_before;
+    before_and_after.notify.after  = ui_edit_doc_test_after;
+    swear(ui_edit_doc.subscribe(d, &before_and_after.notify));
+    // partial line, "\r\n" and utf8 sequences split between appends:
+    static const char* parts[] = {
+        "Hello", " World\r", "\n\xC3", "\xA9t\xC3\xA9\n", "\xFF" "x\n"
+    };
+    for (int32_t i = 0; i < countof(parts); i++) {
+        swear(ui_edit_doc.append(d, (const uint8_t*)parts[i], -1));
+        swear(ui_edit_doc.flush(d) == 0);
+        swear(before_and_after.count_after == i + 1);
+    }
+    swear(ui_edit_doc.flush(d) == 0); // nothing pending: no notifications
+    swear(before_and_after.count_before == countof(parts));
+    swear(before_and_after.count_after  == countof(parts));
+    swear(d->text.np == 4 && d->tail.count == 0);
+    swear(ui_edit_doc_test_tail_ps(d, 0, "Hello World"));
+    swear(ui_edit_doc_test_tail_ps(d, 1, "\xC3\xA9t\xC3\xA9"));
+    swear(ui_edit_doc_test_tail_ps(d, 2, "\xEF\xBF\xBDx"));
+    swear(ui_edit_doc_test_tail_ps(d, 3, ""));
+    swear(d->history.undo == null && d->history.records == 0);
+    // many appends are flushed in a single notification:
+    for (int32_t i = 0; i < 100; i++) {
+        char line[32];
+        ut_str_printf(line, "line %d\n", i);
+        swear(ui_edit_doc.append(d, (const uint8_t*)line, -1));
+    }
+    swear(ui_edit_doc.flush(d) == 0);
+    swear(before_and_after.count_after == countof(parts) + 1);
+    swear(d->text.np == 104 && ui_edit_doc_test_tail_ps(d, 102, "line 99"));
+    // ring of lines drops the oldest paragraphs and undo history:
+    const ui_edit_range_t r = { .from = {0, 0}, .to = {0, 0} };
+    swear(ui_edit_doc.replace(d, &r, (const uint8_t*)"!", 1));
+    swear(d->history.undo != null);
+    d->tail.lines = 3;
+    swear(ui_edit_doc.append(d, (const uint8_t*)"last\n", -1));
+    swear(ui_edit_doc.flush(d) == 0);
+    swear(d->text.np == 3 && d->tail.dropped == 102);
+    swear(ui_edit_doc_test_tail_ps(d, 0, "line 99"));
+    swear(ui_edit_doc_test_tail_ps(d, 1, "last"));
+    swear(d->history.undo == null && d->history.records == 0);
+    // ring of bytes:
+    d->tail.lines = 0;
+    d->tail.bytes = 20;
+    for (int32_t i = 0; i < 5; i++) {
+        swear(ui_edit_doc.append(d, (const uint8_t*)"0123456789\n", -1));
+        swear(ui_edit_doc.flush(d) == 0);
+        const int64_t total = ui_edit_text.offset(&d->text,
+                                  ui_edit_range.end(&d->text));
+        swear(total <= d->tail.bytes);
+    }
+    swear(d->text.np == 2 && ui_edit_doc_test_tail_ps(d, 0, "0123456789"));
+    ui_edit_doc.unsubscribe(d, &before_and_after.notify);
+    ui_edit_doc.dispose(d);
+    // follow() growing and truncated file:
+    char fn[ut_files_max_path];
+    swear(ut_files.create_tmp(fn, countof(fn)) == 0);
+    static const char* file[] = {
+        "partial line\nfirst\n", "partial line\nfirst\nsecond\n", "x\n"
+    };
+    swear(ui_edit_doc.init(d, null, 0, false));
+    d->tail.bytes = 10;
+    for (int32_t i = 0; i < countof(file); i++) {
+        const int64_t bytes = (int64_t)strlen(file[i]);
+        int64_t transferred = 0;
+        swear(ut_files.write_fully(fn, file[i], bytes, &transferred) == 0);
+        swear(transferred == bytes);
+        if (i == 0) { swear(ui_edit_doc.follow(d, fn) == 0); }
+        swear(ui_edit_doc.flush(d) == 0);
+    }
+    swear(d->text.np == 3);
+    swear(ui_edit_doc_test_tail_ps(d, 0, "second"));
+    swear(ui_edit_doc_test_tail_ps(d, 1, "x"));
+    ui_edit_doc.dispose(d);
+    swear(ut_files.unlink(fn) == 0);
+}
+
+static void ui_edit_doc_test_dedup_same(ui_edit_doc_t* d, ui_edit_doc_t* m) {
+    ui_edit_doc_test_cold_same(d, m);
+    swear(d->text.np == m->text.np);
+    for (int32_t pn = 0; pn < d->text.np; pn++) {
+        const ui_edit_str_t* p = ui_edit_text.ps(&d->text, pn);
+        const ui_edit_str_t* q = ui_edit_text.ps(&m->text, pn);
+        swear(p->g == q->g);
+        for (int32_t gp = 0; gp <= p->g; gp++) {
+            swear(ui_edit_str.g2b(p, gp) == ui_edit_str.g2b(q, gp));
+        }
+    }
+}
+
+static void ui_edit_doc_test_dedup(void) {
+    static const char* lines[] = {
+        "2024-01-01 12:00:00 INFO server started on port 8080",
+        "2024-01-01 12:00:01 WARN cache miss for \xC3\xA9t\xC3\xA9 key",
+        "    return ui_edit_str_replace_in(h, s, f, t, u, b);",
+        "}" // in place: not shared
+    };
+    enum { n = 400 };
+    char* text = null;
+    swear(ut_heap.alloc((void**)&text, n * 64) == 0);
+    int32_t k = 0;
+    int32_t shared = 0; // number of paragraphs expected to be shared
+    for (int32_t i = 0; i < n; i++) {
+        char line[64];
+        if (i % 7 == 0) {
+            ut_str_printf(line, "unique paragraph %06d\n", i);
+        } else {
+            ut_str_printf(line, "%s\n", lines[i % 4]);
+            if (i % 4 != 3) { shared++; }
+        }
+        memcpy(text + k, line, strlen(line));
+        k += (int32_t)strlen(line);
+    }
+    const bool arena = ui_edit_doc.arena;
+    const int32_t sparse = ui_edit_str.sparse;
+    for (int32_t i = 0; i < 4; i++) {
+        ui_edit_doc.arena = i % 2 == 0;
+        ui_edit_str.sparse = i < 2 ? 0 : 4;
+        ui_edit_doc_t doc = {0};
+        ui_edit_doc_t* d = &doc;
+        ui_edit_doc_t reference = {0};
+        ui_edit_doc_t* m = &reference;
+        swear(ui_edit_doc.init(d, (const uint8_t*)text, k, true));
+        swear(ui_edit_doc.init(m, (const uint8_t*)text, k, true));
+        ui_edit_doc.dedup(d);
+        const ui_edit_dedup_t s = d->dedup;
+        swear(s.blocks == 3 && s.paragraphs == shared);
+        swear(s.bytes > s.shared * 10);
+        ui_edit_doc_test_dedup_same(d, m);
+        ui_edit_doc.dedup(d); // idempotent
+        swear(memcmp(&s, &d->dedup, sizeof(s)) == 0);
+        // edit copies shared paragraph, the others keep the block:
+        const ui_edit_range_t r = { .from = {1, 5}, .to = {1, 7} };
+        swear(ui_edit_doc.replace(d, &r, (const uint8_t*)"X", 1));
+        swear(ui_edit_doc.replace(m, &r, (const uint8_t*)"X", 1));
+        ui_edit_doc_test_dedup_same(d, m);
+        ui_edit_doc.dedup(d);
+        swear(d->dedup.blocks == 3 && d->dedup.paragraphs == shared - 1);
+        swear(ui_edit_doc.undo(d) && ui_edit_doc.undo(m));
+        ui_edit_doc_test_dedup_same(d, m);
+        // snapshot keeps its copy of the leaf with shared paragraphs:
+        ui_edit_doc.dedup(d);
+        ui_edit_snapshot_t* snapshot = ui_edit_doc.snapshot(d);
+        const ui_edit_range_t e = { .from = {2, 0}, .to = {3, 0} };
+        swear(ui_edit_doc.replace(d, &e, null, 0));
+        swear(ui_edit_doc.replace(m, &e, null, 0));
+        ui_edit_doc_test_dedup_same(d, m);
+        ui_edit_doc.dedup(d); // skips leaves shared with the snapshot
+        swear(d->dedup.paragraphs < shared);
+        const ui_edit_str_t* p = ui_edit_text.ps(&snapshot->text, 2);
+        swear(p->b == (int32_t)strlen(lines[2]) &&
+              memcmp(p->u, lines[2], p->b) == 0);
+        ui_edit_doc.dispose_snapshot(snapshot);
+        ui_edit_doc.dedup(d);
+        swear(d->dedup.paragraphs == shared - 1);
+        // compressed leaves keep copies of the shared bytes:
+        d->cold.ceiling = 1;
+        ui_edit_doc.cool(d);
+        ui_edit_doc.cool(d);
+        swear(d->cold.leaves > 0);
+        ui_edit_doc_test_dedup_same(d, m);
+        ui_edit_doc.dispose(d);
+        ui_edit_doc.dispose(m);
+    }
+    ui_edit_str.sparse = sparse;
+    ui_edit_doc.arena = arena;
+    ut_heap.free(text);
+}
+
+static void ui_edit_doc_test_journal_edits(ui_edit_doc_t* d) {
+    // 8 notifications: replace, typing x 3, undo, redo, batch, append
+    const ui_edit_range_t r = { .from = {0, 0}, .to = {0, 5} };
+    swear(ui_edit_doc.replace(d, &r, (const uint8_t*)"H\xC3\xA9", -1));
+    for (int32_t i = 0; i < 3; i++) {
+        const ui_edit_range_t c = { .from = {1, 5 + i}, .to = {1, 5 + i} };
+        swear(ui_edit_doc.replace(d, &c, (const uint8_t*)"!", 1));
+    }
+    swear(ui_edit_doc.undo(d) && ui_edit_doc.redo(d));
+    const ui_edit_replacement_t b[] = {
+        { .range = { .from = {0, 0}, .to = {0, 1} }, .utf8 = (const uint8_t*)"h", .bytes = 1 },
+        { .range = { .from = {1, 0}, .to = {2, 0} }, .utf8 = null, .bytes = 0 },
+        { .range = { .from = {2, 3}, .to = {2, 3} }, .utf8 = (const uint8_t*)"\nnew\n", .bytes = 5 }
+    };
+    swear(ui_edit_doc.replace_batch(d, b, countof(b)));
+    swear(ui_edit_doc.append(d, (const uint8_t*)"tail\nlines\n", -1));
+    swear(ui_edit_doc.flush(d) == 0);
+}
+
+static void ui_edit_doc_test_journal_file(const char* fn, ui_edit_doc_t* m) {
+    ui_edit_doc_t doc = {0};
+    swear(ui_edit_doc.open(&doc, fn) == 0);
+    ui_edit_doc_test_cold_same(&doc, m);
+    ui_edit_doc.dispose(&doc);
+}
+
+static void ui_edit_doc_test_journal(void) {
+    static const char* text = "Hello\nWorld\nabcdef\n";
+    char fn[ut_files_max_path];
+    swear(ut_files.create_tmp(fn, countof(fn)) == 0);
+    int64_t transferred = 0;
+    swear(ut_files.write_fully(fn, text, (int64_t)strlen(text),
+                               &transferred) == 0);
+    ui_edit_doc_t reference = {0};
+    ui_edit_doc_t* m = &reference;
+    swear(ui_edit_doc.init(m, (const uint8_t*)text,
+                           (int32_t)strlen(text), false));
+    ui_edit_doc_test_journal_edits(m);
+    ui_edit_doc_t doc = {0};
+    ui_edit_doc_t* d = &doc;
+    ui_edit_journal_t journal = {0};
+    ui_edit_journal_t* j = &journal;
+    swear(ui_edit_doc.open(d, fn) == 0);
+    swear(ui_edit_journal.open(j, d, fn) == 0);
+    swear(j->replayed == 0 && j->compactions == 0);
+    ui_edit_doc_test_journal_edits(d);
+    swear(j->records == 8 && j->error == 0);
+    ui_edit_doc_test_cold_same(d, m);
+    // crash: journal synced but not compacted, file is intact:
+    ut_file_name_t name = {0};
+    ut_str.format(name.s, countof(name.s), "%s", j->name.s);
+    const int64_t bytes = j->bytes;
+    swear(ui_edit_journal.dispose(j) == 0);
+    ui_edit_doc.dispose(d);
+    ui_edit_doc_t original = {0};
+    swear(ui_edit_doc.init(&original, (const uint8_t*)text,
+                           (int32_t)strlen(text), false));
+    ui_edit_doc_test_journal_file(fn, &original);
+    // torn record at the end of the journal is ignored:
+    uint8_t* data = null;
+    swear(ut_heap.alloc((void**)&data, bytes + 3) == 0);
+    ut_file_t* f = null;
+    swear(ut_files.open(&f, name.s, ut_files.o_rd) == 0);
+    swear(ut_files.read(f, data, bytes, &transferred) == 0);
+    swear(transferred == bytes);
+    ut_files.close(f);
+    memcpy(data + bytes, "\x10" "ab", 3);
+    swear(ut_files.write_fully(name.s, data, bytes + 3, &transferred) == 0);
+    swear(ui_edit_doc.open(d, fn) == 0);
+    swear(ui_edit_journal.open(j, d, fn) == 0);
+    swear(j->replayed == 8 && j->compactions == 0);
+    swear(j->bytes == bytes && j->records == 8);
+    ui_edit_doc_test_cold_same(d, m);
+    ui_edit_doc_test_journal_file(fn, &original); // mapped: not compacted
+    // new edits are appended to the recovered ones and both survive
+    // the next crash:
+    j->limit = 1;
+    const ui_edit_range_t r = { .from = {0, 0}, .to = {0, 0} };
+    swear(ui_edit_doc.replace(d, &r, (const uint8_t*)"x", 1));
+    swear(ui_edit_doc.replace(m, &r, (const uint8_t*)"x", 1));
+    swear(j->records == 9 && j->compactions == 0 && j->error == 0);
+    swear(ui_edit_journal.dispose(j) == 0);
+    ui_edit_doc.dispose(d);
+    swear(ui_edit_doc.open(d, fn) == 0);
+    swear(ui_edit_journal.open(j, d, fn) == 0);
+    swear(j->replayed == 9 && j->records == 9);
+    ui_edit_doc_test_cold_same(d, m);
+    swear(ui_edit_journal.dispose(j) == 0);
+    ui_edit_doc.dispose(d);
+    // journal of other file content is discarded:
+    static const char* other = "other\n";
+    swear(ut_files.write_fully(fn, other, (int64_t)strlen(other),
+                               &transferred) == 0);
+    swear(ui_edit_doc.open(d, fn) == 0);
+    swear(ui_edit_journal.open(j, d, fn) == 0);
+    swear(j->replayed == 0 && j->compactions == 0);
+    ui_edit_doc_t o = {0};
+    swear(ui_edit_doc.init(&o, (const uint8_t*)other,
+                           (int32_t)strlen(other), false));
+    ui_edit_doc_test_cold_same(d, &o);
+    ui_edit_doc.dispose(&o);
+    swear(ui_edit_journal.dispose(j) == 0);
+    ui_edit_doc.dispose(d);
+    // compaction when journal outgrows both limit and half the document
+    // (not mapped, see above):
+    swear(ui_edit_doc.init(d, (const uint8_t*)text,
+                           (int32_t)strlen(text), false));
+    swear(ui_edit_journal.open(j, d, fn) == 0);
+    swear(j->replayed == 0);
+    j->limit = 64;
+    for (int32_t i = 0; i < 100; i++) {
+        const ui_edit_range_t c = { .from = {1, 0}, .to = {1, 0} };
+        swear(ui_edit_doc.replace(d, &c, (const uint8_t*)"0123456789", 10));
+        swear(ui_edit_doc.replace(&original, &c, (const uint8_t*)"0123456789", 10));
+    }
+    swear(j->compactions > 1 && j->error == 0);
+    swear(j->bytes <= 1000 / 2 + 64);
+    swear(ui_edit_journal.compact(j) == 0 && j->records == 0);
+    ui_edit_doc_test_journal_file(fn, &original);
+    swear(ui_edit_journal.dispose(j) == 0);
+    ui_edit_doc.dispose(d);
+    ui_edit_doc.dispose(&original);
+    // corrupted first payload byte stops replay (from.pn 1 -> 0 would
+    // still be a valid range deleting "Hello\nWorld\n" instead):
+    swear(ut_files.write_fully(fn, text, (int64_t)strlen(text),
+                               &transferred) == 0);
+    swear(ui_edit_doc.open(d, fn) == 0);
+    swear(ui_edit_journal.open(j, d, fn) == 0);
+    const ui_edit_range_t w = { .from = {1, 0}, .to = {2, 0} };
+    swear(ui_edit_doc.replace(d, &w, null, 0));
+    const int64_t corrupted = j->bytes;
+    swear(j->records == 1 && corrupted <= bytes);
+    swear(ui_edit_journal.dispose(j) == 0);
+    ui_edit_doc.dispose(d);
+    swear(ut_files.open(&f, name.s, ut_files.o_rd) == 0);
+    swear(ut_files.read(f, data, corrupted, &transferred) == 0);
+    swear(transferred == corrupted);
+    ut_files.close(f);
+    const int32_t k = ui_edit_journal_header;
+    swear(data[k] < 0x80 && data[k + 1] == 1); // single byte length varint
+    data[k + 1] = 0;
+    swear(ut_files.write_fully(name.s, data, corrupted, &transferred) == 0);
+    swear(ui_edit_doc.open(d, fn) == 0);
+    swear(ui_edit_journal.open(j, d, fn) == 0);
+    swear(j->replayed == 0);
+    swear(ui_edit_doc.init(&original, (const uint8_t*)text,
+                           (int32_t)strlen(text), false));
+    ui_edit_doc_test_cold_same(d, &original);
+    swear(ui_edit_journal.dispose(j) == 0);
+    ui_edit_doc.dispose(d);
+    ui_edit_doc.dispose(&original);
+    ui_edit_doc.dispose(m);
+    ut_heap.free(data);
+    swear(ut_files.unlink(name.s) == 0);
+    swear(ut_files.unlink(fn) == 0);
+}
+
 static void ui_edit_doc_test(void) {
     {
         ui_edit_range_t r = { .from = {0,0}, .to = {0,0} };
@@ -7799,6 +13987,25 @@ static void ui_edit_doc_test(void) {
     #else
         (void)(void*)ui_edit_doc_test_paragraphs; // unused
     #endif
+    ui_edit_doc_test_tree();
+    ui_edit_doc_test_lazy();
+    ui_edit_doc_test_offsets();
+    ui_edit_doc_test_open();
+    ui_edit_doc_test_write();
+    ui_edit_doc_test_snapshot();
+    ui_edit_doc_test_out_of_memory();
+    ui_edit_doc_test_arena();
+    ui_edit_doc_test_cold();
+    ui_edit_doc_test_tail();
+    ui_edit_doc_test_dedup();
+    ui_edit_doc_test_journal();
+    ui_edit_doc_test_parallel();
+    ui_edit_doc_test_parallel_long_lines();
+    ui_edit_doc_test_long_line();
+    ui_edit_doc_test_history();
+    ui_edit_doc_test_batch();
+    ui_edit_doc_test_find();
+    ui_edit_doc_test_index();
     // use n = 10,000,000 and Diagnostic Tools to watch for memory leaks
     enum { n = 1000 };
 //  enum { n = 10 * 1000 * 1000 };
@@ -7834,25 +14041,58 @@ ui_edit_range_if ui_edit_range = {
 
 ui_edit_text_if ui_edit_text = {
     .init          = ui_edit_text_init,
+    .ps            = ui_edit_text_ps,
     .bytes         = ui_edit_text_bytes,
-    .dispose       = ui_edit_text_dispose
+    .glyphs        = ui_edit_text_glyphs,
+    .offset        = ui_edit_text_offset,
+    .pg            = ui_edit_text_pg,
+    .dispose       = ui_edit_text_dispose,
+    .threads       = 0
+};
+
+ui_edit_index_if ui_edit_index = {
+    .init     = ui_edit_index_init,
+    .find_all = ui_edit_index_find_all,
+    .dispose  = ui_edit_index_dispose
+};
+
+ui_edit_journal_if ui_edit_journal = {
+    .open     = ui_edit_journal_open,
+    .sync     = ui_edit_journal_sync,
+    .compact  = ui_edit_journal_compact,
+    .dispose  = ui_edit_journal_dispose
 };
 
 ui_edit_doc_if ui_edit_doc = {
     .init               = ui_edit_doc_init,
+    .open               = ui_edit_doc_open,
     .replace_text       = ui_edit_doc_replace_text,
     .replace            = ui_edit_doc_replace,
+    .replace_batch      = ui_edit_doc_replace_batch,
+    .snapshot           = ui_edit_doc_snapshot,
+    .dispose_snapshot   = ui_edit_doc_dispose_snapshot,
     .bytes              = ui_edit_doc_bytes,
     .copy_text          = ui_edit_doc_copy_text,
     .utf8bytes          = ui_edit_doc_utf8bytes,
     .copy               = ui_edit_doc_copy,
+    .write              = ui_edit_doc_write,
+    .save               = ui_edit_doc_save,
+    .find               = ui_edit_doc_find,
+    .find_all           = ui_edit_doc_find_all,
+    .replace_all        = ui_edit_doc_replace_all,
     .redo               = ui_edit_doc_redo,
     .undo               = ui_edit_doc_undo,
     .subscribe          = ui_edit_doc_subscribe,
     .unsubscribe        = ui_edit_doc_unsubscribe,
     .dispose_to_do      = ui_edit_doc_dispose_to_do,
+    .cool               = ui_edit_doc_cool,
+    .dedup              = ui_edit_doc_dedup,
+    .append             = ui_edit_doc_append,
+    .flush              = ui_edit_doc_flush,
+    .follow             = ui_edit_doc_follow,
     .dispose            = ui_edit_doc_dispose,
-    .test               = ui_edit_doc_test
+    .test               = ui_edit_doc_test,
+    .arena              = true
 };
 
 #pragma push_macro("ui_edit_doc_dump")
@@ -7872,6 +14112,12 @@ ui_edit_doc_if ui_edit_doc = {
 /* Copyright (c) Dmitry "Leo" Kuznetsov 2021-24 see LICENSE for details */
 #include "ut/ut.h"
 
+#undef UI_EDIT_VIEW_TEST
+
+#if 0 // flip to 1 to run tests
+#define UI_EDIT_VIEW_TEST
+#endif
+
 // TODO: undo/redo
 // TODO: back/forward navigation
 // TODO: exit/save keyboard shortcuts?
@@ -7885,7 +14131,7 @@ ui_edit_doc_if ui_edit_doc = {
 // https://web.archive.org/web/20221216044359/http://worrydream.com/refs/Tesler%20-%20A%20Personal%20History%20of%20Modeless%20Text%20Editing%20and%20Cut-Copy-Paste.pdf
 
 // Rich text options that are not addressed yet:
-// * Color of ranges (useful for code editing)
+// * Color of ranges other than syntax coloring (see ui_edit_t.lexer)
 // * Soft line breaks inside the paragraph (useful for e.g. bullet lists of options)
 // * Bold/Italic/Underline (along with color ranges)
 // * Multiple fonts (as long as run vertical size is the maximum of font)
@@ -7900,104 +14146,257 @@ typedef  struct ui_edit_glyph_s {
     int32_t bytes;
 } ui_edit_glyph_t;
 
-static void ui_edit_layout(ui_view_t* v);
+static void ui_edit_layout(ui_view_t* v);
+
+static const ui_edit_run_t* ui_edit_paragraph_runs(ui_edit_t* e, int32_t pn,
+        int32_t* runs);
+
+// Glyphs in monospaced Windows fonts may have different width for non-ASCII
+// characters. Thus even if edit is monospaced glyph measurements are used
+// in text layout for everything except printable ASCII glyphs which are
+// laid out arithmetically (see ui_edit_widths_t.cell).
+
+static void ui_edit_invalidate(ui_edit_t* e) {
+    ui_view.invalidate(&e->view, null);
+}
+
+static int32_t ui_edit_metrics_gdi_advance(ui_edit_metrics_t* unused(m),
+        const ui_fm_t* fm, const uint8_t* utf8, int32_t bytes) {
+    // average GDI measure_text() performance per character:
+    // "ui_app.fm.mono"    ~500us (microseconds)
+    // "ui_app.fm.regular" ~250us (microseconds) DirectWrite ~100us
+    const ui_gdi_ta_t ta = { .fm = fm, .measure = true };
+    return ui_gdi.text(&ta, 0, 0, "%.*s", bytes, utf8).w;
+}
+
+static int32_t ui_edit_metrics_fixed_advance(ui_edit_metrics_t* unused(m),
+        const ui_fm_t* fm, const uint8_t* utf8, int32_t unused(bytes)) {
+    const int32_t w = ut_max(1, fm->em.w);
+    return utf8[0] >= 0xE3 ? w * 2 : w; // U+3000 and above are wide
+}
+
+ui_edit_metrics_t ui_edit_metrics_gdi = {
+    .advance = ui_edit_metrics_gdi_advance, .concurrent = false
+};
+
+ui_edit_metrics_t ui_edit_metrics_fixed = {
+    .advance = ui_edit_metrics_fixed_advance, .concurrent = true
+};
+
+typedef struct ui_edit_measure_s { // glyph advances for the text layout
+    ui_edit_widths_t*  widths;
+    ui_edit_metrics_t* metrics;
+    const ui_fm_t*     fm;
+    bool frozen; // background layout: widths are read only
+    bool missed; // frozen widths miss a glyph of not concurrent metrics
+} ui_edit_measure_t;
+
+static ui_edit_measure_t ui_edit_measure_with(ui_edit_widths_t* w,
+        ui_edit_metrics_t* m, const ui_fm_t* fm) {
+    if (w->metrics != m || w->fm != fm || w->font != fm->font ||
+        w->height != fm->height) {
+        w->metrics = m;
+        w->fm      = fm;
+        w->font    = fm->font;
+        w->height  = fm->height;
+        memset(w->ascii, 0xFF, sizeof(w->ascii)); // -1
+        if (w->entry != null) {
+            memset(w->entry, 0x00, w->capacity * sizeof(w->entry[0]));
+        }
+        w->count = 0;
+        w->cell  = 0;
+        if (fm->mono) { // fixed pitch: all printable ASCII is "m" wide
+            const int32_t c = m->advance(m, fm, (const uint8_t*)"m", 1);
+            if (c > 0) {
+                for (int32_t i = 0x20; i < 0x7F; i++) { w->ascii[i] = c; }
+                w->cell = c;
+            }
+        }
+    }
+    return (ui_edit_measure_t){ .widths = w, .metrics = m, .fm = fm };
+}
+
+static ui_edit_measure_t ui_edit_measure_of(ui_edit_t* e) {
+    ui_edit_metrics_t* m = e->metrics != null ? e->metrics : &ui_edit_metrics_gdi;
+    return ui_edit_measure_with(&e->widths, m, e->view.fm);
+}
+
+static ui_edit_width_t* ui_edit_widths_slot(const ui_edit_widths_t* w,
+        uint32_t glyph) {
+    // slot of the glyph or empty slot where it belongs
+    const uint32_t mask = (uint32_t)w->capacity - 1;
+    uint32_t h = ut_num.hash32((const char*)&glyph, sizeof(glyph));
+    while (w->entry[h & mask].glyph != 0 && w->entry[h & mask].glyph != glyph) {
+        h++;
+    }
+    return &w->entry[h & mask];
+}
+
+static bool ui_edit_widths_grow(ui_edit_widths_t* w) {
+    ui_edit_widths_t g = *w;
+    g.capacity = w->capacity == 0 ? 256 : w->capacity * 2;
+    g.count = 0;
+    bool ok = ut_heap.alloc_zero((void**)&g.entry,
+                  g.capacity * sizeof(g.entry[0])) == 0;
+    if (ok) {
+        for (int32_t i = 0; i < w->capacity; i++) {
+            if (w->entry[i].glyph != 0) {
+                *ui_edit_widths_slot(&g, w->entry[i].glyph) = w->entry[i];
+                g.count++;
+            }
+        }
+        if (w->entry != null) { ut_heap.free(w->entry); }
+        *w = g;
+    }
+    return ok;
+}
+
+static int32_t ui_edit_measure_miss(ui_edit_measure_t* m, const uint8_t* u,
+        int32_t bytes) {
+    // frozen widths can only be extended by concurrent metrics
+    if (m->metrics->concurrent) {
+        return m->metrics->advance(m->metrics, m->fm, u, bytes);
+    } else {
+        m->missed = true;
+        return m->fm->em.w;
+    }
+}
+
+static int32_t ui_edit_advance(ui_edit_measure_t* m, const uint8_t* u,
+        int32_t bytes) {
+    // advance width of the single glyph u[bytes] measured once per font
+    ui_edit_widths_t* w = m->widths;
+    int32_t a = -1;
+    if (bytes == 1 && u[0] < 0x80) {
+        a = w->ascii[u[0]];
+        if (a < 0 && m->frozen) {
+            a = ui_edit_measure_miss(m, u, 1);
+        } else if (a < 0) {
+            a = m->metrics->advance(m->metrics, m->fm, u, 1);
+            w->ascii[u[0]] = a;
+        }
+    } else {
+        assert(1 <= bytes && bytes <= 4);
+        uint32_t glyph = 0;
+        memcpy(&glyph, u, (size_t)bytes); // != 0: u[0] >= 0x80
+        if (!m->frozen && w->count * 4 >= w->capacity * 3) {
+            bool ok = ui_edit_widths_grow(w);
+            swear(ok, "out of memory - cannot continue");
+        }
+        ui_edit_width_t* x = w->capacity == 0 ?
+            null : ui_edit_widths_slot(w, glyph);
+        if (x != null && x->glyph != 0) {
+            a = x->width;
+        } else if (m->frozen) {
+            a = ui_edit_measure_miss(m, u, bytes);
+        } else {
+            x->glyph = glyph;
+            x->width = m->metrics->advance(m->metrics, m->fm, u, bytes);
+            w->count++;
+            a = x->width;
+        }
+    }
+    return a;
+}
 
-// Glyphs in monospaced Windows fonts may have different width for non-ASCII
-// characters. Thus even if edit is monospaced glyph measurements are used
-// in text layout.
+static int32_t ui_edit_glyph_bytes(const uint8_t* s, int32_t n) {
+    const int32_t b = ui_edit_str.utf8bytes(s, n);
+    return b > 0 ? b : 1; // invalid utf8 byte is measured on its own
+}
 
-static void ui_edit_invalidate(ui_edit_t* e) {
-    ui_view.invalidate(&e->view, null);
+static int32_t ui_edit_ascii_span(ui_edit_measure_t* m, const uint8_t* s,
+        int32_t n) {
+    // number of leading printable ASCII glyphs of monospaced font or 0
+    int32_t i = 0;
+    if (m->widths->cell > 0) {
+        while (i < n && 0x20 <= s[i] && s[i] < 0x7F) { i++; }
+    }
+    return i;
 }
 
-static int32_t ui_edit_text_width(ui_edit_t* e, const uint8_t* s, int32_t n) {
-//  fp64_t time = ut_clock.seconds();
-    // average GDI measure_text() performance per character:
-    // "ui_app.fm.mono"    ~500us (microseconds)
-    // "ui_app.fm.regular" ~250us (microseconds) DirectWrite ~100us
-    const ui_gdi_ta_t ta = { .fm = e->view.fm, .color = e->view.color,
-                             .measure = true };
-    int32_t x = n == 0 ? 0 : ui_gdi.text(&ta, 0, 0, "%.*s", n, s).w;
-//  TODO: remove
-//  int32_t x = n == 0 ? 0 : ui_gdi.measure_text(e->view.fm, "%.*s", n, s).w;
-
-//  time = (ut_clock.seconds() - time) * 1000.0;
-//  static fp64_t time_sum;
-//  static fp64_t length_sum;
-//  time_sum += time;
-//  length_sum += n;
-//  traceln("avg=%.6fms per char total %.3fms", time_sum / length_sum, time_sum);
+static int32_t ui_edit_measure_width(ui_edit_measure_t* m,
+        const uint8_t* s, int32_t n) {
+    // sum of the cached advances of the glyphs
+    int32_t x = 0;
+    int32_t i = 0;
+    while (i < n) {
+        const int32_t span = ui_edit_ascii_span(m, s + i, n - i);
+        if (span > 0) {
+            x += span * m->widths->cell;
+            i += span;
+        } else {
+            const int32_t b = ui_edit_glyph_bytes(s + i, n - i);
+            x += ui_edit_advance(m, s + i, b);
+            i += b;
+        }
+    }
     return x;
 }
 
-static int32_t ui_edit_word_break_at(ui_edit_t* e, int32_t pn, int32_t rn,
+static int32_t ui_edit_text_width(ui_edit_t* e, const uint8_t* s, int32_t n) {
+    ui_edit_measure_t m = ui_edit_measure_of(e);
+    return ui_edit_measure_width(&m, s, n);
+}
+
+static int32_t ui_edit_measure_break(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t gp, int32_t bp,
         const int32_t width, bool allow_zero) {
-    // TODO: in sqlite.c 156,000 LoC it takes 11 seconds to get all runs()
-    //       on average ui_edit_word_break_at() takes 4 x ui_edit_text_width()
-    //       measurements and they are slow. If we can reduce this amount
-    //       (not clear how) at least 2 times it will be a win.
-    //       Another way is background thread runs() processing but this is
-    //       involving a lot of complexity.
-    //       MSVC devend() edits sqlite3.c w/o any visible delays
-    int32_t count = 0; // stats logging
-    int32_t chars = 0;
-    ui_edit_text_t* dt = &e->doc->text; // document text
-    assert(0 <= pn && pn < dt->np);
-    ui_edit_paragraph_t* p = &e->para[pn];
-    const ui_edit_str_t* str = &dt->ps[pn];
+    // returns the smallest number of glyphs k such that k + 1 glyphs from
+    // gp (bp in bytes) are at least `width` wide (or all glyphs)
+    // accumulating cached advances in a single pass
     int32_t k = 1; // at least 1 glyph
-    // offsets inside a run in glyphs and bytes from start of the paragraph:
-    int32_t gp = p->run[rn].gp;
-    int32_t bp = p->run[rn].bp;
     if (gp < str->g - 1) {
-        const uint8_t* text = str->u + bp;
         const int32_t glyphs_in_this_run = str->g - gp;
-        int32_t* g2b = &str->g2b[gp];
-        // 4 is maximum number of bytes in a UTF-8 sequence
-        int32_t gc = ut_min(4, glyphs_in_this_run);
-        int32_t w = ui_edit_text_width(e, text, g2b[gc] - bp);
-        count++;
-        chars += g2b[gc] - bp;
-        while (gc < glyphs_in_this_run && w < width) {
-            gc = ut_min(gc * 4, glyphs_in_this_run);
-            w = ui_edit_text_width(e, text, g2b[gc] - bp);
-            count++;
-            chars += g2b[gc] - bp;
-        }
-        if (w < width) {
-            k = gc;
-            assert(1 <= k && k <= str->g - gp);
-        } else {
-            int32_t i = 0;
-            int32_t j = gc;
-            k = (i + j) / 2;
-            while (i < j) {
-                assert(allow_zero || 1 <= k && k < gc + 1);
-                const int32_t n = g2b[k + 1] - bp;
-                int32_t px = ui_edit_text_width(e, text, n);
-                count++;
-                chars += n;
-                if (px == width) { break; }
-                if (px < width) { i = k + 1; } else { j = k; }
-                if (!allow_zero && (i + j) / 2 == 0) { break; }
-                k = (i + j) / 2;
-                assert(allow_zero || 1 <= k && k <= str->g - gp);
-            }
-        }
-    }
-    assert(allow_zero || 1 <= k && k <= str->g - gp);
+        int32_t x = 0;
+        int32_t b = bp;
+        k = 0;
+        while (k < glyphs_in_this_run) {
+            const uint8_t* u = str->u + b;
+            // i + 1 glyphs of a span reach the width, no need to scan
+            // the rest of a multi-megabyte line beyond them:
+            const int32_t c = m->widths->cell;
+            const int32_t i = c == 0 || width - x <= c ?
+                0 : (width - x + c - 1) / c - 1;
+            const int32_t span = ui_edit_ascii_span(m, u,
+                ut_min(ut_min(glyphs_in_this_run - k, str->b - b), i + 1));
+            if (span > 0) {
+                if (i < span) { k += i; break; }
+                x += span * c;
+                b += span;
+                k += span;
+            } else {
+                const int32_t n = ui_edit_glyph_bytes(u, str->b - b);
+                x += ui_edit_advance(m, u, n);
+                if (x >= width) { break; }
+                b += n;
+                k++;
+            }
+        }
+        if (!allow_zero && k == 0) { k = 1; }
+    }
+    assert(allow_zero || (1 <= k && k <= str->g - gp));
     return k;
 }
 
-static int32_t ui_edit_word_break(ui_edit_t* e, int32_t pn, int32_t rn) {
-    return ui_edit_word_break_at(e, pn, rn, e->w, false);
+static int32_t ui_edit_word_break_at(ui_edit_t* e, int32_t pn, int32_t rn,
+        const int32_t width, bool allow_zero) {
+    ui_edit_text_t* dt = &e->doc->text; // document text
+    assert(0 <= pn && pn < dt->np);
+    int32_t runs = 0;
+    const ui_edit_run_t* run = ui_edit_paragraph_runs(e, pn, &runs);
+    assert(0 <= rn && rn < runs);
+    const ui_edit_str_t* str = ui_edit_text.ps(dt, pn);
+    ui_edit_measure_t m = ui_edit_measure_of(e);
+    // offsets inside a run in glyphs and bytes from start of the paragraph:
+    return ui_edit_measure_break(&m, str, run[rn].gp, run[rn].bp,
+                                 width, allow_zero);
 }
 
 static int32_t ui_edit_glyph_at_x(ui_edit_t* e, int32_t pn, int32_t rn,
         int32_t x) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pn && pn < dt->np);
-    if (x == 0 || dt->ps[pn].b == 0) {
+    if (x == 0 || ui_edit_text.ps(dt, pn)->b == 0) {
         return 0;
     } else {
         return ui_edit_word_break_at(e, pn, rn, x + 1, true);
@@ -8011,10 +14410,10 @@ static ui_edit_glyph_t ui_edit_glyph_at(ui_edit_t* e, ui_edit_pg_t p) {
         assert(p.gp == 0); // last empty paragraph
     } else {
         assert(0 <= p.pn && p.pn < dt->np);
-        const ui_edit_str_t* str = &dt->ps[p.pn];
+        const ui_edit_str_t* str = ui_edit_text.ps(dt, p.pn);
         const int32_t bytes = str->b;
         const uint8_t* s = str->u;
-        const int32_t bp = str->g2b[p.gp];
+        const int32_t bp = ui_edit_str.g2b(str, p.gp);
         if (bp < bytes) {
             g.s = s + bp;
             g.bytes = ui_edit_str.utf8bytes(g.s, bytes - bp);
@@ -8024,11 +14423,216 @@ static ui_edit_glyph_t ui_edit_glyph_at(ui_edit_t* e, ui_edit_pg_t p) {
     return g;
 }
 
-// paragraph_runs() breaks paragraph into `runs` according to `width`
+// measure_runs() breaks paragraph into `runs` according to `width`
+
+static ui_edit_run_t* ui_edit_measure_runs(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t width, int32_t* runs) {
+    // runs[] grows as needed: one run for a paragraph that fits
+    // and not str->b + 1 runs for multi-megabyte single lines
+    int32_t max_runs = 1;
+    ui_edit_run_t* run = null;
+    bool ok = ut_heap.alloc((void**)&run, max_runs *
+                            sizeof(ui_edit_run_t)) == 0;
+    swear(ok);
+    run[0].bp = 0;
+    run[0].gp = 0;
+    int32_t gc = str->b == 0 ? 0 :
+        ui_edit_measure_break(m, str, 0, 0, width, false);
+    if (gc == str->g) { // whole paragraph fits into width
+        *runs = 1;
+        run[0].bytes  = str->b;
+        run[0].glyphs = str->g;
+        int32_t pixels = ui_edit_measure_width(m, str->u, ui_edit_str.g2b(str, gc));
+        run[0].pixels = pixels;
+    } else {
+        assert(gc < str->g);
+        int32_t rc = 0; // runs count
+        int32_t ix = 0; // glyph index from to start of paragraph
+        const uint8_t* text = str->u;
+        int32_t bytes = str->b;
+        while (bytes > 0) {
+            if (rc == max_runs) {
+                max_runs = max_runs < 16 ? 16 : max_runs * 2;
+                ok = ut_heap.realloc((void**)&run, max_runs *
+                                     sizeof(ui_edit_run_t)) == 0;
+                swear(ok);
+            }
+            assert(rc < max_runs);
+            run[rc].bp = (int32_t)(text - str->u);
+            run[rc].gp = ix;
+            int32_t glyphs = ui_edit_measure_break(m, str, ix, run[rc].bp,
+                                                   width, false);
+            int32_t utf8bytes = ui_edit_str.g2b(str, ix + glyphs) - run[rc].bp;
+            int32_t pixels = ui_edit_measure_width(m, text, utf8bytes);
+            if (glyphs > 1 && utf8bytes < bytes && text[utf8bytes - 1] != 0x20) {
+                // try to find word break SPACE character. utf8 space is 0x20
+                int32_t i = utf8bytes;
+                while (i > 0 && text[i - 1] != 0x20) { i--; }
+                if (i > 0 && i != utf8bytes) {
+                    utf8bytes = i;
+                    glyphs = ui_edit_str.glyphs(text, utf8bytes);
+                    assert(glyphs >= 0);
+                    pixels = ui_edit_measure_width(m, text, utf8bytes);
+                }
+            }
+            run[rc].bytes  = utf8bytes;
+            run[rc].glyphs = glyphs;
+            run[rc].pixels = pixels;
+            rc++;
+            text += utf8bytes;
+            assert(0 <= utf8bytes && utf8bytes <= bytes);
+            bytes -= utf8bytes;
+            ix += glyphs;
+        }
+        assert(rc > 0);
+        *runs = rc; // truncate heap capacity array:
+        ok = ut_heap.realloc((void**)&run, rc * sizeof(ui_edit_run_t)) == 0;
+        swear(ok);
+    }
+    return run;
+}
+
+// Runs cache: run[] arrays are kept only for the most recently used
+// paragraphs (see notes on .mru) in a double linked list threaded
+// through para[].prev and para[].next by paragraph numbers.
+
+enum { ui_edit_runs_cache = 4 * 1024 }; // paragraphs with run[]
+
+static void ui_edit_cache_unlink(ui_edit_t* e, int32_t pn) {
+    ui_edit_paragraph_t* p = &e->para[pn];
+    assert(p->run != null && e->cached > 0);
+    if (p->prev >= 0) { e->para[p->prev].next = p->next; } else { e->mru = p->next; }
+    if (p->next >= 0) { e->para[p->next].prev = p->prev; } else { e->lru = p->prev; }
+    p->prev = -1;
+    p->next = -1;
+    e->cached--;
+}
+
+static void ui_edit_cache_link(ui_edit_t* e, int32_t pn) { // as mru
+    ui_edit_paragraph_t* p = &e->para[pn];
+    assert(p->run != null);
+    p->prev = -1;
+    p->next = e->mru;
+    if (e->mru >= 0) { e->para[e->mru].prev = pn; } else { e->lru = pn; }
+    e->mru = pn;
+    e->cached++;
+}
+
+static void ui_edit_cache_renumber(ui_edit_t* e, int32_t p, int32_t d) {
+    // paragraphs after `p` moved by `d` after insert (d > 0) or delete
+    // (d < 0) of paragraphs, deleted paragraphs are already unlinked
+    if (e->mru > p) { e->mru += d; }
+    if (e->lru > p) { e->lru += d; }
+    for (int32_t i = e->mru; i >= 0; i = e->para[i].next) {
+        ui_edit_paragraph_t* q = &e->para[i];
+        if (q->prev > p) { q->prev += d; }
+        if (q->next > p) { q->next += d; }
+    }
+}
+
+static void ui_edit_drop_runs(ui_edit_t* e, int32_t pn) {
+    // frees run[] and tokens but keeps .runs count and lexer states
+    ui_edit_paragraph_t* p = &e->para[pn];
+    if (p->run != null) {
+        ui_edit_cache_unlink(e, pn);
+        ut_heap.free(p->run);
+        p->run = null;
+    }
+    // tokens are re-lexed from the kept .start state on demand:
+    if (p->token != null) {
+        ut_heap.free(p->token);
+        p->token = null;
+        p->tokens = 0;
+    }
+}
+
+// Run index: Fenwick tree of para[].runs (see notes on .run_index).
+// Paragraphs that are not laid out count as zero runs and the index
+// keeps the number of laid out paragraphs next to the sums to tell
+// whether a range of paragraphs can be counted without laying it out.
+
+static bool ui_edit_run_index_build(ui_edit_t* e) {
+    // O(np) and only when the index is stale
+    ui_edit_run_index_t* x = &e->run_index;
+    const int32_t np = e->doc->text.np;
+    if (x->np != np) {
+        x->np = 0;
+        const int64_t bytes = (np + 1) * (int64_t)sizeof(x->sum[0]);
+        if (ut_heap.realloc((void**)&x->sum, bytes) == 0) {
+            x->sum[0] = (ui_edit_run_sums_t){ .runs = 0, .laid = 0 };
+            for (int32_t i = 1; i <= np; i++) {
+                x->sum[i].runs = e->para[i - 1].runs;
+                x->sum[i].laid = e->para[i - 1].runs > 0;
+            }
+            for (int32_t i = 1; i <= np; i++) { // in place bottom up
+                const int32_t j = i + (i & -i);
+                if (j <= np) {
+                    x->sum[j].runs += x->sum[i].runs;
+                    x->sum[j].laid += x->sum[i].laid;
+                }
+            }
+            x->np = np;
+        }
+    }
+    return x->np == np;
+}
+
+static void ui_edit_run_index_update(ui_edit_t* e, int32_t pn, int32_t runs,
+        int32_t laid) {
+    ui_edit_run_index_t* x = &e->run_index;
+    if (x->np > 0) { // stale index is rebuilt on demand
+        assert(0 <= pn && pn < x->np);
+        for (int32_t i = pn + 1; i <= x->np; i += i & -i) {
+            x->sum[i].runs += runs;
+            x->sum[i].laid += laid;
+        }
+    }
+}
+
+static ui_edit_run_sums_t ui_edit_run_index_prefix(const ui_edit_run_index_t* x,
+        int32_t pn) { // sums of para[0..pn - 1]
+    assert(0 <= pn && pn <= x->np);
+    ui_edit_run_sums_t s = { .runs = 0, .laid = 0 };
+    for (int32_t i = pn; i > 0; i -= i & -i) {
+        s.runs += x->sum[i].runs;
+        s.laid += x->sum[i].laid;
+    }
+    return s;
+}
+
+static bool ui_edit_run_index_runs(ui_edit_t* e, int32_t f, int32_t t,
+        int32_t* runs) {
+    // true if all paragraphs [f..t - 1] are laid out, *runs is their runs
+    assert(0 <= f && f <= t && t <= e->doc->text.np);
+    bool ok = ui_edit_run_index_build(e);
+    if (ok) {
+        const ui_edit_run_sums_t s0 = ui_edit_run_index_prefix(&e->run_index, f);
+        const ui_edit_run_sums_t s1 = ui_edit_run_index_prefix(&e->run_index, t);
+        ok = s1.laid - s0.laid == t - f;
+        if (ok) { *runs = s1.runs - s0.runs; }
+    }
+    return ok;
+}
+
+static ui_edit_pr_t ui_edit_run_index_find(const ui_edit_run_index_t* x, int32_t r) {
+    // paragraph and run of the r-th run of laid out paragraphs
+    assert(x->np > 0 && 0 <= r && r < ui_edit_run_index_prefix(x, x->np).runs);
+    int32_t pn = 0;
+    int32_t step = 1;
+    while (step <= x->np / 2) { step <<= 1; }
+    while (step > 0) {
+        if (pn + step <= x->np && x->sum[pn + step].runs <= r) {
+            pn += step;
+            r -= x->sum[pn].runs;
+        }
+        step >>= 1;
+    }
+    assert(pn < x->np);
+    return (ui_edit_pr_t){ .pn = pn, .rn = r };
+}
 
 static const ui_edit_run_t* ui_edit_paragraph_runs(ui_edit_t* e, int32_t pn,
         int32_t* runs) {
-//  fp64_t time = ut_clock.seconds();
     assert(e->view.w > 0);
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pn && pn < dt->np);
@@ -8037,67 +14641,24 @@ static const ui_edit_run_t* ui_edit_paragraph_runs(ui_edit_t* e, int32_t pn,
         static const ui_edit_run_t eof_run = { 0 };
         *runs = 1;
         r = &eof_run;
-    } else if (e->para[pn].run != null) {
-        *runs = e->para[pn].runs;
-        r = e->para[pn].run;
     } else {
-        assert(0 <= pn && pn < dt->np);
         ui_edit_paragraph_t* p = &e->para[pn];
-        const ui_edit_str_t* str = &dt->ps[pn];
         if (p->run == null) {
-            assert(p->runs == 0 && p->run == null);
-            const int32_t max_runs = str->b + 1;
-            bool ok = ut_heap.alloc((void**)&p->run, max_runs *
-                                    sizeof(ui_edit_run_t)) == 0;
-            swear(ok);
-            ui_edit_run_t* run = p->run;
-            run[0].bp = 0;
-            run[0].gp = 0;
-            int32_t gc = str->b == 0 ? 0 : ui_edit_word_break(e, pn, 0);
-            if (gc == str->g) { // whole paragraph fits into width
-                p->runs = 1;
-                run[0].bytes  = str->b;
-                run[0].glyphs = str->g;
-                int32_t pixels = ui_edit_text_width(e, str->u, str->g2b[gc]);
-                run[0].pixels = pixels;
-            } else {
-                assert(gc < str->g);
-                int32_t rc = 0; // runs count
-                int32_t ix = 0; // glyph index from to start of paragraph
-                const uint8_t* text = str->u;
-                int32_t bytes = str->b;
-                while (bytes > 0) {
-                    assert(rc < max_runs);
-                    run[rc].bp = (int32_t)(text - str->u);
-                    run[rc].gp = ix;
-                    int32_t glyphs = ui_edit_word_break(e, pn, rc);
-                    int32_t utf8bytes = str->g2b[ix + glyphs] - run[rc].bp;
-                    int32_t pixels = ui_edit_text_width(e, text, utf8bytes);
-                    if (glyphs > 1 && utf8bytes < bytes && text[utf8bytes - 1] != 0x20) {
-                        // try to find word break SPACE character. utf8 space is 0x20
-                        int32_t i = utf8bytes;
-                        while (i > 0 && text[i - 1] != 0x20) { i--; }
-                        if (i > 0 && i != utf8bytes) {
-                            utf8bytes = i;
-                            glyphs = ui_edit_str.glyphs(text, utf8bytes);
-                            assert(glyphs >= 0);
-                            pixels = ui_edit_text_width(e, text, utf8bytes);
-                        }
-                    }
-                    run[rc].bytes  = utf8bytes;
-                    run[rc].glyphs = glyphs;
-                    run[rc].pixels = pixels;
-                    rc++;
-                    text += utf8bytes;
-                    assert(0 <= utf8bytes && utf8bytes <= bytes);
-                    bytes -= utf8bytes;
-                    ix += glyphs;
-                }
-                assert(rc > 0);
-                p->runs = rc; // truncate heap capacity array:
-                ok = ut_heap.realloc((void**)&p->run, rc * sizeof(ui_edit_run_t)) == 0;
-                swear(ok);
+            ui_edit_measure_t m = ui_edit_measure_of(e);
+            int32_t n = 0;
+            p->run = ui_edit_measure_runs(&m, ui_edit_text.ps(dt, pn),
+                                          e->w, &n);
+            // evicted or counted in background: .runs is already known
+            assert(p->runs == 0 || p->runs == n);
+            ui_edit_run_index_update(e, pn, n - p->runs, p->runs == 0);
+            p->runs = n;
+            ui_edit_cache_link(e, pn);
+            while (e->cached > ui_edit_runs_cache) {
+                ui_edit_drop_runs(e, e->lru);
             }
+        } else if (e->mru != pn) {
+            ui_edit_cache_unlink(e, pn);
+            ui_edit_cache_link(e, pn);
         }
         *runs = p->runs;
         r = p->run;
@@ -8111,7 +14672,8 @@ static int32_t ui_edit_paragraph_run_count(ui_edit_t* e, int32_t pn) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     int32_t runs = 0;
     if (e->view.w > 0 && 0 <= pn && pn < dt->np) {
-        (void)ui_edit_paragraph_runs(e, pn, &runs);
+        runs = e->para[pn].runs; // known for evicted paragraphs
+        if (runs == 0) { (void)ui_edit_paragraph_runs(e, pn, &runs); }
     }
     return runs;
 }
@@ -8120,7 +14682,7 @@ static int32_t ui_edit_glyphs_in_paragraph(ui_edit_t* e, int32_t pn) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pn && pn < dt->np);
     (void)ui_edit_paragraph_run_count(e, pn); // word break into runs
-    return dt->ps[pn].g;
+    return ui_edit_text.ps(dt, pn)->g;
 }
 
 static void ui_edit_create_caret(ui_edit_t* e) {
@@ -8173,16 +14735,16 @@ static void ui_edit_allocate_runs(ui_edit_t* e) {
     bool done = ut_heap.alloc_zero((void**)&e->para,
                 dt->np * sizeof(e->para[0])) == 0;
     swear(done, "out of memory - cannot continue");
+    e->mru = -1;
+    e->lru = -1;
+    e->cached = 0;
 }
 
 static void ui_edit_invalidate_run(ui_edit_t* e, int32_t i) {
-    if (e->para[i].run != null) {
-        assert(e->para[i].runs > 0);
-        ut_heap.free(e->para[i].run);
-        e->para[i].run = null;
+    ui_edit_drop_runs(e, i);
+    if (e->para[i].runs > 0) {
+        ui_edit_run_index_update(e, i, -e->para[i].runs, -1);
         e->para[i].runs = 0;
-    } else {
-        assert(e->para[i].runs == 0);
     }
 }
 
@@ -8194,14 +14756,22 @@ static void ui_edit_invalidate_runs(ui_edit_t* e, int32_t f, int32_t t,
 
 static void ui_edit_invalidate_all_runs(ui_edit_t* e) {
     ui_edit_text_t* dt = &e->doc->text; // document text
+    e->run_index.np = 0; // cheaper to rebuild than to update
     ui_edit_invalidate_runs(e, 0, dt->np - 1, dt->np);
+    e->generation++;
+    e->relayout = true; // see ui_edit_background()
 }
 
 static void ui_edit_dispose_runs(ui_edit_t* e, int32_t np) {
     assert(e->para != null);
+    e->run_index.np = 0;
     ui_edit_invalidate_runs(e, 0, np - 1, np);
     ut_heap.free(e->para);
     e->para = null;
+    if (e->run_index.sum != null) {
+        ut_heap.free(e->run_index.sum);
+        e->run_index.sum = null;
+    }
 }
 
 static void ui_edit_dispose_all_runs(ui_edit_t* e) {
@@ -8236,7 +14806,7 @@ static void ui_edit_set_font(ui_edit_t* e, ui_fm_t* f) {
 static ui_edit_pr_t ui_edit_pg_to_pr(ui_edit_t* e, const ui_edit_pg_t pg) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pg.pn && pg.pn < dt->np);
-    const ui_edit_str_t* str = &dt->ps[pg.pn];
+    const ui_edit_str_t* str = ui_edit_text.ps(dt, pg.pn);
     ui_edit_pr_t pr = { .pn = pg.pn, .rn = -1 };
     if (pg.pn == dt->np || str->b == 0) { // last or empty
         assert(pg.gp == 0);
@@ -8264,7 +14834,10 @@ static ui_edit_pr_t ui_edit_pg_to_pr(ui_edit_t* e, const ui_edit_pg_t pg) {
 }
 
 static int32_t ui_edit_runs_between(ui_edit_t* e, const ui_edit_pg_t pg0,
-        const ui_edit_pg_t pg1) {
+        const ui_edit_pg_t pg1, int32_t limit) {
+    // O(log n) when all paragraphs in between are laid out, otherwise
+    // counts runs only until there are more than `limit` of them
+    // thus at most O(limit) paragraphs are laid out synchronously
     assert(ui_edit_range.uint64(pg0) <= ui_edit_range.uint64(pg1));
     int32_t rn0 = ui_edit_pg_to_pr(e, pg0).rn;
     int32_t rn1 = ui_edit_pg_to_pr(e, pg1).rn;
@@ -8272,9 +14845,11 @@ static int32_t ui_edit_runs_between(ui_edit_t* e, const ui_edit_pg_t pg0,
     if (pg0.pn == pg1.pn) {
         assert(rn0 <= rn1);
         rc = rn1 - rn0;
+    } else if (ui_edit_run_index_runs(e, pg0.pn, pg1.pn, &rc)) {
+        rc += rn1 - rn0;
     } else {
         assert(pg0.pn < pg1.pn);
-        for (int32_t i = pg0.pn; i < pg1.pn; i++) {
+        for (int32_t i = pg0.pn; i < pg1.pn && rc <= limit; i++) {
             const int32_t runs = ui_edit_paragraph_run_count(e, i);
             if (i == pg0.pn) {
                 rc += runs - rn0;
@@ -8304,9 +14879,16 @@ static int32_t ui_edit_first_visible_run(ui_edit_t* e, int32_t pn) {
 static ui_point_t ui_edit_pg_to_xy(ui_edit_t* e, const ui_edit_pg_t pg) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     ui_point_t pt = { .x = -1, .y = 0 };
-    for (int32_t i = e->scroll.pn; i < dt->np && pt.x < 0; i++) {
+    int32_t pn = e->scroll.pn;
+    int32_t above = 0; // runs from the scroll position to pg.pn
+    if (pn < pg.pn && pg.pn < dt->np &&
+        ui_edit_run_index_runs(e, pn, pg.pn, &above)) {
+        pt.y = (above - e->scroll.rn) * e->view.fm->height;
+        pn = pg.pn;
+    }
+    for (int32_t i = pn; i < dt->np && pt.x < 0; i++) {
         assert(0 <= i && i < dt->np);
-        const ui_edit_str_t* str = &dt->ps[i];
+        const ui_edit_str_t* str = ui_edit_text.ps(dt, i);
         int32_t runs = 0;
         const ui_edit_run_t* run = ui_edit_paragraph_runs(e, i, &runs);
         for (int32_t j = ui_edit_first_visible_run(e, i); j < runs; j++) {
@@ -8338,7 +14920,7 @@ static ui_point_t ui_edit_pg_to_xy(ui_edit_t* e, const ui_edit_pg_t pg) {
 static int32_t ui_edit_glyph_width_px(ui_edit_t* e, const ui_edit_pg_t pg) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pg.pn && pg.pn < dt->np);
-    const ui_edit_str_t* str = &dt->ps[pg.pn];
+    const ui_edit_str_t* str = ui_edit_text.ps(dt, pg.pn);
     const uint8_t* text = str->u;
     int32_t gc = str->g;
     if (pg.gp == 0 &&  gc == 0) {
@@ -8365,7 +14947,7 @@ static ui_edit_pg_t ui_edit_xy_to_pg(ui_edit_t* e, int32_t x, int32_t y) {
     int32_t py = 0; // paragraph `y' coordinate
     for (int32_t i = e->scroll.pn; i < dt->np && pg.pn < 0; i++) {
         assert(0 <= i && i < dt->np);
-        const ui_edit_str_t* str = &dt->ps[i];
+        const ui_edit_str_t* str = ui_edit_text.ps(dt, i);
         int32_t runs = 0;
         const ui_edit_run_t* run = ui_edit_paragraph_runs(e, i, &runs);
         for (int32_t j = ui_edit_first_visible_run(e, i); j < runs && pg.pn < 0; j++) {
@@ -8435,19 +15017,269 @@ static void ui_edit_paint_selection(ui_edit_t* e, int32_t y, const ui_edit_run_t
     }
 }
 
+// ui_edit_lexer_c: paragraph ends in code state unless it ends inside
+// of "/* comment" or inside of "string" or 'c' continued by backslash
+
+enum {
+    ui_edit_lexer_c_code      = 0,
+    ui_edit_lexer_c_comment   = 1,
+    ui_edit_lexer_c_string    = 2,
+    ui_edit_lexer_c_character = 3
+};
+
+static const char* ui_edit_lexer_c_keywords[] = { // sorted for bsearch()
+    "NULL", "auto", "bool", "break", "case", "catch", "char", "class",
+    "const", "constexpr", "continue", "default", "delete", "do", "double",
+    "else", "enum", "extern", "false", "float", "for", "goto", "if",
+    "inline", "int", "long", "namespace", "new", "null", "nullptr",
+    "private", "protected", "public", "register", "restrict", "return",
+    "short", "signed", "sizeof", "static", "static_assert", "struct",
+    "switch", "template", "this", "throw", "true", "try", "typedef",
+    "typename", "union", "unsigned", "using", "virtual", "void",
+    "volatile", "while"
+};
+
+typedef struct ui_edit_lexer_word_s {
+    const uint8_t* u;
+    int32_t b;
+} ui_edit_lexer_word_t;
+
+static int ui_edit_lexer_c_compare(const void* key, const void* keyword) {
+    const ui_edit_lexer_word_t* w = (const ui_edit_lexer_word_t*)key;
+    const char* k = *(const char**)keyword;
+    const int32_t n = (int32_t)strlen(k);
+    const int r = memcmp(w->u, k, (size_t)ut_min(w->b, n));
+    return r != 0 ? r : w->b - n;
+}
+
+static bool ui_edit_lexer_c_keyword(const uint8_t* u, int32_t b) {
+    const ui_edit_lexer_word_t w = { .u = u, .b = b };
+    return bsearch(&w, ui_edit_lexer_c_keywords,
+                   countof(ui_edit_lexer_c_keywords),
+                   sizeof(ui_edit_lexer_c_keywords[0]),
+                   ui_edit_lexer_c_compare) != null;
+}
+
+static void ui_edit_lexer_emit(ui_edit_token_t* tokens, int32_t* count,
+        int32_t bp, int32_t kind) {
+    // adjacent tokens of the same kind are merged
+    if (tokens != null && (*count == 0 || tokens[*count - 1].kind != kind)) {
+        tokens[*count] = (ui_edit_token_t){ .bp = bp, .kind = kind };
+        (*count)++;
+    }
+}
+
+static int32_t ui_edit_lexer_c_quoted(const uint8_t* u, int32_t b,
+        int32_t i, uint8_t q, uint32_t* state) {
+    // returns position after the closing quote or b, *state is
+    // string or character if paragraph ends with continuation '\\'
+    *state = ui_edit_lexer_c_code;
+    while (i < b && u[i] != q) {
+        if (u[i] == '\\' && i + 1 == b) {
+            *state = q == '"' ? ui_edit_lexer_c_string :
+                                ui_edit_lexer_c_character;
+        }
+        i += u[i] == '\\' && i + 1 < b ? 2 : 1;
+    }
+    return i < b ? i + 1 : b;
+}
+
+static int32_t ui_edit_lexer_c_comment_end(const uint8_t* u, int32_t b,
+        int32_t i, uint32_t* state) {
+    while (i < b - 1 && !(u[i] == '*' && u[i + 1] == '/')) { i++; }
+    *state = i < b - 1 ? ui_edit_lexer_c_code : ui_edit_lexer_c_comment;
+    return i < b - 1 ? i + 2 : b;
+}
+
+static bool ui_edit_lexer_c_ident(uint8_t c) {
+    // utf8 sequences are parts of identifiers thus tokens never
+    // split a glyph
+    return c == '_' || c >= 0x80 || ('a' <= c && c <= 'z') ||
+           ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9');
+}
+
+static uint32_t ui_edit_lexer_c_lex(ui_edit_lexer_t* unused(x),
+        uint32_t state, const uint8_t* u, int32_t b,
+        ui_edit_token_t* tokens, int32_t* count) {
+    if (tokens != null) { *count = 0; }
+    int32_t i = 0;
+    if (state == ui_edit_lexer_c_comment) {
+        ui_edit_lexer_emit(tokens, count, 0, ui_edit_token_comment);
+        i = ui_edit_lexer_c_comment_end(u, b, 0, &state);
+    } else if (state == ui_edit_lexer_c_string ||
+               state == ui_edit_lexer_c_character) {
+        ui_edit_lexer_emit(tokens, count, 0, ui_edit_token_string);
+        const uint8_t q = state == ui_edit_lexer_c_string ? '"' : '\'';
+        i = ui_edit_lexer_c_quoted(u, b, 0, q, &state);
+    }
+    bool first = true; // no tokens but spaces on the line so far
+    while (i < b) {
+        const uint8_t c = u[i];
+        const uint8_t n = i + 1 < b ? u[i + 1] : 0x00;
+        const int32_t bp = i;
+        int32_t kind = ui_edit_token_text;
+        if (c == ' ' || c == '\t') {
+            i++;
+        } else if (c == '/' && n == '/') {
+            kind = ui_edit_token_comment;
+            i = b;
+        } else if (c == '/' && n == '*') {
+            kind = ui_edit_token_comment;
+            i = ui_edit_lexer_c_comment_end(u, b, i + 2, &state);
+        } else if (c == '"' || c == '\'') {
+            kind = ui_edit_token_string;
+            i = ui_edit_lexer_c_quoted(u, b, i + 1, c, &state);
+        } else if (('0' <= c && c <= '9') ||
+                   (c == '.' && '0' <= n && n <= '9')) {
+            kind = ui_edit_token_number;
+            i++;
+            while (i < b && (ui_edit_lexer_c_ident(u[i]) || u[i] == '.' ||
+                   ((u[i] == '+' || u[i] == '-') &&
+                    strchr("eEpP", u[i - 1]) != null))) {
+                i++;
+            }
+        } else if (c == '#' && first) {
+            kind = ui_edit_token_preprocessor;
+            i++;
+            while (i < b && (u[i] == ' ' || u[i] == '\t')) { i++; }
+            while (i < b && ui_edit_lexer_c_ident(u[i])) { i++; }
+        } else if (ui_edit_lexer_c_ident(c)) {
+            while (i < b && ui_edit_lexer_c_ident(u[i])) { i++; }
+            if (ui_edit_lexer_c_keyword(u + bp, i - bp)) {
+                kind = ui_edit_token_keyword;
+            }
+        } else {
+            kind = ui_edit_token_punctuation;
+            i++;
+        }
+        first = first && (c == ' ' || c == '\t');
+        ui_edit_lexer_emit(tokens, count, bp, kind);
+    }
+    return state;
+}
+
+ui_edit_lexer_t ui_edit_lexer_c = {
+    .lex = ui_edit_lexer_c_lex,
+    .color = { // Visual Studio dark theme:
+        [ui_edit_token_text]         = ui_color_undefined,
+        [ui_edit_token_keyword]      = ui_color_rgb(0x56, 0x9C, 0xD6),
+        [ui_edit_token_number]       = ui_color_rgb(0xB5, 0xCE, 0xA8),
+        [ui_edit_token_string]       = ui_color_rgb(0xD6, 0x9D, 0x85),
+        [ui_edit_token_comment]      = ui_color_rgb(0x57, 0xA6, 0x4A),
+        [ui_edit_token_preprocessor] = ui_color_rgb(0x9B, 0x9B, 0x9B),
+        [ui_edit_token_punctuation]  = ui_color_undefined,
+        [7]                          = ui_color_undefined
+    }
+};
+
+static void ui_edit_discard_lexer_states(ui_edit_t* e) {
+    const int32_t np = e->doc->text.np;
+    for (int32_t pn = 0; pn < np; pn++) {
+        ui_edit_paragraph_t* p = &e->para[pn];
+        if (p->token != null) { ut_heap.free(p->token); }
+        p->token = null;
+        p->tokens = 0;
+        p->lexed = false;
+    }
+    e->lexed = 0;
+    e->lexed_by = e->lexer;
+}
+
+static uint32_t ui_edit_lex_state(ui_edit_t* e, int32_t pn) {
+    // lexer state at the start of paragraph pn: lexes paragraphs from
+    // the watermark skipping the ones already lexed from the same state
+    if (e->lexed_by != e->lexer) { ui_edit_discard_lexer_states(e); }
+    ui_edit_text_t* dt = &e->doc->text; // document text
+    while (e->lexed < pn) {
+        const int32_t i = e->lexed;
+        const uint32_t start = i == 0 ? 0 : e->para[i - 1].state;
+        ui_edit_paragraph_t* p = &e->para[i];
+        if (!p->lexed || p->start != start) {
+            const ui_edit_str_t* str = ui_edit_text.ps(dt, i);
+            p->state = e->lexer->lex(e->lexer, start, str->u, str->b,
+                                     null, null);
+            p->start = start;
+            p->lexed = true;
+            if (p->token != null) { ut_heap.free(p->token); }
+            p->token = null;
+            p->tokens = 0;
+        }
+        e->lexed++;
+    }
+    return pn == 0 ? 0 : e->para[pn - 1].state;
+}
+
+static const ui_edit_token_t* ui_edit_paragraph_tokens(ui_edit_t* e,
+        int32_t pn, int32_t* tokens) {
+    const uint32_t start = ui_edit_lex_state(e, pn);
+    ui_edit_paragraph_t* p = &e->para[pn];
+    if (p->token == null || !p->lexed || p->start != start) {
+        const ui_edit_str_t* str = ui_edit_text.ps(&e->doc->text, pn);
+        if (str->b > e->capacity) {
+            bool ok = ut_heap.realloc((void**)&e->tokens,
+                      str->b * sizeof(e->tokens[0])) == 0;
+            swear(ok);
+            e->capacity = str->b;
+        }
+        int32_t n = 0;
+        p->state = e->lexer->lex(e->lexer, start, str->u, str->b,
+                                 e->tokens, &n);
+        p->start = start;
+        p->lexed = true;
+        bool ok = ut_heap.realloc((void**)&p->token,
+                  ut_max(1, n) * sizeof(p->token[0])) == 0;
+        swear(ok);
+        memcpy(p->token, e->tokens, n * sizeof(p->token[0]));
+        p->tokens = n;
+    }
+    *tokens = p->tokens;
+    return p->token;
+}
+
+static int32_t ui_edit_paint_run(ui_edit_t* e, const ui_gdi_ta_t* ta,
+        int32_t x, int32_t y, const ui_edit_str_t* str,
+        const ui_edit_run_t* run, const ui_edit_token_t* token,
+        int32_t tokens, int32_t k) {
+    // paints run in colored spans starting at token[k] that contains
+    // run->bp, returns index of the token that contains the run end
+    const int32_t end = run->bp + run->bytes;
+    int32_t bp = run->bp;
+    while (bp < end) {
+        while (k < tokens - 1 && token[k + 1].bp <= bp) { k++; }
+        const int32_t next = k < tokens - 1 ? token[k + 1].bp : str->b;
+        const int32_t bytes = ut_min(next, end) - bp;
+        assert(0 <= token[k].kind && token[k].kind < ui_edit_token_kinds);
+        ui_gdi_ta_t span = *ta;
+        const ui_color_t c = e->lexer->color[token[k].kind];
+        if (!ui_color_is_undefined(c)) { span.color = c; }
+        ui_gdi.text(&span, x, y, "%.*s", bytes, str->u + bp);
+        x += ui_edit_text_width(e, str->u + bp, bytes);
+        bp += bytes;
+    }
+    return k;
+}
+
 static int32_t ui_edit_paint_paragraph(ui_edit_t* e,
         const ui_gdi_ta_t* ta, int32_t x, int32_t y, int32_t pn) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pn && pn < dt->np);
-    const ui_edit_str_t* str = &dt->ps[pn];
+    int32_t tokens = 0;
+    const ui_edit_token_t* token = e->lexer == null ? null :
+        ui_edit_paragraph_tokens(e, pn, &tokens);
+    const ui_edit_str_t* str = ui_edit_text.ps(dt, pn);
     int32_t runs = 0;
     const ui_edit_run_t* run = ui_edit_paragraph_runs(e, pn, &runs);
+    int32_t k = 0; // token index
     for (int32_t j = ui_edit_first_visible_run(e, pn);
                  j < runs && y < e->view.y + e->inside.bottom; j++) {
         const uint8_t* text = str->u + run[j].bp;
         ui_edit_paint_selection(e, y, &run[j], text, pn,
                                 run[j].gp, run[j].gp + run[j].glyphs);
-        ui_gdi.text(ta, x, y, "%.*s", run[j].bytes, text);
+        if (tokens > 0) {
+            k = ui_edit_paint_run(e, ta, x, y, str, &run[j], token, tokens, k);
+        } else {
+            ui_gdi.text(ta, x, y, "%.*s", run[j].bytes, text);
+        }
         if (j < runs - 1 && !e->hide_word_wrap) {
             ui_gdi.text(ta, x + e->w, y, "%s",
                         ut_glyph_south_west_arrow_with_hook);
@@ -8472,13 +15304,36 @@ static void ui_edit_set_caret(ui_edit_t* e, int32_t x, int32_t y) {
 // scroll_up() text moves up (north) in the visible view,
 // scroll position increments moves down (south)
 
+static bool ui_edit_scroll_up_indexed(ui_edit_t* e, int32_t run_count) {
+    // O(log n) when all paragraphs from scroll position down are laid out
+    const int32_t np = e->doc->text.np;
+    int32_t below = 0; // runs from e->scroll.pn to the end of text
+    const bool ok = e->visible_runs > 0 && e->scroll.pn < np &&
+        ui_edit_run_index_runs(e, e->scroll.pn, np, &below);
+    if (ok) {
+        // same as scroll_up() one run at a time until runs_between()
+        // the scroll position and the last run fit into the view:
+        const int32_t between = below - 1 - e->scroll.rn;
+        const int32_t n = ut_min(run_count,
+                                 ut_max(0, between - (e->visible_runs - 1)));
+        if (n > 0) {
+            const int32_t r = ui_edit_run_index_prefix(&e->run_index,
+                                  e->scroll.pn).runs + e->scroll.rn + n;
+            e->scroll = ui_edit_run_index_find(&e->run_index, r);
+        }
+    }
+    return ok;
+}
+
 static void ui_edit_scroll_up(ui_edit_t* e, int32_t run_count) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 < run_count, "does it make sense to have 0 scroll?");
     const ui_edit_pg_t end = ui_edit_range.end(dt);
+    if (ui_edit_scroll_up_indexed(e, run_count)) { run_count = 0; }
     while (run_count > 0 && e->scroll.pn < dt->np) {
         ui_edit_pg_t scroll = ui_edit_scroll_pg(e);
-        int32_t between = ui_edit_runs_between(e, scroll, end);
+        int32_t between = ui_edit_runs_between(e, scroll, end,
+                                               e->visible_runs);
         if (between <= e->visible_runs - 1) {
             run_count = 0; // enough
         } else {
@@ -8500,8 +15355,26 @@ static void ui_edit_scroll_up(ui_edit_t* e, int32_t run_count) {
 // scroll_dw() text moves down (south) in the visible view,
 // scroll position decrements moves up (north)
 
+static bool ui_edit_scroll_down_indexed(ui_edit_t* e, int32_t run_count) {
+    // O(log n) when all paragraphs from new to old scroll are laid out
+    const int32_t pn = e->scroll.pn;
+    bool ok = pn < e->doc->text.np && e->para[pn].runs > 0 &&
+              ui_edit_run_index_build(e);
+    if (ok) {
+        const int32_t r = ui_edit_run_index_prefix(&e->run_index, pn).runs +
+                          e->scroll.rn - run_count;
+        const ui_edit_pr_t pr = r > 0 ?
+            ui_edit_run_index_find(&e->run_index, r) : (ui_edit_pr_t){ 0, 0 };
+        int32_t runs = 0;
+        ok = ui_edit_run_index_runs(e, pr.pn, pn, &runs);
+        if (ok) { e->scroll = pr; }
+    }
+    return ok;
+}
+
 static void ui_edit_scroll_down(ui_edit_t* e, int32_t run_count) {
     assert(0 < run_count, "does it make sense to have 0 scroll?");
+    if (ui_edit_scroll_down_indexed(e, run_count)) { run_count = 0; }
     while (run_count > 0 && (e->scroll.pn > 0 || e->scroll.rn > 0)) {
         int32_t runs = ui_edit_paragraph_run_count(e, e->scroll.pn);
         e->scroll.rn = ut_min(e->scroll.rn, runs - 1);
@@ -8604,8 +15477,8 @@ static ui_edit_pg_t ui_edit_insert_inline(ui_edit_t* e, ui_edit_pg_t pg,
     if (ui_edit_doc.replace(e->doc, &r, text, bytes)) {
         ui_edit_text_t t = {0};
         if (ui_edit_text.init(&t, text, bytes, false)) {
-            assert(t.ps != null && t.np == 1);
-            g = t.np == 1 && t.ps != null ? t.ps[0].g : 0;
+            assert(t.root != null && t.np == 1);
+            g = t.np == 1 && t.root != null ? ui_edit_text.ps(&t, 0)->g : 0;
             ui_edit_text.dispose(&t);
         }
     }
@@ -8683,7 +15556,7 @@ static void ui_edit_key_up(ui_edit_t* e) {
     if (to.pn == dt->np) {
         assert(to.gp == 0); // positioned past EOF
         to.pn--;
-        to.gp = dt->ps[to.pn].g;
+        to.gp = ui_edit_text.ps(dt, to.pn)->g;
         ui_edit_scroll_into_view(e, to);
         ui_point_t pt = ui_edit_pg_to_xy(e, to);
         pt.x = 0;
@@ -8721,7 +15594,7 @@ static void ui_edit_key_down(ui_edit_t* e) {
     ui_edit_reuse_last_x(e, &pt);
     // scroll runs guaranteed to be already layout for current state of view:
     ui_edit_pg_t scroll = ui_edit_scroll_pg(e);
-    int32_t run_count = ui_edit_runs_between(e, scroll, pg);
+    int32_t run_count = ui_edit_runs_between(e, scroll, pg, e->visible_runs);
     if (!e->sle && run_count >= e->visible_runs - 1) {
         ui_edit_scroll_up(e, 1);
     } else {
@@ -8741,14 +15614,14 @@ static void ui_edit_key_home(ui_edit_t* e) {
         e->selection.a[1].gp = 0;
     }
     const int32_t pn = e->selection.a[1].pn;
-    int32_t runs = ui_edit_paragraph_run_count(e, pn);
-    const ui_edit_paragraph_t* para = &e->para[pn];
+    int32_t runs = 0;
+    const ui_edit_run_t* run = ui_edit_paragraph_runs(e, pn, &runs);
     if (runs <= 1) {
         e->selection.a[1].gp = 0;
     } else {
         int32_t rn = ui_edit_pg_to_pr(e, e->selection.a[1]).rn;
         assert(0 <= rn && rn < runs);
-        const int32_t gp = para->run[rn].gp;
+        const int32_t gp = run[rn].gp;
         if (e->selection.a[1].gp != gp) {
             // first Home keystroke moves caret to start of run
             e->selection.a[1].gp = gp;
@@ -8786,7 +15659,7 @@ static void ui_edit_key_end(ui_edit_t* e) {
         int32_t pn = e->selection.a[1].pn;
         int32_t gp = e->selection.a[1].gp;
         assert(0 <= pn && pn < dt->np);
-        const ui_edit_str_t* str = &dt->ps[pn];
+        const ui_edit_str_t* str = ui_edit_text.ps(dt, pn);
         int32_t runs = 0;
         const ui_edit_run_t* run = ui_edit_paragraph_runs(e, pn, &runs);
         int32_t rn = ui_edit_pg_to_pr(e, e->selection.a[1]).rn;
@@ -8811,7 +15684,7 @@ static void ui_edit_key_page_up(ui_edit_t* e) {
     int32_t n = ut_max(1, e->visible_runs - 1);
     ui_edit_pg_t scr = ui_edit_scroll_pg(e);
     ui_edit_pg_t bof = {.pn = 0, .gp = 0};
-    int32_t m = ui_edit_runs_between(e, bof, scr);
+    int32_t m = ui_edit_runs_between(e, bof, scr, n);
     if (m > n) {
         ui_point_t pt = ui_edit_pg_to_xy(e, e->selection.a[1]);
         ui_edit_pr_t scroll = e->scroll;
@@ -8830,7 +15703,7 @@ static void ui_edit_key_page_down(ui_edit_t* e) {
     int32_t n = ut_max(1, e->visible_runs - 1);
     ui_edit_pg_t scr = ui_edit_scroll_pg(e);
     ui_edit_pg_t end = ui_edit_range.end(dt);
-    int32_t m = ui_edit_runs_between(e, scr, end);
+    int32_t m = ui_edit_runs_between(e, scr, end, n);
     if (m > n) {
         ui_point_t pt = ui_edit_pg_to_xy(e, e->selection.a[1]);
         ui_edit_pr_t scroll = e->scroll;
@@ -9423,6 +16296,7 @@ static void ui_edit_paint(ui_view_t* v) {
         }
     }
     ui_gdi.set_clip(0, 0, 0, 0);
+    e->painted = true; // see ui_edit_every_100ms()
 }
 
 static void ui_edit_move(ui_edit_t* e, ui_edit_pg_t pg) {
@@ -9465,15 +16339,19 @@ static bool ui_edit_reallocate_runs(ui_edit_t* e, int32_t p, int32_t np) {
     int32_t new_np = dt->np; // new (after)  number of paragraphs
     assert(old_np > 0 && new_np > 0 && e->para != null);
     assert(0 <= p && p < old_np);
+    // paragraphs are renumbered: the index is rebuilt on the next query
+    if (old_np != new_np) { e->run_index.np = 0; }
     if (old_np == new_np) {
         ui_edit_invalidate_run(e, p);
     } else if (new_np < old_np) { // shrinking - delete runs
         const int32_t d = old_np - new_np; // `d` delta > 0
+        for (int32_t i = p + 1; i <= p + d; i++) { ui_edit_invalidate_run(e, i); }
+        if (p < new_np) { ui_edit_invalidate_run(e, p); }
         if (p + d < old_np - 1) {
             const int32_t n = ut_max(0, old_np - p - d - 1);
-            memcpy(e->para + p + 1, e->para + p + 1 + d, n * sizeof(e->para[0]));
+            memmove(e->para + p + 1, e->para + p + 1 + d, n * sizeof(e->para[0]));
         }
-        if (p < new_np) { ui_edit_invalidate_run(e, p); }
+        ui_edit_cache_renumber(e, p, -d);
         ok = ut_heap.realloc((void**)&e->para, new_np * sizeof(e->para[0])) == 0;
         swear(ok, "shrinking");
     } else { // growing - insert runs
@@ -9485,9 +16363,9 @@ static bool ui_edit_reallocate_runs(ui_edit_t* e, int32_t p, int32_t np) {
             memmove(e->para + p + 1 + d, e->para + p + 1, n * sizeof(e->para[0]));
             const int32_t m = ut_min(new_np, p + 1 + d);
             for (int32_t i = p + 1; i < m; i++) {
-                e->para[i].run = null;
-                e->para[i].runs = 0;
+                memset(&e->para[i], 0x00, sizeof(e->para[i]));
             }
+            ui_edit_cache_renumber(e, p, d);
         }
     }
     return ok;
@@ -9514,18 +16392,266 @@ static void ui_edit_after(ui_edit_notify_t* notify,
     // number of paragraphs before replace():
     const int32_t np = (int32_t)n->data;
     swear(dt->np == np - ni->deleted + ni->inserted);
+    e->generation++; // paragraphs renumbered: background results are stale
     ui_edit_reallocate_runs(e, ni->r->from.pn, np);
+    // replace of multiple paragraphs or batch modifies [pnf..pnt]:
+    if (ni->pnf < ni->pnt) {
+        ui_edit_invalidate_runs(e, ni->pnf, ni->pnt, dt->np);
+    }
+    // lexer states of [pnf..pnt] are stale, states of the following
+    // paragraphs are checked against their start states on paint:
+    for (int32_t pn = ni->pnf; pn <= ni->pnt; pn++) { e->para[pn].lexed = false; }
+    e->lexed = ut_min(e->lexed, ni->pnf);
     e->selection = *ni->x;
     // this is needed by undo/redo: trim selection
     ui_edit_pg_t* pg = e->selection.a;
     for (int32_t i = 0; i < countof(e->selection.a); i++) {
         pg[i].pn = ut_max(0, ut_min(dt->np - 1, pg[i].pn));
-        pg[i].gp = ut_max(0, ut_min(dt->ps[pg[i].pn].g, pg[i].gp));
+        pg[i].gp = ut_max(0, ut_min(ui_edit_text.ps(dt, pg[i].pn)->g, pg[i].gp));
     }
     ui_edit_scroll_into_view(e, e->selection.to);
     ui_edit_invalidate(e);
 }
 
+// Background layout: after runs of all paragraphs were invalidated
+// (resize, font change) worker threads lay out paragraphs that still
+// have no runs from their own snapshots of the text with a frozen copy
+// of the glyph widths. Workers publish run counts and the UI thread
+// installs them in every_100ms() only if the view generation did not
+// change meanwhile. run[] arrays are left to the runs cache. The job
+// is reference counted and cancelled without waiting: workers notice
+// .cancel after the current paragraph and the last one out frees it.
+
+enum {
+    ui_edit_background_min     = 4 * 1024, // paragraphs
+    ui_edit_background_workers = 4         // at most
+};
+
+typedef struct ui_edit_laid_out_s ui_edit_laid_out_t;
+
+typedef struct ui_edit_laid_out_s { // number of runs of a paragraph
+    ui_edit_laid_out_t* next;
+    int32_t pn;
+    int32_t runs;
+} ui_edit_laid_out_t;
+
+typedef struct ui_edit_background_worker_s {
+    ui_edit_background_t* b;
+    ui_edit_snapshot_t* snapshot; // each reader has its own
+} ui_edit_background_worker_t;
+
+typedef struct ui_edit_background_s {
+    volatile int32_t rc;      // workers and the view
+    volatile int32_t running; // number of workers still running
+    volatile int32_t next;    // index of the next pn[] to lay out
+    volatile int32_t cancel;
+    int32_t  generation;      // of the view when the job started
+    int32_t* pn;              // paragraphs without runs, visible first
+    int32_t  n;               // number of pn[]
+    int32_t  width;
+    ui_fm_t  fm;              // copy for concurrent metrics
+    ui_edit_metrics_t* metrics;
+    ui_edit_widths_t widths;  // frozen copy
+    ut_mutex_t mutex;         // of laid_out list
+    ui_edit_laid_out_t* laid_out;
+    int32_t workers;
+    ui_edit_background_worker_t worker[ui_edit_background_workers];
+} ui_edit_background_t;
+
+static void ui_edit_background_release(ui_edit_background_t* b) {
+    if (ut_atomics.decrement_int32(&b->rc) == 0) {
+        ui_edit_laid_out_t* l = b->laid_out;
+        while (l != null) {
+            ui_edit_laid_out_t* next = l->next;
+            ut_heap.free(l);
+            l = next;
+        }
+        if (b->widths.entry != null) { ut_heap.free(b->widths.entry); }
+        if (b->pn != null) { ut_heap.free(b->pn); }
+        ut_mutex.dispose(&b->mutex);
+        ut_heap.free(b);
+    }
+}
+
+static void ui_edit_background_worker(void* p) {
+    ui_edit_background_t* b = ((ui_edit_background_worker_t*)p)->b;
+    ui_edit_snapshot_t*   s = ((ui_edit_background_worker_t*)p)->snapshot;
+    ut_thread.name("ui_edit.layout");
+    ui_edit_measure_t m = {
+        .widths = &b->widths, .metrics = b->metrics, .fm = &b->fm,
+        .frozen = true
+    };
+    for (;;) {
+        if (ut_atomics.load32(&b->cancel) != 0) { break; }
+        const int32_t i = ut_atomics.increment_int32(&b->next) - 1;
+        if (i >= b->n) { break; }
+        const ui_edit_str_t* str = ui_edit_text.ps(&s->text, b->pn[i]);
+        m.missed = false;
+        int32_t runs = 0;
+        ut_heap.free(ui_edit_measure_runs(&m, str, b->width, &runs));
+        ui_edit_laid_out_t* l = null;
+        // missed glyph that was never measured: left for the UI thread
+        if (!m.missed && ut_heap.alloc((void**)&l, sizeof(*l)) == 0) {
+            *l = (ui_edit_laid_out_t){ .pn = b->pn[i], .runs = runs };
+            ut_mutex.lock(&b->mutex);
+            l->next = b->laid_out;
+            b->laid_out = l;
+            ut_mutex.unlock(&b->mutex);
+        }
+    }
+    ui_edit_doc.dispose_snapshot(s);
+    ut_atomics.decrement_int32(&b->running);
+    ui_edit_background_release(b);
+}
+
+static void ui_edit_background_stop(ui_edit_t* e) {
+    ui_edit_background_t* b = e->background;
+    if (b != null) {
+        ut_atomics.exchange_int32(&b->cancel, 1);
+        e->background = null;
+        ui_edit_background_release(b);
+    }
+}
+
+static void ui_edit_background_install(ui_edit_t* e) {
+    ui_edit_background_t* b = e->background;
+    ut_mutex.lock(&b->mutex);
+    ui_edit_laid_out_t* l = b->laid_out;
+    b->laid_out = null;
+    ut_mutex.unlock(&b->mutex);
+    while (l != null) {
+        ui_edit_laid_out_t* next = l->next;
+        ui_edit_paragraph_t* p = &e->para[l->pn];
+        if (p->runs == 0) { // not laid out by the UI thread meanwhile
+            p->runs = l->runs;
+            ui_edit_run_index_update(e, l->pn, p->runs, 1);
+        }
+        ut_heap.free(l);
+        l = next;
+    }
+}
+
+static bool ui_edit_background_start(ui_edit_t* e) {
+    // false if there is nothing to lay out or no memory
+    const int32_t np = e->doc->text.np;
+    ui_edit_background_t* b = null;
+    bool ok = ut_heap.alloc_zero((void**)&b, sizeof(*b)) == 0;
+    if (ok) {
+        ut_mutex.init(&b->mutex);
+        b->rc = 1;
+        ok = ut_heap.alloc((void**)&b->pn, np * sizeof(b->pn[0])) == 0;
+    }
+    if (ok) { // paragraphs below the visible ones first:
+        for (int32_t i = 0; i < np; i++) {
+            const int32_t pn = (e->scroll.pn + i) % np;
+            if (e->para[pn].runs == 0) { b->pn[b->n++] = pn; }
+        }
+        ok = b->n > 0;
+    }
+    if (ok) {
+        ui_edit_measure_t m = ui_edit_measure_of(e);
+        b->generation = e->generation;
+        b->width   = e->w;
+        b->fm      = *m.fm;
+        b->metrics = m.metrics;
+        b->widths  = *m.widths;
+        b->widths.entry = null;
+        if (m.widths->capacity > 0) {
+            const int64_t bytes = m.widths->capacity * sizeof(m.widths->entry[0]);
+            ok = ut_heap.alloc((void**)&b->widths.entry, bytes) == 0;
+            if (ok) { memcpy(b->widths.entry, m.widths->entry, (size_t)bytes); }
+        }
+    }
+    if (ok) {
+        const int32_t workers = ut_min(ui_edit_background_workers,
+                                       ut_max(1, ut_thread.processors() - 1));
+        for (int32_t i = 0; i < workers; i++) {
+            ui_edit_snapshot_t* s = ui_edit_doc.snapshot(e->doc);
+            if (s != null) {
+                b->worker[b->workers].b = b;
+                b->worker[b->workers].snapshot = s;
+                b->workers++;
+            }
+        }
+        ok = b->workers > 0;
+    }
+    if (ok) {
+        b->rc = b->workers + 1;
+        b->running = b->workers;
+        for (int32_t i = 0; i < b->workers; i++) {
+            ut_thread.detach(ut_thread.start(ui_edit_background_worker,
+                                             &b->worker[i]));
+        }
+        e->background = b;
+    } else if (b != null) {
+        ui_edit_background_release(b);
+    }
+    return ok;
+}
+
+static void ui_edit_background(ui_edit_t* e) {
+    // called every 100ms: installs laid out runs, starts the layout
+    // when the view did not change since the previous call
+    ui_edit_background_t* b = e->background;
+    if (b != null && b->generation != e->generation) {
+        ui_edit_background_stop(e);
+    } else if (b != null) {
+        const bool done = ut_atomics.load32(&b->running) == 0;
+        ui_edit_background_install(e);
+        if (done) {
+            e->relayout = false;
+            ui_edit_background_stop(e);
+        }
+    } else if (e->relayout && e->quiet == e->generation && !e->sle &&
+               e->view.w > 0 && !ui_view.is_hidden(&e->view)) {
+        if (e->doc->text.np < ui_edit_background_min ||
+            !ui_edit_background_start(e)) {
+            e->relayout = false; // nothing to do or no memory
+        }
+    }
+    e->quiet = e->generation;
+}
+
+static void ui_edit_every_100ms(ui_view_t* v) {
+    // streaming documents (see ui_edit_doc.append()) are flushed here:
+    // caret at the end of the text follows appended text, otherwise
+    // selection and scroll stay on the same paragraphs even when the
+    // oldest paragraphs are dropped. Background layout is polled here.
+    ui_edit_t* e = (ui_edit_t*)v;
+    ui_edit_doc_t* d = e->doc;
+    if (d->tail.count > 0 || d->tail.file != null) {
+        const ui_edit_pg_t end = ui_edit_range.end(&d->text);
+        const bool follow =
+            ui_edit_range.compare(e->selection.from, end) == 0 &&
+            ui_edit_range.compare(e->selection.to, end) == 0;
+        ui_edit_range_t s = e->selection;
+        ui_edit_pr_t scroll = e->scroll;
+        const int64_t dropped = d->tail.dropped;
+        errno_t r = ui_edit_doc.flush(d);
+        if (r != 0) { traceln("ui_edit_doc.flush() %s", strerr(r)); }
+        if (follow) {
+            ui_edit_move(e, ui_edit_range.end(&d->text));
+        } else {
+            const int32_t k = (int32_t)(d->tail.dropped - dropped);
+            for (int32_t i = 0; i < countof(s.a); i++) {
+                s.a[i] = s.a[i].pn >= k ?
+                    (ui_edit_pg_t){ .pn = s.a[i].pn - k, .gp = s.a[i].gp } :
+                    (ui_edit_pg_t){ .pn = 0, .gp = 0 };
+            }
+            e->selection = s;
+            e->scroll = scroll.pn >= k ?
+                (ui_edit_pr_t){ .pn = scroll.pn - k, .rn = scroll.rn } :
+                (ui_edit_pr_t){ .pn = 0, .rn = 0 };
+        }
+    }
+    // leaves of paragraphs painted since the previous cool() stay hot,
+    // the rest may be compressed down to the ceiling. cool() walks all
+    // the leaves: at most 10 times a second and only after paint.
+    if (e->painted && d->cold.ceiling > 0) { ui_edit_doc.cool(d); }
+    e->painted = false;
+    ui_edit_background(e);
+}
+
 static void ui_edit_init(ui_edit_t* e, ui_edit_doc_t* d) {
     memset(e, 0, sizeof(*e));
     assert(d != null && d->text.np > 0);
@@ -9562,6 +16688,7 @@ static void ui_edit_init(ui_edit_t* e, ui_edit_doc_t* d) {
     e->view.kill_focus      = ui_edit_kill_focus;
     e->view.key_pressed     = ui_edit_key_pressed;
     e->view.mouse_wheel     = ui_edit_mouse_wheel;
+    e->view.every_100ms     = ui_edit_every_100ms;
     #ifdef EDIT_USE_TAP
         e->view.tap         = ui_edit_tap;
     #else
@@ -9571,11 +16698,256 @@ static void ui_edit_init(ui_edit_t* e, ui_edit_doc_t* d) {
 }
 
 static void ui_edit_dispose(ui_edit_t* e) {
+    ui_edit_background_stop(e);
     ui_edit_doc.unsubscribe(e->doc, &e->listener.notify);
     ui_edit_dispose_all_runs(e);
+    if (e->tokens != null) { ut_heap.free(e->tokens); }
+    if (e->widths.entry != null) { ut_heap.free(e->widths.entry); }
     memset(e, 0, sizeof(*e));
 }
 
+// tests:
+
+static int32_t ui_edit_test_advance(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t gp) {
+    // advance of the glyph gp straight from the metrics (no cache, no spans)
+    const int32_t bp = ui_edit_str.g2b(str, gp);
+    const int32_t bytes = ui_edit_str.g2b(str, gp + 1) - bp;
+    return m->metrics->advance(m->metrics, m->fm, str->u + bp, bytes);
+}
+
+static int32_t ui_edit_test_width(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t gp, int32_t glyphs) {
+    int32_t x = 0;
+    for (int32_t i = gp; i < gp + glyphs; i++) {
+        x += ui_edit_test_advance(m, str, i);
+    }
+    return x;
+}
+
+static int32_t ui_edit_test_break(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t gp, int32_t width, bool allow_zero) {
+    // ui_edit_measure_break() by per glyph summation of advances
+    int32_t k = 1;
+    if (gp < str->g - 1) {
+        int32_t x = 0;
+        k = 0;
+        while (gp + k < str->g) {
+            x += ui_edit_test_advance(m, str, gp + k);
+            if (x >= width) { break; }
+            k++;
+        }
+        if (!allow_zero && k == 0) { k = 1; }
+    }
+    return k;
+}
+
+static void ui_edit_test_runs(ui_edit_measure_t* m, const ui_edit_str_t* str,
+        int32_t width) {
+    for (int32_t gp = 0; gp < str->g; gp++) {
+        const int32_t bp = ui_edit_str.g2b(str, gp);
+        for (int32_t z = 0; z < 2; z++) {
+            const int32_t k = ui_edit_measure_break(m, str, gp, bp, width, z);
+            swear(k == ui_edit_test_break(m, str, gp, width, z),
+                  "\"%.*s\" gp: %d width: %d", str->b, str->u, gp, width);
+        }
+    }
+    int32_t runs = 0;
+    ui_edit_run_t* run = ui_edit_measure_runs(m, str, width, &runs);
+    int32_t gp = 0;
+    int32_t bp = 0;
+    for (int32_t i = 0; i < runs; i++) {
+        swear(run[i].gp == gp && run[i].bp == bp);
+        swear(run[i].bytes == ui_edit_str.g2b(str, gp + run[i].glyphs) - bp);
+        swear(run[i].pixels == ui_edit_test_width(m, str, gp, run[i].glyphs));
+        swear(run[i].pixels < width || run[i].glyphs == 1);
+        if (str->g > 0) {
+            const int32_t k = ui_edit_test_break(m, str, gp, width, false);
+            // word break may only shorten the run to the last SPACE:
+            swear(run[i].glyphs == k || (run[i].glyphs < k &&
+                  str->u[bp + run[i].bytes - 1] == 0x20));
+        }
+        gp += run[i].glyphs;
+        bp += run[i].bytes;
+    }
+    swear(gp == str->g && bp == str->b);
+    ut_heap.free(run);
+}
+
+static void ui_edit_test_fixed(void) {
+    // ui_edit_measure_break() and ui_edit_measure_runs() of monospaced
+    // fonts step over printable ASCII spans arithmetically. Both are
+    // compared with per glyph summation at every width up to the width
+    // of the whole text including all exact multiples of the cell.
+    static const char* texts[] = {
+        "",
+        "a",
+        "\xE4\xB8\xAD",                             // wide
+        "hello world",
+        "abc\xE4\xB8\xAD" "def",                     // ASCII, wide, ASCII
+        "\xE4\xB8\xAD" "abc \xE4\xB8\xAD\xE6\x96\x87 de",
+        "a\tb\x01" "cd\xC3\xA9" "ef\xE2\x82\xAC" "gh",     // not printable
+        "\xF0\x9F\x98\x80 smile \xF0\x9F\x98\x80\xF0\x9F\x98\x80 x",
+        "one two  three   four \xE4\xB8\xAD\xE6\x96\x87 five six seven",
+    };
+    ui_fm_t fms[] = {
+        { .em = { .w = 7, .h = 16 }, .height = 16, .mono = true  },
+        { .em = { .w = 7, .h = 16 }, .height = 16, .mono = false },
+        { .em = { .w = 1, .h = 16 }, .height = 16, .mono = true  },
+    };
+    for (int32_t f = 0; f < countof(fms); f++) {
+        ui_edit_widths_t w = {0};
+        ui_edit_measure_t m = ui_edit_measure_with(&w,
+            &ui_edit_metrics_fixed, &fms[f]);
+        swear(w.cell == (fms[f].mono ? fms[f].em.w : 0));
+        for (int32_t i = 0; i < countof(texts); i++) {
+            ui_edit_str_t s = {0};
+            swear(ui_edit_str.init(&s, (const uint8_t*)texts[i], -1, false));
+            const int32_t total = ui_edit_test_width(&m, &s, 0, s.g);
+            swear(ui_edit_measure_width(&m, s.u, s.b) == total);
+            for (int32_t width = 1; width <= total + 2 * 7 + 1; width++) {
+                ui_edit_test_runs(&m, &s, width);
+            }
+            ui_edit_str.free(&s);
+        }
+        if (w.entry != null) { ut_heap.free(w.entry); }
+    }
+    // span step i = (width - x + c - 1) / c - 1 at the cell boundaries:
+    ui_fm_t fm = fms[0];
+    ui_edit_widths_t w = {0};
+    ui_edit_measure_t m = ui_edit_measure_with(&w, &ui_edit_metrics_fixed, &fm);
+    const int32_t c = w.cell;
+    ui_edit_str_t s = {0};
+    swear(ui_edit_str.init(&s, (const uint8_t*)"abcdefgh", -1, false));
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 3 * c, false) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 3 * c + 1, false) == 3);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 3 * c - 1, false) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, c, true) == 0);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, c, false) == 1);
+    swear(ui_edit_measure_break(&m, &s, 2, 2, 6 * c, false) == 5);
+    swear(ui_edit_measure_break(&m, &s, 2, 2, 6 * c + 1, false) == 6);
+    ui_edit_str.free(&s);
+    // x > 0 when the span starts after a wide glyph (2 * c):
+    swear(ui_edit_str.init(&s, (const uint8_t*)"\xE4\xB8\xAD" "abcd", -1, false));
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 2 * c, true) == 0);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 2 * c + 1, true) == 1);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 4 * c, true) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 4 * c + 1, true) == 3);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 6 * c, true) == 4);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 6 * c + 1, true) == 5);
+    ui_edit_str.free(&s);
+    // wide glyph right after the span: span does not reach the width
+    swear(ui_edit_str.init(&s, (const uint8_t*)"ab\xE4\xB8\xAD" "cd", -1, false));
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 2 * c, true) == 1);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 2 * c + 1, true) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 4 * c, true) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 4 * c + 1, true) == 3);
+    ui_edit_str.free(&s);
+    if (w.entry != null) { ut_heap.free(w.entry); }
+}
+
+static void ui_edit_test_widths(void) {
+    // glyph widths hash grows and keeps all measured glyphs, frozen
+    // (background) widths are never written to
+    ui_fm_t fm = { .em = { .w = 8, .h = 16 }, .height = 16, .mono = true };
+    ui_edit_widths_t w = {0};
+    ui_edit_measure_t m = ui_edit_measure_with(&w, &ui_edit_metrics_fixed, &fm);
+    swear(w.cell == 8 && w.count == 0 && w.capacity == 0);
+    enum { n = 4096 }; // CJK U+4E00..U+5DFF
+    for (int32_t r = 0; r < 2; r++) { // measure, then hit the cache
+        for (uint32_t i = 0; i < n; i++) {
+            const uint32_t cp = 0x4E00 + i;
+            const uint8_t u[3] = { (uint8_t)(0xE0 | (cp >> 12)),
+                (uint8_t)(0x80 | ((cp >> 6) & 0x3F)),
+                (uint8_t)(0x80 | (cp & 0x3F)) };
+            swear(ui_edit_advance(&m, u, 3) == 16);
+            uint32_t glyph = 0;
+            memcpy(&glyph, u, 3);
+            const ui_edit_width_t* x = ui_edit_widths_slot(&w, glyph);
+            swear(x->glyph == glyph && x->width == 16);
+        }
+        swear(w.count == n && w.count * 4 < w.capacity * 3);
+    }
+    const int32_t capacity = w.capacity;
+    const uint8_t* smile = (const uint8_t*)"\xF0\x9F\x98\x80";
+    const uint8_t* cjk = (const uint8_t*)"\xE4\xB8\xAD";
+    m.frozen = true; // concurrent metrics measure missing glyphs:
+    swear(ui_edit_advance(&m, smile, 4) == 16 && !m.missed);
+    swear(ui_edit_advance(&m, (const uint8_t*)"\t", 1) == 8 && !m.missed);
+    swear(w.count == n && w.capacity == capacity && w.ascii['\t'] < 0);
+    ui_edit_metrics_t gdi_like = {
+        .advance = ui_edit_metrics_fixed_advance, .concurrent = false
+    };
+    m.metrics = &gdi_like; // not concurrent metrics are not called:
+    swear(ui_edit_advance(&m, cjk, 3) == 16 && !m.missed); // cached
+    swear(ui_edit_advance(&m, (const uint8_t*)"m", 1) == 8 && !m.missed);
+    swear(ui_edit_advance(&m, smile, 4) == fm.em.w && m.missed);
+    m.missed = false;
+    swear(ui_edit_advance(&m, (const uint8_t*)"\t", 1) == fm.em.w && m.missed);
+    swear(w.count == n && w.capacity == capacity && w.ascii['\t'] < 0);
+    m.frozen  = false; // foreground layout fills the cache:
+    m.missed  = false;
+    swear(ui_edit_advance(&m, smile, 4) == 16 && !m.missed);
+    swear(ui_edit_advance(&m, (const uint8_t*)"\t", 1) == 8);
+    swear(w.count == n + 1 && w.ascii['\t'] == 8);
+    ut_heap.free(w.entry);
+}
+
+static void ui_edit_test_performance(void) {
+    // measure_runs() of a long line vs per glyph summation of advances
+    enum { n = 4 * 1024 * 1024 };
+    uint8_t* u = null;
+    swear(ut_heap.alloc((void**)&u, n) == 0);
+    const char* words[] = { "lorem ", "ipsum ", "dolor ", "sit ", "amet, ",
+                            "\xE4\xB8\xAD\xE6\x96\x87 " };
+    for (int32_t wide = 0; wide < 2; wide++) {
+        uint32_t seed = 1;
+        int32_t b = 0;
+        for (;;) {
+            const int32_t i = (int32_t)(ut_num.random32(&seed) %
+                                        (countof(words) - 1 + wide));
+            const int32_t k = (int32_t)strlen(words[i]);
+            if (b + k > n) { break; }
+            memcpy(u + b, words[i], (size_t)k);
+            b += k;
+        }
+        ui_edit_str_t s = {0};
+        swear(ui_edit_str.init(&s, u, b, false));
+        for (int32_t mono = 0; mono < 2; mono++) {
+            ui_fm_t fm = { .em = { .w = 8, .h = 16 }, .height = 16,
+                           .mono = mono != 0 };
+            ui_edit_widths_t w = {0};
+            ui_edit_measure_t m = ui_edit_measure_with(&w,
+                &ui_edit_metrics_fixed, &fm);
+            fp64_t time = ut_clock.seconds();
+            int32_t runs = 0;
+            ui_edit_run_t* run = ui_edit_measure_runs(&m, &s, 80 * 8, &runs);
+            const fp64_t layout = ut_clock.seconds() - time;
+            time = ut_clock.seconds();
+            const int32_t x = ui_edit_test_width(&m, &s, 0, s.g);
+            const fp64_t summation = ut_clock.seconds() - time;
+            int32_t pixels = 0;
+            for (int32_t i = 0; i < runs; i++) { pixels += run[i].pixels; }
+            swear(pixels == x);
+            ut_heap.free(run);
+            if (w.entry != null) { ut_heap.free(w.entry); }
+            const fp64_t mb = b / (1024.0 * 1024.0);
+            traceln("%s%s measure_runs() %7.1f MB/s %d runs "
+                    "per glyph sum %7.1f MB/s",
+                    mono ? "mono " : "prop ", wide ? "CJK  " : "ASCII",
+                    mb / layout, runs, mb / summation);
+        }
+        ui_edit_str.free(&s);
+    }
+    ut_heap.free(u);
+}
+
+static void ui_edit_test(void) {
+    ui_edit_test_fixed();
+    ui_edit_test_widths();
+    ui_edit_test_performance();
+}
+
 ui_edit_if ui_edit = {
     .init                 = ui_edit_init,
     .set_font             = ui_edit_set_font,
@@ -9599,8 +16971,13 @@ ui_edit_if ui_edit = {
     .key_backspace        = ui_edit_key_backspace,
     .key_enter            = ui_edit_key_enter,
     .fuzz                 = null,
-    .dispose              = ui_edit_dispose
+    .dispose              = ui_edit_dispose,
+    .test                 = ui_edit_test
 };
+
+#ifdef UI_EDIT_VIEW_TEST
+    ut_static_init(ui_edit) { ui_edit.test(); }
+#endif
 // _________________________________ ui_gdi.c _________________________________
 
 #include "ut/ut.h"
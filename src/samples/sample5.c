@@ -247,7 +247,8 @@ static void key_pressed(ui_view_t* unused(view), int64_t key) {
 static void edit_enter(ui_edit_t* e) {
     assert(e->sle);
     if (!ui_app.shift) { // ignore shift ENTER:
-        traceln("text: %.*s", e->doc->text.ps[0].b, e->doc->text.ps[0].u);
+        const ui_edit_str_t* p = ui_edit_text.ps(&e->doc->text, 0);
+        traceln("text: %.*s", p->b, p->u);
     }
 }
 
@@ -471,25 +471,22 @@ controls_large(&large);
 
 static void edit1_test(ui_view_t* parent) {
     ui_view.disband(parent);
-    static void* text;
-    static int64_t bytes;
-    if (text == null) {
+    static ui_view_t  list = ui_view(list);
+    static ui_edit_t  edit = {0};
+    static ui_edit_doc_t doc = {0};
+    if (doc.text.np == 0) {
+        errno_t r = ENOENT;
         if (ut_args.c > 1) {
             if (ut_files.exists(ut_args.v[1])) {
-                errno_t r = ut_mem.map_ro(ut_args.v[1], &text, &bytes);
+                r = ui_edit_doc.open(&doc, ut_args.v[1]);
                 if (r != 0) {
-                    traceln("ut_mem.map_ro(%s) failed %s", ut_args.v[1], ut_str.error(r));
+                    traceln("ui_edit_doc.open(%s) failed %s", ut_args.v[1], ut_str.error(r));
                 }
             } else {
                 traceln("file \"%s\" does not exist", ut_args.v[1]);
             }
         }
-    }
-    static ui_view_t  list = ui_view(list);
-    static ui_edit_t  edit = {0};
-    static ui_edit_doc_t doc = {0};
-    if (doc.text.np == 0) {
-        swear(ui_edit_doc.init(&doc, text, (int32_t)bytes, false));
+        if (r != 0) { swear(ui_edit_doc.init(&doc, null, 0, false)); }
         ui_edit.init(&edit, &doc);
     }
     ui_view.add(&test,
@@ -3,6 +3,12 @@
 #include "ui/ui.h"
 #include "ui/ui_edit_doc.h"
 
+#undef UI_EDIT_VIEW_TEST
+
+#if 0 // flip to 1 to run tests
+#define UI_EDIT_VIEW_TEST
+#endif
+
 // TODO: undo/redo
 // TODO: back/forward navigation
 // TODO: exit/save keyboard shortcuts?
@@ -16,7 +22,7 @@
 // https://web.archive.org/web/20221216044359/http://worrydream.com/refs/Tesler%20-%20A%20Personal%20History%20of%20Modeless%20Text%20Editing%20and%20Cut-Copy-Paste.pdf
 
 // Rich text options that are not addressed yet:
-// * Color of ranges (useful for code editing)
+// * Color of ranges other than syntax coloring (see ui_edit_t.lexer)
 // * Soft line breaks inside the paragraph (useful for e.g. bullet lists of options)
 // * Bold/Italic/Underline (along with color ranges)
 // * Multiple fonts (as long as run vertical size is the maximum of font)
@@ -33,102 +39,255 @@ typedef  struct ui_edit_glyph_s {
 
 static void ui_edit_layout(ui_view_t* v);
 
+static const ui_edit_run_t* ui_edit_paragraph_runs(ui_edit_t* e, int32_t pn,
+        int32_t* runs);
+
 // Glyphs in monospaced Windows fonts may have different width for non-ASCII
 // characters. Thus even if edit is monospaced glyph measurements are used
-// in text layout.
+// in text layout for everything except printable ASCII glyphs which are
+// laid out arithmetically (see ui_edit_widths_t.cell).
 
 static void ui_edit_invalidate(ui_edit_t* e) {
     ui_view.invalidate(&e->view, null);
 }
 
-static int32_t ui_edit_text_width(ui_edit_t* e, const uint8_t* s, int32_t n) {
-//  fp64_t time = ut_clock.seconds();
+static int32_t ui_edit_metrics_gdi_advance(ui_edit_metrics_t* unused(m),
+        const ui_fm_t* fm, const uint8_t* utf8, int32_t bytes) {
     // average GDI measure_text() performance per character:
     // "ui_app.fm.mono"    ~500us (microseconds)
     // "ui_app.fm.regular" ~250us (microseconds) DirectWrite ~100us
-    const ui_gdi_ta_t ta = { .fm = e->view.fm, .color = e->view.color,
-                             .measure = true };
-    int32_t x = n == 0 ? 0 : ui_gdi.text(&ta, 0, 0, "%.*s", n, s).w;
-//  TODO: remove
-//  int32_t x = n == 0 ? 0 : ui_gdi.measure_text(e->view.fm, "%.*s", n, s).w;
-
-//  time = (ut_clock.seconds() - time) * 1000.0;
-//  static fp64_t time_sum;
-//  static fp64_t length_sum;
-//  time_sum += time;
-//  length_sum += n;
-//  traceln("avg=%.6fms per char total %.3fms", time_sum / length_sum, time_sum);
+    const ui_gdi_ta_t ta = { .fm = fm, .measure = true };
+    return ui_gdi.text(&ta, 0, 0, "%.*s", bytes, utf8).w;
+}
+
+static int32_t ui_edit_metrics_fixed_advance(ui_edit_metrics_t* unused(m),
+        const ui_fm_t* fm, const uint8_t* utf8, int32_t unused(bytes)) {
+    const int32_t w = ut_max(1, fm->em.w);
+    return utf8[0] >= 0xE3 ? w * 2 : w; // U+3000 and above are wide
+}
+
+ui_edit_metrics_t ui_edit_metrics_gdi = {
+    .advance = ui_edit_metrics_gdi_advance, .concurrent = false
+};
+
+ui_edit_metrics_t ui_edit_metrics_fixed = {
+    .advance = ui_edit_metrics_fixed_advance, .concurrent = true
+};
+
+typedef struct ui_edit_measure_s { // glyph advances for the text layout
+    ui_edit_widths_t*  widths;
+    ui_edit_metrics_t* metrics;
+    const ui_fm_t*     fm;
+    bool frozen; // background layout: widths are read only
+    bool missed; // frozen widths miss a glyph of not concurrent metrics
+} ui_edit_measure_t;
+
+static ui_edit_measure_t ui_edit_measure_with(ui_edit_widths_t* w,
+        ui_edit_metrics_t* m, const ui_fm_t* fm) {
+    if (w->metrics != m || w->fm != fm || w->font != fm->font ||
+        w->height != fm->height) {
+        w->metrics = m;
+        w->fm      = fm;
+        w->font    = fm->font;
+        w->height  = fm->height;
+        memset(w->ascii, 0xFF, sizeof(w->ascii)); // -1
+        if (w->entry != null) {
+            memset(w->entry, 0x00, w->capacity * sizeof(w->entry[0]));
+        }
+        w->count = 0;
+        w->cell  = 0;
+        if (fm->mono) { // fixed pitch: all printable ASCII is "m" wide
+            const int32_t c = m->advance(m, fm, (const uint8_t*)"m", 1);
+            if (c > 0) {
+                for (int32_t i = 0x20; i < 0x7F; i++) { w->ascii[i] = c; }
+                w->cell = c;
+            }
+        }
+    }
+    return (ui_edit_measure_t){ .widths = w, .metrics = m, .fm = fm };
+}
+
+static ui_edit_measure_t ui_edit_measure_of(ui_edit_t* e) {
+    ui_edit_metrics_t* m = e->metrics != null ? e->metrics : &ui_edit_metrics_gdi;
+    return ui_edit_measure_with(&e->widths, m, e->view.fm);
+}
+
+static ui_edit_width_t* ui_edit_widths_slot(const ui_edit_widths_t* w,
+        uint32_t glyph) {
+    // slot of the glyph or empty slot where it belongs
+    const uint32_t mask = (uint32_t)w->capacity - 1;
+    uint32_t h = ut_num.hash32((const char*)&glyph, sizeof(glyph));
+    while (w->entry[h & mask].glyph != 0 && w->entry[h & mask].glyph != glyph) {
+        h++;
+    }
+    return &w->entry[h & mask];
+}
+
+static bool ui_edit_widths_grow(ui_edit_widths_t* w) {
+    ui_edit_widths_t g = *w;
+    g.capacity = w->capacity == 0 ? 256 : w->capacity * 2;
+    g.count = 0;
+    bool ok = ut_heap.alloc_zero((void**)&g.entry,
+                  g.capacity * sizeof(g.entry[0])) == 0;
+    if (ok) {
+        for (int32_t i = 0; i < w->capacity; i++) {
+            if (w->entry[i].glyph != 0) {
+                *ui_edit_widths_slot(&g, w->entry[i].glyph) = w->entry[i];
+                g.count++;
+            }
+        }
+        if (w->entry != null) { ut_heap.free(w->entry); }
+        *w = g;
+    }
+    return ok;
+}
+
+static int32_t ui_edit_measure_miss(ui_edit_measure_t* m, const uint8_t* u,
+        int32_t bytes) {
+    // frozen widths can only be extended by concurrent metrics
+    if (m->metrics->concurrent) {
+        return m->metrics->advance(m->metrics, m->fm, u, bytes);
+    } else {
+        m->missed = true;
+        return m->fm->em.w;
+    }
+}
+
+static int32_t ui_edit_advance(ui_edit_measure_t* m, const uint8_t* u,
+        int32_t bytes) {
+    // advance width of the single glyph u[bytes] measured once per font
+    ui_edit_widths_t* w = m->widths;
+    int32_t a = -1;
+    if (bytes == 1 && u[0] < 0x80) {
+        a = w->ascii[u[0]];
+        if (a < 0 && m->frozen) {
+            a = ui_edit_measure_miss(m, u, 1);
+        } else if (a < 0) {
+            a = m->metrics->advance(m->metrics, m->fm, u, 1);
+            w->ascii[u[0]] = a;
+        }
+    } else {
+        assert(1 <= bytes && bytes <= 4);
+        uint32_t glyph = 0;
+        memcpy(&glyph, u, (size_t)bytes); // != 0: u[0] >= 0x80
+        if (!m->frozen && w->count * 4 >= w->capacity * 3) {
+            bool ok = ui_edit_widths_grow(w);
+            swear(ok, "out of memory - cannot continue");
+        }
+        ui_edit_width_t* x = w->capacity == 0 ?
+            null : ui_edit_widths_slot(w, glyph);
+        if (x != null && x->glyph != 0) {
+            a = x->width;
+        } else if (m->frozen) {
+            a = ui_edit_measure_miss(m, u, bytes);
+        } else {
+            x->glyph = glyph;
+            x->width = m->metrics->advance(m->metrics, m->fm, u, bytes);
+            w->count++;
+            a = x->width;
+        }
+    }
+    return a;
+}
+
+static int32_t ui_edit_glyph_bytes(const uint8_t* s, int32_t n) {
+    const int32_t b = ui_edit_str.utf8bytes(s, n);
+    return b > 0 ? b : 1; // invalid utf8 byte is measured on its own
+}
+
+static int32_t ui_edit_ascii_span(ui_edit_measure_t* m, const uint8_t* s,
+        int32_t n) {
+    // number of leading printable ASCII glyphs of monospaced font or 0
+    int32_t i = 0;
+    if (m->widths->cell > 0) {
+        while (i < n && 0x20 <= s[i] && s[i] < 0x7F) { i++; }
+    }
+    return i;
+}
+
+static int32_t ui_edit_measure_width(ui_edit_measure_t* m,
+        const uint8_t* s, int32_t n) {
+    // sum of the cached advances of the glyphs
+    int32_t x = 0;
+    int32_t i = 0;
+    while (i < n) {
+        const int32_t span = ui_edit_ascii_span(m, s + i, n - i);
+        if (span > 0) {
+            x += span * m->widths->cell;
+            i += span;
+        } else {
+            const int32_t b = ui_edit_glyph_bytes(s + i, n - i);
+            x += ui_edit_advance(m, s + i, b);
+            i += b;
+        }
+    }
     return x;
 }
 
-static int32_t ui_edit_word_break_at(ui_edit_t* e, int32_t pn, int32_t rn,
+static int32_t ui_edit_text_width(ui_edit_t* e, const uint8_t* s, int32_t n) {
+    ui_edit_measure_t m = ui_edit_measure_of(e);
+    return ui_edit_measure_width(&m, s, n);
+}
+
+static int32_t ui_edit_measure_break(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t gp, int32_t bp,
         const int32_t width, bool allow_zero) {
-    // TODO: in sqlite.c 156,000 LoC it takes 11 seconds to get all runs()
-    //       on average ui_edit_word_break_at() takes 4 x ui_edit_text_width()
-    //       measurements and they are slow. If we can reduce this amount
-    //       (not clear how) at least 2 times it will be a win.
-    //       Another way is background thread runs() processing but this is
-    //       involving a lot of complexity.
-    //       MSVC devend() edits sqlite3.c w/o any visible delays
-    int32_t count = 0; // stats logging
-    int32_t chars = 0;
-    ui_edit_text_t* dt = &e->doc->text; // document text
-    assert(0 <= pn && pn < dt->np);
-    ui_edit_paragraph_t* p = &e->para[pn];
-    const ui_edit_str_t* str = &dt->ps[pn];
+    // returns the smallest number of glyphs k such that k + 1 glyphs from
+    // gp (bp in bytes) are at least `width` wide (or all glyphs)
+    // accumulating cached advances in a single pass
     int32_t k = 1; // at least 1 glyph
-    // offsets inside a run in glyphs and bytes from start of the paragraph:
-    int32_t gp = p->run[rn].gp;
-    int32_t bp = p->run[rn].bp;
     if (gp < str->g - 1) {
-        const uint8_t* text = str->u + bp;
         const int32_t glyphs_in_this_run = str->g - gp;
-        int32_t* g2b = &str->g2b[gp];
-        // 4 is maximum number of bytes in a UTF-8 sequence
-        int32_t gc = ut_min(4, glyphs_in_this_run);
-        int32_t w = ui_edit_text_width(e, text, g2b[gc] - bp);
-        count++;
-        chars += g2b[gc] - bp;
-        while (gc < glyphs_in_this_run && w < width) {
-            gc = ut_min(gc * 4, glyphs_in_this_run);
-            w = ui_edit_text_width(e, text, g2b[gc] - bp);
-            count++;
-            chars += g2b[gc] - bp;
-        }
-        if (w < width) {
-            k = gc;
-            assert(1 <= k && k <= str->g - gp);
-        } else {
-            int32_t i = 0;
-            int32_t j = gc;
-            k = (i + j) / 2;
-            while (i < j) {
-                assert(allow_zero || 1 <= k && k < gc + 1);
-                const int32_t n = g2b[k + 1] - bp;
-                int32_t px = ui_edit_text_width(e, text, n);
-                count++;
-                chars += n;
-                if (px == width) { break; }
-                if (px < width) { i = k + 1; } else { j = k; }
-                if (!allow_zero && (i + j) / 2 == 0) { break; }
-                k = (i + j) / 2;
-                assert(allow_zero || 1 <= k && k <= str->g - gp);
+        int32_t x = 0;
+        int32_t b = bp;
+        k = 0;
+        while (k < glyphs_in_this_run) {
+            const uint8_t* u = str->u + b;
+            // i + 1 glyphs of a span reach the width, no need to scan
+            // the rest of a multi-megabyte line beyond them:
+            const int32_t c = m->widths->cell;
+            const int32_t i = c == 0 || width - x <= c ?
+                0 : (width - x + c - 1) / c - 1;
+            const int32_t span = ui_edit_ascii_span(m, u,
+                ut_min(ut_min(glyphs_in_this_run - k, str->b - b), i + 1));
+            if (span > 0) {
+                if (i < span) { k += i; break; }
+                x += span * c;
+                b += span;
+                k += span;
+            } else {
+                const int32_t n = ui_edit_glyph_bytes(u, str->b - b);
+                x += ui_edit_advance(m, u, n);
+                if (x >= width) { break; }
+                b += n;
+                k++;
             }
         }
+        if (!allow_zero && k == 0) { k = 1; }
     }
-    assert(allow_zero || 1 <= k && k <= str->g - gp);
+    assert(allow_zero || (1 <= k && k <= str->g - gp));
     return k;
 }
 
-static int32_t ui_edit_word_break(ui_edit_t* e, int32_t pn, int32_t rn) {
-    return ui_edit_word_break_at(e, pn, rn, e->w, false);
+static int32_t ui_edit_word_break_at(ui_edit_t* e, int32_t pn, int32_t rn,
+        const int32_t width, bool allow_zero) {
+    ui_edit_text_t* dt = &e->doc->text; // document text
+    assert(0 <= pn && pn < dt->np);
+    int32_t runs = 0;
+    const ui_edit_run_t* run = ui_edit_paragraph_runs(e, pn, &runs);
+    assert(0 <= rn && rn < runs);
+    const ui_edit_str_t* str = ui_edit_text.ps(dt, pn);
+    ui_edit_measure_t m = ui_edit_measure_of(e);
+    // offsets inside a run in glyphs and bytes from start of the paragraph:
+    return ui_edit_measure_break(&m, str, run[rn].gp, run[rn].bp,
+                                 width, allow_zero);
 }
 
 static int32_t ui_edit_glyph_at_x(ui_edit_t* e, int32_t pn, int32_t rn,
         int32_t x) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pn && pn < dt->np);
-    if (x == 0 || dt->ps[pn].b == 0) {
+    if (x == 0 || ui_edit_text.ps(dt, pn)->b == 0) {
         return 0;
     } else {
         return ui_edit_word_break_at(e, pn, rn, x + 1, true);
@@ -142,10 +301,10 @@ static ui_edit_glyph_t ui_edit_glyph_at(ui_edit_t* e, ui_edit_pg_t p) {
         assert(p.gp == 0); // last empty paragraph
     } else {
         assert(0 <= p.pn && p.pn < dt->np);
-        const ui_edit_str_t* str = &dt->ps[p.pn];
+        const ui_edit_str_t* str = ui_edit_text.ps(dt, p.pn);
         const int32_t bytes = str->b;
         const uint8_t* s = str->u;
-        const int32_t bp = str->g2b[p.gp];
+        const int32_t bp = ui_edit_str.g2b(str, p.gp);
         if (bp < bytes) {
             g.s = s + bp;
             g.bytes = ui_edit_str.utf8bytes(g.s, bytes - bp);
@@ -155,11 +314,216 @@ static ui_edit_glyph_t ui_edit_glyph_at(ui_edit_t* e, ui_edit_pg_t p) {
     return g;
 }
 
-// paragraph_runs() breaks paragraph into `runs` according to `width`
+// measure_runs() breaks paragraph into `runs` according to `width`
+
+static ui_edit_run_t* ui_edit_measure_runs(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t width, int32_t* runs) {
+    // runs[] grows as needed: one run for a paragraph that fits
+    // and not str->b + 1 runs for multi-megabyte single lines
+    int32_t max_runs = 1;
+    ui_edit_run_t* run = null;
+    bool ok = ut_heap.alloc((void**)&run, max_runs *
+                            sizeof(ui_edit_run_t)) == 0;
+    swear(ok);
+    run[0].bp = 0;
+    run[0].gp = 0;
+    int32_t gc = str->b == 0 ? 0 :
+        ui_edit_measure_break(m, str, 0, 0, width, false);
+    if (gc == str->g) { // whole paragraph fits into width
+        *runs = 1;
+        run[0].bytes  = str->b;
+        run[0].glyphs = str->g;
+        int32_t pixels = ui_edit_measure_width(m, str->u, ui_edit_str.g2b(str, gc));
+        run[0].pixels = pixels;
+    } else {
+        assert(gc < str->g);
+        int32_t rc = 0; // runs count
+        int32_t ix = 0; // glyph index from to start of paragraph
+        const uint8_t* text = str->u;
+        int32_t bytes = str->b;
+        while (bytes > 0) {
+            if (rc == max_runs) {
+                max_runs = max_runs < 16 ? 16 : max_runs * 2;
+                ok = ut_heap.realloc((void**)&run, max_runs *
+                                     sizeof(ui_edit_run_t)) == 0;
+                swear(ok);
+            }
+            assert(rc < max_runs);
+            run[rc].bp = (int32_t)(text - str->u);
+            run[rc].gp = ix;
+            int32_t glyphs = ui_edit_measure_break(m, str, ix, run[rc].bp,
+                                                   width, false);
+            int32_t utf8bytes = ui_edit_str.g2b(str, ix + glyphs) - run[rc].bp;
+            int32_t pixels = ui_edit_measure_width(m, text, utf8bytes);
+            if (glyphs > 1 && utf8bytes < bytes && text[utf8bytes - 1] != 0x20) {
+                // try to find word break SPACE character. utf8 space is 0x20
+                int32_t i = utf8bytes;
+                while (i > 0 && text[i - 1] != 0x20) { i--; }
+                if (i > 0 && i != utf8bytes) {
+                    utf8bytes = i;
+                    glyphs = ui_edit_str.glyphs(text, utf8bytes);
+                    assert(glyphs >= 0);
+                    pixels = ui_edit_measure_width(m, text, utf8bytes);
+                }
+            }
+            run[rc].bytes  = utf8bytes;
+            run[rc].glyphs = glyphs;
+            run[rc].pixels = pixels;
+            rc++;
+            text += utf8bytes;
+            assert(0 <= utf8bytes && utf8bytes <= bytes);
+            bytes -= utf8bytes;
+            ix += glyphs;
+        }
+        assert(rc > 0);
+        *runs = rc; // truncate heap capacity array:
+        ok = ut_heap.realloc((void**)&run, rc * sizeof(ui_edit_run_t)) == 0;
+        swear(ok);
+    }
+    return run;
+}
+
+// Runs cache: run[] arrays are kept only for the most recently used
+// paragraphs (see notes on .mru) in a double linked list threaded
+// through para[].prev and para[].next by paragraph numbers.
+
+enum { ui_edit_runs_cache = 4 * 1024 }; // paragraphs with run[]
+
+static void ui_edit_cache_unlink(ui_edit_t* e, int32_t pn) {
+    ui_edit_paragraph_t* p = &e->para[pn];
+    assert(p->run != null && e->cached > 0);
+    if (p->prev >= 0) { e->para[p->prev].next = p->next; } else { e->mru = p->next; }
+    if (p->next >= 0) { e->para[p->next].prev = p->prev; } else { e->lru = p->prev; }
+    p->prev = -1;
+    p->next = -1;
+    e->cached--;
+}
+
+static void ui_edit_cache_link(ui_edit_t* e, int32_t pn) { // as mru
+    ui_edit_paragraph_t* p = &e->para[pn];
+    assert(p->run != null);
+    p->prev = -1;
+    p->next = e->mru;
+    if (e->mru >= 0) { e->para[e->mru].prev = pn; } else { e->lru = pn; }
+    e->mru = pn;
+    e->cached++;
+}
+
+static void ui_edit_cache_renumber(ui_edit_t* e, int32_t p, int32_t d) {
+    // paragraphs after `p` moved by `d` after insert (d > 0) or delete
+    // (d < 0) of paragraphs, deleted paragraphs are already unlinked
+    if (e->mru > p) { e->mru += d; }
+    if (e->lru > p) { e->lru += d; }
+    for (int32_t i = e->mru; i >= 0; i = e->para[i].next) {
+        ui_edit_paragraph_t* q = &e->para[i];
+        if (q->prev > p) { q->prev += d; }
+        if (q->next > p) { q->next += d; }
+    }
+}
+
+static void ui_edit_drop_runs(ui_edit_t* e, int32_t pn) {
+    // frees run[] and tokens but keeps .runs count and lexer states
+    ui_edit_paragraph_t* p = &e->para[pn];
+    if (p->run != null) {
+        ui_edit_cache_unlink(e, pn);
+        ut_heap.free(p->run);
+        p->run = null;
+    }
+    // tokens are re-lexed from the kept .start state on demand:
+    if (p->token != null) {
+        ut_heap.free(p->token);
+        p->token = null;
+        p->tokens = 0;
+    }
+}
+
+// Run index: Fenwick tree of para[].runs (see notes on .run_index).
+// Paragraphs that are not laid out count as zero runs and the index
+// keeps the number of laid out paragraphs next to the sums to tell
+// whether a range of paragraphs can be counted without laying it out.
+
+static bool ui_edit_run_index_build(ui_edit_t* e) {
+    // O(np) and only when the index is stale
+    ui_edit_run_index_t* x = &e->run_index;
+    const int32_t np = e->doc->text.np;
+    if (x->np != np) {
+        x->np = 0;
+        const int64_t bytes = (np + 1) * (int64_t)sizeof(x->sum[0]);
+        if (ut_heap.realloc((void**)&x->sum, bytes) == 0) {
+            x->sum[0] = (ui_edit_run_sums_t){ .runs = 0, .laid = 0 };
+            for (int32_t i = 1; i <= np; i++) {
+                x->sum[i].runs = e->para[i - 1].runs;
+                x->sum[i].laid = e->para[i - 1].runs > 0;
+            }
+            for (int32_t i = 1; i <= np; i++) { // in place bottom up
+                const int32_t j = i + (i & -i);
+                if (j <= np) {
+                    x->sum[j].runs += x->sum[i].runs;
+                    x->sum[j].laid += x->sum[i].laid;
+                }
+            }
+            x->np = np;
+        }
+    }
+    return x->np == np;
+}
+
+static void ui_edit_run_index_update(ui_edit_t* e, int32_t pn, int32_t runs,
+        int32_t laid) {
+    ui_edit_run_index_t* x = &e->run_index;
+    if (x->np > 0) { // stale index is rebuilt on demand
+        assert(0 <= pn && pn < x->np);
+        for (int32_t i = pn + 1; i <= x->np; i += i & -i) {
+            x->sum[i].runs += runs;
+            x->sum[i].laid += laid;
+        }
+    }
+}
+
+static ui_edit_run_sums_t ui_edit_run_index_prefix(const ui_edit_run_index_t* x,
+        int32_t pn) { // sums of para[0..pn - 1]
+    assert(0 <= pn && pn <= x->np);
+    ui_edit_run_sums_t s = { .runs = 0, .laid = 0 };
+    for (int32_t i = pn; i > 0; i -= i & -i) {
+        s.runs += x->sum[i].runs;
+        s.laid += x->sum[i].laid;
+    }
+    return s;
+}
+
+static bool ui_edit_run_index_runs(ui_edit_t* e, int32_t f, int32_t t,
+        int32_t* runs) {
+    // true if all paragraphs [f..t - 1] are laid out, *runs is their runs
+    assert(0 <= f && f <= t && t <= e->doc->text.np);
+    bool ok = ui_edit_run_index_build(e);
+    if (ok) {
+        const ui_edit_run_sums_t s0 = ui_edit_run_index_prefix(&e->run_index, f);
+        const ui_edit_run_sums_t s1 = ui_edit_run_index_prefix(&e->run_index, t);
+        ok = s1.laid - s0.laid == t - f;
+        if (ok) { *runs = s1.runs - s0.runs; }
+    }
+    return ok;
+}
+
+static ui_edit_pr_t ui_edit_run_index_find(const ui_edit_run_index_t* x, int32_t r) {
+    // paragraph and run of the r-th run of laid out paragraphs
+    assert(x->np > 0 && 0 <= r && r < ui_edit_run_index_prefix(x, x->np).runs);
+    int32_t pn = 0;
+    int32_t step = 1;
+    while (step <= x->np / 2) { step <<= 1; }
+    while (step > 0) {
+        if (pn + step <= x->np && x->sum[pn + step].runs <= r) {
+            pn += step;
+            r -= x->sum[pn].runs;
+        }
+        step >>= 1;
+    }
+    assert(pn < x->np);
+    return (ui_edit_pr_t){ .pn = pn, .rn = r };
+}
 
 static const ui_edit_run_t* ui_edit_paragraph_runs(ui_edit_t* e, int32_t pn,
         int32_t* runs) {
-//  fp64_t time = ut_clock.seconds();
     assert(e->view.w > 0);
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pn && pn < dt->np);
@@ -168,67 +532,24 @@ static const ui_edit_run_t* ui_edit_paragraph_runs(ui_edit_t* e, int32_t pn,
         static const ui_edit_run_t eof_run = { 0 };
         *runs = 1;
         r = &eof_run;
-    } else if (e->para[pn].run != null) {
-        *runs = e->para[pn].runs;
-        r = e->para[pn].run;
     } else {
-        assert(0 <= pn && pn < dt->np);
         ui_edit_paragraph_t* p = &e->para[pn];
-        const ui_edit_str_t* str = &dt->ps[pn];
         if (p->run == null) {
-            assert(p->runs == 0 && p->run == null);
-            const int32_t max_runs = str->b + 1;
-            bool ok = ut_heap.alloc((void**)&p->run, max_runs *
-                                    sizeof(ui_edit_run_t)) == 0;
-            swear(ok);
-            ui_edit_run_t* run = p->run;
-            run[0].bp = 0;
-            run[0].gp = 0;
-            int32_t gc = str->b == 0 ? 0 : ui_edit_word_break(e, pn, 0);
-            if (gc == str->g) { // whole paragraph fits into width
-                p->runs = 1;
-                run[0].bytes  = str->b;
-                run[0].glyphs = str->g;
-                int32_t pixels = ui_edit_text_width(e, str->u, str->g2b[gc]);
-                run[0].pixels = pixels;
-            } else {
-                assert(gc < str->g);
-                int32_t rc = 0; // runs count
-                int32_t ix = 0; // glyph index from to start of paragraph
-                const uint8_t* text = str->u;
-                int32_t bytes = str->b;
-                while (bytes > 0) {
-                    assert(rc < max_runs);
-                    run[rc].bp = (int32_t)(text - str->u);
-                    run[rc].gp = ix;
-                    int32_t glyphs = ui_edit_word_break(e, pn, rc);
-                    int32_t utf8bytes = str->g2b[ix + glyphs] - run[rc].bp;
-                    int32_t pixels = ui_edit_text_width(e, text, utf8bytes);
-                    if (glyphs > 1 && utf8bytes < bytes && text[utf8bytes - 1] != 0x20) {
-                        // try to find word break SPACE character. utf8 space is 0x20
-                        int32_t i = utf8bytes;
-                        while (i > 0 && text[i - 1] != 0x20) { i--; }
-                        if (i > 0 && i != utf8bytes) {
-                            utf8bytes = i;
-                            glyphs = ui_edit_str.glyphs(text, utf8bytes);
-                            assert(glyphs >= 0);
-                            pixels = ui_edit_text_width(e, text, utf8bytes);
-                        }
-                    }
-                    run[rc].bytes  = utf8bytes;
-                    run[rc].glyphs = glyphs;
-                    run[rc].pixels = pixels;
-                    rc++;
-                    text += utf8bytes;
-                    assert(0 <= utf8bytes && utf8bytes <= bytes);
-                    bytes -= utf8bytes;
-                    ix += glyphs;
-                }
-                assert(rc > 0);
-                p->runs = rc; // truncate heap capacity array:
-                ok = ut_heap.realloc((void**)&p->run, rc * sizeof(ui_edit_run_t)) == 0;
-                swear(ok);
+            ui_edit_measure_t m = ui_edit_measure_of(e);
+            int32_t n = 0;
+            p->run = ui_edit_measure_runs(&m, ui_edit_text.ps(dt, pn),
+                                          e->w, &n);
+            // evicted or counted in background: .runs is already known
+            assert(p->runs == 0 || p->runs == n);
+            ui_edit_run_index_update(e, pn, n - p->runs, p->runs == 0);
+            p->runs = n;
+            ui_edit_cache_link(e, pn);
+            while (e->cached > ui_edit_runs_cache) {
+                ui_edit_drop_runs(e, e->lru);
             }
+        } else if (e->mru != pn) {
+            ui_edit_cache_unlink(e, pn);
+            ui_edit_cache_link(e, pn);
         }
         *runs = p->runs;
         r = p->run;
@@ -242,7 +563,8 @@ static int32_t ui_edit_paragraph_run_count(ui_edit_t* e, int32_t pn) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     int32_t runs = 0;
     if (e->view.w > 0 && 0 <= pn && pn < dt->np) {
-        (void)ui_edit_paragraph_runs(e, pn, &runs);
+        runs = e->para[pn].runs; // known for evicted paragraphs
+        if (runs == 0) { (void)ui_edit_paragraph_runs(e, pn, &runs); }
     }
     return runs;
 }
@@ -251,7 +573,7 @@ static int32_t ui_edit_glyphs_in_paragraph(ui_edit_t* e, int32_t pn) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pn && pn < dt->np);
     (void)ui_edit_paragraph_run_count(e, pn); // word break into runs
-    return dt->ps[pn].g;
+    return ui_edit_text.ps(dt, pn)->g;
 }
 
 static void ui_edit_create_caret(ui_edit_t* e) {
@@ -304,16 +626,16 @@ static void ui_edit_allocate_runs(ui_edit_t* e) {
     bool done = ut_heap.alloc_zero((void**)&e->para,
                 dt->np * sizeof(e->para[0])) == 0;
     swear(done, "out of memory - cannot continue");
+    e->mru = -1;
+    e->lru = -1;
+    e->cached = 0;
 }
 
 static void ui_edit_invalidate_run(ui_edit_t* e, int32_t i) {
-    if (e->para[i].run != null) {
-        assert(e->para[i].runs > 0);
-        ut_heap.free(e->para[i].run);
-        e->para[i].run = null;
+    ui_edit_drop_runs(e, i);
+    if (e->para[i].runs > 0) {
+        ui_edit_run_index_update(e, i, -e->para[i].runs, -1);
         e->para[i].runs = 0;
-    } else {
-        assert(e->para[i].runs == 0);
     }
 }
 
@@ -325,14 +647,22 @@ static void ui_edit_invalidate_runs(ui_edit_t* e, int32_t f, int32_t t,
 
 static void ui_edit_invalidate_all_runs(ui_edit_t* e) {
     ui_edit_text_t* dt = &e->doc->text; // document text
+    e->run_index.np = 0; // cheaper to rebuild than to update
     ui_edit_invalidate_runs(e, 0, dt->np - 1, dt->np);
+    e->generation++;
+    e->relayout = true; // see ui_edit_background()
 }
 
 static void ui_edit_dispose_runs(ui_edit_t* e, int32_t np) {
     assert(e->para != null);
+    e->run_index.np = 0;
     ui_edit_invalidate_runs(e, 0, np - 1, np);
     ut_heap.free(e->para);
     e->para = null;
+    if (e->run_index.sum != null) {
+        ut_heap.free(e->run_index.sum);
+        e->run_index.sum = null;
+    }
 }
 
 static void ui_edit_dispose_all_runs(ui_edit_t* e) {
@@ -367,7 +697,7 @@ static void ui_edit_set_font(ui_edit_t* e, ui_fm_t* f) {
 static ui_edit_pr_t ui_edit_pg_to_pr(ui_edit_t* e, const ui_edit_pg_t pg) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pg.pn && pg.pn < dt->np);
-    const ui_edit_str_t* str = &dt->ps[pg.pn];
+    const ui_edit_str_t* str = ui_edit_text.ps(dt, pg.pn);
     ui_edit_pr_t pr = { .pn = pg.pn, .rn = -1 };
     if (pg.pn == dt->np || str->b == 0) { // last or empty
         assert(pg.gp == 0);
@@ -395,7 +725,10 @@ static ui_edit_pr_t ui_edit_pg_to_pr(ui_edit_t* e, const ui_edit_pg_t pg) {
 }
 
 static int32_t ui_edit_runs_between(ui_edit_t* e, const ui_edit_pg_t pg0,
-        const ui_edit_pg_t pg1) {
+        const ui_edit_pg_t pg1, int32_t limit) {
+    // O(log n) when all paragraphs in between are laid out, otherwise
+    // counts runs only until there are more than `limit` of them
+    // thus at most O(limit) paragraphs are laid out synchronously
     assert(ui_edit_range.uint64(pg0) <= ui_edit_range.uint64(pg1));
     int32_t rn0 = ui_edit_pg_to_pr(e, pg0).rn;
     int32_t rn1 = ui_edit_pg_to_pr(e, pg1).rn;
@@ -403,9 +736,11 @@ static int32_t ui_edit_runs_between(ui_edit_t* e, const ui_edit_pg_t pg0,
     if (pg0.pn == pg1.pn) {
         assert(rn0 <= rn1);
         rc = rn1 - rn0;
+    } else if (ui_edit_run_index_runs(e, pg0.pn, pg1.pn, &rc)) {
+        rc += rn1 - rn0;
     } else {
         assert(pg0.pn < pg1.pn);
-        for (int32_t i = pg0.pn; i < pg1.pn; i++) {
+        for (int32_t i = pg0.pn; i < pg1.pn && rc <= limit; i++) {
             const int32_t runs = ui_edit_paragraph_run_count(e, i);
             if (i == pg0.pn) {
                 rc += runs - rn0;
@@ -435,9 +770,16 @@ static int32_t ui_edit_first_visible_run(ui_edit_t* e, int32_t pn) {
 static ui_point_t ui_edit_pg_to_xy(ui_edit_t* e, const ui_edit_pg_t pg) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     ui_point_t pt = { .x = -1, .y = 0 };
-    for (int32_t i = e->scroll.pn; i < dt->np && pt.x < 0; i++) {
+    int32_t pn = e->scroll.pn;
+    int32_t above = 0; // runs from the scroll position to pg.pn
+    if (pn < pg.pn && pg.pn < dt->np &&
+        ui_edit_run_index_runs(e, pn, pg.pn, &above)) {
+        pt.y = (above - e->scroll.rn) * e->view.fm->height;
+        pn = pg.pn;
+    }
+    for (int32_t i = pn; i < dt->np && pt.x < 0; i++) {
         assert(0 <= i && i < dt->np);
-        const ui_edit_str_t* str = &dt->ps[i];
+        const ui_edit_str_t* str = ui_edit_text.ps(dt, i);
         int32_t runs = 0;
         const ui_edit_run_t* run = ui_edit_paragraph_runs(e, i, &runs);
         for (int32_t j = ui_edit_first_visible_run(e, i); j < runs; j++) {
@@ -469,7 +811,7 @@ static ui_point_t ui_edit_pg_to_xy(ui_edit_t* e, const ui_edit_pg_t pg) {
 static int32_t ui_edit_glyph_width_px(ui_edit_t* e, const ui_edit_pg_t pg) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pg.pn && pg.pn < dt->np);
-    const ui_edit_str_t* str = &dt->ps[pg.pn];
+    const ui_edit_str_t* str = ui_edit_text.ps(dt, pg.pn);
     const uint8_t* text = str->u;
     int32_t gc = str->g;
     if (pg.gp == 0 &&  gc == 0) {
@@ -496,7 +838,7 @@ static ui_edit_pg_t ui_edit_xy_to_pg(ui_edit_t* e, int32_t x, int32_t y) {
     int32_t py = 0; // paragraph `y' coordinate
     for (int32_t i = e->scroll.pn; i < dt->np && pg.pn < 0; i++) {
         assert(0 <= i && i < dt->np);
-        const ui_edit_str_t* str = &dt->ps[i];
+        const ui_edit_str_t* str = ui_edit_text.ps(dt, i);
         int32_t runs = 0;
         const ui_edit_run_t* run = ui_edit_paragraph_runs(e, i, &runs);
         for (int32_t j = ui_edit_first_visible_run(e, i); j < runs && pg.pn < 0; j++) {
@@ -566,19 +908,269 @@ static void ui_edit_paint_selection(ui_edit_t* e, int32_t y, const ui_edit_run_t
     }
 }
 
+// ui_edit_lexer_c: paragraph ends in code state unless it ends inside
+// of "/* comment" or inside of "string" or 'c' continued by backslash
+
+enum {
+    ui_edit_lexer_c_code      = 0,
+    ui_edit_lexer_c_comment   = 1,
+    ui_edit_lexer_c_string    = 2,
+    ui_edit_lexer_c_character = 3
+};
+
+static const char* ui_edit_lexer_c_keywords[] = { // sorted for bsearch()
+    "NULL", "auto", "bool", "break", "case", "catch", "char", "class",
+    "const", "constexpr", "continue", "default", "delete", "do", "double",
+    "else", "enum", "extern", "false", "float", "for", "goto", "if",
+    "inline", "int", "long", "namespace", "new", "null", "nullptr",
+    "private", "protected", "public", "register", "restrict", "return",
+    "short", "signed", "sizeof", "static", "static_assert", "struct",
+    "switch", "template", "this", "throw", "true", "try", "typedef",
+    "typename", "union", "unsigned", "using", "virtual", "void",
+    "volatile", "while"
+};
+
+typedef struct ui_edit_lexer_word_s {
+    const uint8_t* u;
+    int32_t b;
+} ui_edit_lexer_word_t;
+
+static int ui_edit_lexer_c_compare(const void* key, const void* keyword) {
+    const ui_edit_lexer_word_t* w = (const ui_edit_lexer_word_t*)key;
+    const char* k = *(const char**)keyword;
+    const int32_t n = (int32_t)strlen(k);
+    const int r = memcmp(w->u, k, (size_t)ut_min(w->b, n));
+    return r != 0 ? r : w->b - n;
+}
+
+static bool ui_edit_lexer_c_keyword(const uint8_t* u, int32_t b) {
+    const ui_edit_lexer_word_t w = { .u = u, .b = b };
+    return bsearch(&w, ui_edit_lexer_c_keywords,
+                   countof(ui_edit_lexer_c_keywords),
+                   sizeof(ui_edit_lexer_c_keywords[0]),
+                   ui_edit_lexer_c_compare) != null;
+}
+
+static void ui_edit_lexer_emit(ui_edit_token_t* tokens, int32_t* count,
+        int32_t bp, int32_t kind) {
+    // adjacent tokens of the same kind are merged
+    if (tokens != null && (*count == 0 || tokens[*count - 1].kind != kind)) {
+        tokens[*count] = (ui_edit_token_t){ .bp = bp, .kind = kind };
+        (*count)++;
+    }
+}
+
+static int32_t ui_edit_lexer_c_quoted(const uint8_t* u, int32_t b,
+        int32_t i, uint8_t q, uint32_t* state) {
+    // returns position after the closing quote or b, *state is
+    // string or character if paragraph ends with continuation '\\'
+    *state = ui_edit_lexer_c_code;
+    while (i < b && u[i] != q) {
+        if (u[i] == '\\' && i + 1 == b) {
+            *state = q == '"' ? ui_edit_lexer_c_string :
+                                ui_edit_lexer_c_character;
+        }
+        i += u[i] == '\\' && i + 1 < b ? 2 : 1;
+    }
+    return i < b ? i + 1 : b;
+}
+
+static int32_t ui_edit_lexer_c_comment_end(const uint8_t* u, int32_t b,
+        int32_t i, uint32_t* state) {
+    while (i < b - 1 && !(u[i] == '*' && u[i + 1] == '/')) { i++; }
+    *state = i < b - 1 ? ui_edit_lexer_c_code : ui_edit_lexer_c_comment;
+    return i < b - 1 ? i + 2 : b;
+}
+
+static bool ui_edit_lexer_c_ident(uint8_t c) {
+    // utf8 sequences are parts of identifiers thus tokens never
+    // split a glyph
+    return c == '_' || c >= 0x80 || ('a' <= c && c <= 'z') ||
+           ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9');
+}
+
+static uint32_t ui_edit_lexer_c_lex(ui_edit_lexer_t* unused(x),
+        uint32_t state, const uint8_t* u, int32_t b,
+        ui_edit_token_t* tokens, int32_t* count) {
+    if (tokens != null) { *count = 0; }
+    int32_t i = 0;
+    if (state == ui_edit_lexer_c_comment) {
+        ui_edit_lexer_emit(tokens, count, 0, ui_edit_token_comment);
+        i = ui_edit_lexer_c_comment_end(u, b, 0, &state);
+    } else if (state == ui_edit_lexer_c_string ||
+               state == ui_edit_lexer_c_character) {
+        ui_edit_lexer_emit(tokens, count, 0, ui_edit_token_string);
+        const uint8_t q = state == ui_edit_lexer_c_string ? '"' : '\'';
+        i = ui_edit_lexer_c_quoted(u, b, 0, q, &state);
+    }
+    bool first = true; // no tokens but spaces on the line so far
+    while (i < b) {
+        const uint8_t c = u[i];
+        const uint8_t n = i + 1 < b ? u[i + 1] : 0x00;
+        const int32_t bp = i;
+        int32_t kind = ui_edit_token_text;
+        if (c == ' ' || c == '\t') {
+            i++;
+        } else if (c == '/' && n == '/') {
+            kind = ui_edit_token_comment;
+            i = b;
+        } else if (c == '/' && n == '*') {
+            kind = ui_edit_token_comment;
+            i = ui_edit_lexer_c_comment_end(u, b, i + 2, &state);
+        } else if (c == '"' || c == '\'') {
+            kind = ui_edit_token_string;
+            i = ui_edit_lexer_c_quoted(u, b, i + 1, c, &state);
+        } else if (('0' <= c && c <= '9') ||
+                   (c == '.' && '0' <= n && n <= '9')) {
+            kind = ui_edit_token_number;
+            i++;
+            while (i < b && (ui_edit_lexer_c_ident(u[i]) || u[i] == '.' ||
+                   ((u[i] == '+' || u[i] == '-') &&
+                    strchr("eEpP", u[i - 1]) != null))) {
+                i++;
+            }
+        } else if (c == '#' && first) {
+            kind = ui_edit_token_preprocessor;
+            i++;
+            while (i < b && (u[i] == ' ' || u[i] == '\t')) { i++; }
+            while (i < b && ui_edit_lexer_c_ident(u[i])) { i++; }
+        } else if (ui_edit_lexer_c_ident(c)) {
+            while (i < b && ui_edit_lexer_c_ident(u[i])) { i++; }
+            if (ui_edit_lexer_c_keyword(u + bp, i - bp)) {
+                kind = ui_edit_token_keyword;
+            }
+        } else {
+            kind = ui_edit_token_punctuation;
+            i++;
+        }
+        first = first && (c == ' ' || c == '\t');
+        ui_edit_lexer_emit(tokens, count, bp, kind);
+    }
+    return state;
+}
+
+ui_edit_lexer_t ui_edit_lexer_c = {
+    .lex = ui_edit_lexer_c_lex,
+    .color = { // Visual Studio dark theme:
+        [ui_edit_token_text]         = ui_color_undefined,
+        [ui_edit_token_keyword]      = ui_color_rgb(0x56, 0x9C, 0xD6),
+        [ui_edit_token_number]       = ui_color_rgb(0xB5, 0xCE, 0xA8),
+        [ui_edit_token_string]       = ui_color_rgb(0xD6, 0x9D, 0x85),
+        [ui_edit_token_comment]      = ui_color_rgb(0x57, 0xA6, 0x4A),
+        [ui_edit_token_preprocessor] = ui_color_rgb(0x9B, 0x9B, 0x9B),
+        [ui_edit_token_punctuation]  = ui_color_undefined,
+        [7]                          = ui_color_undefined
+    }
+};
+
+static void ui_edit_discard_lexer_states(ui_edit_t* e) {
+    const int32_t np = e->doc->text.np;
+    for (int32_t pn = 0; pn < np; pn++) {
+        ui_edit_paragraph_t* p = &e->para[pn];
+        if (p->token != null) { ut_heap.free(p->token); }
+        p->token = null;
+        p->tokens = 0;
+        p->lexed = false;
+    }
+    e->lexed = 0;
+    e->lexed_by = e->lexer;
+}
+
+static uint32_t ui_edit_lex_state(ui_edit_t* e, int32_t pn) {
+    // lexer state at the start of paragraph pn: lexes paragraphs from
+    // the watermark skipping the ones already lexed from the same state
+    if (e->lexed_by != e->lexer) { ui_edit_discard_lexer_states(e); }
+    ui_edit_text_t* dt = &e->doc->text; // document text
+    while (e->lexed < pn) {
+        const int32_t i = e->lexed;
+        const uint32_t start = i == 0 ? 0 : e->para[i - 1].state;
+        ui_edit_paragraph_t* p = &e->para[i];
+        if (!p->lexed || p->start != start) {
+            const ui_edit_str_t* str = ui_edit_text.ps(dt, i);
+            p->state = e->lexer->lex(e->lexer, start, str->u, str->b,
+                                     null, null);
+            p->start = start;
+            p->lexed = true;
+            if (p->token != null) { ut_heap.free(p->token); }
+            p->token = null;
+            p->tokens = 0;
+        }
+        e->lexed++;
+    }
+    return pn == 0 ? 0 : e->para[pn - 1].state;
+}
+
+static const ui_edit_token_t* ui_edit_paragraph_tokens(ui_edit_t* e,
+        int32_t pn, int32_t* tokens) {
+    const uint32_t start = ui_edit_lex_state(e, pn);
+    ui_edit_paragraph_t* p = &e->para[pn];
+    if (p->token == null || !p->lexed || p->start != start) {
+        const ui_edit_str_t* str = ui_edit_text.ps(&e->doc->text, pn);
+        if (str->b > e->capacity) {
+            bool ok = ut_heap.realloc((void**)&e->tokens,
+                      str->b * sizeof(e->tokens[0])) == 0;
+            swear(ok);
+            e->capacity = str->b;
+        }
+        int32_t n = 0;
+        p->state = e->lexer->lex(e->lexer, start, str->u, str->b,
+                                 e->tokens, &n);
+        p->start = start;
+        p->lexed = true;
+        bool ok = ut_heap.realloc((void**)&p->token,
+                  ut_max(1, n) * sizeof(p->token[0])) == 0;
+        swear(ok);
+        memcpy(p->token, e->tokens, n * sizeof(p->token[0]));
+        p->tokens = n;
+    }
+    *tokens = p->tokens;
+    return p->token;
+}
+
+static int32_t ui_edit_paint_run(ui_edit_t* e, const ui_gdi_ta_t* ta,
+        int32_t x, int32_t y, const ui_edit_str_t* str,
+        const ui_edit_run_t* run, const ui_edit_token_t* token,
+        int32_t tokens, int32_t k) {
+    // paints run in colored spans starting at token[k] that contains
+    // run->bp, returns index of the token that contains the run end
+    const int32_t end = run->bp + run->bytes;
+    int32_t bp = run->bp;
+    while (bp < end) {
+        while (k < tokens - 1 && token[k + 1].bp <= bp) { k++; }
+        const int32_t next = k < tokens - 1 ? token[k + 1].bp : str->b;
+        const int32_t bytes = ut_min(next, end) - bp;
+        assert(0 <= token[k].kind && token[k].kind < ui_edit_token_kinds);
+        ui_gdi_ta_t span = *ta;
+        const ui_color_t c = e->lexer->color[token[k].kind];
+        if (!ui_color_is_undefined(c)) { span.color = c; }
+        ui_gdi.text(&span, x, y, "%.*s", bytes, str->u + bp);
+        x += ui_edit_text_width(e, str->u + bp, bytes);
+        bp += bytes;
+    }
+    return k;
+}
+
 static int32_t ui_edit_paint_paragraph(ui_edit_t* e,
         const ui_gdi_ta_t* ta, int32_t x, int32_t y, int32_t pn) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 <= pn && pn < dt->np);
-    const ui_edit_str_t* str = &dt->ps[pn];
+    int32_t tokens = 0;
+    const ui_edit_token_t* token = e->lexer == null ? null :
+        ui_edit_paragraph_tokens(e, pn, &tokens);
+    const ui_edit_str_t* str = ui_edit_text.ps(dt, pn);
     int32_t runs = 0;
     const ui_edit_run_t* run = ui_edit_paragraph_runs(e, pn, &runs);
+    int32_t k = 0; // token index
     for (int32_t j = ui_edit_first_visible_run(e, pn);
                  j < runs && y < e->view.y + e->inside.bottom; j++) {
         const uint8_t* text = str->u + run[j].bp;
         ui_edit_paint_selection(e, y, &run[j], text, pn,
                                 run[j].gp, run[j].gp + run[j].glyphs);
-        ui_gdi.text(ta, x, y, "%.*s", run[j].bytes, text);
+        if (tokens > 0) {
+            k = ui_edit_paint_run(e, ta, x, y, str, &run[j], token, tokens, k);
+        } else {
+            ui_gdi.text(ta, x, y, "%.*s", run[j].bytes, text);
+        }
         if (j < runs - 1 && !e->hide_word_wrap) {
             ui_gdi.text(ta, x + e->w, y, "%s",
                         ut_glyph_south_west_arrow_with_hook);
@@ -603,13 +1195,36 @@ static void ui_edit_set_caret(ui_edit_t* e, int32_t x, int32_t y) {
 // scroll_up() text moves up (north) in the visible view,
 // scroll position increments moves down (south)
 
+static bool ui_edit_scroll_up_indexed(ui_edit_t* e, int32_t run_count) {
+    // O(log n) when all paragraphs from scroll position down are laid out
+    const int32_t np = e->doc->text.np;
+    int32_t below = 0; // runs from e->scroll.pn to the end of text
+    const bool ok = e->visible_runs > 0 && e->scroll.pn < np &&
+        ui_edit_run_index_runs(e, e->scroll.pn, np, &below);
+    if (ok) {
+        // same as scroll_up() one run at a time until runs_between()
+        // the scroll position and the last run fit into the view:
+        const int32_t between = below - 1 - e->scroll.rn;
+        const int32_t n = ut_min(run_count,
+                                 ut_max(0, between - (e->visible_runs - 1)));
+        if (n > 0) {
+            const int32_t r = ui_edit_run_index_prefix(&e->run_index,
+                                  e->scroll.pn).runs + e->scroll.rn + n;
+            e->scroll = ui_edit_run_index_find(&e->run_index, r);
+        }
+    }
+    return ok;
+}
+
 static void ui_edit_scroll_up(ui_edit_t* e, int32_t run_count) {
     ui_edit_text_t* dt = &e->doc->text; // document text
     assert(0 < run_count, "does it make sense to have 0 scroll?");
     const ui_edit_pg_t end = ui_edit_range.end(dt);
+    if (ui_edit_scroll_up_indexed(e, run_count)) { run_count = 0; }
     while (run_count > 0 && e->scroll.pn < dt->np) {
         ui_edit_pg_t scroll = ui_edit_scroll_pg(e);
-        int32_t between = ui_edit_runs_between(e, scroll, end);
+        int32_t between = ui_edit_runs_between(e, scroll, end,
+                                               e->visible_runs);
         if (between <= e->visible_runs - 1) {
             run_count = 0; // enough
         } else {
@@ -631,8 +1246,26 @@ static void ui_edit_scroll_up(ui_edit_t* e, int32_t run_count) {
 // scroll_dw() text moves down (south) in the visible view,
 // scroll position decrements moves up (north)
 
+static bool ui_edit_scroll_down_indexed(ui_edit_t* e, int32_t run_count) {
+    // O(log n) when all paragraphs from new to old scroll are laid out
+    const int32_t pn = e->scroll.pn;
+    bool ok = pn < e->doc->text.np && e->para[pn].runs > 0 &&
+              ui_edit_run_index_build(e);
+    if (ok) {
+        const int32_t r = ui_edit_run_index_prefix(&e->run_index, pn).runs +
+                          e->scroll.rn - run_count;
+        const ui_edit_pr_t pr = r > 0 ?
+            ui_edit_run_index_find(&e->run_index, r) : (ui_edit_pr_t){ 0, 0 };
+        int32_t runs = 0;
+        ok = ui_edit_run_index_runs(e, pr.pn, pn, &runs);
+        if (ok) { e->scroll = pr; }
+    }
+    return ok;
+}
+
 static void ui_edit_scroll_down(ui_edit_t* e, int32_t run_count) {
     assert(0 < run_count, "does it make sense to have 0 scroll?");
+    if (ui_edit_scroll_down_indexed(e, run_count)) { run_count = 0; }
     while (run_count > 0 && (e->scroll.pn > 0 || e->scroll.rn > 0)) {
         int32_t runs = ui_edit_paragraph_run_count(e, e->scroll.pn);
         e->scroll.rn = ut_min(e->scroll.rn, runs - 1);
@@ -735,8 +1368,8 @@ static ui_edit_pg_t ui_edit_insert_inline(ui_edit_t* e, ui_edit_pg_t pg,
     if (ui_edit_doc.replace(e->doc, &r, text, bytes)) {
         ui_edit_text_t t = {0};
         if (ui_edit_text.init(&t, text, bytes, false)) {
-            assert(t.ps != null && t.np == 1);
-            g = t.np == 1 && t.ps != null ? t.ps[0].g : 0;
+            assert(t.root != null && t.np == 1);
+            g = t.np == 1 && t.root != null ? ui_edit_text.ps(&t, 0)->g : 0;
             ui_edit_text.dispose(&t);
         }
     }
@@ -814,7 +1447,7 @@ static void ui_edit_key_up(ui_edit_t* e) {
     if (to.pn == dt->np) {
         assert(to.gp == 0); // positioned past EOF
         to.pn--;
-        to.gp = dt->ps[to.pn].g;
+        to.gp = ui_edit_text.ps(dt, to.pn)->g;
         ui_edit_scroll_into_view(e, to);
         ui_point_t pt = ui_edit_pg_to_xy(e, to);
         pt.x = 0;
@@ -852,7 +1485,7 @@ static void ui_edit_key_down(ui_edit_t* e) {
     ui_edit_reuse_last_x(e, &pt);
     // scroll runs guaranteed to be already layout for current state of view:
     ui_edit_pg_t scroll = ui_edit_scroll_pg(e);
-    int32_t run_count = ui_edit_runs_between(e, scroll, pg);
+    int32_t run_count = ui_edit_runs_between(e, scroll, pg, e->visible_runs);
     if (!e->sle && run_count >= e->visible_runs - 1) {
         ui_edit_scroll_up(e, 1);
     } else {
@@ -872,14 +1505,14 @@ static void ui_edit_key_home(ui_edit_t* e) {
         e->selection.a[1].gp = 0;
     }
     const int32_t pn = e->selection.a[1].pn;
-    int32_t runs = ui_edit_paragraph_run_count(e, pn);
-    const ui_edit_paragraph_t* para = &e->para[pn];
+    int32_t runs = 0;
+    const ui_edit_run_t* run = ui_edit_paragraph_runs(e, pn, &runs);
     if (runs <= 1) {
         e->selection.a[1].gp = 0;
     } else {
         int32_t rn = ui_edit_pg_to_pr(e, e->selection.a[1]).rn;
         assert(0 <= rn && rn < runs);
-        const int32_t gp = para->run[rn].gp;
+        const int32_t gp = run[rn].gp;
         if (e->selection.a[1].gp != gp) {
             // first Home keystroke moves caret to start of run
             e->selection.a[1].gp = gp;
@@ -917,7 +1550,7 @@ static void ui_edit_key_end(ui_edit_t* e) {
         int32_t pn = e->selection.a[1].pn;
         int32_t gp = e->selection.a[1].gp;
         assert(0 <= pn && pn < dt->np);
-        const ui_edit_str_t* str = &dt->ps[pn];
+        const ui_edit_str_t* str = ui_edit_text.ps(dt, pn);
         int32_t runs = 0;
         const ui_edit_run_t* run = ui_edit_paragraph_runs(e, pn, &runs);
         int32_t rn = ui_edit_pg_to_pr(e, e->selection.a[1]).rn;
@@ -942,7 +1575,7 @@ static void ui_edit_key_page_up(ui_edit_t* e) {
     int32_t n = ut_max(1, e->visible_runs - 1);
     ui_edit_pg_t scr = ui_edit_scroll_pg(e);
     ui_edit_pg_t bof = {.pn = 0, .gp = 0};
-    int32_t m = ui_edit_runs_between(e, bof, scr);
+    int32_t m = ui_edit_runs_between(e, bof, scr, n);
     if (m > n) {
         ui_point_t pt = ui_edit_pg_to_xy(e, e->selection.a[1]);
         ui_edit_pr_t scroll = e->scroll;
@@ -961,7 +1594,7 @@ static void ui_edit_key_page_down(ui_edit_t* e) {
     int32_t n = ut_max(1, e->visible_runs - 1);
     ui_edit_pg_t scr = ui_edit_scroll_pg(e);
     ui_edit_pg_t end = ui_edit_range.end(dt);
-    int32_t m = ui_edit_runs_between(e, scr, end);
+    int32_t m = ui_edit_runs_between(e, scr, end, n);
     if (m > n) {
         ui_point_t pt = ui_edit_pg_to_xy(e, e->selection.a[1]);
         ui_edit_pr_t scroll = e->scroll;
@@ -1554,6 +2187,7 @@ static void ui_edit_paint(ui_view_t* v) {
         }
     }
     ui_gdi.set_clip(0, 0, 0, 0);
+    e->painted = true; // see ui_edit_every_100ms()
 }
 
 static void ui_edit_move(ui_edit_t* e, ui_edit_pg_t pg) {
@@ -1596,15 +2230,19 @@ static bool ui_edit_reallocate_runs(ui_edit_t* e, int32_t p, int32_t np) {
     int32_t new_np = dt->np; // new (after)  number of paragraphs
     assert(old_np > 0 && new_np > 0 && e->para != null);
     assert(0 <= p && p < old_np);
+    // paragraphs are renumbered: the index is rebuilt on the next query
+    if (old_np != new_np) { e->run_index.np = 0; }
     if (old_np == new_np) {
         ui_edit_invalidate_run(e, p);
     } else if (new_np < old_np) { // shrinking - delete runs
         const int32_t d = old_np - new_np; // `d` delta > 0
+        for (int32_t i = p + 1; i <= p + d; i++) { ui_edit_invalidate_run(e, i); }
+        if (p < new_np) { ui_edit_invalidate_run(e, p); }
         if (p + d < old_np - 1) {
             const int32_t n = ut_max(0, old_np - p - d - 1);
-            memcpy(e->para + p + 1, e->para + p + 1 + d, n * sizeof(e->para[0]));
+            memmove(e->para + p + 1, e->para + p + 1 + d, n * sizeof(e->para[0]));
         }
-        if (p < new_np) { ui_edit_invalidate_run(e, p); }
+        ui_edit_cache_renumber(e, p, -d);
         ok = ut_heap.realloc((void**)&e->para, new_np * sizeof(e->para[0])) == 0;
         swear(ok, "shrinking");
     } else { // growing - insert runs
@@ -1616,9 +2254,9 @@ static bool ui_edit_reallocate_runs(ui_edit_t* e, int32_t p, int32_t np) {
             memmove(e->para + p + 1 + d, e->para + p + 1, n * sizeof(e->para[0]));
             const int32_t m = ut_min(new_np, p + 1 + d);
             for (int32_t i = p + 1; i < m; i++) {
-                e->para[i].run = null;
-                e->para[i].runs = 0;
+                memset(&e->para[i], 0x00, sizeof(e->para[i]));
             }
+            ui_edit_cache_renumber(e, p, d);
         }
     }
     return ok;
@@ -1645,18 +2283,266 @@ static void ui_edit_after(ui_edit_notify_t* notify,
     // number of paragraphs before replace():
     const int32_t np = (int32_t)n->data;
     swear(dt->np == np - ni->deleted + ni->inserted);
+    e->generation++; // paragraphs renumbered: background results are stale
     ui_edit_reallocate_runs(e, ni->r->from.pn, np);
+    // replace of multiple paragraphs or batch modifies [pnf..pnt]:
+    if (ni->pnf < ni->pnt) {
+        ui_edit_invalidate_runs(e, ni->pnf, ni->pnt, dt->np);
+    }
+    // lexer states of [pnf..pnt] are stale, states of the following
+    // paragraphs are checked against their start states on paint:
+    for (int32_t pn = ni->pnf; pn <= ni->pnt; pn++) { e->para[pn].lexed = false; }
+    e->lexed = ut_min(e->lexed, ni->pnf);
     e->selection = *ni->x;
     // this is needed by undo/redo: trim selection
     ui_edit_pg_t* pg = e->selection.a;
     for (int32_t i = 0; i < countof(e->selection.a); i++) {
         pg[i].pn = ut_max(0, ut_min(dt->np - 1, pg[i].pn));
-        pg[i].gp = ut_max(0, ut_min(dt->ps[pg[i].pn].g, pg[i].gp));
+        pg[i].gp = ut_max(0, ut_min(ui_edit_text.ps(dt, pg[i].pn)->g, pg[i].gp));
     }
     ui_edit_scroll_into_view(e, e->selection.to);
     ui_edit_invalidate(e);
 }
 
+// Background layout: after runs of all paragraphs were invalidated
+// (resize, font change) worker threads lay out paragraphs that still
+// have no runs from their own snapshots of the text with a frozen copy
+// of the glyph widths. Workers publish run counts and the UI thread
+// installs them in every_100ms() only if the view generation did not
+// change meanwhile. run[] arrays are left to the runs cache. The job
+// is reference counted and cancelled without waiting: workers notice
+// .cancel after the current paragraph and the last one out frees it.
+
+enum {
+    ui_edit_background_min     = 4 * 1024, // paragraphs
+    ui_edit_background_workers = 4         // at most
+};
+
+typedef struct ui_edit_laid_out_s ui_edit_laid_out_t;
+
+typedef struct ui_edit_laid_out_s { // number of runs of a paragraph
+    ui_edit_laid_out_t* next;
+    int32_t pn;
+    int32_t runs;
+} ui_edit_laid_out_t;
+
+typedef struct ui_edit_background_worker_s {
+    ui_edit_background_t* b;
+    ui_edit_snapshot_t* snapshot; // each reader has its own
+} ui_edit_background_worker_t;
+
+typedef struct ui_edit_background_s {
+    volatile int32_t rc;      // workers and the view
+    volatile int32_t running; // number of workers still running
+    volatile int32_t next;    // index of the next pn[] to lay out
+    volatile int32_t cancel;
+    int32_t  generation;      // of the view when the job started
+    int32_t* pn;              // paragraphs without runs, visible first
+    int32_t  n;               // number of pn[]
+    int32_t  width;
+    ui_fm_t  fm;              // copy for concurrent metrics
+    ui_edit_metrics_t* metrics;
+    ui_edit_widths_t widths;  // frozen copy
+    ut_mutex_t mutex;         // of laid_out list
+    ui_edit_laid_out_t* laid_out;
+    int32_t workers;
+    ui_edit_background_worker_t worker[ui_edit_background_workers];
+} ui_edit_background_t;
+
+static void ui_edit_background_release(ui_edit_background_t* b) {
+    if (ut_atomics.decrement_int32(&b->rc) == 0) {
+        ui_edit_laid_out_t* l = b->laid_out;
+        while (l != null) {
+            ui_edit_laid_out_t* next = l->next;
+            ut_heap.free(l);
+            l = next;
+        }
+        if (b->widths.entry != null) { ut_heap.free(b->widths.entry); }
+        if (b->pn != null) { ut_heap.free(b->pn); }
+        ut_mutex.dispose(&b->mutex);
+        ut_heap.free(b);
+    }
+}
+
+static void ui_edit_background_worker(void* p) {
+    ui_edit_background_t* b = ((ui_edit_background_worker_t*)p)->b;
+    ui_edit_snapshot_t*   s = ((ui_edit_background_worker_t*)p)->snapshot;
+    ut_thread.name("ui_edit.layout");
+    ui_edit_measure_t m = {
+        .widths = &b->widths, .metrics = b->metrics, .fm = &b->fm,
+        .frozen = true
+    };
+    for (;;) {
+        if (ut_atomics.load32(&b->cancel) != 0) { break; }
+        const int32_t i = ut_atomics.increment_int32(&b->next) - 1;
+        if (i >= b->n) { break; }
+        const ui_edit_str_t* str = ui_edit_text.ps(&s->text, b->pn[i]);
+        m.missed = false;
+        int32_t runs = 0;
+        ut_heap.free(ui_edit_measure_runs(&m, str, b->width, &runs));
+        ui_edit_laid_out_t* l = null;
+        // missed glyph that was never measured: left for the UI thread
+        if (!m.missed && ut_heap.alloc((void**)&l, sizeof(*l)) == 0) {
+            *l = (ui_edit_laid_out_t){ .pn = b->pn[i], .runs = runs };
+            ut_mutex.lock(&b->mutex);
+            l->next = b->laid_out;
+            b->laid_out = l;
+            ut_mutex.unlock(&b->mutex);
+        }
+    }
+    ui_edit_doc.dispose_snapshot(s);
+    ut_atomics.decrement_int32(&b->running);
+    ui_edit_background_release(b);
+}
+
+static void ui_edit_background_stop(ui_edit_t* e) {
+    ui_edit_background_t* b = e->background;
+    if (b != null) {
+        ut_atomics.exchange_int32(&b->cancel, 1);
+        e->background = null;
+        ui_edit_background_release(b);
+    }
+}
+
+static void ui_edit_background_install(ui_edit_t* e) {
+    ui_edit_background_t* b = e->background;
+    ut_mutex.lock(&b->mutex);
+    ui_edit_laid_out_t* l = b->laid_out;
+    b->laid_out = null;
+    ut_mutex.unlock(&b->mutex);
+    while (l != null) {
+        ui_edit_laid_out_t* next = l->next;
+        ui_edit_paragraph_t* p = &e->para[l->pn];
+        if (p->runs == 0) { // not laid out by the UI thread meanwhile
+            p->runs = l->runs;
+            ui_edit_run_index_update(e, l->pn, p->runs, 1);
+        }
+        ut_heap.free(l);
+        l = next;
+    }
+}
+
+static bool ui_edit_background_start(ui_edit_t* e) {
+    // false if there is nothing to lay out or no memory
+    const int32_t np = e->doc->text.np;
+    ui_edit_background_t* b = null;
+    bool ok = ut_heap.alloc_zero((void**)&b, sizeof(*b)) == 0;
+    if (ok) {
+        ut_mutex.init(&b->mutex);
+        b->rc = 1;
+        ok = ut_heap.alloc((void**)&b->pn, np * sizeof(b->pn[0])) == 0;
+    }
+    if (ok) { // paragraphs below the visible ones first:
+        for (int32_t i = 0; i < np; i++) {
+            const int32_t pn = (e->scroll.pn + i) % np;
+            if (e->para[pn].runs == 0) { b->pn[b->n++] = pn; }
+        }
+        ok = b->n > 0;
+    }
+    if (ok) {
+        ui_edit_measure_t m = ui_edit_measure_of(e);
+        b->generation = e->generation;
+        b->width   = e->w;
+        b->fm      = *m.fm;
+        b->metrics = m.metrics;
+        b->widths  = *m.widths;
+        b->widths.entry = null;
+        if (m.widths->capacity > 0) {
+            const int64_t bytes = m.widths->capacity * sizeof(m.widths->entry[0]);
+            ok = ut_heap.alloc((void**)&b->widths.entry, bytes) == 0;
+            if (ok) { memcpy(b->widths.entry, m.widths->entry, (size_t)bytes); }
+        }
+    }
+    if (ok) {
+        const int32_t workers = ut_min(ui_edit_background_workers,
+                                       ut_max(1, ut_thread.processors() - 1));
+        for (int32_t i = 0; i < workers; i++) {
+            ui_edit_snapshot_t* s = ui_edit_doc.snapshot(e->doc);
+            if (s != null) {
+                b->worker[b->workers].b = b;
+                b->worker[b->workers].snapshot = s;
+                b->workers++;
+            }
+        }
+        ok = b->workers > 0;
+    }
+    if (ok) {
+        b->rc = b->workers + 1;
+        b->running = b->workers;
+        for (int32_t i = 0; i < b->workers; i++) {
+            ut_thread.detach(ut_thread.start(ui_edit_background_worker,
+                                             &b->worker[i]));
+        }
+        e->background = b;
+    } else if (b != null) {
+        ui_edit_background_release(b);
+    }
+    return ok;
+}
+
+static void ui_edit_background(ui_edit_t* e) {
+    // called every 100ms: installs laid out runs, starts the layout
+    // when the view did not change since the previous call
+    ui_edit_background_t* b = e->background;
+    if (b != null && b->generation != e->generation) {
+        ui_edit_background_stop(e);
+    } else if (b != null) {
+        const bool done = ut_atomics.load32(&b->running) == 0;
+        ui_edit_background_install(e);
+        if (done) {
+            e->relayout = false;
+            ui_edit_background_stop(e);
+        }
+    } else if (e->relayout && e->quiet == e->generation && !e->sle &&
+               e->view.w > 0 && !ui_view.is_hidden(&e->view)) {
+        if (e->doc->text.np < ui_edit_background_min ||
+            !ui_edit_background_start(e)) {
+            e->relayout = false; // nothing to do or no memory
+        }
+    }
+    e->quiet = e->generation;
+}
+
+static void ui_edit_every_100ms(ui_view_t* v) {
+    // streaming documents (see ui_edit_doc.append()) are flushed here:
+    // caret at the end of the text follows appended text, otherwise
+    // selection and scroll stay on the same paragraphs even when the
+    // oldest paragraphs are dropped. Background layout is polled here.
+    ui_edit_t* e = (ui_edit_t*)v;
+    ui_edit_doc_t* d = e->doc;
+    if (d->tail.count > 0 || d->tail.file != null) {
+        const ui_edit_pg_t end = ui_edit_range.end(&d->text);
+        const bool follow =
+            ui_edit_range.compare(e->selection.from, end) == 0 &&
+            ui_edit_range.compare(e->selection.to, end) == 0;
+        ui_edit_range_t s = e->selection;
+        ui_edit_pr_t scroll = e->scroll;
+        const int64_t dropped = d->tail.dropped;
+        errno_t r = ui_edit_doc.flush(d);
+        if (r != 0) { traceln("ui_edit_doc.flush() %s", strerr(r)); }
+        if (follow) {
+            ui_edit_move(e, ui_edit_range.end(&d->text));
+        } else {
+            const int32_t k = (int32_t)(d->tail.dropped - dropped);
+            for (int32_t i = 0; i < countof(s.a); i++) {
+                s.a[i] = s.a[i].pn >= k ?
+                    (ui_edit_pg_t){ .pn = s.a[i].pn - k, .gp = s.a[i].gp } :
+                    (ui_edit_pg_t){ .pn = 0, .gp = 0 };
+            }
+            e->selection = s;
+            e->scroll = scroll.pn >= k ?
+                (ui_edit_pr_t){ .pn = scroll.pn - k, .rn = scroll.rn } :
+                (ui_edit_pr_t){ .pn = 0, .rn = 0 };
+        }
+    }
+    // leaves of paragraphs painted since the previous cool() stay hot,
+    // the rest may be compressed down to the ceiling. cool() walks all
+    // the leaves: at most 10 times a second and only after paint.
+    if (e->painted && d->cold.ceiling > 0) { ui_edit_doc.cool(d); }
+    e->painted = false;
+    ui_edit_background(e);
+}
+
 static void ui_edit_init(ui_edit_t* e, ui_edit_doc_t* d) {
     memset(e, 0, sizeof(*e));
     assert(d != null && d->text.np > 0);
@@ -1693,6 +2579,7 @@ static void ui_edit_init(ui_edit_t* e, ui_edit_doc_t* d) {
     e->view.kill_focus      = ui_edit_kill_focus;
     e->view.key_pressed     = ui_edit_key_pressed;
     e->view.mouse_wheel     = ui_edit_mouse_wheel;
+    e->view.every_100ms     = ui_edit_every_100ms;
     #ifdef EDIT_USE_TAP
         e->view.tap         = ui_edit_tap;
     #else
@@ -1702,11 +2589,256 @@ static void ui_edit_init(ui_edit_t* e, ui_edit_doc_t* d) {
 }
 
 static void ui_edit_dispose(ui_edit_t* e) {
+    ui_edit_background_stop(e);
     ui_edit_doc.unsubscribe(e->doc, &e->listener.notify);
     ui_edit_dispose_all_runs(e);
+    if (e->tokens != null) { ut_heap.free(e->tokens); }
+    if (e->widths.entry != null) { ut_heap.free(e->widths.entry); }
     memset(e, 0, sizeof(*e));
 }
 
+// tests:
+
+static int32_t ui_edit_test_advance(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t gp) {
+    // advance of the glyph gp straight from the metrics (no cache, no spans)
+    const int32_t bp = ui_edit_str.g2b(str, gp);
+    const int32_t bytes = ui_edit_str.g2b(str, gp + 1) - bp;
+    return m->metrics->advance(m->metrics, m->fm, str->u + bp, bytes);
+}
+
+static int32_t ui_edit_test_width(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t gp, int32_t glyphs) {
+    int32_t x = 0;
+    for (int32_t i = gp; i < gp + glyphs; i++) {
+        x += ui_edit_test_advance(m, str, i);
+    }
+    return x;
+}
+
+static int32_t ui_edit_test_break(ui_edit_measure_t* m,
+        const ui_edit_str_t* str, int32_t gp, int32_t width, bool allow_zero) {
+    // ui_edit_measure_break() by per glyph summation of advances
+    int32_t k = 1;
+    if (gp < str->g - 1) {
+        int32_t x = 0;
+        k = 0;
+        while (gp + k < str->g) {
+            x += ui_edit_test_advance(m, str, gp + k);
+            if (x >= width) { break; }
+            k++;
+        }
+        if (!allow_zero && k == 0) { k = 1; }
+    }
+    return k;
+}
+
+static void ui_edit_test_runs(ui_edit_measure_t* m, const ui_edit_str_t* str,
+        int32_t width) {
+    for (int32_t gp = 0; gp < str->g; gp++) {
+        const int32_t bp = ui_edit_str.g2b(str, gp);
+        for (int32_t z = 0; z < 2; z++) {
+            const int32_t k = ui_edit_measure_break(m, str, gp, bp, width, z);
+            swear(k == ui_edit_test_break(m, str, gp, width, z),
+                  "\"%.*s\" gp: %d width: %d", str->b, str->u, gp, width);
+        }
+    }
+    int32_t runs = 0;
+    ui_edit_run_t* run = ui_edit_measure_runs(m, str, width, &runs);
+    int32_t gp = 0;
+    int32_t bp = 0;
+    for (int32_t i = 0; i < runs; i++) {
+        swear(run[i].gp == gp && run[i].bp == bp);
+        swear(run[i].bytes == ui_edit_str.g2b(str, gp + run[i].glyphs) - bp);
+        swear(run[i].pixels == ui_edit_test_width(m, str, gp, run[i].glyphs));
+        swear(run[i].pixels < width || run[i].glyphs == 1);
+        if (str->g > 0) {
+            const int32_t k = ui_edit_test_break(m, str, gp, width, false);
+            // word break may only shorten the run to the last SPACE:
+            swear(run[i].glyphs == k || (run[i].glyphs < k &&
+                  str->u[bp + run[i].bytes - 1] == 0x20));
+        }
+        gp += run[i].glyphs;
+        bp += run[i].bytes;
+    }
+    swear(gp == str->g && bp == str->b);
+    ut_heap.free(run);
+}
+
+static void ui_edit_test_fixed(void) {
+    // ui_edit_measure_break() and ui_edit_measure_runs() of monospaced
+    // fonts step over printable ASCII spans arithmetically. Both are
+    // compared with per glyph summation at every width up to the width
+    // of the whole text including all exact multiples of the cell.
+    static const char* texts[] = {
+        "",
+        "a",
+        "\xE4\xB8\xAD",                             // wide
+        "hello world",
+        "abc\xE4\xB8\xAD" "def",                     // ASCII, wide, ASCII
+        "\xE4\xB8\xAD" "abc \xE4\xB8\xAD\xE6\x96\x87 de",
+        "a\tb\x01" "cd\xC3\xA9" "ef\xE2\x82\xAC" "gh",     // not printable
+        "\xF0\x9F\x98\x80 smile \xF0\x9F\x98\x80\xF0\x9F\x98\x80 x",
+        "one two  three   four \xE4\xB8\xAD\xE6\x96\x87 five six seven",
+    };
+    ui_fm_t fms[] = {
+        { .em = { .w = 7, .h = 16 }, .height = 16, .mono = true  },
+        { .em = { .w = 7, .h = 16 }, .height = 16, .mono = false },
+        { .em = { .w = 1, .h = 16 }, .height = 16, .mono = true  },
+    };
+    for (int32_t f = 0; f < countof(fms); f++) {
+        ui_edit_widths_t w = {0};
+        ui_edit_measure_t m = ui_edit_measure_with(&w,
+            &ui_edit_metrics_fixed, &fms[f]);
+        swear(w.cell == (fms[f].mono ? fms[f].em.w : 0));
+        for (int32_t i = 0; i < countof(texts); i++) {
+            ui_edit_str_t s = {0};
+            swear(ui_edit_str.init(&s, (const uint8_t*)texts[i], -1, false));
+            const int32_t total = ui_edit_test_width(&m, &s, 0, s.g);
+            swear(ui_edit_measure_width(&m, s.u, s.b) == total);
+            for (int32_t width = 1; width <= total + 2 * 7 + 1; width++) {
+                ui_edit_test_runs(&m, &s, width);
+            }
+            ui_edit_str.free(&s);
+        }
+        if (w.entry != null) { ut_heap.free(w.entry); }
+    }
+    // span step i = (width - x + c - 1) / c - 1 at the cell boundaries:
+    ui_fm_t fm = fms[0];
+    ui_edit_widths_t w = {0};
+    ui_edit_measure_t m = ui_edit_measure_with(&w, &ui_edit_metrics_fixed, &fm);
+    const int32_t c = w.cell;
+    ui_edit_str_t s = {0};
+    swear(ui_edit_str.init(&s, (const uint8_t*)"abcdefgh", -1, false));
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 3 * c, false) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 3 * c + 1, false) == 3);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 3 * c - 1, false) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, c, true) == 0);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, c, false) == 1);
+    swear(ui_edit_measure_break(&m, &s, 2, 2, 6 * c, false) == 5);
+    swear(ui_edit_measure_break(&m, &s, 2, 2, 6 * c + 1, false) == 6);
+    ui_edit_str.free(&s);
+    // x > 0 when the span starts after a wide glyph (2 * c):
+    swear(ui_edit_str.init(&s, (const uint8_t*)"\xE4\xB8\xAD" "abcd", -1, false));
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 2 * c, true) == 0);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 2 * c + 1, true) == 1);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 4 * c, true) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 4 * c + 1, true) == 3);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 6 * c, true) == 4);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 6 * c + 1, true) == 5);
+    ui_edit_str.free(&s);
+    // wide glyph right after the span: span does not reach the width
+    swear(ui_edit_str.init(&s, (const uint8_t*)"ab\xE4\xB8\xAD" "cd", -1, false));
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 2 * c, true) == 1);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 2 * c + 1, true) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 4 * c, true) == 2);
+    swear(ui_edit_measure_break(&m, &s, 0, 0, 4 * c + 1, true) == 3);
+    ui_edit_str.free(&s);
+    if (w.entry != null) { ut_heap.free(w.entry); }
+}
+
+static void ui_edit_test_widths(void) {
+    // glyph widths hash grows and keeps all measured glyphs, frozen
+    // (background) widths are never written to
+    ui_fm_t fm = { .em = { .w = 8, .h = 16 }, .height = 16, .mono = true };
+    ui_edit_widths_t w = {0};
+    ui_edit_measure_t m = ui_edit_measure_with(&w, &ui_edit_metrics_fixed, &fm);
+    swear(w.cell == 8 && w.count == 0 && w.capacity == 0);
+    enum { n = 4096 }; // CJK U+4E00..U+5DFF
+    for (int32_t r = 0; r < 2; r++) { // measure, then hit the cache
+        for (uint32_t i = 0; i < n; i++) {
+            const uint32_t cp = 0x4E00 + i;
+            const uint8_t u[3] = { (uint8_t)(0xE0 | (cp >> 12)),
+                (uint8_t)(0x80 | ((cp >> 6) & 0x3F)),
+                (uint8_t)(0x80 | (cp & 0x3F)) };
+            swear(ui_edit_advance(&m, u, 3) == 16);
+            uint32_t glyph = 0;
+            memcpy(&glyph, u, 3);
+            const ui_edit_width_t* x = ui_edit_widths_slot(&w, glyph);
+            swear(x->glyph == glyph && x->width == 16);
+        }
+        swear(w.count == n && w.count * 4 < w.capacity * 3);
+    }
+    const int32_t capacity = w.capacity;
+    const uint8_t* smile = (const uint8_t*)"\xF0\x9F\x98\x80";
+    const uint8_t* cjk = (const uint8_t*)"\xE4\xB8\xAD";
+    m.frozen = true; // concurrent metrics measure missing glyphs:
+    swear(ui_edit_advance(&m, smile, 4) == 16 && !m.missed);
+    swear(ui_edit_advance(&m, (const uint8_t*)"\t", 1) == 8 && !m.missed);
+    swear(w.count == n && w.capacity == capacity && w.ascii['\t'] < 0);
+    ui_edit_metrics_t gdi_like = {
+        .advance = ui_edit_metrics_fixed_advance, .concurrent = false
+    };
+    m.metrics = &gdi_like; // not concurrent metrics are not called:
+    swear(ui_edit_advance(&m, cjk, 3) == 16 && !m.missed); // cached
+    swear(ui_edit_advance(&m, (const uint8_t*)"m", 1) == 8 && !m.missed);
+    swear(ui_edit_advance(&m, smile, 4) == fm.em.w && m.missed);
+    m.missed = false;
+    swear(ui_edit_advance(&m, (const uint8_t*)"\t", 1) == fm.em.w && m.missed);
+    swear(w.count == n && w.capacity == capacity && w.ascii['\t'] < 0);
+    m.frozen  = false; // foreground layout fills the cache:
+    m.missed  = false;
+    swear(ui_edit_advance(&m, smile, 4) == 16 && !m.missed);
+    swear(ui_edit_advance(&m, (const uint8_t*)"\t", 1) == 8);
+    swear(w.count == n + 1 && w.ascii['\t'] == 8);
+    ut_heap.free(w.entry);
+}
+
+static void ui_edit_test_performance(void) {
+    // measure_runs() of a long line vs per glyph summation of advances
+    enum { n = 4 * 1024 * 1024 };
+    uint8_t* u = null;
+    swear(ut_heap.alloc((void**)&u, n) == 0);
+    const char* words[] = { "lorem ", "ipsum ", "dolor ", "sit ", "amet, ",
+                            "\xE4\xB8\xAD\xE6\x96\x87 " };
+    for (int32_t wide = 0; wide < 2; wide++) {
+        uint32_t seed = 1;
+        int32_t b = 0;
+        for (;;) {
+            const int32_t i = (int32_t)(ut_num.random32(&seed) %
+                                        (countof(words) - 1 + wide));
+            const int32_t k = (int32_t)strlen(words[i]);
+            if (b + k > n) { break; }
+            memcpy(u + b, words[i], (size_t)k);
+            b += k;
+        }
+        ui_edit_str_t s = {0};
+        swear(ui_edit_str.init(&s, u, b, false));
+        for (int32_t mono = 0; mono < 2; mono++) {
+            ui_fm_t fm = { .em = { .w = 8, .h = 16 }, .height = 16,
+                           .mono = mono != 0 };
+            ui_edit_widths_t w = {0};
+            ui_edit_measure_t m = ui_edit_measure_with(&w,
+                &ui_edit_metrics_fixed, &fm);
+            fp64_t time = ut_clock.seconds();
+            int32_t runs = 0;
+            ui_edit_run_t* run = ui_edit_measure_runs(&m, &s, 80 * 8, &runs);
+            const fp64_t layout = ut_clock.seconds() - time;
+            time = ut_clock.seconds();
+            const int32_t x = ui_edit_test_width(&m, &s, 0, s.g);
+            const fp64_t summation = ut_clock.seconds() - time;
+            int32_t pixels = 0;
+            for (int32_t i = 0; i < runs; i++) { pixels += run[i].pixels; }
+            swear(pixels == x);
+            ut_heap.free(run);
+            if (w.entry != null) { ut_heap.free(w.entry); }
+            const fp64_t mb = b / (1024.0 * 1024.0);
+            traceln("%s%s measure_runs() %7.1f MB/s %d runs "
+                    "per glyph sum %7.1f MB/s",
+                    mono ? "mono " : "prop ", wide ? "CJK  " : "ASCII",
+                    mb / layout, runs, mb / summation);
+        }
+        ui_edit_str.free(&s);
+    }
+    ut_heap.free(u);
+}
+
+static void ui_edit_test(void) {
+    ui_edit_test_fixed();
+    ui_edit_test_widths();
+    ui_edit_test_performance();
+}
+
 ui_edit_if ui_edit = {
     .init                 = ui_edit_init,
     .set_font             = ui_edit_set_font,
@@ -1730,5 +2862,10 @@ ui_edit_if ui_edit = {
     .key_backspace        = ui_edit_key_backspace,
     .key_enter            = ui_edit_key_enter,
     .fuzz                 = null,
-    .dispose              = ui_edit_dispose
+    .dispose              = ui_edit_dispose,
+    .test                 = ui_edit_test
 };
+
+#ifdef UI_EDIT_VIEW_TEST
+    ut_static_init(ui_edit) { ui_edit.test(); }
+#endif
@@ -68,6 +68,102 @@ static void ut_streams_read_write(ut_stream_memory_if* s,
     s->pos_write = 0;
 }
 
+static errno_t ut_streams_file_drain(ut_stream_file_if* s) {
+    // writes buffered bytes to the file
+    if (s->error == 0 && s->pos > 0) {
+        int64_t transferred = 0;
+        s->error = ut_files.write(s->file, s->data, s->pos, &transferred);
+        if (s->error == 0 && transferred != s->pos) {
+            s->error = ut_runtime.error.io_error;
+        }
+    }
+    s->pos = 0;
+    return s->error;
+}
+
+static errno_t ut_streams_file_write_data(ut_stream_if* stream,
+        const void* data, int64_t bytes, int64_t *transferred) {
+    swear(bytes > 0);
+    ut_stream_file_if* s = (ut_stream_file_if*)stream;
+    swear(0 <= s->pos && s->pos <= s->bytes);
+    if (s->error == 0 && s->pos + bytes > s->bytes) {
+        ut_streams_file_drain(s);
+    }
+    if (s->error == 0 && bytes >= s->bytes) { // bypass the buffer
+        int64_t written = 0;
+        s->error = ut_files.write(s->file, data, bytes, &written);
+        if (s->error == 0 && written != bytes) {
+            s->error = ut_runtime.error.io_error;
+        }
+    } else if (s->error == 0) {
+        memcpy(s->data + s->pos, data, (size_t)bytes);
+        s->pos += bytes;
+    }
+    if (transferred != null) { *transferred = s->error == 0 ? bytes : 0; }
+    return s->error;
+}
+
+static errno_t ut_streams_file_flush(ut_stream_file_if* s) {
+    errno_t r = ut_streams_file_drain(s);
+    if (r == 0) { r = ut_files.flush(s->file); }
+    if (s->error == 0) { s->error = r; }
+    return r;
+}
+
+static errno_t ut_streams_file_close(ut_stream_file_if* s) {
+    errno_t r = ut_streams_file_drain(s);
+    if (s->file != null) { ut_files.close(s->file); }
+    if (s->data != null) { ut_heap.free(s->data); }
+    memset(s, 0x00, sizeof(*s));
+    return r;
+}
+
+static void ut_streams_file_close_stream(ut_stream_if* stream) {
+    ut_streams_file_close((ut_stream_file_if*)stream);
+}
+
+static errno_t ut_streams_file_open(ut_stream_file_if* s,
+        const char* filename, int64_t buffer_bytes, int32_t flags) {
+    swear(buffer_bytes > 0);
+    memset(s, 0x00, sizeof(*s));
+    errno_t r = ut_heap.alloc((void**)&s->data, buffer_bytes);
+    if (r == 0) {
+        r = ut_files.open(&s->file, filename, flags);
+        if (r != 0) {
+            s->file = null;
+            ut_heap.free(s->data);
+            s->data = null;
+        }
+    }
+    if (r == 0) {
+        s->stream.read  = null;
+        s->stream.write = ut_streams_file_write_data;
+        s->stream.close = ut_streams_file_close_stream;
+        s->bytes = buffer_bytes;
+    }
+    return r;
+}
+
+static errno_t ut_streams_file_write(ut_stream_file_if* s,
+        const char* filename, int64_t buffer_bytes) {
+    const int32_t flags = ut_files.o_wr | ut_files.o_create |
+                          ut_files.o_trunc;
+    return ut_streams_file_open(s, filename, buffer_bytes, flags);
+}
+
+static errno_t ut_streams_file_append(ut_stream_file_if* s,
+        const char* filename, int64_t buffer_bytes) {
+    // ut_files.o_wr opens the file positioned at its start
+    errno_t r = ut_streams_file_open(s, filename, buffer_bytes,
+                                     ut_files.o_wr);
+    if (r == 0) {
+        int64_t position = 0;
+        r = ut_files.seek(s->file, &position, ut_files.seek_end);
+        if (r != 0) { ut_streams_file_close(s); }
+    }
+    return r;
+}
+
 #ifdef UT_TESTS
 
 static void ut_streams_test(void) {
@@ -87,7 +183,58 @@ static void ut_streams_test(void) {
         }
     }
     {   // write test
-        // TODO: implement
+        uint8_t memory[256];
+        for (int32_t i = 1; i < countof(memory) - 1; i++) {
+            ut_stream_memory_if ms; // memory stream
+            for (int32_t j = 0; j < countof(memory); j++) { memory[j] = 0xFF; }
+            ut_streams.write_only(&ms, memory, i);
+            uint8_t data[256];
+            for (int32_t j = 0; j < countof(data); j++) { data[j] = (uint8_t)j; }
+            int64_t transferred = 0;
+            errno_t r = ms.stream.write(&ms.stream, data, i, &transferred);
+            swear(r == 0 && transferred == i);
+            for (int32_t j = 0; j < i; j++) { swear(memory[j] == data[j]); }
+            for (int32_t j = i; j < countof(memory); j++) { swear(memory[j] == 0xFF); }
+            r = ms.stream.write(&ms.stream, data, 1, &transferred);
+            swear(r == ERROR_INSUFFICIENT_BUFFER && transferred == 0);
+        }
+    }
+    {   // buffered file write test: small writes coalesce, large bypass
+        char fn[ut_files_max_path];
+        swear(ut_files.create_tmp(fn, countof(fn)) == 0);
+        uint8_t data[1024];
+        for (int32_t i = 0; i < countof(data); i++) { data[i] = (uint8_t)i; }
+        ut_stream_file_if fs; // file stream
+        swear(ut_streams.file_write(&fs, fn, 64) == 0);
+        int64_t total = 0;
+        for (int32_t i = 1; i < countof(data); i = i * 3 / 2 + 1) {
+            int64_t transferred = 0;
+            swear(fs.stream.write(&fs.stream, data, i, &transferred) == 0);
+            swear(transferred == i);
+            total += i;
+        }
+        swear(ut_streams.file_flush(&fs) == 0);
+        swear(ut_streams.file_close(&fs) == 0);
+        ut_file_t* f = null;
+        swear(ut_files.open(&f, fn, ut_files.o_rd) == 0);
+        ut_files_stat_t st = {0};
+        swear(ut_files.stat(f, &st, false) == 0 && st.size == total);
+        for (int32_t i = 1; i < countof(data); i = i * 3 / 2 + 1) {
+            uint8_t read[countof(data)];
+            int64_t transferred = 0;
+            swear(ut_files.read(f, read, i, &transferred) == 0);
+            swear(transferred == i && memcmp(read, data, (size_t)i) == 0);
+        }
+        ut_files.close(f);
+        // append continues after the end of the existing file:
+        swear(ut_streams.file_append(&fs, fn, 64) == 0);
+        int64_t transferred = 0;
+        swear(fs.stream.write(&fs.stream, data, 10, &transferred) == 0);
+        swear(ut_streams.file_close(&fs) == 0);
+        swear(ut_files.open(&f, fn, ut_files.o_rd) == 0);
+        swear(ut_files.stat(f, &st, false) == 0 && st.size == total + 10);
+        ut_files.close(f);
+        swear(ut_files.unlink(fn) == 0);
     }
     {   // read/write test
         // TODO: implement
@@ -102,8 +249,12 @@ static void ut_streams_test(void) { }
 #endif
 
 ut_streams_if ut_streams = {
-    .read_only  = ut_streams_read_only,
-    .write_only = ut_streams_write_only,
-    .read_write = ut_streams_read_write,
-    .test       = ut_streams_test
+    .read_only   = ut_streams_read_only,
+    .write_only  = ut_streams_write_only,
+    .read_write  = ut_streams_read_write,
+    .file_write  = ut_streams_file_write,
+    .file_append = ut_streams_file_append,
+    .file_flush  = ut_streams_file_flush,
+    .file_close  = ut_streams_file_close,
+    .test        = ut_streams_test
 };
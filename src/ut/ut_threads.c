@@ -364,6 +364,16 @@ static void ut_thread_realtime(void) {
 
 static void ut_thread_yield(void) { SwitchToThread(); }
 
+static int32_t ut_thread_processors(void) {
+    static int32_t processors;
+    if (processors == 0) {
+        // all processor groups, not only the group of the calling thread
+        processors = (int32_t)GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+        if (processors <= 0) { processors = 1; }
+    }
+    return processors;
+}
+
 static ut_thread_t ut_thread_start(void (*func)(void*), void* p) {
     ut_thread_t t = (ut_thread_t)CreateThread(null, 0,
         (LPTHREAD_START_ROUTINE)(void*)func, p, 0, null);
@@ -608,17 +618,18 @@ static void ut_thread_test(void) { }
 #endif
 
 ut_thread_if ut_thread = {
-    .start     = ut_thread_start,
-    .join      = ut_thread_join,
-    .detach    = ut_thread_detach,
-    .name      = ut_thread_name,
-    .realtime  = ut_thread_realtime,
-    .yield     = ut_thread_yield,
-    .sleep_for = ut_thread_sleep_for,
-    .id_of     = ut_thread_id_of,
-    .id        = ut_thread_id,
-    .self      = ut_thread_self,
-    .open      = ut_thread_open,
-    .close     = ut_thread_close,
-    .test      = ut_thread_test
+    .start      = ut_thread_start,
+    .join       = ut_thread_join,
+    .detach     = ut_thread_detach,
+    .name       = ut_thread_name,
+    .realtime   = ut_thread_realtime,
+    .yield      = ut_thread_yield,
+    .sleep_for  = ut_thread_sleep_for,
+    .processors = ut_thread_processors,
+    .id_of      = ut_thread_id_of,
+    .id         = ut_thread_id,
+    .self       = ut_thread_self,
+    .open       = ut_thread_open,
+    .close      = ut_thread_close,
+    .test       = ut_thread_test
 };